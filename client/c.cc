@@ -323,6 +323,35 @@ consus_admin_set_default_data_center(consus_client* client, const char* name,
     );
 }
 
+CONSUS_API int
+consus_admin_set_partitioning(consus_client* client, const char* name,
+                              consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_partitioning(name, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_set_kvs_leases(consus_client* client, int enable,
+                            consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_kvs_leases(enable != 0, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_set_table_policy(consus_client* client, const char* table,
+                              unsigned replication,
+                              const char** data_centers, size_t data_centers_sz,
+                              consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_table_policy(table, replication, data_centers, data_centers_sz, status);
+    );
+}
+
 CONSUS_API int
 consus_admin_availability_check(consus_client* client,
                                 consus_availability_requirements* reqs,
@@ -277,6 +277,167 @@ client :: set_default_data_center(const char* name, consus_returncode* status)
     return 0;
 }
 
+int
+client :: set_partitioning(const char* name, consus_returncode* status)
+{
+    std::string tmp;
+    e::packer(&tmp) << e::slice(name);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "kvs_partitioning",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // unlike the data center calls, the coordinator can refuse this one, so
+    // surface its answer rather than assuming success
+    coordinator_returncode crc;
+    e::unpacker up(data, data_sz);
+    up = up >> crc;
+    if (data) free(data);
+
+    if (up.error())
+    {
+        ERROR(COORD_FAIL) << "coordinator failure: invalid return value";
+        return -1;
+    }
+
+    switch (crc)
+    {
+        case COORD_SUCCESS:
+            *status = CONSUS_SUCCESS;
+            return 0;
+        case COORD_MALFORMED:
+            ERROR(INVALID) << "unknown partitioning function \"" << name << "\"";
+            return -1;
+        case COORD_NO_CAN_DO:
+            ERROR(INVALID) << "cannot change partitioning once key value stores have registered";
+            return -1;
+        case COORD_UNINITIALIZED:
+            ERROR(COORD_FAIL) << "coordinator not initialized";
+            return -1;
+        case COORD_DUPLICATE:
+        case COORD_NOT_FOUND:
+        default:
+            ERROR(COORD_FAIL) << "coordinator failure: unexpected return value " << crc;
+            return -1;
+    }
+}
+
+int
+client :: set_kvs_leases(bool enable, consus_returncode* status)
+{
+    std::string tmp;
+    e::packer(&tmp) << uint8_t(enable ? 1 : 0);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "kvs_leases",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    coordinator_returncode crc;
+    e::unpacker up(data, data_sz);
+    up = up >> crc;
+    if (data) free(data);
+
+    if (up.error())
+    {
+        ERROR(COORD_FAIL) << "coordinator failure: invalid return value";
+        return -1;
+    }
+
+    switch (crc)
+    {
+        case COORD_SUCCESS:
+            *status = CONSUS_SUCCESS;
+            return 0;
+        case COORD_NO_CAN_DO:
+            ERROR(INVALID) << "cannot change key value store leases once key value stores have registered";
+            return -1;
+        case COORD_UNINITIALIZED:
+            ERROR(COORD_FAIL) << "coordinator not initialized";
+            return -1;
+        case COORD_MALFORMED:
+        case COORD_DUPLICATE:
+        case COORD_NOT_FOUND:
+        default:
+            ERROR(COORD_FAIL) << "coordinator failure: unexpected return value " << crc;
+            return -1;
+    }
+}
+
+int
+client :: set_table_policy(const char* table, unsigned replication,
+                           const char** data_centers, size_t data_centers_sz,
+                           consus_returncode* status)
+{
+    std::string tmp;
+    e::packer pa(&tmp);
+    pa = pa << e::slice(table) << uint32_t(replication) << uint32_t(data_centers_sz);
+
+    for (size_t i = 0; i < data_centers_sz; ++i)
+    {
+        pa = pa << e::slice(data_centers[i]);
+    }
+
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "table_policy_set",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    coordinator_returncode crc;
+    e::unpacker up(data, data_sz);
+    up = up >> crc;
+    if (data) free(data);
+
+    if (up.error())
+    {
+        ERROR(COORD_FAIL) << "coordinator failure: invalid return value";
+        return -1;
+    }
+
+    switch (crc)
+    {
+        case COORD_SUCCESS:
+            *status = CONSUS_SUCCESS;
+            return 0;
+        case COORD_MALFORMED:
+            ERROR(INVALID) << "invalid policy for table \"" << table << "\"";
+            return -1;
+        case COORD_NOT_FOUND:
+            ERROR(INVALID) << "data center does not exist";
+            return -1;
+        case COORD_NO_CAN_DO:
+            ERROR(INVALID) << "cannot set a table's policy once key value stores have registered";
+            return -1;
+        case COORD_UNINITIALIZED:
+            ERROR(COORD_FAIL) << "coordinator not initialized";
+            return -1;
+        case COORD_DUPLICATE:
+        default:
+            ERROR(COORD_FAIL) << "coordinator failure: unexpected return value " << crc;
+            return -1;
+    }
+}
+
 int
 client :: availability_check(consus_availability_requirements* reqs,
                              int timeout,
@@ -565,7 +726,8 @@ client :: debug_kvs_configuration(consus_returncode* status, const char** str)
     uint64_t flags;
     std::vector<kvs_state> kvss;
     std::vector<ring> rings;
-    up = kvs_configuration(up, &cid, &vid, &flags, &kvss, &rings);
+    std::vector<table_policy> tables;
+    up = kvs_configuration(up, &cid, &vid, &flags, &kvss, &rings, &tables);
     free(data);
 
     if (up.error())
@@ -574,7 +736,7 @@ client :: debug_kvs_configuration(consus_returncode* status, const char** str)
         return -1;
     }
 
-    std::string s = kvs_configuration(cid, vid, flags, kvss, rings);
+    std::string s = kvs_configuration(cid, vid, flags, kvss, rings, tables);
     e::intrusive_ptr<pending_string> p = new pending_string(s);
     *str = p->string();
     m_returned = p.get();
@@ -72,6 +72,11 @@ class client
         // admin API
         int create_data_center(const char* name, consus_returncode* status);
         int set_default_data_center(const char* name, consus_returncode* status);
+        int set_partitioning(const char* name, consus_returncode* status);
+        int set_kvs_leases(bool enable, consus_returncode* status);
+        int set_table_policy(const char* table, unsigned replication,
+                             const char** data_centers, size_t data_centers_sz,
+                             consus_returncode* status);
         int availability_check(consus_availability_requirements* reqs,
                                int timeout, consus_returncode* status);
         // internal semi-public API
@@ -54,6 +54,8 @@ class background_thread
     protected:
         po6::threads::mutex* mtx() { return &m_protect; }
         void wakeup() { m_wakeup_thread.signal(); }
+        // with mtx() held, sleep until woken or until nanos pass
+        void wait_for(uint64_t nanos) { m_wakeup_thread.wait_for(nanos); }
         virtual const char* thread_name() = 0;
         virtual bool have_work() = 0;
         virtual void do_work() = 0;
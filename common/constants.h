@@ -29,6 +29,8 @@
 #define consus_common_constants_h_
 
 #define CONSUS_MAX_REPLICATION_FACTOR 9
+// used for every table that lacks a table_policy
+#define CONSUS_DEFAULT_REPLICATION_FACTOR 5
 
 #define CONSUS_PORT_TXMAN 22751
 #define CONSUS_PORT_KVS 22761
@@ -57,4 +59,12 @@
 
 #define CONSUS_WRITE_TOMBSTONE 1
 
+// When set in the cluster flags, the first replica of each replica set holds
+// a lease from the coordinator and answers reads without a quorum.  The lease
+// runs for CONSUS_KVS_LEASE_DURATION nanoseconds from when it was requested,
+// less CONSUS_KVS_LEASE_MARGIN to absorb clock drift between daemons.
+#define CONSUS_FLAG_KVS_LEASES 0x10ULL
+#define CONSUS_KVS_LEASE_DURATION 3000000000ULL
+#define CONSUS_KVS_LEASE_MARGIN 300000000ULL
+
 #endif // consus_common_constants_h_
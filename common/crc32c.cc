@@ -80,6 +80,153 @@ crc32_sse42_quads(uint32_t init_crc, const uint8_t* data, size_t n)
     return crc;
 }
 
+// The crc32 instruction has a latency of three cycles but a throughput of one
+// per cycle, so a single dependent chain leaves two thirds of the unit idle.
+// The streams kernel cuts the input into three equal blocks, runs an
+// independent chain over each, and then stitches the three CRCs together.
+// Stitching requires shifting a CRC forward over a block's worth of zeros,
+// i.e., multiplying it by x^(8 * block) mod P; one carry-less multiply by a
+// precomputed constant followed by a crc32q reduction does exactly that.
+
+#define CRC32C_POLY_REFLECTED 0x82f63b78U
+#define CRC32C_STREAM_LONG 8192
+#define CRC32C_STREAM_SHORT 256
+
+// multiply two polynomials modulo P; both are in the reflected representation
+// where the most significant bit holds the coefficient of x^0
+static uint32_t
+crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31;
+    uint32_t p = 0;
+
+    while (m)
+    {
+        if (a & m)
+        {
+            p ^= b;
+        }
+
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY_REFLECTED : b >> 1;
+    }
+
+    return p;
+}
+
+// x^n mod P
+static uint32_t
+crc32c_xnmodp(uint64_t n)
+{
+    uint32_t p = 1U << 31; // x^0
+    uint32_t sq = 1U << 30; // x^1
+
+    while (n)
+    {
+        if (n & 1)
+        {
+            p = crc32c_multmodp(sq, p);
+        }
+
+        n >>= 1;
+        sq = crc32c_multmodp(sq, sq);
+    }
+
+    return p;
+}
+
+// The carry-less product of two reflected 32-bit values comes out one degree
+// high, and crc32q multiplies by another x^32 as it reduces, so shifting by
+// "bytes" zeros wants the constant x^(8 * bytes - 33).
+static uint32_t crc32c_stream_long_k = crc32c_xnmodp(8 * CRC32C_STREAM_LONG - 33);
+static uint32_t crc32c_stream_short_k = crc32c_xnmodp(8 * CRC32C_STREAM_SHORT - 33);
+
+static inline uint64_t
+crc32c_shift(uint64_t crc, uint64_t k)
+{
+    uint64_t prod;
+    __asm__ ("movq %1, %%xmm0\n\t"
+             "movq %2, %%xmm1\n\t"
+             "pclmulqdq $0x00, %%xmm1, %%xmm0\n\t"
+             "movq %%xmm0, %0\n\t"
+             : "=r"(prod) : "r"(crc), "r"(k) : "xmm0", "xmm1");
+    uint64_t out = 0;
+    __asm__ ("crc32q %2, %0" : "=r"(out) : "0"(out), "r"(prod) : );
+    return out;
+}
+
+// run three interleaved chains over consecutive blocks of "words" quads each
+// and fold them into crc; the caller guarantees 3 * words quads at ptr
+static inline uint64_t
+crc32c_three_streams(uint64_t crc, const uint64_t* ptr, size_t words, uint64_t k)
+{
+    uint64_t crc_a = crc;
+    uint64_t crc_b = 0;
+    uint64_t crc_c = 0;
+    const uint64_t* a = ptr;
+    const uint64_t* b = ptr + words;
+    const uint64_t* c = ptr + 2 * words;
+
+    for (size_t i = 0; i < words; ++i)
+    {
+        __asm__ ("crc32q %2, %0" : "=r"(crc_a) : "0"(crc_a), "r"(a[i]) : );
+        __asm__ ("crc32q %2, %0" : "=r"(crc_b) : "0"(crc_b), "r"(b[i]) : );
+        __asm__ ("crc32q %2, %0" : "=r"(crc_c) : "0"(crc_c), "r"(c[i]) : );
+    }
+
+    crc = crc32c_shift(crc_a, k) ^ crc_b;
+    return crc32c_shift(crc, k) ^ crc_c;
+}
+
+static uint32_t
+crc32_sse42_streams(uint32_t init_crc, const uint8_t* data, size_t n)
+{
+    uint64_t crc = init_crc ^ CRC_FFs;
+    const uintptr_t x = reinterpret_cast<uintptr_t>(data);
+    const size_t align = ((x + 7) & ~7ULL) - x;
+    const size_t init = align > n ? n : align;
+    size_t body = (n - init) >> 3;
+    const size_t tail = n - (body << 3) - init;
+
+    for (size_t i = 0; i < init; ++i)
+    {
+        __asm__ __volatile__("crc32b %2, %0\n\t" : "=r"(crc) : "0"(crc), "r"(data[i]) : );
+    }
+
+    const uint64_t* body_ptr = reinterpret_cast<const uint64_t*>(data + init);
+    const size_t long_words = CRC32C_STREAM_LONG >> 3;
+    const size_t short_words = CRC32C_STREAM_SHORT >> 3;
+
+    while (body >= 3 * long_words)
+    {
+        crc = crc32c_three_streams(crc, body_ptr, long_words, crc32c_stream_long_k);
+        body_ptr += 3 * long_words;
+        body -= 3 * long_words;
+    }
+
+    while (body >= 3 * short_words)
+    {
+        crc = crc32c_three_streams(crc, body_ptr, short_words, crc32c_stream_short_k);
+        body_ptr += 3 * short_words;
+        body -= 3 * short_words;
+    }
+
+    for (size_t i = 0; i < body; ++i)
+    {
+        __asm__ __volatile__("crc32q %2, %0" : "=r"(crc) : "0"(crc), "r"(body_ptr[i]) : );
+    }
+
+    const size_t offset = n - tail;
+
+    for (size_t i = 0; i < tail; ++i)
+    {
+        __asm__ __volatile__("crc32b %2, %0\n\t" : "=r"(crc) : "0"(crc), "r"(data[offset + i]) : );
+    }
+
+    crc ^= CRC_FFs;
+    return crc;
+}
+
 typedef uint32_t (*crc32c_func_t)(uint32_t init_crc, const uint8_t* data, size_t n);
 
 #if defined(__i386__)
@@ -108,6 +255,11 @@ choose_crc32c()
     cpuid_t xd;
     cpuid(xa, xb, xc, xd, 1);
 
+    if ((xc & (1<<20)) && (xc & (1<<1)))
+    {
+        return crc32_sse42_streams;
+    }
+
     if (xc & (1<<20))
     {
         return crc32_sse42_quads;
@@ -125,6 +277,12 @@ consus :: crc32c(uint32_t init, const unsigned char* data, size_t n)
     return crc32c_func(init, data, n);
 }
 
+uint32_t
+consus :: crc32c_portable(uint32_t init, const unsigned char* data, size_t n)
+{
+    return crc32_software(init, data, n);
+}
+
 /* This is Intel's slicing-by-8 implementation of CRC32.
  *
  * Retrieved From:  http://slicing-by-8.sourceforge.net/
@@ -40,6 +40,11 @@ BEGIN_CONSUS_NAMESPACE
 uint32_t
 crc32c(uint32_t init, const unsigned char* data, size_t n);
 
+// crc32c dispatches to the fastest kernel the CPU supports; this is the
+// portable table-driven kernel that the others must agree with
+uint32_t
+crc32c_portable(uint32_t init, const unsigned char* data, size_t n);
+
 END_CONSUS_NAMESPACE
 
 #endif // consus_common_crc32c_h_
@@ -37,9 +37,10 @@ consus :: kvs_configuration(e::unpacker up,
                             version_id* vid,
                             uint64_t* flags,
                             std::vector<kvs_state>* kvss,
-                            std::vector<ring>* rings)
+                            std::vector<ring>* rings,
+                            std::vector<table_policy>* tables)
 {
-    return up >> *cid >> *vid >> *flags >> *kvss >> *rings;
+    return up >> *cid >> *vid >> *flags >> *kvss >> *rings >> *tables;
 }
 
 std::string
@@ -47,7 +48,8 @@ consus :: kvs_configuration(const cluster_id& cid,
                               const version_id& vid,
                               uint64_t,
                               const std::vector<kvs_state>& kvss,
-                              const std::vector<ring>& rings)
+                              const std::vector<ring>& rings,
+                              const std::vector<table_policy>& tables)
 {
     std::ostringstream ostr;
     ostr << cid << "\n"
@@ -112,5 +114,10 @@ consus :: kvs_configuration(const cluster_id& cid,
         }
     }
 
+    for (size_t i = 0; i < tables.size(); ++i)
+    {
+        ostr << tables[i] << "\n";
+    }
+
     return ostr.str();
 }
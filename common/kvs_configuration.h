@@ -33,6 +33,7 @@
 #include "common/ids.h"
 #include "common/kvs_state.h"
 #include "common/ring.h"
+#include "common/table_policy.h"
 
 BEGIN_CONSUS_NAMESPACE
 
@@ -41,12 +42,14 @@ e::unpacker kvs_configuration(e::unpacker up,
                               version_id* vid,
                               uint64_t* flags,
                               std::vector<kvs_state>* kvss,
-                              std::vector<ring>* rings);
+                              std::vector<ring>* rings,
+                              std::vector<table_policy>* tables);
 std::string kvs_configuration(const cluster_id& cid,
                               const version_id& vid,
                               uint64_t flags,
                               const std::vector<kvs_state>& kvss,
-                              const std::vector<ring>& rings);
+                              const std::vector<ring>& rings,
+                              const std::vector<table_policy>& tables);
 
 END_CONSUS_NAMESPACE
 
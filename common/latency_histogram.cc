@@ -0,0 +1,122 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// consus
+#include "common/latency_histogram.h"
+
+using consus::latency_histogram;
+
+latency_histogram :: latency_histogram()
+    : m_count(0)
+{
+    for (unsigned i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i)
+    {
+        m_buckets[i] = 0;
+    }
+}
+
+latency_histogram :: ~latency_histogram() throw ()
+{
+}
+
+void
+latency_histogram :: add(uint64_t nanos)
+{
+    ++m_buckets[bucket(nanos)];
+    ++m_count;
+}
+
+void
+latency_histogram :: merge(const latency_histogram& other)
+{
+    for (unsigned i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i)
+    {
+        m_buckets[i] += other.m_buckets[i];
+    }
+
+    m_count += other.m_count;
+}
+
+uint64_t
+latency_histogram :: percentile(double q) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+
+    const uint64_t target = q >= 1.0 ? m_count : uint64_t(q * m_count) + 1;
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += m_buckets[i];
+
+        if (seen >= target)
+        {
+            return bucket_upper_bound(i);
+        }
+    }
+
+    return bucket_upper_bound(LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+unsigned
+latency_histogram :: bucket(uint64_t nanos)
+{
+    if (nanos < 8)
+    {
+        return nanos;
+    }
+
+    const unsigned e = 63 - __builtin_clzll(nanos);
+    return 8 + 4 * (e - 3) + ((nanos >> (e - 2)) & 3);
+}
+
+uint64_t
+latency_histogram :: bucket_upper_bound(unsigned b)
+{
+    if (b < 8)
+    {
+        return b;
+    }
+
+    const unsigned e = (b - 8) / 4 + 3;
+    const uint64_t sub = (b - 8) % 4;
+    const uint64_t lower = (4 + sub) << (e - 2);
+    return lower + (uint64_t(1) << (e - 2)) - 1;
+}
+
+std::ostream&
+consus :: operator << (std::ostream& lhs, const latency_histogram& rhs)
+{
+    return lhs << "count=" << rhs.count()
+               << " p50=" << rhs.percentile(0.5) / 1000. << "us"
+               << " p99=" << rhs.percentile(0.99) / 1000. << "us"
+               << " p999=" << rhs.percentile(0.999) / 1000. << "us"
+               << " max=" << rhs.percentile(1.0) / 1000. << "us";
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_latency_histogram_h_
+#define consus_common_latency_histogram_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+
+// consus
+#include "namespace.h"
+
+// Log-linear buckets:  every power of two is split into four buckets, so any
+// reported percentile is within 25% of the true value.
+#define LATENCY_HISTOGRAM_BUCKETS 252
+
+BEGIN_CONSUS_NAMESPACE
+
+class latency_histogram
+{
+    public:
+        latency_histogram();
+        ~latency_histogram() throw ();
+
+    public:
+        void add(uint64_t nanos);
+        void merge(const latency_histogram& other);
+        uint64_t count() const { return m_count; }
+        // the upper bound of the bucket holding the q-th fraction of samples
+        uint64_t percentile(double q) const;
+
+    private:
+        static unsigned bucket(uint64_t nanos);
+        static uint64_t bucket_upper_bound(unsigned b);
+
+    private:
+        uint64_t m_buckets[LATENCY_HISTOGRAM_BUCKETS];
+        uint64_t m_count;
+};
+
+std::ostream&
+operator << (std::ostream& lhs, const latency_histogram& rhs);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_latency_histogram_h_
@@ -67,6 +67,7 @@ consus :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(KVS_REP_RD_RESP);
         STRINGIFY(KVS_REP_WR);
         STRINGIFY(KVS_REP_WR_RESP);
+        STRINGIFY(KVS_REP_WR_MULTI);
         STRINGIFY(KVS_RAW_RD);
         STRINGIFY(KVS_RAW_RD_RESP);
         STRINGIFY(KVS_RAW_WR);
@@ -76,6 +77,11 @@ consus :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(KVS_RAW_LK);
         STRINGIFY(KVS_RAW_LK_RESP);
         STRINGIFY(KVS_WOUND_XACT);
+        STRINGIFY(KVS_RAW_WR_MULTI);
+        STRINGIFY(KVS_RAW_WR_MULTI_RESP);
+        STRINGIFY(KVS_LEASE_RD);
+        STRINGIFY(KVS_LEASE_RD_RESP);
+        STRINGIFY(KVS_BATCH);
         STRINGIFY(KVS_MIGRATE_SYN);
         STRINGIFY(KVS_MIGRATE_ACK);
         STRINGIFY(CONSUS_NOP);
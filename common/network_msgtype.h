@@ -75,6 +75,7 @@ enum network_msgtype
     KVS_REP_RD_RESP = 7741,
     KVS_REP_WR      = 7742,
     KVS_REP_WR_RESP = 7743,
+    KVS_REP_WR_MULTI = 7744,
 
     KVS_RAW_RD      = 7750,
     KVS_RAW_RD_RESP = 7751,
@@ -89,6 +90,14 @@ enum network_msgtype
 
     KVS_WOUND_XACT  = 7758,
 
+    KVS_RAW_WR_MULTI      = 7760,
+    KVS_RAW_WR_MULTI_RESP = 7761,
+
+    KVS_LEASE_RD      = 7762,
+    KVS_LEASE_RD_RESP = 7763,
+
+    KVS_BATCH       = 7764,
+
     KVS_MIGRATE_SYN = 7800,
     KVS_MIGRATE_ACK = 7801,
 
@@ -0,0 +1,142 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// e
+#include <e/endian.h>
+
+// consus
+#include "common/crc32c.h"
+#include "common/partitioning.h"
+
+using consus::partitioning;
+
+static uint16_t
+key_prefix(const e::slice& key)
+{
+    unsigned char buf[sizeof(uint16_t)];
+    memset(buf, 0, sizeof(buf));
+    memmove(buf, key.data(), key.size() < 2 ? key.size() : 2);
+    uint16_t index;
+    e::unpack16be(buf, &index);
+    return index;
+}
+
+static uint32_t
+table_hash(const e::slice& table)
+{
+    unsigned char buf[sizeof(uint32_t)];
+    e::pack32be(table.size(), buf);
+    uint32_t h = consus::crc32c(0, buf, sizeof(buf));
+    return consus::crc32c(h, table.data(), table.size());
+}
+
+uint16_t
+consus :: partition_index(partitioning p, const e::slice& table, const e::slice& key)
+{
+    switch (p)
+    {
+        case PARTITION_HASH:
+        {
+            // the table is length-prefixed so that ("ab", "c") and ("a", "bc")
+            // do not systematically collide
+            uint32_t h = table_hash(table);
+            h = crc32c(h, key.data(), key.size());
+            return (h ^ (h >> 16)) & 0xffffU;
+        }
+        case PARTITION_ORDERED:
+        {
+            uint32_t h = table_hash(table);
+            return ((h ^ (h >> 16)) + key_prefix(key)) & 0xffffU;
+        }
+        case PARTITION_PREFIX:
+        default:
+            return key_prefix(key);
+    }
+}
+
+partitioning
+consus :: partitioning_from_flags(uint64_t flags)
+{
+    uint64_t p = flags & CONSUS_FLAG_PARTITIONING_MASK;
+    return partitioning_valid(p) ? partitioning(p) : PARTITION_PREFIX;
+}
+
+uint64_t
+consus :: partitioning_to_flags(uint64_t flags, partitioning p)
+{
+    return (flags & ~CONSUS_FLAG_PARTITIONING_MASK) | (uint64_t(p) & CONSUS_FLAG_PARTITIONING_MASK);
+}
+
+bool
+consus :: partitioning_valid(uint64_t p)
+{
+    return p == PARTITION_PREFIX ||
+           p == PARTITION_HASH ||
+           p == PARTITION_ORDERED;
+}
+
+const char*
+consus :: partitioning_to_string(partitioning p)
+{
+    switch (p)
+    {
+        case PARTITION_PREFIX:
+            return "prefix";
+        case PARTITION_HASH:
+            return "hash";
+        case PARTITION_ORDERED:
+            return "ordered";
+        default:
+            return "unknown";
+    }
+}
+
+bool
+consus :: partitioning_from_string(const char* s, partitioning* p)
+{
+    if (strcmp(s, "prefix") == 0)
+    {
+        *p = PARTITION_PREFIX;
+    }
+    else if (strcmp(s, "hash") == 0)
+    {
+        *p = PARTITION_HASH;
+    }
+    else if (strcmp(s, "ordered") == 0)
+    {
+        *p = PARTITION_ORDERED;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_partitioning_h_
+#define consus_common_partitioning_h_
+
+// C
+#include <stdint.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// The function that maps a (table, key) pair onto one of the
+// CONSUS_KVS_PARTITIONS partitions of a ring.  The choice is recorded in the
+// low bits of the cluster-wide configuration flags.  Clusters created before
+// the flag existed carry a zero there and keep the legacy prefix mapping.
+enum partitioning
+{
+    // the first two bytes of the key; ignores the table
+    PARTITION_PREFIX    = 0,
+    // crc32c of table and key; uniform regardless of key distribution
+    PARTITION_HASH      = 1,
+    // each table starts at its own point on the ring and keys are laid out in
+    // order from there, so a range of keys lands on a run of partitions
+    PARTITION_ORDERED   = 2
+};
+
+#define CONSUS_FLAG_PARTITIONING_MASK 0xfULL
+
+uint16_t
+partition_index(partitioning p, const e::slice& table, const e::slice& key);
+
+partitioning
+partitioning_from_flags(uint64_t flags);
+uint64_t
+partitioning_to_flags(uint64_t flags, partitioning p);
+bool
+partitioning_valid(uint64_t p);
+
+const char*
+partitioning_to_string(partitioning p);
+bool
+partitioning_from_string(const char* s, partitioning* p);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_partitioning_h_
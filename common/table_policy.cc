@@ -0,0 +1,125 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// e
+#include <e/strescape.h>
+
+// consus
+#include "common/constants.h"
+#include "common/table_policy.h"
+
+using consus::table_policy;
+
+table_policy :: table_policy()
+    : name()
+    , replication(CONSUS_DEFAULT_REPLICATION_FACTOR)
+    , data_centers()
+{
+}
+
+table_policy :: table_policy(const std::string& n, unsigned r)
+    : name(n)
+    , replication(r)
+    , data_centers()
+{
+}
+
+table_policy :: table_policy(const table_policy& other)
+    : name(other.name)
+    , replication(other.replication)
+    , data_centers(other.data_centers)
+{
+}
+
+table_policy :: ~table_policy() throw ()
+{
+}
+
+bool
+table_policy :: stored_in(data_center_id dc) const
+{
+    if (data_centers.empty())
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < data_centers.size(); ++i)
+    {
+        if (data_centers[i] == dc)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+consus :: operator == (const table_policy& lhs, const table_policy& rhs)
+{
+    return lhs.name == rhs.name &&
+           lhs.replication == rhs.replication &&
+           lhs.data_centers == rhs.data_centers;
+}
+
+std::ostream&
+consus :: operator << (std::ostream& lhs, const table_policy& rhs)
+{
+    lhs << "table_policy(name=\"" << e::strescape(rhs.name)
+        << "\", replication=" << rhs.replication;
+
+    if (!rhs.data_centers.empty())
+    {
+        lhs << ", data_centers=[";
+
+        for (size_t i = 0; i < rhs.data_centers.size(); ++i)
+        {
+            lhs << (i > 0 ? ", " : "") << rhs.data_centers[i].get();
+        }
+
+        lhs << "]";
+    }
+
+    return lhs << ")";
+}
+
+e::packer
+consus :: operator << (e::packer lhs, const table_policy& rhs)
+{
+    return lhs << e::slice(rhs.name) << e::pack_varint(rhs.replication) << rhs.data_centers;
+}
+
+e::unpacker
+consus :: operator >> (e::unpacker lhs, table_policy& rhs)
+{
+    e::slice name;
+    uint64_t replication = 0;
+    lhs = lhs >> name >> e::unpack_varint(replication) >> rhs.data_centers;
+    rhs.name = name.str();
+    rhs.replication = replication;
+    return lhs;
+}
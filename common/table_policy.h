@@ -0,0 +1,77 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_table_policy_h_
+#define consus_common_table_policy_h_
+
+// STL
+#include <string>
+#include <vector>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// How the key value stores keep one table.  Tables without a policy use
+// CONSUS_DEFAULT_REPLICATION_FACTOR and are stored in every data center.
+class table_policy
+{
+    public:
+        table_policy();
+        table_policy(const std::string& name, unsigned replication);
+        table_policy(const table_policy& other);
+        ~table_policy() throw ();
+
+    public:
+        bool stored_in(data_center_id dc) const;
+
+    public:
+        std::string name;
+        unsigned replication;
+        // when non-empty, only these data centers keep replicas; the others
+        // route the table's operations to the first of them
+        std::vector<data_center_id> data_centers;
+};
+
+bool
+operator == (const table_policy& lhs, const table_policy& rhs);
+inline bool
+operator != (const table_policy& lhs, const table_policy& rhs) { return !(lhs == rhs); }
+
+std::ostream&
+operator << (std::ostream& lhs, const table_policy& rhs);
+
+e::packer
+operator << (e::packer lhs, const table_policy& rhs);
+e::unpacker
+operator >> (e::unpacker lhs, table_policy& rhs);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_table_policy_h_
@@ -44,7 +44,12 @@ main(int argc, const char* argv[])
 	cmds.push_back(e::subcommand("coordinator",			"Start a new coordinator"));
     cmds.push_back(e::subcommand("create-data-center",  "Create a new data center"));
     cmds.push_back(e::subcommand("set-default-data-center", "Set the default data center for new servers"));
+    cmds.push_back(e::subcommand("set-partitioning", "Choose how keys map to partitions in a new cluster"));
+    cmds.push_back(e::subcommand("set-kvs-leases", "Let key value stores serve reads under a lease in a new cluster"));
+    cmds.push_back(e::subcommand("set-table-policy", "Set a table's replication factor and placement"));
     cmds.push_back(e::subcommand("availability-check",  "Check that the cluster has sufficient availability"));
+    cmds.push_back(e::subcommand("migrate-kvs-data",    "Convert a key value store data directory to the current key format"));
+    cmds.push_back(e::subcommand("partition-skew",      "Report how a key value store's keys spread across partitions"));
     cmds.push_back(e::subcommand("debug",             	"Debug tools for Consus developers"));
     return dispatch_to_subcommands(argc, argv,
                                    "consus", "Consus",
@@ -40,8 +40,10 @@
 #include <e/strescape.h>
 
 // consus
+#include "common/constants.h"
 #include "common/coordinator_returncode.h"
 #include "common/macros.h"
+#include "common/partitioning.h"
 #include "coordinator/coordinator.h"
 #include "coordinator/util.h"
 
@@ -110,6 +112,7 @@ coordinator :: coordinator()
     , m_kvss_changed(false)
     , m_rings()
     , m_migrated()
+    , m_tables()
 {
 }
 
@@ -131,6 +134,9 @@ coordinator :: init(rsm_context* ctx, uint64_t token)
     rsm_tick_interval(ctx, "tick", 1 /*PER SECOND*/);
     rsm_log(ctx, "initializing consus cluster(%" PRIu64 ")\n", token);
     m_cluster = cluster_id(token);
+    // clusters that predate the partitioning flag read it as zero and keep
+    // the prefix mapping; new clusters start out hashing table and key
+    m_flags = partitioning_to_flags(m_flags, PARTITION_HASH);
     generate_next_configuration(ctx);
     return generate_response(ctx, COORD_SUCCESS);
 }
@@ -543,6 +549,189 @@ coordinator :: kvs_migrated(rsm_context*, partition_id id)
     m_migrated.push_back(id);
 }
 
+void
+coordinator :: kvs_partitioning(rsm_context* ctx, const std::string& name)
+{
+    partitioning p;
+
+    if (!partitioning_from_string(name.c_str(), &p))
+    {
+        rsm_log(ctx, "cannot change partitioning to \"%s\" because it is not a known partitioning function\n", e::strescape(name).c_str());
+        return generate_response(ctx, COORD_MALFORMED);
+    }
+
+    if (partitioning_from_flags(m_flags) == p)
+    {
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    // Changing the function reassigns nearly every key to a new partition,
+    // and the key value stores have no way to move the data over, so the
+    // choice must be made before the first store joins.  Existing clusters
+    // migrate by standing up a new cluster and copying their data across.
+    if (!m_kvss.empty())
+    {
+        rsm_log(ctx, "cannot change partitioning to %s because key value stores are already registered\n", partitioning_to_string(p));
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    rsm_log(ctx, "changing partitioning from %s to %s\n",
+                 partitioning_to_string(partitioning_from_flags(m_flags)),
+                 partitioning_to_string(p));
+    m_flags = partitioning_to_flags(m_flags, p);
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: kvs_leases(rsm_context* ctx, bool enable)
+{
+    if (((m_flags & CONSUS_FLAG_KVS_LEASES) != 0) == enable)
+    {
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    // A leaseholder only has every write because writers wait for it.  Data
+    // written before the flag was set never had to reach it, and writers that
+    // stop waiting once it's cleared could race a lease that hasn't run out,
+    // so, like partitioning, this is fixed before the first store joins.
+    if (!m_kvss.empty())
+    {
+        rsm_log(ctx, "cannot %s key value store leases because key value stores are already registered\n",
+                     enable ? "enable" : "disable");
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    rsm_log(ctx, "%s key value store leases\n", enable ? "enabling" : "disabling");
+
+    if (enable)
+    {
+        m_flags |= CONSUS_FLAG_KVS_LEASES;
+    }
+    else
+    {
+        m_flags &= ~CONSUS_FLAG_KVS_LEASES;
+    }
+
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: kvs_lease(rsm_context* ctx, comm_id id, version_id version)
+{
+    // The grant is a pure function of the replicated state, so every replica
+    // of the coordinator answers alike; the key value store times the lease
+    // from when it sent the request.  Because the version must be current, no
+    // lease outlives the configuration that issued it by more than one lease
+    // duration.
+    kvs_state* kv = get_kvs(id);
+
+    if ((m_flags & CONSUS_FLAG_KVS_LEASES) == 0 ||
+        !kv || kv->state != kvs_state::ONLINE ||
+        version != m_version)
+    {
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+namespace
+{
+
+bool
+compare_table_names(const consus::table_policy& lhs, const consus::table_policy& rhs)
+{
+    return lhs.name < rhs.name;
+}
+
+} // namespace
+
+consus::table_policy*
+coordinator :: get_table_policy(const std::string& name)
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (m_tables[i].name == name)
+        {
+            return &m_tables[i];
+        }
+    }
+
+    return NULL;
+}
+
+void
+coordinator :: table_policy_set(rsm_context* ctx, const std::string& name,
+                                unsigned replication,
+                                const std::vector<std::string>& dc_names)
+{
+    if (name.empty() || replication > CONSUS_MAX_REPLICATION_FACTOR)
+    {
+        rsm_log(ctx, "cannot set policy for table \"%s\": replication must be at most %d\n",
+                     e::strescape(name).c_str(), CONSUS_MAX_REPLICATION_FACTOR);
+        return generate_response(ctx, COORD_MALFORMED);
+    }
+
+    table_policy tp(name, replication == 0 ? CONSUS_DEFAULT_REPLICATION_FACTOR : replication);
+
+    for (size_t i = 0; i < dc_names.size(); ++i)
+    {
+        data_center* dc = get_data_center(dc_names[i]);
+
+        if (!dc)
+        {
+            rsm_log(ctx, "cannot set policy for table \"%s\": data center %s doesn't exist\n",
+                         e::strescape(name).c_str(), e::strescape(dc_names[i]).c_str());
+            return generate_response(ctx, COORD_NOT_FOUND);
+        }
+
+        if (std::find(tp.data_centers.begin(), tp.data_centers.end(), dc->id) == tp.data_centers.end())
+        {
+            tp.data_centers.push_back(dc->id);
+        }
+    }
+
+    table_policy* existing = get_table_policy(name);
+    table_policy current = existing ? *existing : table_policy(name, CONSUS_DEFAULT_REPLICATION_FACTOR);
+
+    if (current == tp)
+    {
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    // Moving a table to a different replica set would leave quorums that do
+    // not intersect the ones its data was written under, and the key value
+    // stores cannot re-replicate it.  A table without a policy of its own may
+    // already hold data under the default, so, like partitioning, every
+    // table's policy is fixed once the first store joins.
+    if (!m_kvss.empty())
+    {
+        rsm_log(ctx, "cannot change %s to %s because key value stores are already registered\n",
+                     to_string(current).c_str(), to_string(tp).c_str());
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    if (existing && tp == table_policy(name, CONSUS_DEFAULT_REPLICATION_FACTOR))
+    {
+        m_tables.erase(m_tables.begin() + (existing - &m_tables[0]));
+    }
+    else if (existing)
+    {
+        *existing = tp;
+    }
+    else
+    {
+        m_tables.push_back(tp);
+        std::sort(m_tables.begin(), m_tables.end(), compare_table_names);
+    }
+
+    rsm_log(ctx, "set %s\n", to_string(tp).c_str());
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
 void
 coordinator :: is_stable(rsm_context* ctx)
 {
@@ -629,6 +818,12 @@ coordinator :: recreate(rsm_context* /*ctx*/,
             >> c->m_rings
             >> c->m_migrated;
 
+    // snapshots taken before table policies existed end here
+    if (!up.error() && up.remain())
+    {
+        up = up >> c->m_tables;
+    }
+
     if (up.error())
     {
         return NULL;
@@ -654,7 +849,8 @@ coordinator :: snapshot(rsm_context* /*ctx*/,
         << m_kvs_quiescence_counter
         << e::pack_uint8<bool>(m_kvss_changed)
         << m_rings
-        << m_migrated;
+        << m_migrated
+        << m_tables;
     char* ptr = static_cast<char*>(malloc(buf.size()));
     *data = ptr;
     *data_sz = buf.size();
@@ -707,7 +903,7 @@ coordinator :: generate_next_configuration(rsm_context* ctx)
     // kvs configuration
     std::string kvsconf;
     e::packer(&kvsconf)
-        << m_cluster << m_version << m_flags << m_kvss << m_rings;
+        << m_cluster << m_version << m_flags << m_kvss << m_rings << m_tables;
     rsm_cond_broadcast_data(ctx, "kvsconf", kvsconf.data(), kvsconf.size());
 }
 
@@ -42,6 +42,7 @@
 #include "common/kvs_state.h"
 #include "common/paxos_group.h"
 #include "common/ring.h"
+#include "common/table_policy.h"
 #include "common/txman.h"
 #include "common/txman_state.h"
 
@@ -82,6 +83,16 @@ class coordinator
         void kvs_online(rsm_context* ctx, comm_id id, const po6::net::location& bind_to, uint64_t nonce);
         void kvs_offline(rsm_context* ctx, comm_id id, const po6::net::location& bind_to, uint64_t nonce);
         void kvs_migrated(rsm_context* ctx, partition_id part);
+        void kvs_partitioning(rsm_context* ctx, const std::string& name);
+        void kvs_leases(rsm_context* ctx, bool enable);
+        void kvs_lease(rsm_context* ctx, comm_id id, version_id version);
+
+    // tables
+    public:
+        table_policy* get_table_policy(const std::string& name);
+        void table_policy_set(rsm_context* ctx, const std::string& name,
+                              unsigned replication,
+                              const std::vector<std::string>& data_centers);
 
     // maintenance
     public:
@@ -127,6 +138,8 @@ class coordinator
         // rings
         std::vector<ring> m_rings;
         std::vector<partition_id> m_migrated;
+        // tables, sorted by name
+        std::vector<table_policy> m_tables;
 
     private:
         coordinator(const coordinator&);
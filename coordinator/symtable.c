@@ -50,6 +50,10 @@ struct state_machine CONSUS_API rsm = {
      {"kvs_online", consus_coordinator_kvs_online},
      {"kvs_offline", consus_coordinator_kvs_offline},
      {"kvs_migrated", consus_coordinator_kvs_migrated},
+     {"kvs_partitioning", consus_coordinator_kvs_partitioning},
+     {"kvs_leases", consus_coordinator_kvs_leases},
+     {"kvs_lease", consus_coordinator_kvs_lease},
+     {"table_policy_set", consus_coordinator_table_policy_set},
      {"is_stable", consus_coordinator_is_stable},
      {"tick", consus_coordinator_tick},
      {NULL, NULL}}
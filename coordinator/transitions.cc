@@ -214,6 +214,62 @@ consus_coordinator_kvs_migrated(rsm_context* ctx, void* obj, const char* data, s
     c->kvs_migrated(ctx, id);
 }
 
+CONSUS_API void
+consus_coordinator_kvs_partitioning(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    e::slice name;
+    e::unpacker up(data, data_sz);
+    up = up >> name;
+    CHECK_UNPACK(kvs_partitioning);
+    c->kvs_partitioning(ctx, name.str());
+}
+
+CONSUS_API void
+consus_coordinator_kvs_leases(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    uint8_t enable;
+    e::unpacker up(data, data_sz);
+    up = up >> enable;
+    CHECK_UNPACK(kvs_leases);
+    c->kvs_leases(ctx, enable != 0);
+}
+
+CONSUS_API void
+consus_coordinator_kvs_lease(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    comm_id id;
+    version_id version;
+    e::unpacker up(data, data_sz);
+    up = up >> id >> version;
+    CHECK_UNPACK(kvs_lease);
+    c->kvs_lease(ctx, id, version);
+}
+
+CONSUS_API void
+consus_coordinator_table_policy_set(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    e::slice name;
+    uint32_t replication = 0;
+    uint32_t data_centers_sz = 0;
+    e::unpacker up(data, data_sz);
+    up = up >> name >> replication >> data_centers_sz;
+    std::vector<std::string> data_centers;
+
+    for (uint32_t i = 0; !up.error() && i < data_centers_sz; ++i)
+    {
+        e::slice dc;
+        up = up >> dc;
+        data_centers.push_back(dc.str());
+    }
+
+    CHECK_UNPACK(table_policy_set);
+    c->table_policy_set(ctx, name.str(), replication, data_centers);
+}
+
 CONSUS_API void
 consus_coordinator_is_stable(rsm_context* ctx, void* obj, const char*, size_t)
 {
@@ -65,6 +65,11 @@ TRANSITION(kvs_register);
 TRANSITION(kvs_online);
 TRANSITION(kvs_offline);
 TRANSITION(kvs_migrated);
+TRANSITION(kvs_partitioning);
+TRANSITION(kvs_leases);
+TRANSITION(kvs_lease);
+
+TRANSITION(table_policy_set);
 
 TRANSITION(is_stable);
 TRANSITION(tick);
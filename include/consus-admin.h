@@ -41,6 +41,20 @@ int consus_admin_create_data_center(struct consus_client* client, const char* na
                                     enum consus_returncode* status);
 int consus_admin_set_default_data_center(struct consus_client* client, const char* name,
                                          enum consus_returncode* status);
+/* name is one of "hash", "ordered", or "prefix"; may only be changed before
+ * the first key value store registers */
+int consus_admin_set_partitioning(struct consus_client* client, const char* name,
+                                  enum consus_returncode* status);
+/* let the first replica of each partition serve reads under a lease; may only
+ * be changed before the first key value store registers */
+int consus_admin_set_kvs_leases(struct consus_client* client, int enable,
+                                enum consus_returncode* status);
+/* replication of 0 means the cluster default; an empty data_centers list
+ * keeps the table in every data center */
+int consus_admin_set_table_policy(struct consus_client* client, const char* table,
+                                  unsigned replication,
+                                  const char** data_centers, size_t data_centers_sz,
+                                  enum consus_returncode* status);
 
 struct consus_availability_requirements
 {
@@ -0,0 +1,222 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/network_msgtype.h"
+#include "kvs/batcher.h"
+
+using consus::batcher;
+
+// a batch this large goes out without waiting out the window
+#define BATCH_MAX_BYTES 65536
+
+batcher :: batcher(uint64_t window)
+    : m_window(window)
+    , m_mtx()
+    , m_pending()
+{
+}
+
+batcher :: ~batcher() throw ()
+{
+    for (pending_map_t::iterator it = m_pending.begin();
+            it != m_pending.end(); ++it)
+    {
+        for (size_t i = 0; i < it->second.msgs.size(); ++i)
+        {
+            delete it->second.msgs[i];
+        }
+    }
+}
+
+bool
+batcher :: batchable(e::buffer* msg)
+{
+    network_msgtype mt;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt;
+    return !up.error() && batchable(mt);
+}
+
+bool
+batcher :: batchable(network_msgtype mt)
+{
+    switch (mt)
+    {
+        case KVS_RAW_RD:
+        case KVS_RAW_RD_RESP:
+        case KVS_RAW_WR:
+        case KVS_RAW_WR_RESP:
+        case KVS_RAW_WR_MULTI:
+        case KVS_RAW_WR_MULTI_RESP:
+        case KVS_RAW_LK:
+        case KVS_RAW_LK_RESP:
+        case KVS_LEASE_RD:
+        case KVS_LEASE_RD_RESP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool
+batcher :: unpack(e::unpacker up, std::vector<e::slice>* msgs)
+{
+    uint32_t count = 0;
+    up = up >> count;
+
+    // every message takes at least a byte, which bounds a bogus count
+    if (!up.error() && count <= up.remain())
+    {
+        msgs->reserve(count);
+    }
+
+    for (uint32_t i = 0; !up.error() && i < count; ++i)
+    {
+        e::slice m;
+        up = up >> m;
+
+        if (!up.error())
+        {
+            msgs->push_back(m);
+        }
+    }
+
+    if (up.error() || up.remain() > 0)
+    {
+        msgs->clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+batcher :: enqueue(comm_id id, std::auto_ptr<e::buffer> msg, uint64_t now,
+                   std::auto_ptr<e::buffer>* full)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    const bool was_empty = m_pending.empty();
+    pending& p(m_pending[id]);
+
+    if (p.msgs.empty())
+    {
+        p.since = now;
+    }
+
+    assert(msg->size() >= BUSYBEE_HEADER_SIZE);
+    e::slice m(msg->data() + BUSYBEE_HEADER_SIZE, msg->size() - BUSYBEE_HEADER_SIZE);
+    p.bytes += pack_size(m);
+    p.msgs.push_back(msg.get());
+    msg.release();
+
+    if (p.bytes >= BATCH_MAX_BYTES)
+    {
+        *full = frame(&p);
+        m_pending.erase(id);
+    }
+
+    return was_empty && !m_pending.empty();
+}
+
+uint64_t
+batcher :: deadline()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    uint64_t oldest = 0;
+
+    for (pending_map_t::iterator it = m_pending.begin();
+            it != m_pending.end(); ++it)
+    {
+        if (oldest == 0 || it->second.since < oldest)
+        {
+            oldest = it->second.since;
+        }
+    }
+
+    return oldest == 0 ? 0 : oldest + m_window;
+}
+
+bool
+batcher :: dequeue(uint64_t now, comm_id* id, std::auto_ptr<e::buffer>* msg)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (pending_map_t::iterator it = m_pending.begin();
+            it != m_pending.end(); ++it)
+    {
+        if (it->second.since + m_window <= now)
+        {
+            *id = it->first;
+            *msg = frame(&it->second);
+            m_pending.erase(it);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Copies each message once, straight into a buffer sized for the batch, and
+// frees it.  A lone message is already framed, so it goes as it came.
+std::auto_ptr<e::buffer>
+batcher :: frame(pending* p)
+{
+    assert(!p->msgs.empty());
+
+    if (p->msgs.size() == 1)
+    {
+        std::auto_ptr<e::buffer> msg(p->msgs[0]);
+        p->msgs.clear();
+        return msg;
+    }
+
+    const uint32_t count = p->msgs.size();
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_BATCH)
+                    + sizeof(uint32_t)
+                    + p->bytes;
+    std::auto_ptr<e::buffer> batch(e::buffer::create(sz));
+    e::packer pa = batch->pack_at(BUSYBEE_HEADER_SIZE);
+    pa = pa << KVS_BATCH << count;
+
+    for (size_t i = 0; i < p->msgs.size(); ++i)
+    {
+        e::buffer* m = p->msgs[i];
+        pa = pa << e::slice(m->data() + BUSYBEE_HEADER_SIZE, m->size() - BUSYBEE_HEADER_SIZE);
+        delete m;
+    }
+
+    p->msgs.clear();
+    return batch;
+}
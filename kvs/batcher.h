@@ -0,0 +1,108 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_batcher_h_
+#define consus_kvs_batcher_h_
+
+// STL
+#include <map>
+#include <memory>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/buffer.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/network_msgtype.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Coalesces the small messages key value stores exchange on behalf of the
+// replicators into one KVS_BATCH frame per destination.  The first message
+// queued for a destination opens its batch; the batch goes out once it has
+// been open for the window, or sooner if it fills.  A batch holding a single
+// message goes out as that message, unwrapped.
+//
+// Only messages between key value stores may be batched, because nothing
+// else knows how to take a KVS_BATCH apart.
+class batcher
+{
+    public:
+        batcher(uint64_t window);
+        ~batcher() throw ();
+
+    public:
+        static bool batchable(e::buffer* msg);
+        static bool batchable(network_msgtype mt);
+        // up is positioned just past the KVS_BATCH msgtype; on success, msgs
+        // holds each message of the batch, less its busybee header, pointing
+        // into the batch itself
+        static bool unpack(e::unpacker up, std::vector<e::slice>* msgs);
+
+    public:
+        // Takes ownership of msg.  If that fills the batch for id, the batch
+        // is handed back in *full to be sent right away.  Returns true if no
+        // batch was open before, so the flusher may be asleep.
+        bool enqueue(comm_id id, std::auto_ptr<e::buffer> msg, uint64_t now,
+                     std::auto_ptr<e::buffer>* full);
+        // when the oldest open batch is due; zero if none is open
+        uint64_t deadline();
+        // removes one batch that is due by now; false if none is
+        bool dequeue(uint64_t now, comm_id* id, std::auto_ptr<e::buffer>* msg);
+
+    private:
+        struct pending
+        {
+            pending() : since(0), bytes(0), msgs() {}
+
+            uint64_t since;
+            // the space the messages take in the batch
+            size_t bytes;
+            // owned until the batch is framed
+            std::vector<e::buffer*> msgs;
+        };
+        typedef std::map<comm_id, pending> pending_map_t;
+        static std::auto_ptr<e::buffer> frame(pending* p);
+
+    private:
+        const uint64_t m_window;
+        po6::threads::mutex m_mtx;
+        pending_map_t m_pending;
+
+    private:
+        batcher(const batcher&);
+        batcher& operator = (const batcher&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_batcher_h_
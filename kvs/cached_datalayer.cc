@@ -0,0 +1,461 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <assert.h>
+
+// STL
+#include <list>
+#include <map>
+#include <sstream>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "common/crc32c.h"
+#include "kvs/cached_datalayer.h"
+#include "kvs/table_key_pair.h"
+
+using consus::cached_datalayer;
+
+#define ROW_CACHE_SHARDS 64
+// bytes charged to each row on top of its table, key and value, to cover the
+// map node, the LRU node and the string headers
+#define ROW_OVERHEAD 192
+
+// An immutable version of one key.  The shard holds one reference while the
+// row is cached and every outstanding read holds another, so a row may be
+// evicted or replaced while a reader still points into its value.
+struct cached_datalayer::row
+{
+    row(uint64_t timestamp, bool tombstone, const e::slice& value);
+    ~row() throw ();
+
+    void inc() { e::atomic::increment_64_nobarrier(&ref, 1); }
+    void dec() { if (e::atomic::increment_64_fullbarrier(&ref, -1) == 0) delete this; }
+
+    const uint64_t timestamp;
+    const bool tombstone;
+    const std::string value;
+    uint64_t ref;
+
+    private:
+        row(const row&);
+        row& operator = (const row&);
+};
+
+cached_datalayer :: row :: row(uint64_t t, bool tomb, const e::slice& v)
+    : timestamp(t)
+    , tombstone(tomb)
+    , value(v.cdata(), v.size())
+    , ref(1)
+{
+}
+
+cached_datalayer :: row :: ~row() throw ()
+{
+}
+
+struct cached_datalayer::shard
+{
+    struct less
+    {
+        bool operator () (const table_key_pair& lhs, const table_key_pair& rhs) const
+        {
+            return lhs.table < rhs.table ||
+                   (lhs.table == rhs.table && lhs.key < rhs.key);
+        }
+    };
+    struct slot
+    {
+        row* r;
+        std::list<const table_key_pair*>::iterator lru;
+    };
+    typedef std::map<table_key_pair, slot, less> row_map_t;
+
+    shard();
+    ~shard() throw ();
+
+    row_map_t::iterator find(const e::slice& table, const e::slice& key);
+    void touch(row_map_t::iterator it);
+    void replace(row_map_t::iterator it, row* r);
+    void erase(row_map_t::iterator it);
+    void evict(uint64_t capacity);
+    static uint64_t charge(const table_key_pair& tk, const row* r);
+
+    po6::threads::mutex mtx;
+    // bumped by every write to the shard; a read that saw another generation
+    // may have raced the write and must not cache what it read
+    uint64_t generation;
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    table_key_pair scratch;
+    row_map_t rows;
+    std::list<const table_key_pair*> lru;
+
+    private:
+        shard(const shard&);
+        shard& operator = (const shard&);
+};
+
+cached_datalayer :: shard :: shard()
+    : mtx()
+    , generation(0)
+    , bytes(0)
+    , hits(0)
+    , misses(0)
+    , scratch()
+    , rows()
+    , lru()
+{
+}
+
+cached_datalayer :: shard :: ~shard() throw ()
+{
+    for (row_map_t::iterator it = rows.begin(); it != rows.end(); ++it)
+    {
+        it->second.r->dec();
+    }
+}
+
+cached_datalayer::shard::row_map_t::iterator
+cached_datalayer :: shard :: find(const e::slice& table, const e::slice& key)
+{
+    scratch.table.assign(table.cdata(), table.size());
+    scratch.key.assign(key.cdata(), key.size());
+    return rows.find(scratch);
+}
+
+void
+cached_datalayer :: shard :: touch(row_map_t::iterator it)
+{
+    lru.splice(lru.begin(), lru, it->second.lru);
+}
+
+void
+cached_datalayer :: shard :: replace(row_map_t::iterator it, row* r)
+{
+    bytes -= charge(it->first, it->second.r);
+    bytes += charge(it->first, r);
+    it->second.r->dec();
+    it->second.r = r;
+    touch(it);
+}
+
+void
+cached_datalayer :: shard :: erase(row_map_t::iterator it)
+{
+    bytes -= charge(it->first, it->second.r);
+    it->second.r->dec();
+    lru.erase(it->second.lru);
+    rows.erase(it);
+}
+
+void
+cached_datalayer :: shard :: evict(uint64_t capacity)
+{
+    while (bytes > capacity && !lru.empty())
+    {
+        row_map_t::iterator it = rows.find(*lru.back());
+        assert(it != rows.end());
+        erase(it);
+    }
+}
+
+uint64_t
+cached_datalayer :: shard :: charge(const table_key_pair& tk, const row* r)
+{
+    return tk.table.size() + tk.key.size() + r->value.size() + ROW_OVERHEAD;
+}
+
+struct cached_datalayer::reference : public datalayer::reference
+{
+    reference(row* r);
+    virtual ~reference() throw ();
+
+    row* r;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+cached_datalayer :: reference :: reference(row* _r)
+    : datalayer::reference()
+    , r(_r)
+{
+    r->inc();
+}
+
+cached_datalayer :: reference :: ~reference() throw ()
+{
+    r->dec();
+}
+
+cached_datalayer :: cached_datalayer(datalayer* inner, uint64_t capacity)
+    : m_inner(inner)
+    , m_shard_capacity(capacity / ROW_CACHE_SHARDS)
+    , m_shards()
+{
+    for (size_t i = 0; i < ROW_CACHE_SHARDS; ++i)
+    {
+        m_shards.push_back(new shard());
+    }
+}
+
+cached_datalayer :: ~cached_datalayer() throw ()
+{
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        delete m_shards[i];
+    }
+}
+
+bool
+cached_datalayer :: init(std::string data)
+{
+    return m_inner->init(data);
+}
+
+consus_returncode
+cached_datalayer :: get(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp_le,
+                        uint64_t* timestamp,
+                        e::slice* value,
+                        datalayer::reference** ref)
+{
+    shard* s = get_shard(table, key);
+    uint64_t generation;
+
+    {
+        po6::threads::mutex::hold hold(&s->mtx);
+        shard::row_map_t::iterator it = s->find(table, key);
+
+        if (it != s->rows.end() && it->second.r->timestamp <= timestamp_le)
+        {
+            row* r = it->second.r;
+            ++s->hits;
+            s->touch(it);
+            *timestamp = r->timestamp;
+            *value = e::slice(r->value);
+            *ref = new reference(r);
+            return r->tombstone ? CONSUS_NOT_FOUND : CONSUS_SUCCESS;
+        }
+
+        ++s->misses;
+        generation = s->generation;
+    }
+
+    consus_returncode rc = m_inner->get(table, key, timestamp_le, timestamp, value, ref);
+
+    // only a read of the newest version tells us what to cache
+    if (timestamp_le == UINT64_MAX &&
+        (rc == CONSUS_SUCCESS || rc == CONSUS_NOT_FOUND))
+    {
+        fill(s, generation, table, key, *timestamp, rc == CONSUS_NOT_FOUND, *value);
+    }
+
+    return rc;
+}
+
+consus_returncode
+cached_datalayer :: put(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp,
+                        const e::slice& value)
+{
+    consus_returncode rc = m_inner->put(table, key, timestamp, value);
+    written(rc, table, key, timestamp, false, value);
+    return rc;
+}
+
+consus_returncode
+cached_datalayer :: del(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp)
+{
+    consus_returncode rc = m_inner->del(table, key, timestamp);
+    written(rc, table, key, timestamp, true, e::slice());
+    return rc;
+}
+
+consus_returncode
+cached_datalayer :: read_lock(const e::slice& table,
+                              const e::slice& key,
+                              transaction_group* tg)
+{
+    return m_inner->read_lock(table, key, tg);
+}
+
+consus_returncode
+cached_datalayer :: write_lock(const e::slice& table,
+                               const e::slice& key,
+                               const transaction_group& tg)
+{
+    return m_inner->write_lock(table, key, tg);
+}
+
+consus_returncode
+cached_datalayer :: apply(const datalayer::write* writes, size_t writes_sz)
+{
+    consus_returncode rc = m_inner->apply(writes, writes_sz);
+
+    for (size_t i = 0; i < writes_sz; ++i)
+    {
+        const datalayer::write& w(writes[i]);
+        written(rc, w.table, w.key, w.timestamp, w.tombstone, w.value);
+    }
+
+    return rc;
+}
+
+// pruning never removes the newest version of a key, which is all the cache
+// holds
+consus_returncode
+cached_datalayer :: prune(uint64_t watermark,
+                          std::string* position,
+                          size_t max_keys,
+                          uint64_t* pruned)
+{
+    return m_inner->prune(watermark, position, max_keys, pruned);
+}
+
+bool
+cached_datalayer :: checkpoint()
+{
+    return m_inner->checkpoint();
+}
+
+std::string
+cached_datalayer :: debug_dump()
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytes;
+    stats(&hits, &misses, &bytes);
+    std::ostringstream ostr;
+    ostr << "row cache hits=" << hits
+         << " misses=" << misses
+         << " bytes=" << bytes
+         << " capacity=" << m_shard_capacity * m_shards.size() << "\n"
+         << m_inner->debug_dump();
+    return ostr.str();
+}
+
+void
+cached_datalayer :: stats(uint64_t* hits, uint64_t* misses, uint64_t* bytes)
+{
+    *hits = 0;
+    *misses = 0;
+    *bytes = 0;
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        po6::threads::mutex::hold hold(&m_shards[i]->mtx);
+        *hits += m_shards[i]->hits;
+        *misses += m_shards[i]->misses;
+        *bytes += m_shards[i]->bytes;
+    }
+}
+
+cached_datalayer::shard*
+cached_datalayer :: get_shard(const e::slice& table, const e::slice& key)
+{
+    uint32_t h = crc32c(0, table.data(), table.size());
+    h = crc32c(h, key.data(), key.size());
+    return m_shards[h % m_shards.size()];
+}
+
+void
+cached_datalayer :: fill(shard* s, uint64_t generation,
+                         const e::slice& table, const e::slice& key,
+                         uint64_t timestamp, bool tombstone, const e::slice& value)
+{
+    const uint64_t sz = table.size() + key.size() + value.size() + ROW_OVERHEAD;
+
+    if (sz > m_shard_capacity)
+    {
+        return;
+    }
+
+    po6::threads::mutex::hold hold(&s->mtx);
+
+    if (s->generation != generation ||
+        s->find(table, key) != s->rows.end())
+    {
+        return;
+    }
+
+    shard::slot sl;
+    sl.r = new row(timestamp, tombstone, value);
+    std::pair<shard::row_map_t::iterator, bool> ins;
+    ins = s->rows.insert(std::make_pair(s->scratch, sl));
+    assert(ins.second);
+    ins.first->second.lru = s->lru.insert(s->lru.begin(), &ins.first->first);
+    s->bytes += sz;
+    s->evict(m_shard_capacity);
+}
+
+// Called once a write has reached the underlying datalayer.  A cached row is
+// only worth keeping if it is still the newest version:  an older write
+// leaves it alone, a newer one replaces it, and anything ambiguous (a failed
+// write, or a second write at the same timestamp) drops it.
+void
+cached_datalayer :: written(consus_returncode rc,
+                            const e::slice& table, const e::slice& key,
+                            uint64_t timestamp, bool tombstone, const e::slice& value)
+{
+    shard* s = get_shard(table, key);
+    po6::threads::mutex::hold hold(&s->mtx);
+    ++s->generation;
+    shard::row_map_t::iterator it = s->find(table, key);
+
+    if (it == s->rows.end())
+    {
+        return;
+    }
+
+    const uint64_t cached = it->second.r->timestamp;
+
+    if (rc != CONSUS_SUCCESS || timestamp == cached)
+    {
+        s->erase(it);
+    }
+    else if (timestamp > cached)
+    {
+        s->replace(it, new row(timestamp, tombstone, value));
+        s->evict(m_shard_capacity);
+    }
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_cached_datalayer_h_
+#define consus_kvs_cached_datalayer_h_
+
+// STL
+#include <memory>
+#include <vector>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Caches the newest version of recently read keys in front of another
+// datalayer.  The cache only ever holds a version known to be the newest in
+// the underlying datalayer, so any read whose timestamp_le is at least that
+// version's timestamp can be answered from memory.  Older reads and locks go
+// straight through.
+class cached_datalayer : public datalayer
+{
+    public:
+        // takes ownership of inner; holds at most capacity bytes of rows
+        cached_datalayer(datalayer* inner, uint64_t capacity);
+        virtual ~cached_datalayer() throw ();
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            transaction_group* tg);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const transaction_group& tg);
+        virtual consus_returncode apply(const datalayer::write* writes, size_t writes_sz);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        std::string* position,
+                                        size_t max_keys,
+                                        uint64_t* pruned);
+        virtual bool checkpoint();
+        virtual std::string debug_dump();
+
+    public:
+        void stats(uint64_t* hits, uint64_t* misses, uint64_t* bytes);
+
+    private:
+        struct row;
+        struct shard;
+        struct reference;
+
+    private:
+        shard* get_shard(const e::slice& table, const e::slice& key);
+        void fill(shard* s, uint64_t generation,
+                  const e::slice& table, const e::slice& key,
+                  uint64_t timestamp, bool tombstone, const e::slice& value);
+        void written(consus_returncode rc,
+                     const e::slice& table, const e::slice& key,
+                     uint64_t timestamp, bool tombstone, const e::slice& value);
+
+    private:
+        std::auto_ptr<datalayer> m_inner;
+        const uint64_t m_shard_capacity;
+        std::vector<shard*> m_shards;
+
+    private:
+        cached_datalayer(const cached_datalayer&);
+        cached_datalayer& operator = (const cached_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_cached_datalayer_h_
@@ -25,22 +25,27 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
-// e
-#include <e/endian.h>
+// C
+#include <string.h>
+
+// STL
+#include <algorithm>
 
 // consus
 #include "common/kvs_configuration.h"
+#include "common/partitioning.h"
 #include "kvs/configuration.h"
 
 using consus::configuration;
 
+// The replica set of every partition of one data center's ring, already
+// trimmed to one replication factor, as an index into m_cached_replica_sets.
 struct configuration::cached_ring
 {
-    cached_ring() : dc() {}
+    cached_ring() {}
     ~cached_ring() throw () {}
 
-    data_center_id dc;
-    size_t replica_sets[CONSUS_KVS_PARTITIONS];
+    uint32_t replica_sets[CONSUS_KVS_PARTITIONS];
 };
 
 configuration :: configuration()
@@ -49,9 +54,17 @@ configuration :: configuration()
     , m_flags(0)
     , m_kvss()
     , m_rings()
+    , m_tables()
+    , m_cached_dcs()
+    , m_cached_factors()
     , m_cached_replica_sets()
     , m_cached_rings()
+    , m_no_replicas()
 {
+    for (unsigned i = 0; i <= CONSUS_MAX_REPLICATION_FACTOR; ++i)
+    {
+        m_factor_slots[i] = 0;
+    }
 }
 
 configuration :: ~configuration() throw ()
@@ -122,38 +135,77 @@ configuration :: daemons() const
 
 bool
 configuration :: hash(data_center_id dc,
-                      const e::slice& /* table XXX */,
+                      const e::slice& table,
                       const e::slice& key,
-                      replica_set* rs)
+                      const replica_set** rs) const
 {
-    // XXX use a better mapping scheme
-    char buf[sizeof(uint16_t)];
-    memset(buf, 0, sizeof(buf));
-    memmove(buf, key.data(), key.size() < 2 ? key.size() : 2);
-    uint16_t index;
-    e::unpack16be(buf, &index);
+    uint16_t index = partition_index(partitioning_from_flags(m_flags), table, key);
+    const table_policy* tp = get_table_policy(table);
+    unsigned replication = CONSUS_DEFAULT_REPLICATION_FACTOR;
 
-    for (size_t i = 0; i < m_rings.size(); ++i)
+    if (tp)
     {
-        if (m_cached_rings[i].dc == dc)
+        replication = tp->replication;
+
+        // the table is not kept here; use the replicas of a data center
+        // where it is
+        if (!tp->stored_in(dc))
         {
-            size_t r = m_cached_rings[i].replica_sets[index];
-            assert(r < m_cached_replica_sets.size());
-            *rs = m_cached_replica_sets[r];
-            rs->desired_replication = 5;//XXX
+            dc = tp->data_centers[0];
+        }
+    }
 
-            if (rs->num_replicas > rs->desired_replication)
-            {
-                rs->num_replicas = rs->desired_replication;
-            }
+    assert(replication <= CONSUS_MAX_REPLICATION_FACTOR);
+    const size_t slot = m_factor_slots[replication];
+    assert(slot < m_cached_factors.size());
 
+    for (size_t i = 0; i < m_cached_dcs.size(); ++i)
+    {
+        if (m_cached_dcs[i] == dc)
+        {
+            const cached_ring& cr(m_cached_rings[i * m_cached_factors.size() + slot]);
+            uint32_t r = cr.replica_sets[index];
+            assert(r < m_cached_replica_sets.size());
+            *rs = &m_cached_replica_sets[r];
             return true;
         }
     }
 
+    *rs = &m_no_replicas;
     return false;
 }
 
+bool
+configuration :: same_owners(const configuration& other) const
+{
+    if (m_rings.size() != other.m_rings.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        const ring& lhs(m_rings[i]);
+        const ring& rhs(other.m_rings[i]);
+
+        if (lhs.dc != rhs.dc)
+        {
+            return false;
+        }
+
+        for (size_t idx = 0; idx < CONSUS_KVS_PARTITIONS; ++idx)
+        {
+            if (lhs.partitions[idx].owner != rhs.partitions[idx].owner ||
+                lhs.partitions[idx].next_owner != rhs.partitions[idx].next_owner)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 std::vector<consus::comm_id>
 configuration :: ids()
 {
@@ -200,38 +252,84 @@ configuration :: owner_from_next_id(partition_id id)
 std::string
 configuration :: dump() const
 {
-    return kvs_configuration(m_cluster, m_version, m_flags, m_kvss, m_rings);
+    return kvs_configuration(m_cluster, m_version, m_flags, m_kvss, m_rings, m_tables);
 }
 
 void
 configuration :: reconstruct_cache()
 {
+    // one cached ring per data center per replication factor in use, so
+    // hash hands out a finished replica set without trimming or copying it
+    m_cached_dcs.clear();
+    m_cached_factors.clear();
+    m_cached_factors.push_back(CONSUS_DEFAULT_REPLICATION_FACTOR);
+
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (std::find(m_cached_factors.begin(), m_cached_factors.end(),
+                      m_tables[i].replication) == m_cached_factors.end())
+        {
+            m_cached_factors.push_back(m_tables[i].replication);
+        }
+    }
+
+    for (unsigned i = 0; i <= CONSUS_MAX_REPLICATION_FACTOR; ++i)
+    {
+        m_factor_slots[i] = 0;
+    }
+
+    for (size_t i = 0; i < m_cached_factors.size(); ++i)
+    {
+        assert(m_cached_factors[i] <= CONSUS_MAX_REPLICATION_FACTOR);
+        m_factor_slots[m_cached_factors[i]] = i;
+    }
+
+    const size_t factors = m_cached_factors.size();
     m_cached_replica_sets.clear();
     m_cached_rings.clear();
-    m_cached_rings.resize(m_rings.size());
+    m_cached_rings.resize(m_rings.size() * factors);
+    std::vector<uint32_t> last(factors);
 
     for (size_t i = 0; i < m_rings.size(); ++i)
     {
-        m_cached_rings[i].dc = m_rings[i].dc;
+        m_cached_dcs.push_back(m_rings[i].dc);
+        replica_set full;
 
         for (size_t idx = 0; idx < CONSUS_KVS_PARTITIONS; ++idx)
         {
-            replica_set rs;
-            rs.desired_replication = CONSUS_MAX_REPLICATION_FACTOR;
+            const partition& p(m_rings[i].partitions[idx]);
 
-            if (m_cached_replica_sets.empty() ||
-                m_cached_replica_sets.back().replicas[0] != m_rings[i].partitions[idx].owner ||
-                m_cached_replica_sets.back().transitioning[0] != m_rings[i].partitions[idx].next_owner)
+            if (idx > 0 &&
+                full.replicas[0] == p.owner &&
+                full.transitioning[0] == p.next_owner)
             {
-                lookup(&m_rings[i], idx, &rs);
+                // same run of partitions, same replica sets
+                for (size_t f = 0; f < factors; ++f)
+                {
+                    m_cached_rings[i * factors + f].replica_sets[idx] = last[f];
+                }
+
+                continue;
+            }
+
+            full = replica_set();
+            full.desired_replication = CONSUS_MAX_REPLICATION_FACTOR;
+            lookup(&m_rings[i], idx, &full);
 
-                if (m_cached_replica_sets.empty() || m_cached_replica_sets.back() != rs)
+            for (size_t f = 0; f < factors; ++f)
+            {
+                replica_set rs(full);
+                rs.desired_replication = m_cached_factors[f];
+                rs.num_replicas = std::min(rs.num_replicas, rs.desired_replication);
+
+                if (idx == 0 || m_cached_replica_sets[last[f]] != rs)
                 {
+                    last[f] = m_cached_replica_sets.size();
                     m_cached_replica_sets.push_back(rs);
                 }
-            }
 
-            m_cached_rings[i].replica_sets[idx] = m_cached_replica_sets.size() - 1;
+                m_cached_rings[i * factors + f].replica_sets[idx] = last[f];
+            }
         }
     }
 }
@@ -259,6 +357,41 @@ configuration :: lookup(ring* r, uint16_t idx, replica_set* rs)
     }
 }
 
+const consus::table_policy*
+configuration :: get_table_policy(const e::slice& table) const
+{
+    size_t lo = 0;
+    size_t hi = m_tables.size();
+
+    // binary search without materializing the table name as a std::string
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const std::string& name(m_tables[mid].name);
+        int cmp = memcmp(name.data(), table.data(), std::min(name.size(), table.size()));
+
+        if (cmp == 0)
+        {
+            cmp = name.size() < table.size() ? -1 : name.size() > table.size() ? 1 : 0;
+        }
+
+        if (cmp == 0)
+        {
+            return &m_tables[mid];
+        }
+        else if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
 void
 configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partition_id>* parts)
 {
@@ -336,7 +469,7 @@ configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partitio
 e::unpacker
 consus :: operator >> (e::unpacker up, configuration& c)
 {
-    up = kvs_configuration(up, &c.m_cluster, &c.m_version, &c.m_flags, &c.m_kvss, &c.m_rings);
+    up = kvs_configuration(up, &c.m_cluster, &c.m_version, &c.m_flags, &c.m_kvss, &c.m_rings, &c.m_tables);
 
     if (up.error())
     {
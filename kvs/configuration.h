@@ -33,6 +33,7 @@
 #include "common/ids.h"
 #include "common/kvs_state.h"
 #include "common/ring.h"
+#include "common/table_policy.h"
 #include "kvs/replica_set.h"
 
 BEGIN_CONSUS_NAMESPACE
@@ -47,6 +48,7 @@ class configuration
     public:
         cluster_id cluster() const { return m_cluster; }
         version_id version() const { return m_version; }
+        bool leases() const { return (m_flags & CONSUS_FLAG_KVS_LEASES) != 0; }
 
     // kvs daemons
     public:
@@ -58,10 +60,15 @@ class configuration
 
     // hashing
     public:
+        // *rs points into this configuration and stays valid as long as it
+        // does; on failure it points to an empty replica set
         bool hash(data_center_id dc,
                   const e::slice& table,
                   const e::slice& key,
-                  replica_set* rs);
+                  const replica_set** rs) const;
+        // true if every partition has the same owner and next owner in both
+        // configurations, and therefore the same leaseholder
+        bool same_owners(const configuration& other) const;
 
     // XXX these APIs could be better designed or use better datastructures;
     // reevaluate them and their consistency with respect to other calls in this
@@ -81,6 +88,7 @@ class configuration
     private:
         void reconstruct_cache();
         void lookup(ring* r, uint16_t idx, replica_set* rs);
+        const table_policy* get_table_policy(const e::slice& table) const;
 
     // XXX same as above xxx about APIs
     private:
@@ -95,10 +103,18 @@ class configuration
         uint64_t m_flags;
         std::vector<kvs_state> m_kvss;
         std::vector<ring> m_rings;
-
-        // cached data
+        // sorted by name
+        std::vector<table_policy> m_tables;
+
+        // cached data; m_cached_rings holds one ring per (data center,
+        // replication factor), indexed by the data center's position in
+        // m_cached_dcs times the number of factors plus the factor's slot
+        std::vector<data_center_id> m_cached_dcs;
+        std::vector<unsigned> m_cached_factors;
+        unsigned m_factor_slots[CONSUS_MAX_REPLICATION_FACTOR + 1];
         std::vector<replica_set> m_cached_replica_sets;
         std::vector<cached_ring> m_cached_rings;
+        replica_set m_no_replicas;
 
     private:
         configuration(const configuration& other);
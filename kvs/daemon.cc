@@ -25,6 +25,8 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -33,6 +35,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // POSIX
 #include <signal.h>
@@ -72,10 +75,16 @@
 #include "common/network_msgtype.h"
 #include "common/transaction_group.h"
 #include "kvs/daemon.h"
+#include "kvs/cached_datalayer.h"
 #include "kvs/leveldb_datalayer.h"
+#include "kvs/memory_datalayer.h"
+#include "kvs/rocksdb_datalayer.h"
 
 using consus::daemon;
 
+// keys examined per call into the datalayer during a pruning pass
+#define PRUNE_KEYS 4096
+
 #define CHECK_UNPACK(MSGTYPE, UNPACKER) \
     do \
     { \
@@ -99,6 +108,24 @@ exit_on_signal(int /*signum*/)
     e::atomic::increment_32_nobarrier(&s_interrupts, 1);
 }
 
+static e::unpacker
+unpack_writes(e::unpacker up, std::vector<consus::datalayer::write>* writes)
+{
+    uint64_t count = 0;
+    up = up >> count;
+
+    for (uint64_t i = 0; i < count && !up.error(); ++i)
+    {
+        uint8_t flags = 0;
+        consus::datalayer::write w;
+        up = up >> flags >> w.table >> w.key >> w.timestamp >> w.value;
+        w.tombstone = (CONSUS_WRITE_TOMBSTONE & flags);
+        writes->push_back(w);
+    }
+
+    return up;
+}
+
 static void
 handle_debug_dump(int /*signum*/)
 {
@@ -150,6 +177,51 @@ class daemon::migration_bgthread : public consus::background_thread
         bool m_have_new_config;
 };
 
+class daemon::lease_bgthread : public consus::background_thread
+{
+    public:
+        lease_bgthread(daemon* d);
+        virtual ~lease_bgthread() throw ();
+
+    public:
+        void new_config();
+
+    protected:
+        virtual const char* thread_name();
+        virtual bool have_work();
+        virtual void do_work();
+
+    private:
+        lease_bgthread(const lease_bgthread&);
+        lease_bgthread& operator = (const lease_bgthread&);
+
+    private:
+        daemon* m_d;
+        bool m_have_new_config;
+};
+
+class daemon::batch_bgthread : public consus::background_thread
+{
+    public:
+        batch_bgthread(daemon* d);
+        virtual ~batch_bgthread() throw ();
+
+    public:
+        void new_batch();
+
+    protected:
+        virtual const char* thread_name();
+        virtual bool have_work();
+        virtual void do_work();
+
+    private:
+        batch_bgthread(const batch_bgthread&);
+        batch_bgthread& operator = (const batch_bgthread&);
+
+    private:
+        daemon* m_d;
+};
+
 daemon :: coordinator_callback :: coordinator_callback(daemon* _d)
     : d(_d)
 {
@@ -197,10 +269,25 @@ daemon :: coordinator_callback :: new_config(const char* data, size_t data_sz)
     }
 
     configuration* old_config = d->get_config();
+
+    // A store that still believes it leads a partition under an older
+    // configuration serves reads until its lease runs out, and only it knows
+    // whether that lease is live.  Hold back every write, and keep the new
+    // owner from answering reads on its own, until any such lease must have
+    // lapsed, unless leadership provably did not move.
+    if (c->leases() &&
+        (!old_config ||
+         old_config->version().get() + 1 != c->version().get() ||
+         !old_config->same_owners(*c)))
+    {
+        d->fence_writes();
+    }
+
     d->m_us.dc = c->get_data_center(d->m_us.id);
     e::atomic::store_ptr_release(&d->m_config, c.release());
     d->m_gc.collect(old_config, e::garbage_collector::free_ptr<configuration>);
     d->m_migrate_thread->new_config();
+    d->m_lease_thread->new_config();
     LOG(INFO) << "updating to configuration " << d->get_config()->version();
 
 #if 0
@@ -345,7 +432,18 @@ daemon :: daemon()
     , m_repl_wr(&m_gc)
     , m_migrations(&m_gc)
     , m_migrate_thread(new migration_bgthread(this))
+    , m_batcher()
+    , m_batch_thread(new batch_bgthread(this))
     , m_pumping_thread(po6::threads::make_obj_func(&daemon::pump, this))
+    , m_gc_horizon(0)
+    , m_pruning_thread(po6::threads::make_obj_func(&daemon::prune, this))
+    , m_lease_coord()
+    , m_lease_thread(new lease_bgthread(this))
+    , m_lease_mtx()
+    , m_lease_version()
+    , m_lease_expiry(0)
+    , m_lease_requested(0)
+    , m_lease_fence(0)
 {
 }
 
@@ -354,6 +452,111 @@ daemon :: ~daemon() throw ()
     m_gc.collect(get_config(), e::garbage_collector::free_ptr<configuration>);
 }
 
+daemon :: lease_bgthread :: lease_bgthread(daemon* d)
+    : background_thread(&d->m_gc)
+    , m_d(d)
+    , m_have_new_config(false)
+{
+}
+
+daemon :: lease_bgthread :: ~lease_bgthread() throw ()
+{
+}
+
+void
+daemon :: lease_bgthread :: new_config()
+{
+    po6::threads::mutex::hold hold(mtx());
+    m_have_new_config = true;
+    wakeup();
+}
+
+const char*
+daemon :: lease_bgthread :: thread_name()
+{
+    return "lease";
+}
+
+bool
+daemon :: lease_bgthread :: have_work()
+{
+    return m_have_new_config || m_d->get_config()->leases();
+}
+
+// Renewing blocks on the coordinator, so it happens here, over a link of its
+// own, rather than on the thread that maintains the coordinator connection
+// and holds up new configurations while it waits.  renew_lease skips
+// requests until a third of the lease has passed; a new configuration cuts
+// the wait short, because the lease for the old one no longer counts.
+void
+daemon :: lease_bgthread :: do_work()
+{
+    {
+        po6::threads::mutex::hold hold(mtx());
+        m_have_new_config = false;
+    }
+
+    m_d->renew_lease();
+    po6::threads::mutex::hold hold(mtx());
+
+    if (!m_have_new_config)
+    {
+        wait_for(CONSUS_KVS_LEASE_DURATION / 6);
+    }
+}
+
+daemon :: batch_bgthread :: batch_bgthread(daemon* d)
+    : background_thread(&d->m_gc)
+    , m_d(d)
+{
+}
+
+daemon :: batch_bgthread :: ~batch_bgthread() throw ()
+{
+}
+
+void
+daemon :: batch_bgthread :: new_batch()
+{
+    po6::threads::mutex::hold hold(mtx());
+    wakeup();
+}
+
+const char*
+daemon :: batch_bgthread :: thread_name()
+{
+    return "batching";
+}
+
+bool
+daemon :: batch_bgthread :: have_work()
+{
+    return m_d->m_batcher->deadline() != 0;
+}
+
+// Sleep out the window of the oldest open batch, then send every batch that
+// is due.  Batches opened while asleep wait for the next pass.
+void
+daemon :: batch_bgthread :: do_work()
+{
+    const uint64_t deadline = m_d->m_batcher->deadline();
+    uint64_t now = po6::monotonic_time();
+
+    if (deadline > now)
+    {
+        po6::sleep(deadline - now);
+        now = po6::monotonic_time();
+    }
+
+    comm_id id;
+    std::auto_ptr<e::buffer> msg;
+
+    while (m_d->m_batcher->dequeue(now, &id, &msg))
+    {
+        m_d->send_frame(id, msg);
+    }
+}
+
 int
 daemon :: run(bool background,
               std::string data,
@@ -365,7 +568,17 @@ daemon :: run(bool background,
               bool set_coordinator,
               const char* coordinator,
               const char* data_center,
-              unsigned threads)
+              unsigned threads,
+              const char* datalayer,
+              bool snapshot,
+              uint64_t commit_delay,
+              uint64_t value_threshold,
+              uint64_t row_cache,
+              uint64_t gc_horizon,
+              uint64_t rocksdb_block_cache,
+              unsigned rocksdb_bloom_bits,
+              uint64_t rocksdb_compaction_rate,
+              uint64_t batch_delay)
 {
     if (!e::block_all_signals())
     {
@@ -389,7 +602,38 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
-    m_data.reset(new leveldb_datalayer());
+#ifndef CONSUS_ROCKSDB
+    (void) rocksdb_block_cache;
+    (void) rocksdb_bloom_bits;
+    (void) rocksdb_compaction_rate;
+#endif
+
+    if (strcmp(datalayer, "memory") == 0)
+    {
+        m_data.reset(new memory_datalayer(snapshot));
+    }
+#ifdef CONSUS_ROCKSDB
+    else if (strcmp(datalayer, "rocksdb") == 0)
+    {
+        m_data.reset(new rocksdb_datalayer(rocksdb_block_cache,
+                                           rocksdb_bloom_bits,
+                                           rocksdb_compaction_rate));
+    }
+#endif
+    else if (strcmp(datalayer, "leveldb") == 0)
+    {
+        m_data.reset(new leveldb_datalayer(commit_delay, value_threshold));
+    }
+    else
+    {
+        LOG(ERROR) << "unknown datalayer \"" << datalayer << "\"";
+        return EXIT_FAILURE;
+    }
+
+    if (row_cache > 0)
+    {
+        m_data.reset(new cached_datalayer(m_data.release(), row_cache));
+    }
 
     if (!m_data->init(data))
     {
@@ -430,6 +674,7 @@ daemon :: run(bool background,
     m_coord_cb.reset(new coordinator_callback(this));
     m_coord.reset(new coordinator_link(rendezvous, m_us.id, m_us.bind_to, data_center, m_coord_cb.get()));
     m_coord->allow_reregistration();
+    m_lease_coord.reset(new coordinator_link(rendezvous, m_us.id, m_us.bind_to, data_center, m_coord_cb.get()));
     LOG(INFO) << "starting consus kvs-daemon " << m_us.id
               << " on address " << m_us.bind_to;
     LOG(INFO) << "connecting to " << rendezvous;
@@ -449,6 +694,12 @@ daemon :: run(bool background,
 
     m_busybee.reset(busybee_server::create(&m_busybee_controller, id, bind_to, &m_gc));
 
+    if (batch_delay > 0)
+    {
+        m_batcher.reset(new batcher(batch_delay));
+        m_batch_thread->start();
+    }
+
     for (size_t i = 0; i < threads; ++i)
     {
         using namespace po6::threads;
@@ -458,7 +709,14 @@ daemon :: run(bool background,
     }
 
     m_migrate_thread->start();
+    m_lease_thread->start();
     m_pumping_thread.start();
+    m_gc_horizon = gc_horizon;
+
+    if (m_gc_horizon > 0)
+    {
+        m_pruning_thread.start();
+    }
 
     while (e::atomic::increment_32_nobarrier(&s_interrupts, 0) == 0)
     {
@@ -499,7 +757,15 @@ daemon :: run(bool background,
 
     e::atomic::increment_32_nobarrier(&s_interrupts, 1);
     m_pumping_thread.join();
+
+    if (m_gc_horizon > 0)
+    {
+        m_pruning_thread.join();
+    }
+
     m_migrate_thread->shutdown();
+    m_lease_thread->shutdown();
+    m_batch_thread->shutdown();
     m_busybee->shutdown();
 
     for (size_t i = 0; i < m_threads.size(); ++i)
@@ -507,6 +773,12 @@ daemon :: run(bool background,
         m_threads[i]->join();
     }
 
+    if (!m_data->checkpoint())
+    {
+        LOG(ERROR) << "could not checkpoint the data layer";
+        return EXIT_FAILURE;
+    }
+
     LOG(INFO) << "consus is gracefully shutting down";
     return EXIT_SUCCESS;
 }
@@ -555,107 +827,180 @@ daemon :: loop(size_t thread)
                 abort();
         }
 
-        comm_id id(_id);
-        network_msgtype mt;
-        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
-        up = up >> mt;
+        process_message(comm_id(_id), msg);
+        m_gc.quiescent_state(&ts);
+    }
 
-        if (up.error())
-        {
-            LOG(WARNING) << "dropping message that has a malformed header";
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "network thread shutting down";
+}
 
-            if (s_debug_mode)
-            {
-                LOG(WARNING) << "here's some hex: " << msg->hex();
-            }
+void
+daemon :: process_message(comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    network_msgtype mt;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt;
 
-            continue;
-        }
+    if (up.error())
+    {
+        LOG(WARNING) << "dropping message that has a malformed header";
 
-#ifdef CONSUS_LOG_ALL_MESSAGES
         if (s_debug_mode)
         {
-            memset(msg->data(), 0, BUSYBEE_HEADER_SIZE);
-            LOG(INFO) << "recv<-" << id << " " << mt << " " << msg->b64();
+            LOG(WARNING) << "here's some hex: " << msg->hex();
         }
+
+        return;
+    }
+
+#ifdef CONSUS_LOG_ALL_MESSAGES
+    if (s_debug_mode)
+    {
+        memset(msg->data(), 0, BUSYBEE_HEADER_SIZE);
+        LOG(INFO) << "recv<-" << id << " " << mt << " " << msg->b64();
+    }
 #endif
 
-        switch (mt)
+    dispatch_message(id, mt, msg, up);
+}
+
+// up is positioned just past the msgtype
+void
+daemon :: dispatch_message(comm_id id, network_msgtype mt,
+                           std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    switch (mt)
+    {
+        case KVS_REP_RD:
+            process_rep_rd(id, msg, up);
+            break;
+        case KVS_REP_WR:
+            process_rep_wr(id, msg, up);
+            break;
+        case KVS_REP_WR_MULTI:
+            process_rep_wr_multi(id, msg, up);
+            break;
+        case KVS_RAW_RD:
+            process_raw_rd(id, msg, up);
+            break;
+        case KVS_RAW_RD_RESP:
+            process_raw_rd_resp(id, msg, up);
+            break;
+        case KVS_RAW_WR:
+            process_raw_wr(id, msg, up);
+            break;
+        case KVS_RAW_WR_RESP:
+            process_raw_wr_resp(id, msg, up);
+            break;
+        case KVS_RAW_WR_MULTI:
+            process_raw_wr_multi(id, msg, up);
+            break;
+        case KVS_RAW_WR_MULTI_RESP:
+            process_raw_wr_multi_resp(id, msg, up);
+            break;
+        case KVS_LEASE_RD:
+            process_lease_rd(id, msg, up);
+            break;
+        case KVS_LEASE_RD_RESP:
+            process_lease_rd_resp(id, msg, up);
+            break;
+        case KVS_LOCK_OP:
+            process_lock_op(id, msg, up);
+            break;
+        case KVS_RAW_LK:
+            process_raw_lk(id, msg, up);
+            break;
+        case KVS_RAW_LK_RESP:
+            process_raw_lk_resp(id, msg, up);
+            break;
+        case KVS_WOUND_XACT:
+            process_wound_xact(id, msg, up);
+            break;
+        case KVS_MIGRATE_SYN:
+            process_migrate_syn(id, msg, up);
+            break;
+        case KVS_MIGRATE_ACK:
+            process_migrate_ack(id, msg, up);
+            break;
+        case KVS_BATCH:
+            process_batch(id, msg, up);
+            break;
+        case CONSUS_NOP:
+            break;
+        case CLIENT_RESPONSE:
+        case TXMAN_BEGIN:
+        case TXMAN_READ:
+        case TXMAN_WRITE:
+        case TXMAN_COMMIT:
+        case TXMAN_ABORT:
+        case TXMAN_WOUND:
+        case TXMAN_HOLD_LOCK:
+        case TXMAN_FINISHED:
+        case TXMAN_PAXOS_2A:
+        case TXMAN_PAXOS_2B:
+        case LV_VOTE_1A:
+        case LV_VOTE_1B:
+        case LV_VOTE_2A:
+        case LV_VOTE_2B:
+        case LV_VOTE_LEARN:
+        case COMMIT_RECORD:
+        case GV_OUTCOME:
+        case GV_PROPOSE:
+        case GV_VOTE_1A:
+        case GV_VOTE_1B:
+        case GV_VOTE_2A:
+        case GV_VOTE_2B:
+        case KVS_REP_RD_RESP:
+        case KVS_REP_WR_RESP:
+        case KVS_LOCK_OP_RESP:
+        default:
+            LOG(INFO) << "received " << mt << " message which key-value-stores do not process";
+            break;
+    }
+}
+
+// Each message is handled in place, through an unpacker over the batch.  The
+// handlers of batchable messages don't hold on to their buffer, except the
+// read responses:  a read replicator keeps the buffer to back the value it
+// returns, so each of those gets a buffer of its own.
+void
+daemon :: process_batch(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    std::vector<e::slice> msgs;
+
+    if (!batcher::unpack(up, &msgs))
+    {
+        LOG(WARNING) << "dropping malformed batch from " << id;
+        return;
+    }
+
+    for (size_t i = 0; i < msgs.size(); ++i)
+    {
+        network_msgtype mt;
+        e::unpacker mup(msgs[i].cdata(), msgs[i].size());
+        mup = mup >> mt;
+
+        // batches only ever hold messages that are not themselves batches
+        if (mup.error() || !batcher::batchable(mt))
         {
-            case KVS_REP_RD:
-                process_rep_rd(id, msg, up);
-                break;
-            case KVS_REP_WR:
-                process_rep_wr(id, msg, up);
-                break;
-            case KVS_RAW_RD:
-                process_raw_rd(id, msg, up);
-                break;
-            case KVS_RAW_RD_RESP:
-                process_raw_rd_resp(id, msg, up);
-                break;
-            case KVS_RAW_WR:
-                process_raw_wr(id, msg, up);
-                break;
-            case KVS_RAW_WR_RESP:
-                process_raw_wr_resp(id, msg, up);
-                break;
-            case KVS_LOCK_OP:
-                process_lock_op(id, msg, up);
-                break;
-            case KVS_RAW_LK:
-                process_raw_lk(id, msg, up);
-                break;
-            case KVS_RAW_LK_RESP:
-                process_raw_lk_resp(id, msg, up);
-                break;
-            case KVS_WOUND_XACT:
-                process_wound_xact(id, msg, up);
-                break;
-            case KVS_MIGRATE_SYN:
-                process_migrate_syn(id, msg, up);
-                break;
-            case KVS_MIGRATE_ACK:
-                process_migrate_ack(id, msg, up);
-                break;
-            case CONSUS_NOP:
-                break;
-            case CLIENT_RESPONSE:
-            case TXMAN_BEGIN:
-            case TXMAN_READ:
-            case TXMAN_WRITE:
-            case TXMAN_COMMIT:
-            case TXMAN_ABORT:
-            case TXMAN_WOUND:
-            case TXMAN_HOLD_LOCK:
-            case TXMAN_FINISHED:
-            case TXMAN_PAXOS_2A:
-            case TXMAN_PAXOS_2B:
-            case LV_VOTE_1A:
-            case LV_VOTE_1B:
-            case LV_VOTE_2A:
-            case LV_VOTE_2B:
-            case LV_VOTE_LEARN:
-            case COMMIT_RECORD:
-            case GV_OUTCOME:
-            case GV_PROPOSE:
-            case GV_VOTE_1A:
-            case GV_VOTE_1B:
-            case GV_VOTE_2A:
-            case GV_VOTE_2B:
-            case KVS_REP_RD_RESP:
-            case KVS_REP_WR_RESP:
-            case KVS_LOCK_OP_RESP:
-            default:
-                LOG(INFO) << "received " << mt << " message which key-value-stores do not process";
-                break;
+            LOG(WARNING) << "dropping unbatchable message inside batch from " << id;
+            continue;
         }
 
-        m_gc.quiescent_state(&ts);
+        if (mt == KVS_RAW_RD_RESP || mt == KVS_LEASE_RD_RESP)
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE + msgs[i].size();
+            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            msg->resize(sz);
+            memmove(msg->data() + BUSYBEE_HEADER_SIZE, msgs[i].data(), msgs[i].size());
+            process_message(id, msg);
+        }
+        else
+        {
+            dispatch_message(id, mt, std::auto_ptr<e::buffer>(), mup);
+        }
     }
-
-    m_gc.deregister_thread(&ts);
-    LOG(INFO) << "network thread shutting down";
 }
 
 void
@@ -716,6 +1061,39 @@ daemon :: process_rep_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker u
     }
 }
 
+void
+daemon :: process_rep_wr_multi(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    std::vector<datalayer::write> writes;
+    up = up >> nonce;
+    up = unpack_writes(up, &writes);
+    CHECK_UNPACK(KVS_REP_WR_MULTI, up);
+    // XXX check keys/values meet spec
+
+    if (writes.empty())
+    {
+        LOG(WARNING) << "received \"" << KVS_REP_WR_MULTI << "\" message with no writes";
+        return;
+    }
+
+    while (true)
+    {
+        uint64_t x = generate_id();
+        write_replicator_map_t::state_reference wsr;
+        write_replicator* w = m_repl_wr.create_state(x, &wsr);
+
+        if (!w)
+        {
+            continue;
+        }
+
+        w->init(id, nonce, writes, msg);
+        w->externally_work_state_machine(this);
+        break;
+    }
+}
+
 void
 daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
@@ -728,7 +1106,7 @@ daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     configuration* c = get_config();
     // XXX check table exists
     // XXX check key meet spec
-    replica_set rs;
+    const replica_set* rs = NULL;
 
     if (!c->hash(m_us.dc, table, key, &rs))
     {
@@ -744,6 +1122,8 @@ daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     datalayer::reference* ref = NULL;
     consus_returncode rc = CONSUS_GARBAGE;
     rc = m_data->get(table, key, timestamp, &timestamp, &value, &ref);
+    // value points into ref; hold it until the response is logged
+    std::auto_ptr<datalayer::reference> pin(ref);
 
     const size_t sz = BUSYBEE_HEADER_SIZE
                     + pack_size(KVS_RAW_RD_RESP)
@@ -751,17 +1131,17 @@ daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
                     + pack_size(rc)
                     + sizeof(uint64_t)
                     + pack_size(value)
-                    + pack_size(rs);
+                    + pack_size(*rs);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_RAW_RD_RESP << nonce << rc << timestamp << value << rs;
+        << KVS_RAW_RD_RESP << nonce << rc << timestamp << value << *rs;
     send(id, msg);
 
     if (s_debug_mode)
     {
         LOG(INFO) << logid(table, key) << "-R-RAW read; value=\""
                   << e::strescape(value.str()) << "\"@" << timestamp
-                  << "\", nonce=" << nonce << " replicas=" << rs;
+                  << "\", nonce=" << nonce << " replicas=" << *rs;
     }
 }
 
@@ -788,6 +1168,86 @@ daemon :: process_raw_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpac
     }
 }
 
+void
+daemon :: process_lease_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    e::slice table;
+    e::slice key;
+    up = up >> nonce >> table >> key;
+    CHECK_UNPACK(KVS_LEASE_RD, up);
+    configuration* c = get_config();
+    const replica_set* rs = NULL;
+
+    if (!c->hash(m_us.dc, table, key, &rs))
+    {
+        if (s_debug_mode)
+        {
+            LOG(INFO) << logid(table, key) << "-R-LEASE dropped because hashing failed";
+        }
+
+        return;
+    }
+
+    // without the lease, say so rather than answer; the sender falls back to
+    // a quorum read
+    const uint8_t leased = holds_lease(c, *rs) ? 1 : 0;
+    consus_returncode rc = CONSUS_GARBAGE;
+    uint64_t timestamp = 0;
+    e::slice value;
+    datalayer::reference* ref = NULL;
+
+    if (leased)
+    {
+        rc = m_data->get(table, key, UINT64_MAX, &timestamp, &value, &ref);
+    }
+
+    std::auto_ptr<datalayer::reference> pin(ref);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_LEASE_RD_RESP)
+                    + sizeof(uint64_t)
+                    + sizeof(uint8_t)
+                    + pack_size(rc)
+                    + sizeof(uint64_t)
+                    + pack_size(value)
+                    + pack_size(*rs);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_LEASE_RD_RESP << nonce << leased << rc << timestamp << value << *rs;
+    send(id, msg);
+
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid(table, key) << "-R-LEASE leased=" << unsigned(leased)
+                  << " value=\"" << e::strescape(value.str()) << "\"@" << timestamp
+                  << ", nonce=" << nonce << " replicas=" << *rs;
+    }
+}
+
+void
+daemon :: process_lease_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    uint8_t leased;
+    consus_returncode rc;
+    uint64_t timestamp;
+    e::slice value;
+    replica_set rs;
+    up = up >> nonce >> leased >> rc >> timestamp >> value >> rs;
+    CHECK_UNPACK(KVS_LEASE_RD_RESP, up);
+    read_replicator_map_t::state_reference rsr;
+    read_replicator* r = m_repl_rd.get_state(nonce, &rsr);
+
+    if (r)
+    {
+        r->lease_response(id, leased != 0, rc, timestamp, value, rs, msg, this);
+    }
+    else
+    {
+        LOG_IF(INFO, s_debug_mode) << "dropped lease read; nonce=" << nonce << " rc=" << rc << " from=" << id;
+    }
+}
+
 void
 daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
@@ -802,7 +1262,7 @@ daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     configuration* c = get_config();
     // XXX check table exists
     // XXX check key/value meet spec
-    replica_set rs;
+    const replica_set* rs = NULL;
 
     if (!c->hash(m_us.dc, table, key, &rs))
     {
@@ -829,20 +1289,20 @@ daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
                     + pack_size(KVS_RAW_WR_RESP)
                     + sizeof(uint64_t)
                     + pack_size(rc)
-                    + pack_size(rs);
+                    + pack_size(*rs);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_RAW_WR_RESP << nonce << rc << rs;
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_RAW_WR_RESP << nonce << rc << *rs;
     send(id, msg);
 
     if (s_debug_mode)
     {
         if ((CONSUS_WRITE_TOMBSTONE & flags))
         {
-            LOG(INFO) << logid(table, key) << "-W-RAW deleted; nonce=" << nonce << " replicas=" << rs;
+            LOG(INFO) << logid(table, key) << "-W-RAW deleted; nonce=" << nonce << " replicas=" << *rs;
         }
         else
         {
-            LOG(INFO) << logid(table, key) << "-W-RAW written; nonce=" << nonce << " replicas=" << rs;
+            LOG(INFO) << logid(table, key) << "-W-RAW written; nonce=" << nonce << " replicas=" << *rs;
         }
     }
 }
@@ -868,6 +1328,102 @@ daemon :: process_raw_wr_resp(comm_id id, std::auto_ptr<e::buffer>, e::unpacker
     }
 }
 
+void
+daemon :: process_raw_wr_multi(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    std::vector<datalayer::write> writes;
+    up = up >> nonce;
+    up = unpack_writes(up, &writes);
+    CHECK_UNPACK(KVS_RAW_WR_MULTI, up);
+    configuration* c = get_config();
+    // XXX check tables exist
+    // XXX check keys/values meet spec
+    std::vector<const replica_set*> rs(writes.size());
+
+    for (size_t i = 0; i < writes.size(); ++i)
+    {
+        if (!c->hash(m_us.dc, writes[i].table, writes[i].key, &rs[i]))
+        {
+            if (s_debug_mode)
+            {
+                LOG(INFO) << logid(writes[i].table, writes[i].key) << "-W-RAW-MULTI dropped because hashing failed";
+            }
+
+            return;
+        }
+    }
+
+    // one batch, one sync, one response for the whole lot
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!writes.empty())
+    {
+        rc = m_data->apply(&writes[0], writes.size());
+    }
+
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(KVS_RAW_WR_MULTI_RESP)
+              + sizeof(uint64_t)
+              + pack_size(rc)
+              + sizeof(uint64_t);
+
+    for (size_t i = 0; i < rs.size(); ++i)
+    {
+        sz += pack_size(*rs[i]);
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE);
+    pa = pa << KVS_RAW_WR_MULTI_RESP << nonce << rc << uint64_t(rs.size());
+
+    for (size_t i = 0; i < rs.size(); ++i)
+    {
+        pa = pa << *rs[i];
+    }
+
+    send(id, msg);
+
+    if (s_debug_mode)
+    {
+        for (size_t i = 0; i < writes.size(); ++i)
+        {
+            LOG(INFO) << logid(writes[i].table, writes[i].key)
+                      << "-W-RAW-MULTI " << (writes[i].tombstone ? "deleted" : "written")
+                      << "; nonce=" << nonce << " replicas=" << *rs[i];
+        }
+    }
+}
+
+void
+daemon :: process_raw_wr_multi_resp(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    consus_returncode rc;
+    uint64_t count = 0;
+    std::vector<replica_set> rs;
+    up = up >> nonce >> rc >> count;
+
+    for (uint64_t i = 0; i < count && !up.error(); ++i)
+    {
+        rs.push_back(replica_set());
+        up = up >> rs.back();
+    }
+
+    CHECK_UNPACK(KVS_RAW_WR_MULTI_RESP, up);
+    write_replicator_map_t::state_reference wsr;
+    write_replicator* w = m_repl_wr.get_state(nonce, &wsr);
+
+    if (w)
+    {
+        w->response(id, rc, rs, this);
+    }
+    else
+    {
+        LOG_IF(INFO, s_debug_mode) << "dropped raw multi-write; nonce=" << nonce << " rc=" << rc << " from=" << id;
+    }
+}
+
 void
 daemon :: process_lock_op(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
@@ -1089,6 +1645,18 @@ daemon :: debug_dump()
         }
     }
 
+    LOG(INFO) << "---------------------------------- Data Layer ----------------------------------";
+
+    {
+        std::string debug = m_data->debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
     LOG(INFO) << "---------------------------------- Migrations ----------------------------------";
 
     for (migrator_map_t::iterator it(&m_migrations); it.valid(); ++it)
@@ -1145,6 +1713,24 @@ daemon :: send(comm_id id, std::auto_ptr<e::buffer> msg)
         return false;
     }
 
+    if (m_batcher.get() && batcher::batchable(msg.get()))
+    {
+        std::auto_ptr<e::buffer> full;
+
+        if (m_batcher->enqueue(id, msg, po6::monotonic_time(), &full))
+        {
+            m_batch_thread->new_batch();
+        }
+
+        return full.get() ? send_frame(id, full) : true;
+    }
+
+    return send_frame(id, msg);
+}
+
+bool
+daemon :: send_frame(comm_id id, std::auto_ptr<e::buffer> msg)
+{
     busybee_returncode rc = m_busybee->send(id.get(), msg);
 
     switch (rc)
@@ -1167,6 +1753,105 @@ daemon :: send(comm_id id, std::auto_ptr<e::buffer> msg)
     }
 }
 
+consus::comm_id
+daemon :: leaseholder(configuration* c, const replica_set& rs)
+{
+    // A partition whose first replica is handing off has two owners and must
+    // go to both, so nobody holds its lease until the migration finishes.
+    if (!c->leases() ||
+        rs.num_replicas == 0 ||
+        rs.transitioning[0] != comm_id())
+    {
+        return comm_id();
+    }
+
+    return rs.replicas[0];
+}
+
+bool
+daemon :: holds_lease(configuration* c, const replica_set& rs)
+{
+    if (leaseholder(c, rs) != m_us.id)
+    {
+        return false;
+    }
+
+    // A writer still on the old configuration may finish a write this store
+    // never sees, so a new owner reads from a quorum until the fence passes.
+    const uint64_t now = po6::monotonic_time();
+    po6::threads::mutex::hold hold(&m_lease_mtx);
+    return m_lease_version == c->version() &&
+           now < m_lease_expiry &&
+           now >= m_lease_fence;
+}
+
+uint64_t
+daemon :: lease_fence()
+{
+    po6::threads::mutex::hold hold(&m_lease_mtx);
+    return m_lease_fence;
+}
+
+// Ask the coordinator to vouch for the current configuration.  The lease
+// counts from before the request went out, so however long the coordinator
+// takes, it expires no later than the coordinator could believe it does.
+void
+daemon :: renew_lease()
+{
+    configuration* c = get_config();
+
+    if (!c->leases())
+    {
+        return;
+    }
+
+    const uint64_t now = po6::monotonic_time();
+
+    {
+        po6::threads::mutex::hold hold(&m_lease_mtx);
+
+        if (m_lease_version == c->version() &&
+            now < m_lease_requested + CONSUS_KVS_LEASE_DURATION / 3)
+        {
+            return;
+        }
+    }
+
+    std::string input;
+    e::packer(&input) << m_us.id << c->version();
+    coordinator_returncode rc;
+
+    if (!m_lease_coord->call("kvs_lease", input.data(), input.size(), &rc))
+    {
+        return;
+    }
+
+    if (rc != COORD_SUCCESS)
+    {
+        LOG_IF(INFO, s_debug_mode) << "coordinator refused lease for configuration " << c->version();
+        return;
+    }
+
+    po6::threads::mutex::hold hold(&m_lease_mtx);
+
+    if (m_lease_version != c->version())
+    {
+        LOG_IF(INFO, s_debug_mode) << "acquired lease for configuration " << c->version();
+    }
+
+    m_lease_version = c->version();
+    m_lease_expiry = now + CONSUS_KVS_LEASE_DURATION - CONSUS_KVS_LEASE_MARGIN;
+    m_lease_requested = now;
+}
+
+void
+daemon :: fence_writes()
+{
+    const uint64_t now = po6::monotonic_time();
+    po6::threads::mutex::hold hold(&m_lease_mtx);
+    m_lease_fence = now + CONSUS_KVS_LEASE_DURATION + CONSUS_KVS_LEASE_MARGIN;
+}
+
 void
 daemon :: pump()
 {
@@ -1224,3 +1909,70 @@ daemon :: pump()
     m_gc.deregister_thread(&ts);
     LOG(INFO) << "pumping thread shutting down";
 }
+
+// Every m_gc_horizon, scan the data for versions that no read can observe
+// anymore.  Every read that reaches the datalayer asks for the newest version
+// by reading at UINT64_MAX: the read_replicator sends KVS_RAW_RD at UINT64_MAX
+// and reads locally at UINT64_MAX when it holds the lease, and
+// process_lease_rd does the same.  So a version shadowed by a newer one is
+// already unreachable, and dropping the shadowed versions below
+// now - m_gc_horizon is safe whatever the horizon.  Adding a read of a
+// historical timestamp breaks this; such a read must first check that its
+// timestamp is above the last watermark pruned.
+// The scan goes PRUNE_KEYS keys at a time so that it never holds up shutdown
+// for long.
+void
+daemon :: prune()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "pruning thread started";
+    uint64_t next_pass = po6::monotonic_time() + m_gc_horizon;
+    uint64_t watermark = 0;
+    uint64_t pruned = 0;
+    std::string position;
+
+    while (e::atomic::increment_32_nobarrier(&s_interrupts, 0) == 0)
+    {
+        if (position.empty())
+        {
+            if (po6::monotonic_time() < next_pass)
+            {
+                po6::sleep(PO6_MILLIS * 250);
+                continue;
+            }
+
+            const uint64_t now = po6::wallclock_time();
+            watermark = now > m_gc_horizon ? now - m_gc_horizon : 0;
+            pruned = 0;
+        }
+
+        uint64_t p = 0;
+        consus_returncode rc = m_data->prune(watermark, &position, PRUNE_KEYS, &p);
+        pruned += p;
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            LOG(ERROR) << "pruning versions below " << watermark << " failed: " << rc;
+            position.clear();
+        }
+        else if (position.empty())
+        {
+            LOG_IF(INFO, s_debug_mode) << "pruned " << pruned << " versions below " << watermark;
+        }
+
+        if (position.empty())
+        {
+            next_pass = po6::monotonic_time() + m_gc_horizon;
+        }
+    }
+
+    LOG(INFO) << "pruning thread shutting down";
+}
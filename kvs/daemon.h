@@ -37,6 +37,7 @@
 
 // po6
 #include <po6/net/location.h>
+#include <po6/threads/mutex.h>
 #include <po6/threads/thread.h>
 
 // e
@@ -52,6 +53,8 @@
 #include "common/constants.h"
 #include "common/coordinator_link.h"
 #include "common/kvs.h"
+#include "common/network_msgtype.h"
+#include "kvs/batcher.h"
 #include "kvs/configuration.h"
 #include "kvs/controller.h"
 #include "kvs/datalayer.h"
@@ -80,11 +83,23 @@ class daemon
                 bool set_coordinator,
                 const char* coordinator,
                 const char* data_center,
-                unsigned threads);
+                unsigned threads,
+                const char* datalayer,
+                bool snapshot,
+                uint64_t commit_delay,
+                uint64_t value_threshold,
+                uint64_t row_cache,
+                uint64_t gc_horizon,
+                uint64_t rocksdb_block_cache,
+                unsigned rocksdb_bloom_bits,
+                uint64_t rocksdb_compaction_rate,
+                uint64_t batch_delay);
 
     private:
         struct coordinator_callback;
         class migration_bgthread;
+        class batch_bgthread;
+        class lease_bgthread;
         typedef e::state_hash_table<uint64_t, lock_replicator> lock_replicator_map_t;
         typedef e::state_hash_table<uint64_t, read_replicator> read_replicator_map_t;
         typedef e::state_hash_table<uint64_t, write_replicator> write_replicator_map_t;
@@ -99,6 +114,10 @@ class daemon
 
     private:
         void loop(size_t thread);
+        void process_message(comm_id id, std::auto_ptr<e::buffer> msg);
+        void dispatch_message(comm_id id, network_msgtype mt,
+                              std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_read_lock(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_read_unlock(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_write_begin(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
@@ -107,10 +126,15 @@ class daemon
 
         void process_rep_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_rep_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_rep_wr_multi(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_wr_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_raw_wr_multi(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_raw_wr_multi_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lease_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lease_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
 
         void process_lock_op(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_lk(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
@@ -129,7 +153,23 @@ class daemon
         uint64_t generate_id();
         uint64_t resend_interval() { return PO6_SECONDS; }
         bool send(comm_id id, std::auto_ptr<e::buffer> msg);
+        // bypasses batching
+        bool send_frame(comm_id id, std::auto_ptr<e::buffer> msg);
         void pump();
+        void prune();
+
+    // leases
+    public:
+        // the daemon that may answer reads on rs without a quorum, if any
+        comm_id leaseholder(configuration* c, const replica_set& rs);
+        bool holds_lease(configuration* c, const replica_set& rs);
+        // writes may not complete, nor leased reads be answered, before
+        // this time; see new_config
+        uint64_t lease_fence();
+
+    private:
+        void renew_lease();
+        void fence_writes();
 
     private:
         kvs m_us;
@@ -148,9 +188,28 @@ class daemon
         migrator_map_t m_migrations;
         std::auto_ptr<migration_bgthread> m_migrate_thread;
 
+        // outbound batching; m_batcher is NULL when batching is off
+        std::auto_ptr<batcher> m_batcher;
+        std::auto_ptr<batch_bgthread> m_batch_thread;
+
         // state machine pumping
         po6::threads::thread m_pumping_thread;
 
+        // versions older than this are unreachable; zero disables pruning
+        uint64_t m_gc_horizon;
+        po6::threads::thread m_pruning_thread;
+
+        // leases; m_lease_requested is touched only by the lease thread,
+        // which renews over a link of its own so that a slow coordinator
+        // never holds up m_coord
+        std::auto_ptr<coordinator_link> m_lease_coord;
+        std::auto_ptr<lease_bgthread> m_lease_thread;
+        po6::threads::mutex m_lease_mtx;
+        version_id m_lease_version;
+        uint64_t m_lease_expiry;
+        uint64_t m_lease_requested;
+        uint64_t m_lease_fence;
+
     private:
         daemon(const daemon&);
         daemon& operator = (const daemon&);
@@ -38,6 +38,18 @@ datalayer :: ~datalayer() throw ()
 {
 }
 
+bool
+datalayer :: checkpoint()
+{
+    return true;
+}
+
+std::string
+datalayer :: debug_dump()
+{
+    return std::string();
+}
+
 datalayer :: reference :: reference()
 {
 }
@@ -45,3 +57,16 @@ datalayer :: reference :: reference()
 datalayer :: reference :: ~reference() throw ()
 {
 }
+
+datalayer :: write :: write()
+    : tombstone(false)
+    , table()
+    , key()
+    , timestamp()
+    , value()
+{
+}
+
+datalayer :: write :: ~write() throw ()
+{
+}
@@ -28,6 +28,9 @@
 #ifndef consus_kvs_datalayer_h_
 #define consus_kvs_datalayer_h_
 
+// STL
+#include <string>
+
 // e
 #include <e/slice.h>
 
@@ -43,6 +46,7 @@ class datalayer
 {
     public:
         class reference;
+        struct write;
 
     public:
         datalayer();
@@ -69,6 +73,35 @@ class datalayer
         virtual consus_returncode write_lock(const e::slice& table,
                                              const e::slice& key,
                                              const transaction_group& tg) = 0;
+        // apply all of the writes atomically; either every write is durable
+        // when this returns CONSUS_SUCCESS, or none of them is
+        virtual consus_returncode apply(const write* writes, size_t writes_sz) = 0;
+        // drop the versions that no read at or after watermark can observe:
+        // for each key, every version older than its newest version at or
+        // below watermark.  A pass over the data takes several calls; each
+        // examines about max_keys keys after *position, where the previous
+        // call left off, and leaves *position empty when the pass is done.
+        virtual consus_returncode prune(uint64_t watermark,
+                                        std::string* position,
+                                        size_t max_keys,
+                                        uint64_t* pruned) = 0;
+        // make everything written so far survive a restart; called at
+        // shutdown for datalayers whose writes are not otherwise durable
+        virtual bool checkpoint();
+        // a human-readable summary for the daemon's debug dump
+        virtual std::string debug_dump();
+};
+
+struct datalayer::write
+{
+    write();
+    ~write() throw ();
+
+    bool tombstone;
+    e::slice table;
+    e::slice key;
+    uint64_t timestamp;
+    e::slice value;
 };
 
 class datalayer::reference
@@ -25,131 +25,231 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stddef.h>
+#include <stdint.h>
+
+// STL
+#include <algorithm>
+
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/time.h>
+
 // e
+#include <e/atomic.h>
 #include <e/endian.h>
 #include <e/serialization.h>
 #include <e/strescape.h>
 
 // consus
+#include "common/crc32c.h"
 #include "kvs/leveldb_datalayer.h"
+#include "kvs/leveldb_keys.h"
 
 using consus::leveldb_datalayer;
 
-struct leveldb_datalayer::comparator : public leveldb::Comparator
-{
-    comparator();
-    virtual ~comparator() throw ();
-    virtual int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const;
-    virtual const char* Name() const { return "ConsusComparator"; }
-    virtual void FindShortestSeparator(std::string*,
-                                       const leveldb::Slice&) const {}
-    virtual void FindShortSuccessor(std::string*) const {}
-};
+// stop holding a commit open once its batch is this large
+#define GROUP_COMMIT_MAX_BYTES (4ULL * 1024ULL * 1024ULL)
+// idle read cursors kept for reuse; about one per reading thread
+#define MAX_IDLE_CURSORS 32
+// flush the deletes of a prune pass once a batch grows this large
+#define PRUNE_BATCH_BYTES (1ULL * 1024ULL * 1024ULL)
+// the comparator of data directories that predate the bytewise key format
+#define LEGACY_COMPARATOR "ConsusComparator"
+// the value log lives in this subdirectory of the data directory
+#define VALUE_LOG_DIR "values"
+// a tagged pointer into the value log:  tag, file, offset, length, checksum
+#define VALUE_POINTER_SZ (1 + 8 + 8 + 4 + 4)
 
-leveldb_datalayer :: comparator :: comparator()
+static void
+encode_pointer(const consus::value_log::pointer& ptr, std::string* out)
 {
+    out->resize(VALUE_POINTER_SZ);
+    char* buf = &(*out)[0];
+    buf[0] = LEVELDB_VALUE_POINTER;
+    buf = e::pack64be(ptr.file, buf + 1);
+    buf = e::pack64be(ptr.offset, buf);
+    buf = e::pack32be(ptr.length, buf);
+    buf = e::pack32be(ptr.checksum, buf);
 }
 
-leveldb_datalayer :: comparator :: ~comparator() throw ()
+static bool
+decode_pointer(const leveldb::Slice& v, consus::value_log::pointer* ptr)
 {
+    if (v.size() != VALUE_POINTER_SZ || v[0] != LEVELDB_VALUE_POINTER)
+    {
+        return false;
+    }
+
+    const char* buf = v.data() + 1;
+    buf = e::unpack64be(buf, &ptr->file);
+    buf = e::unpack64be(buf, &ptr->offset);
+    buf = e::unpack32be(buf, &ptr->length);
+    buf = e::unpack32be(buf, &ptr->checksum);
+    return true;
 }
 
-int
-leveldb_datalayer :: comparator :: Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+// pins the value returned by get; it is built in place inside the cursor
+// that read it, and hands the cursor back only once fully destroyed, so a
+// point read never allocates a reference of its own
+struct leveldb_datalayer::reference : public datalayer::reference
 {
-    static const leveldb::Slice lock_table_prefix("\x0bconsus.lock", 12);
+    reference(value_log::mapping* m);
+    virtual ~reference() throw ();
+    static void* operator new(size_t, void* where) { return where; }
+    static void operator delete(void* ptr);
 
-    if (a.starts_with(lock_table_prefix) && b.starts_with(lock_table_prefix))
-    {
-        return a.compare(b);
-    }
-    else if (a.starts_with(lock_table_prefix))
-    {
-        return -1;
-    }
-    else if (b.starts_with(lock_table_prefix))
-    {
-        return 1;
-    }
+    value_log::mapping* m;
 
-    assert(!a.starts_with(lock_table_prefix));
-    assert(!b.starts_with(lock_table_prefix));
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
 
-    if (a.size() < 8 || b.size() < 8)
-    {
-        return -1;
-    }
+// An iterator plus the scratch space to encode the key it seeks and the room
+// for the reference that pins what it read; all of them are reused across
+// reads so that a point read allocates nothing once warm.  A commit makes the
+// iterator stale, but only the iterator is replaced.
+struct leveldb_datalayer::cursor
+{
+    cursor(leveldb_datalayer* dl);
+    ~cursor() throw ();
+    reference* pin(value_log::mapping* m);
 
-    e::slice x(a.data(), a.size() - 8);
-    e::slice y(b.data(), b.size() - 8);
-    size_t sz = std::min(x.size(), y.size());
-    int cmp = memcmp(x.data(), y.data(), sz);
+    leveldb_datalayer* const dl;
+    std::auto_ptr<leveldb::Iterator> it;
+    uint64_t generation;
+    std::string key;
 
-    if (cmp < 0)
+    // leads the reference built in the space back to its cursor
+    struct slot
     {
-        return -1;
-    }
-    if (cmp > 0)
-    {
-        return 1;
-    }
-    // cmp == 0; order by size now
-    if (x.size() < y.size())
-    {
-        return -1;
-    }
-    if (x.size() > y.size())
-    {
-        return 1;
-    }
+        cursor* owner;
+        union
+        {
+            char bytes[sizeof(reference)];
+            void* align;
+        } space;
+    } ref;
 
-    uint64_t at;
-    uint64_t bt;
-    e::unpack64be(a.data() + a.size() - 8, &at);
-    e::unpack64be(b.data() + b.size() - 8, &bt);
+    private:
+        cursor(const cursor&);
+        cursor& operator = (const cursor&);
+};
 
-    if (at > bt)
-    {
-        return -1;
-    }
-    if (at < bt)
+leveldb_datalayer :: reference :: reference(value_log::mapping* _m)
+    : datalayer::reference()
+    , m(_m)
+{
+}
+
+leveldb_datalayer :: reference :: ~reference() throw ()
+{
+    if (m)
     {
-        return 1;
+        value_log::release(m);
     }
-
-    return 0;
 }
 
-struct leveldb_datalayer::reference : public datalayer::reference
+void
+leveldb_datalayer :: reference :: operator delete(void* ptr)
 {
-    reference(std::auto_ptr<leveldb::Iterator> it);
-    virtual ~reference() throw ();
+    char* space = static_cast<char*>(ptr) - offsetof(cursor::slot, space);
+    cursor* c = reinterpret_cast<cursor::slot*>(space)->owner;
+    c->dl->put_cursor(c);
+}
 
-    std::auto_ptr<leveldb::Iterator> it;
-};
+leveldb_datalayer :: cursor :: cursor(leveldb_datalayer* _dl)
+    : dl(_dl)
+    , it()
+    , generation(0)
+    , key()
+    , ref()
+{
+    ref.owner = this;
+}
 
-leveldb_datalayer :: reference :: reference(std::auto_ptr<leveldb::Iterator> _it)
-    : datalayer::reference()
-    , it(_it)
+leveldb_datalayer :: cursor :: ~cursor() throw ()
 {
 }
 
-leveldb_datalayer :: reference :: ~reference() throw ()
+leveldb_datalayer::reference*
+leveldb_datalayer :: cursor :: pin(value_log::mapping* m)
 {
+    return new (ref.space.bytes) reference(m);
 }
 
-leveldb_datalayer :: leveldb_datalayer()
-    : m_cmp(new comparator())
-    , m_bf(NULL)
+struct leveldb_datalayer::writer
+{
+    writer(const overwritten* o) : done(false), rc(CONSUS_GARBAGE), ow(o) {}
+
+    bool done;
+    consus_returncode rc;
+    const overwritten* ow;
+};
+
+// the value log bytes that writes make unreachable by replacing a version
+// at the same timestamp, and the oldest such timestamp; also the value log
+// files the writes point into, pinned until the writes commit or fail
+struct leveldb_datalayer::overwritten
+{
+    overwritten(value_log* v) : garbage(), oldest(UINT64_MAX), values(v), pinned() {}
+    ~overwritten() throw ()
+    {
+        for (size_t i = 0; i < pinned.size(); ++i)
+        {
+            values->unpin(pinned[i]);
+        }
+    }
+
+    std::map<uint64_t, uint64_t> garbage;
+    uint64_t oldest;
+    value_log* const values;
+    std::vector<uint64_t> pinned;
+
+    private:
+        overwritten(const overwritten&);
+        overwritten& operator = (const overwritten&);
+};
+
+leveldb_datalayer :: leveldb_datalayer(uint64_t commit_delay, uint64_t value_threshold)
+    : m_bf(NULL)
     , m_db(NULL)
+    , m_value_threshold(value_threshold)
+    , m_tagged(false)
+    , m_values()
+    , m_garbage_mtx()
+    , m_prune_watermark(0)
+    , m_unreached()
+    , m_generation(0)
+    , m_cursors_mtx()
+    , m_cursors()
+    , m_commit_delay(commit_delay)
+    , m_commit_mtx()
+    , m_commit_cond(&m_commit_mtx)
+    , m_commit_full(&m_commit_mtx)
+    , m_committing(false)
+    , m_batches()
+    , m_staged(&m_batches[0])
+    , m_staged_bytes(0)
+    , m_staged_logged(false)
+    , m_staged_since(0)
+    , m_staged_writers()
 {
 }
 
 leveldb_datalayer :: ~leveldb_datalayer() throw ()
 {
+    for (size_t i = 0; i < m_cursors.size(); ++i)
+    {
+        delete m_cursors[i];
+    }
+
     delete m_bf;
     delete m_db;
 }
@@ -161,16 +261,34 @@ leveldb_datalayer :: init(std::string data)
     opts.create_if_missing = true;
     opts.filter_policy = m_bf = leveldb::NewBloomFilterPolicy(10);
     opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L);
-    opts.comparator = m_cmp.get();
     leveldb::Status st = leveldb::DB::Open(opts, data, &m_db);
 
     if (!st.ok())
     {
         LOG(ERROR) << "could not open leveldb: " << st.ToString();
+
+        if (st.ToString().find(LEGACY_COMPARATOR) != std::string::npos)
+        {
+            LOG(ERROR) << "the data directory uses the old key format; "
+                       << "convert it with consus-migrate-kvs-data";
+        }
+
         return false;
     }
 
-    return true;
+    if (!init_format())
+    {
+        return false;
+    }
+
+    if (!m_tagged && m_value_threshold > 0)
+    {
+        LOG(ERROR) << "the data directory predates the value log and stores "
+                   << "values untagged; it cannot use a value log threshold";
+        return false;
+    }
+
+    return !m_tagged || init_value_log(data);
 }
 
 consus_returncode
@@ -181,36 +299,73 @@ leveldb_datalayer :: get(const e::slice& table,
                          e::slice* value,
                          datalayer::reference** ref)
 {
-    std::string tmp = data_key(table, key, timestamp_le);
-    std::auto_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
-    it->Seek(tmp);
     *timestamp = 0;
     *value = e::slice();
     *ref = NULL;
+    cursor* c = get_cursor();
+    data_key(table, key, timestamp_le, &c->key);
+    leveldb::Iterator* it = c->it.get();
+    it->Seek(c->key);
 
     if (!it->status().ok())
     {
         LOG(ERROR) << "leveldb error: " << it->status().ToString();
+        put_cursor(c);
         return CONSUS_SERVER_ERROR;
     }
-    else if (!it->Valid() || tmp.size() != it->key().size() ||
-             memcmp(tmp.data(), it->key().data(), tmp.size() - 8) != 0)
+    else if (!it->Valid() || c->key.size() != it->key().size() ||
+             memcmp(c->key.data(), it->key().data(),
+                    c->key.size() - LEVELDB_TIMESTAMP_SZ) != 0)
     {
+        put_cursor(c);
         return CONSUS_NOT_FOUND;
     }
 
-    e::unpack64be(it->key().data() + it->key().size() - 8, timestamp);
-    *value = e::slice(it->value().data(), it->value().size());
-    *ref = new reference(it);
+    *timestamp = leveldb_data_key_timestamp(it->key().data(), it->key().size());
+    const leveldb::Slice v = it->value();
 
-    if (value->empty())
+    if (v.empty())
     {
+        *ref = c->pin(NULL);
         return CONSUS_NOT_FOUND;
     }
-    else
+    else if (!m_tagged)
+    {
+        *value = e::slice(v.data(), v.size());
+        *ref = c->pin(NULL);
+        return CONSUS_SUCCESS;
+    }
+    else if (v[0] == LEVELDB_VALUE_INLINE)
     {
+        *value = e::slice(v.data() + 1, v.size() - 1);
+        *ref = c->pin(NULL);
         return CONSUS_SUCCESS;
     }
+
+    value_log::pointer ptr;
+
+    if (!decode_pointer(v, &ptr))
+    {
+        LOG(ERROR) << "corrupt value (\""
+                   << e::strescape(table.str()) << "\", \""
+                   << e::strescape(key.str()) << "\")";
+        put_cursor(c);
+        return CONSUS_SERVER_ERROR;
+    }
+
+    value_log::mapping* m = NULL;
+    consus_returncode rc = m_values.read(ptr, value, &m);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        *timestamp = 0;
+        put_cursor(c);
+        return rc;
+    }
+
+    // the cursor is done reading, but it carries the reference
+    *ref = c->pin(m);
+    return CONSUS_SUCCESS;
 }
 
 consus_returncode
@@ -221,22 +376,17 @@ leveldb_datalayer :: put(const e::slice& table,
 {
     assert(!value.empty()); /* XXX */
     std::string tmp = data_key(table, key, timestamp);
-    leveldb::WriteOptions opts;
-    opts.sync = true;
-    leveldb::Status st = m_db->Put(opts, tmp, leveldb::Slice(value.cdata(), value.size()));
-    consus_returncode rc;
+    std::string encoded;
+    bool logged = false;
+    overwritten ow(&m_values);
 
-    if (st.ok())
-    {
-        rc = CONSUS_SUCCESS;
-    }
-    else
+    if (!encode_value(tmp, value, &encoded, &logged, &ow))
     {
-        LOG(ERROR) << "leveldb error: " << st.ToString();
-        rc = CONSUS_SERVER_ERROR;
+        return CONSUS_SERVER_ERROR;
     }
 
-    return rc;
+    leveldb::Slice val(encoded);
+    return commit(&tmp, &val, 1, logged, &ow);
 }
 
 consus_returncode
@@ -245,22 +395,8 @@ leveldb_datalayer :: del(const e::slice& table,
                          uint64_t timestamp)
 {
     std::string tmp = data_key(table, key, timestamp);
-    leveldb::WriteOptions opts;
-    opts.sync = true;
-    leveldb::Status st = m_db->Put(opts, tmp, leveldb::Slice());
-    consus_returncode rc;
-
-    if (st.ok())
-    {
-        rc = CONSUS_SUCCESS;
-    }
-    else
-    {
-        LOG(ERROR) << "leveldb error: " << st.ToString();
-        rc = CONSUS_SERVER_ERROR;
-    }
-
-    return rc;
+    leveldb::Slice val;
+    return commit(&tmp, &val, 1, false, NULL);
 }
 
 consus_returncode
@@ -305,19 +441,697 @@ leveldb_datalayer :: write_lock(const e::slice& table,
     std::string tmp = lock_key(table, key);
     std::string val;
     e::packer(&val) << tg;
+    leveldb::Slice v(val);
+    return commit(&tmp, &v, 1, false, NULL);
+}
+
+consus_returncode
+leveldb_datalayer :: apply(const datalayer::write* writes, size_t writes_sz)
+{
+    if (writes_sz == 0)
+    {
+        return CONSUS_SUCCESS;
+    }
+
+    std::vector<std::string> keys(writes_sz);
+    std::vector<std::string> encoded(writes_sz);
+    std::vector<leveldb::Slice> values(writes_sz);
+    bool logged = false;
+    overwritten ow(&m_values);
+
+    for (size_t i = 0; i < writes_sz; ++i)
+    {
+        assert(writes[i].tombstone || !writes[i].value.empty()); /* XXX */
+        keys[i] = data_key(writes[i].table, writes[i].key, writes[i].timestamp);
+
+        if (!writes[i].tombstone)
+        {
+            if (!encode_value(keys[i], writes[i].value, &encoded[i], &logged, &ow))
+            {
+                return CONSUS_SERVER_ERROR;
+            }
+
+            values[i] = leveldb::Slice(encoded[i]);
+        }
+    }
+
+    return commit(&keys[0], &values[0], writes_sz, logged, &ow);
+}
+
+// The versions of one key are adjacent and newest first, so a single scan
+// finds, for each key, the first version at or below the watermark; every
+// version after it is invisible to reads at or after the watermark.  That
+// version itself stays even when it is a tombstone, because replicas compare
+// the timestamps of what they read and a missing key reads as timestamp zero.
+// The deletes skip group commit and are not synced:  a crash that loses them
+// leaves garbage for the next pass, and no read can tell the difference.
+// Pruning a pointer into the value log counts its bytes against the file
+// that holds them, in the same batch as the delete, so that the count is
+// exact across crashes and the file goes once every value in it is gone.
+// Bytes that were never counted keep a file forever, so a pass that starts
+// from the beginning also notes every sealed file, strikes each file that a
+// surviving version points into, and at the end removes those left over.
+consus_returncode
+leveldb_datalayer :: prune(uint64_t watermark,
+                           std::string* position,
+                           size_t max_keys,
+                           uint64_t* pruned)
+{
+    *pruned = 0;
+
+    {
+        // before the scan, so that a commit that can still overwrite a
+        // version this pass removes sees the watermark and leaves the
+        // version it replaces for this pass to count
+        po6::threads::mutex::hold hold(&m_garbage_mtx);
+        m_prune_watermark = std::max(m_prune_watermark, watermark);
+    }
+
+    if (position->empty())
+    {
+        // before the iterator, so that a pointer committed after it was
+        // created is into a file pinned since, which reclaim will skip
+        m_unreached.clear();
+
+        if (m_tagged)
+        {
+            m_values.reclaimable(&m_unreached);
+        }
+    }
+
+    leveldb::ReadOptions ropts;
+    ropts.fill_cache = false;
+    std::auto_ptr<leveldb::Iterator> it(m_db->NewIterator(ropts));
+
+    if (position->empty())
+    {
+        const char tag = LEVELDB_DATA_KEY_TAG;
+        it->Seek(leveldb::Slice(&tag, 1));
+    }
+    else
+    {
+        it->Seek(*position);
+    }
+
+    leveldb::WriteBatch batch;
+    size_t batch_bytes = 0;
+    std::map<uint64_t, uint64_t> garbage;
+    std::string group;
+    bool shadowed = false;
+    size_t examined = 0;
+    position->clear();
+
+    for (; it->Valid(); it->Next())
+    {
+        const leveldb::Slice k = it->key();
+
+        if (k.size() <= LEVELDB_TIMESTAMP_SZ || k[0] != LEVELDB_DATA_KEY_TAG)
+        {
+            break;
+        }
+
+        const size_t prefix_sz = k.size() - LEVELDB_TIMESTAMP_SZ;
+
+        if (group.size() != prefix_sz ||
+            memcmp(group.data(), k.data(), prefix_sz) != 0)
+        {
+            // only stop between keys, so the next call starts on a newest
+            // version
+            if (examined >= max_keys)
+            {
+                position->assign(k.data(), k.size());
+                break;
+            }
+
+            group.assign(k.data(), prefix_sz);
+            shadowed = false;
+            ++examined;
+        }
+
+        value_log::pointer ptr;
+        const bool points = m_tagged && decode_pointer(it->value(), &ptr);
+
+        if (shadowed)
+        {
+            batch.Delete(k);
+            batch_bytes += k.size();
+            ++*pruned;
+
+            if (points)
+            {
+                garbage[ptr.file] += ptr.length;
+            }
+        }
+        else
+        {
+            if (points)
+            {
+                m_unreached.erase(ptr.file);
+            }
+
+            if (leveldb_data_key_timestamp(k.data(), k.size()) <= watermark)
+            {
+                shadowed = true;
+            }
+        }
+
+        if (batch_bytes >= PRUNE_BATCH_BYTES)
+        {
+            if (prune_flush(&batch, &garbage) != CONSUS_SUCCESS)
+            {
+                position->clear();
+                return CONSUS_SERVER_ERROR;
+            }
+
+            batch_bytes = 0;
+        }
+    }
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "leveldb error: " << it->status().ToString();
+        position->clear();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    if (prune_flush(&batch, &garbage) != CONSUS_SUCCESS)
+    {
+        position->clear();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    // the pass is complete, and saw every version that survives it
+    if (position->empty())
+    {
+        return reclaim_unreached();
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+leveldb_datalayer::cursor*
+leveldb_datalayer :: get_cursor()
+{
+    const uint64_t generation = e::atomic::load_64_acquire(&m_generation);
+    cursor* c = NULL;
+
+    {
+        po6::threads::mutex::hold hold(&m_cursors_mtx);
+
+        if (!m_cursors.empty())
+        {
+            c = m_cursors.back();
+            m_cursors.pop_back();
+        }
+    }
+
+    if (!c)
+    {
+        c = new cursor(this);
+    }
+
+    if (!c->it.get() || c->generation < generation)
+    {
+        // created after reading the generation, so it sees every write that
+        // finished before this read began
+        c->it.reset(m_db->NewIterator(leveldb::ReadOptions()));
+        c->generation = generation;
+    }
+
+    return c;
+}
+
+void
+leveldb_datalayer :: put_cursor(cursor* c)
+{
+    if (!c->it->status().ok() ||
+        c->generation < e::atomic::load_64_acquire(&m_generation))
+    {
+        // don't let an idle cursor pin a version of the tree no read can use
+        c->it.reset();
+    }
+
+    {
+        po6::threads::mutex::hold hold(&m_cursors_mtx);
+
+        if (m_cursors.size() < MAX_IDLE_CURSORS)
+        {
+            m_cursors.push_back(c);
+            c = NULL;
+        }
+    }
+
+    delete c;
+}
+
+// An idle iterator pins the version of the tree it was created on, and with
+// it every file that version references; release them once a write makes
+// the version stale, rather than when the cursor is next used.
+void
+leveldb_datalayer :: drop_stale_cursors()
+{
+    const uint64_t generation = e::atomic::load_64_acquire(&m_generation);
+    std::vector<leveldb::Iterator*> stale;
+
+    {
+        po6::threads::mutex::hold hold(&m_cursors_mtx);
+
+        for (size_t i = 0; i < m_cursors.size(); ++i)
+        {
+            cursor* c = m_cursors[i];
+
+            if (c->it.get() && c->generation < generation)
+            {
+                stale.push_back(c->it.release());
+            }
+        }
+    }
+
+    for (size_t i = 0; i < stale.size(); ++i)
+    {
+        delete stale[i];
+    }
+}
+
+// Directories created since the value log existed carry the format key;
+// a directory without it is new only if it holds no data at all.
+bool
+leveldb_datalayer :: init_format()
+{
+    const char tag = LEVELDB_FORMAT_KEY_TAG;
+    std::string fmt;
+    leveldb::Status st = m_db->Get(leveldb::ReadOptions(), leveldb::Slice(&tag, 1), &fmt);
+
+    if (st.ok())
+    {
+        m_tagged = true;
+        return true;
+    }
+    else if (!st.IsNotFound())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return false;
+    }
+
+    std::auto_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
+    it->SeekToFirst();
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "leveldb error: " << it->status().ToString();
+        return false;
+    }
+    else if (it->Valid())
+    {
+        m_tagged = false;
+        return true;
+    }
+
     leveldb::WriteOptions opts;
     opts.sync = true;
-    leveldb::Status st = m_db->Put(opts, tmp, val);
+    st = m_db->Put(opts, leveldb::Slice(&tag, 1), leveldb::Slice());
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return false;
+    }
+
+    m_tagged = true;
+    return true;
+}
+
+bool
+leveldb_datalayer :: init_value_log(const std::string& data)
+{
+    if (!m_values.open(data + "/" VALUE_LOG_DIR))
+    {
+        return false;
+    }
+
+    const char tag = LEVELDB_GARBAGE_KEY_TAG;
+    std::auto_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
+    leveldb::WriteBatch batch;
+
+    for (it->Seek(leveldb::Slice(&tag, 1)); it->Valid(); it->Next())
+    {
+        const leveldb::Slice k = it->key();
+        const leveldb::Slice v = it->value();
+
+        if (k.size() == 0 || k[0] != LEVELDB_GARBAGE_KEY_TAG)
+        {
+            break;
+        }
+        else if (k.size() != 1 + sizeof(uint64_t) || v.size() != sizeof(uint64_t))
+        {
+            LOG(ERROR) << "corrupt value log garbage count";
+            return false;
+        }
+
+        uint64_t file;
+        uint64_t bytes;
+        e::unpack64be(k.data() + 1, &file);
+        e::unpack64be(v.data(), &bytes);
+
+        if (m_values.collect(file, bytes))
+        {
+            batch.Delete(k);
+        }
+    }
+
+    leveldb::Status st = it->status();
 
     if (st.ok())
+    {
+        st = m_db->Write(leveldb::WriteOptions(), &batch);
+    }
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return false;
+    }
+
+    return true;
+}
+
+// A retried write arrives at the timestamp of the version it already wrote.
+// When that version points into the value log, point at the same bytes again
+// if they hold this value, and otherwise count them as garbage when the write
+// replaces the pointer, so retries neither append duplicates nor leak space.
+// Two copies of a write racing each other can still leave one uncounted,
+// for the prune pass to find.
+bool
+leveldb_datalayer :: encode_value(const std::string& key,
+                                  const e::slice& value,
+                                  std::string* out,
+                                  bool* logged,
+                                  overwritten* ow)
+{
+    if (!m_tagged)
+    {
+        out->assign(value.cdata(), value.size());
+        return true;
+    }
+
+    // An inline value skips the lookup.  It replaces a pointer only when the
+    // threshold changed between a write and its retry, and the prune pass
+    // reclaims files that no pointer reaches.
+    if (m_value_threshold == 0 ||
+        value.size() < m_value_threshold ||
+        value.size() > UINT32_MAX)
+    {
+        out->reserve(1 + value.size());
+        out->push_back(LEVELDB_VALUE_INLINE);
+        out->append(value.cdata(), value.size());
+        return true;
+    }
+
+    std::string existing;
+    value_log::pointer old;
+    leveldb::Status st = m_db->Get(leveldb::ReadOptions(), key, &existing);
+
+    if (!st.ok() && !st.IsNotFound())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return false;
+    }
+
+    const bool replaces = st.ok() && decode_pointer(existing, &old);
+
+    // a committed pointer is durable, and so is the value it points to
+    if (replaces && old.length == value.size() &&
+        old.checksum == crc32c(0, value.data(), value.size()) &&
+        m_values.pin(old.file))
+    {
+        ow->pinned.push_back(old.file);
+        out->swap(existing);
+        return true;
+    }
+
+    value_log::pointer ptr;
+
+    if (!m_values.append(value, &ptr))
+    {
+        return false;
+    }
+
+    ow->pinned.push_back(ptr.file);
+    encode_pointer(ptr, out);
+    *logged = true;
+
+    if (replaces)
+    {
+        ow->garbage[old.file] += old.length;
+        ow->oldest = std::min(ow->oldest,
+                              leveldb_data_key_timestamp(key.data(), key.size()));
+    }
+
+    return true;
+}
+
+// Every mutation is staged into a shared batch and the caller blocks until
+// that batch is synced.  Whichever caller finds no commit in progress becomes
+// the leader:  it takes the staged batch, writes it with one synchronous
+// leveldb::DB::Write, and wakes everyone in it.  Writers that arrive while a
+// commit is in flight stage into the next batch, so under load each sync
+// covers every write that queued up during the previous one.  The mutations
+// passed to one call always land in the same batch, so they are atomic.
+consus_returncode
+leveldb_datalayer :: commit(const std::string* keys,
+                            const leveldb::Slice* values,
+                            size_t sz,
+                            bool logged,
+                            const overwritten* ow)
+{
+    writer w(ow && !ow->garbage.empty() ? ow : NULL);
+    m_commit_mtx.lock();
+
+    if (m_staged_writers.empty())
+    {
+        m_staged_since = po6::monotonic_time();
+    }
+
+    for (size_t i = 0; i < sz; ++i)
+    {
+        m_staged->Put(keys[i], values[i]);
+        m_staged_bytes += keys[i].size() + values[i].size();
+    }
+
+    m_staged_writers.push_back(&w);
+    m_staged_logged = m_staged_logged || logged;
+
+    if (m_staged_bytes >= GROUP_COMMIT_MAX_BYTES)
+    {
+        m_commit_full.signal();
+    }
+
+    while (!w.done)
+    {
+        if (m_committing)
+        {
+            m_commit_cond.wait();
+            continue;
+        }
+
+        m_committing = true;
+
+        // hold the batch open for the configured delay so that writers on
+        // other threads can join it
+        while (m_commit_delay > 0 && m_staged_bytes < GROUP_COMMIT_MAX_BYTES)
+        {
+            const uint64_t now = po6::monotonic_time();
+            const uint64_t deadline = m_staged_since + m_commit_delay;
+
+            if (now >= deadline)
+            {
+                break;
+            }
+
+            m_commit_full.wait_for(deadline - now);
+        }
+
+        leveldb::WriteBatch* batch = m_staged;
+        m_staged = batch == &m_batches[0] ? &m_batches[1] : &m_batches[0];
+        std::vector<writer*> writers;
+        writers.swap(m_staged_writers);
+        const bool batch_logged = m_staged_logged;
+        m_staged_bytes = 0;
+        m_staged_logged = false;
+        m_commit_mtx.unlock();
+
+        consus_returncode rc = CONSUS_SUCCESS;
+
+        // a pointer must never be durable before the value it points to
+        if (batch_logged && !m_values.sync())
+        {
+            rc = CONSUS_SERVER_ERROR;
+        }
+        else
+        {
+            po6::threads::mutex::hold hold(&m_garbage_mtx);
+            std::map<uint64_t, uint64_t> garbage;
+
+            for (size_t i = 0; i < writers.size(); ++i)
+            {
+                const overwritten* ow = writers[i]->ow;
+
+                // a prune pass at or above the version may count the bytes
+                // too; counting them here would free data still in use, so
+                // leave them uncounted instead
+                if (!ow || ow->oldest <= m_prune_watermark)
+                {
+                    continue;
+                }
+
+                for (std::map<uint64_t, uint64_t>::const_iterator g = ow->garbage.begin();
+                        g != ow->garbage.end(); ++g)
+                {
+                    garbage[g->first] += g->second;
+                }
+            }
+
+            stage_garbage(&garbage, batch);
+            leveldb::WriteOptions opts;
+            opts.sync = true;
+            leveldb::Status st = m_db->Write(opts, batch);
+            // make the read cursors stale before anyone learns of the write
+            e::atomic::increment_64_fullbarrier(&m_generation, 1);
+            drop_stale_cursors();
+
+            if (!st.ok())
+            {
+                LOG(ERROR) << "leveldb error: " << st.ToString();
+                rc = CONSUS_SERVER_ERROR;
+            }
+            else if (!garbage.empty())
+            {
+                // the write stands even if forgetting removed files fails
+                collect_garbage(garbage);
+            }
+        }
+
+        // no writer stages into this batch until the next leader takes over
+        batch->Clear();
+        m_commit_mtx.lock();
+
+        for (size_t i = 0; i < writers.size(); ++i)
+        {
+            writers[i]->rc = rc;
+            writers[i]->done = true;
+        }
+
+        m_committing = false;
+        m_commit_cond.broadcast();
+    }
+
+    m_commit_mtx.unlock();
+    return w.rc;
+}
+
+consus_returncode
+leveldb_datalayer :: prune_flush(leveldb::WriteBatch* batch,
+                                 std::map<uint64_t, uint64_t>* garbage)
+{
+    po6::threads::mutex::hold hold(&m_garbage_mtx);
+    stage_garbage(garbage, batch);
+    leveldb::Status st = m_db->Write(leveldb::WriteOptions(), batch);
+    batch->Clear();
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        garbage->clear();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    consus_returncode rc = collect_garbage(*garbage);
+    garbage->clear();
+    return rc;
+}
+
+// Turn the bytes each file newly lost into the file's new total, and record
+// the totals in the batch.  Requires m_garbage_mtx.
+void
+leveldb_datalayer :: stage_garbage(std::map<uint64_t, uint64_t>* garbage,
+                                   leveldb::WriteBatch* batch)
+{
+    std::string gk;
+    char buf[sizeof(uint64_t)];
+
+    for (std::map<uint64_t, uint64_t>::iterator g = garbage->begin();
+            g != garbage->end(); ++g)
+    {
+        g->second += m_values.garbage(g->first);
+        leveldb_garbage_key(g->first, &gk);
+        e::pack64be(g->second, buf);
+        batch->Put(gk, leveldb::Slice(buf, sizeof(buf)));
+    }
+}
+
+// Remove the files that no surviving version pointed into during a complete
+// prune pass, along with their garbage counts.
+consus_returncode
+leveldb_datalayer :: reclaim_unreached()
+{
+    if (m_unreached.empty())
     {
         return CONSUS_SUCCESS;
     }
-    else
+
+    po6::threads::mutex::hold hold(&m_garbage_mtx);
+    leveldb::WriteBatch batch;
+    std::string gk;
+
+    for (std::map<uint64_t, uint64_t>::const_iterator u = m_unreached.begin();
+            u != m_unreached.end(); ++u)
+    {
+        if (m_values.reclaim(u->first, u->second))
+        {
+            leveldb_garbage_key(u->first, &gk);
+            batch.Delete(gk);
+        }
+    }
+
+    m_unreached.clear();
+    leveldb::Status st = m_db->Write(leveldb::WriteOptions(), &batch);
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+// Once the totals are written, hand them to the value log, and drop the
+// counts of the files it removes.  Requires m_garbage_mtx.
+consus_returncode
+leveldb_datalayer :: collect_garbage(const std::map<uint64_t, uint64_t>& garbage)
+{
+    leveldb::WriteBatch batch;
+    std::string gk;
+
+    for (std::map<uint64_t, uint64_t>::const_iterator g = garbage.begin();
+            g != garbage.end(); ++g)
+    {
+        if (m_values.collect(g->first, g->second))
+        {
+            leveldb_garbage_key(g->first, &gk);
+            batch.Delete(gk);
+        }
+    }
+
+    leveldb::Status st = m_db->Write(leveldb::WriteOptions(), &batch);
+
+    if (!st.ok())
     {
         LOG(ERROR) << "leveldb error: " << st.ToString();
         return CONSUS_SERVER_ERROR;
     }
+
+    return CONSUS_SUCCESS;
 }
 
 std::string
@@ -326,21 +1140,24 @@ leveldb_datalayer :: data_key(const e::slice& table,
                               uint64_t timestamp)
 {
     std::string tmp;
-    e::packer(&tmp)
-        << table
-        << e::pack_array<uint8_t>(key.data(), key.size())
-        << timestamp;
+    data_key(table, key, timestamp, &tmp);
     return tmp;
 }
 
+void
+leveldb_datalayer :: data_key(const e::slice& table,
+                              const e::slice& key,
+                              uint64_t timestamp,
+                              std::string* out)
+{
+    leveldb_data_key(table, key, timestamp, out);
+}
+
 std::string
 leveldb_datalayer :: lock_key(const e::slice& table,
                               const e::slice& key)
 {
     std::string tmp;
-    e::packer(&tmp)
-        << e::slice("consus.lock")
-        << table
-        << e::pack_array<uint8_t>(key.data(), key.size());
+    leveldb_lock_key(table, key, &tmp);
     return tmp;
 }
@@ -29,12 +29,18 @@
 #define consus_kvs_leveldb_datalayer_h_
 
 // STL
+#include <map>
 #include <memory>
+#include <vector>
 
 // LevelDB
-#include <leveldb/comparator.h>
 #include <leveldb/db.h>
 #include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+
+// po6
+#include <po6/threads/cond.h>
+#include <po6/threads/mutex.h>
 
 // e
 #include <e/slice.h>
@@ -43,13 +49,18 @@
 #include <consus.h>
 #include "namespace.h"
 #include "kvs/datalayer.h"
+#include "kvs/value_log.h"
 
 BEGIN_CONSUS_NAMESPACE
 
 class leveldb_datalayer : public datalayer
 {
     public:
-        leveldb_datalayer();
+        // writes are group committed; a commit waits up to commit_delay
+        // nanoseconds for concurrent writers to join its batch.  Values of
+        // at least value_threshold bytes go to the value log instead of the
+        // LSM; zero keeps every value inline.
+        leveldb_datalayer(uint64_t commit_delay, uint64_t value_threshold);
         virtual ~leveldb_datalayer() throw ();
 
     public:
@@ -73,23 +84,91 @@ class leveldb_datalayer : public datalayer
         virtual consus_returncode write_lock(const e::slice& table,
                                              const e::slice& key,
                                              const transaction_group& tg);
+        virtual consus_returncode apply(const datalayer::write* writes, size_t writes_sz);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        std::string* position,
+                                        size_t max_keys,
+                                        uint64_t* pruned);
 
     private:
-        struct comparator;
+        struct cursor;
         struct reference;
+        struct writer;
+        struct overwritten;
+        friend struct reference;
 
     private:
+        cursor* get_cursor();
+        void put_cursor(cursor* c);
+        void drop_stale_cursors();
+        bool init_format();
+        bool init_value_log(const std::string& data);
+        bool encode_value(const std::string& key,
+                          const e::slice& value,
+                          std::string* out,
+                          bool* logged,
+                          overwritten* ow);
+        consus_returncode commit(const std::string* keys,
+                                 const leveldb::Slice* values,
+                                 size_t sz,
+                                 bool logged,
+                                 const overwritten* ow);
+        consus_returncode prune_flush(leveldb::WriteBatch* batch,
+                                      std::map<uint64_t, uint64_t>* garbage);
+        void stage_garbage(std::map<uint64_t, uint64_t>* garbage,
+                           leveldb::WriteBatch* batch);
+        consus_returncode collect_garbage(const std::map<uint64_t, uint64_t>& garbage);
+        consus_returncode reclaim_unreached();
         std::string data_key(const e::slice& table,
                              const e::slice& key,
                              uint64_t timestamp);
+        void data_key(const e::slice& table,
+                      const e::slice& key,
+                      uint64_t timestamp,
+                      std::string* out);
         std::string lock_key(const e::slice& table,
                              const e::slice& key);
 
     private:
-        std::auto_ptr<comparator> m_cmp;
         const leveldb::FilterPolicy* m_bf;
         leveldb::DB* m_db;
 
+        // key-value separation; only directories with the format key can
+        // hold pointers into the value log
+        const uint64_t m_value_threshold;
+        bool m_tagged;
+        value_log m_values;
+        // the garbage counts are totals, so updating one is read-modify-write
+        // and prune passes and commits take turns; pruning removes versions
+        // below the highest watermark it has been given
+        po6::threads::mutex m_garbage_mtx;
+        uint64_t m_prune_watermark;
+        // sealed value log files that no version seen so far in the current
+        // prune pass points into, with their pin counts when it began; owned
+        // by the pruning thread
+        std::map<uint64_t, uint64_t> m_unreached;
+
+        // idle read cursors; an iterator reads a snapshot, so a cursor's
+        // iterator is dropped once a write commits and bumps m_generation
+        uint64_t m_generation;
+        po6::threads::mutex m_cursors_mtx;
+        std::vector<cursor*> m_cursors;
+
+        // group commit
+        const uint64_t m_commit_delay;
+        po6::threads::mutex m_commit_mtx;
+        po6::threads::cond m_commit_cond;
+        po6::threads::cond m_commit_full;
+        bool m_committing;
+        // writers stage into one batch while the leader writes the other;
+        // the two trade places instead of being copied
+        leveldb::WriteBatch m_batches[2];
+        leveldb::WriteBatch* m_staged;
+        size_t m_staged_bytes;
+        bool m_staged_logged;
+        uint64_t m_staged_since;
+        std::vector<writer*> m_staged_writers;
+
     private:
         leveldb_datalayer(const leveldb_datalayer&);
         leveldb_datalayer& operator = (const leveldb_datalayer&);
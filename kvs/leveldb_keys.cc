@@ -0,0 +1,172 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <string.h>
+
+// e
+#include <e/endian.h>
+
+// consus
+#include "kvs/leveldb_keys.h"
+
+namespace
+{
+
+void
+escape(const e::slice& s, std::string* out)
+{
+    const char* ptr = s.cdata();
+    const char* const end = ptr + s.size();
+
+    while (ptr < end)
+    {
+        const char* zero = static_cast<const char*>(memchr(ptr, 0, end - ptr));
+
+        if (!zero)
+        {
+            out->append(ptr, end - ptr);
+            break;
+        }
+
+        out->append(ptr, zero - ptr);
+        out->append("\x00\xff", 2);
+        ptr = zero + 1;
+    }
+
+    out->append("\x00\x01", 2);
+}
+
+// advances *ptr past one escaped string, appending the original to out
+bool
+unescape(const char** ptr, const char* end, std::string* out)
+{
+    out->clear();
+
+    while (*ptr < end)
+    {
+        const char* zero = static_cast<const char*>(memchr(*ptr, 0, end - *ptr));
+
+        if (!zero || zero + 1 >= end)
+        {
+            return false;
+        }
+
+        out->append(*ptr, zero - *ptr);
+        *ptr = zero + 2;
+
+        if (zero[1] == '\x01')
+        {
+            return true;
+        }
+        else if (zero[1] == '\xff')
+        {
+            out->push_back('\x00');
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+void
+consus :: leveldb_data_key(const e::slice& table,
+                           const e::slice& key,
+                           uint64_t timestamp,
+                           std::string* out)
+{
+    out->clear();
+    out->reserve(1 + table.size() + key.size() + 4 + LEVELDB_TIMESTAMP_SZ);
+    out->push_back(LEVELDB_DATA_KEY_TAG);
+    escape(table, out);
+    escape(key, out);
+    char buf[LEVELDB_TIMESTAMP_SZ];
+    e::pack64be(~timestamp, buf);
+    out->append(buf, LEVELDB_TIMESTAMP_SZ);
+}
+
+uint64_t
+consus :: leveldb_data_key_timestamp(const char* key, size_t key_sz)
+{
+    assert(key_sz >= LEVELDB_TIMESTAMP_SZ);
+    uint64_t timestamp;
+    e::unpack64be(key + key_sz - LEVELDB_TIMESTAMP_SZ, &timestamp);
+    return ~timestamp;
+}
+
+bool
+consus :: leveldb_parse_data_key(const char* key, size_t key_sz,
+                                 std::string* table,
+                                 std::string* k,
+                                 uint64_t* timestamp)
+{
+    if (key_sz < 1 + LEVELDB_TIMESTAMP_SZ || key[0] != LEVELDB_DATA_KEY_TAG)
+    {
+        return false;
+    }
+
+    const char* ptr = key + 1;
+    const char* end = key + key_sz - LEVELDB_TIMESTAMP_SZ;
+
+    if (!unescape(&ptr, end, table) ||
+        !unescape(&ptr, end, k) ||
+        ptr != end)
+    {
+        return false;
+    }
+
+    *timestamp = leveldb_data_key_timestamp(key, key_sz);
+    return true;
+}
+
+void
+consus :: leveldb_lock_key(const e::slice& table,
+                           const e::slice& key,
+                           std::string* out)
+{
+    out->clear();
+    out->reserve(1 + table.size() + key.size() + 4);
+    out->push_back(LEVELDB_LOCK_KEY_TAG);
+    escape(table, out);
+    escape(key, out);
+}
+
+void
+consus :: leveldb_garbage_key(uint64_t file, std::string* out)
+{
+    out->clear();
+    out->push_back(LEVELDB_GARBAGE_KEY_TAG);
+    char buf[sizeof(uint64_t)];
+    e::pack64be(file, buf);
+    out->append(buf, sizeof(buf));
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_leveldb_keys_h_
+#define consus_kvs_leveldb_keys_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// The keys the LevelDB datalayer stores.  Both kinds sort correctly under
+// LevelDB's default bytewise comparator.
+//
+// A data key is 'd', the escaped table, the escaped key, and the bitwise
+// complement of the timestamp in big-endian order, so the versions of one key
+// are adjacent and the newest comes first.  A lock key is 'l', the escaped
+// table, and the escaped key.  Escaping replaces each 0x00 with 0x00 0xff and
+// ends the string with 0x00 0x01, so no escaped string is a prefix of another
+// and escaped strings sort in the same order as the originals.
+//
+// The format key is the single byte 'f'.  When it is present, every data
+// value is tagged:  a tombstone is still empty, and any other value is
+// LEVELDB_VALUE_INLINE followed by the value itself, or LEVELDB_VALUE_POINTER
+// followed by where the value log keeps it.  Data directories without it
+// predate the value log and store values untagged.  A garbage key is 'g' and
+// the big-endian number of a value log file; its value is the big-endian
+// count of bytes in that file that pruning or overwriting has made
+// unreachable.
+
+// the first byte of each kind of key
+#define LEVELDB_DATA_KEY_TAG 'd'
+#define LEVELDB_LOCK_KEY_TAG 'l'
+#define LEVELDB_FORMAT_KEY_TAG 'f'
+#define LEVELDB_GARBAGE_KEY_TAG 'g'
+// the encoding stores timestamps in this many trailing bytes
+#define LEVELDB_TIMESTAMP_SZ 8
+// the first byte of a tagged value
+#define LEVELDB_VALUE_INLINE 'i'
+#define LEVELDB_VALUE_POINTER 'p'
+
+void
+leveldb_data_key(const e::slice& table,
+                 const e::slice& key,
+                 uint64_t timestamp,
+                 std::string* out);
+uint64_t
+leveldb_data_key_timestamp(const char* key, size_t key_sz);
+// the inverse of leveldb_data_key; false if key is not a well-formed data key
+bool
+leveldb_parse_data_key(const char* key, size_t key_sz,
+                       std::string* table,
+                       std::string* k,
+                       uint64_t* timestamp);
+void
+leveldb_lock_key(const e::slice& table,
+                 const e::slice& key,
+                 std::string* out);
+void
+leveldb_garbage_key(uint64_t file, std::string* out);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_leveldb_keys_h_
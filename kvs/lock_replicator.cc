@@ -334,7 +334,7 @@ lock_replicator :: work_state_machine(daemon* d)
 {
     assert(m_init);
     configuration* c = d->get_config();
-    replica_set rs;
+    const replica_set* rs = NULL;
 
     if (!c->hash(d->m_us.dc, m_table, m_key, &rs))
     {
@@ -345,15 +345,15 @@ lock_replicator :: work_state_machine(daemon* d)
     unsigned complete = 0;
     std::vector<transaction_group> groups;
 
-    for (unsigned i = 0; i < rs.num_replicas; ++i)
+    for (unsigned i = 0; i < rs->num_replicas; ++i)
     {
-        ensure_stub_exists(rs.replicas[i]);
-        ensure_stub_exists(rs.transitioning[i]);
+        ensure_stub_exists(rs->replicas[i]);
+        ensure_stub_exists(rs->transitioning[i]);
         // need to do it again in case anything was created
-        lock_stub* owner1 = get_stub(rs.replicas[i]);
-        lock_stub* owner2 = get_stub(rs.transitioning[i]);
+        lock_stub* owner1 = get_stub(rs->replicas[i]);
+        lock_stub* owner2 = get_stub(rs->transitioning[i]);
         assert(owner1);
-        bool agree = !owner2 || replica_sets_agree(rs.replicas[i], owner1->rs, owner2->rs);
+        bool agree = !owner2 || replica_sets_agree(rs->replicas[i], owner1->rs, owner2->rs);
 
         if (owner1->tg == m_tg && (!owner2 || owner2->tg == m_tg) && agree)
         {
@@ -380,17 +380,18 @@ lock_replicator :: work_state_machine(daemon* d)
     }
 
     bool short_lock = false;
+    unsigned desired_replication = rs->desired_replication;
 
-    if (rs.desired_replication > rs.num_replicas)
+    if (desired_replication > rs->num_replicas)
     {
         LOG_EVERY_N(WARNING, 1000) << "too few kvs daemons to achieve desired replication factor: "
-                                   << rs.desired_replication - rs.num_replicas
+                                   << desired_replication - rs->num_replicas
                                    << " more daemons needed";
-        rs.desired_replication = rs.num_replicas;
+        desired_replication = rs->num_replicas;
         short_lock = true;
     }
 
-    const unsigned quorum = rs.desired_replication / 2 + 1;
+    const unsigned quorum = desired_replication / 2 + 1;
 
     if (complete >= quorum)
     {
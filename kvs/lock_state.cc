@@ -417,7 +417,7 @@ lock_state :: send_response(comm_id id, uint64_t nonce,
     }
 
     configuration* c = d->get_config();
-    replica_set rs;
+    const replica_set* rs = NULL;
 
     if (!c->hash(d->m_us.dc, m_state_key.table, m_state_key.key, &rs))
     {
@@ -429,9 +429,9 @@ lock_state :: send_response(comm_id id, uint64_t nonce,
                     + pack_size(KVS_RAW_LK_RESP)
                     + sizeof(uint64_t)
                     + pack_size(tg)
-                    + pack_size(rs);
+                    + pack_size(*rs);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_RAW_LK_RESP << nonce << tg << rs;
+        << KVS_RAW_LK_RESP << nonce << tg << *rs;
     d->send(id, msg);
 }
@@ -25,6 +25,10 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 // POSIX
 #include <signal.h>
 
@@ -37,6 +41,7 @@
 // po6
 #include <po6/net/hostname.h>
 #include <po6/net/location.h>
+#include <po6/time.h>
 
 // e
 #include <e/popt.h>
@@ -68,6 +73,16 @@ main(int argc, const char* argv[])
     const char* pidfile = "";
     bool has_pidfile = false;
     long threads = 0;
+    const char* datalayer = "leveldb";
+    bool snapshot = false;
+    long commit_delay = 0;
+    long value_threshold = 0;
+    long row_cache = 0;
+    long gc_horizon = 0;
+    long rocksdb_block_cache = 128;
+    long rocksdb_bloom_bits = 10;
+    long rocksdb_compaction_rate = 0;
+    long batch_delay = 0;
     bool log_immediate = false;
     sigset_t ss;
 
@@ -108,6 +123,36 @@ main(int argc, const char* argv[])
     ap.arg().name('t', "threads")
             .description("the number of threads which will handle network traffic")
             .metavar("N").as_long(&threads);
+    ap.arg().long_name("datalayer")
+            .description("store data with this backend: leveldb, memory, or rocksdb (default: leveldb)")
+            .metavar("name").as_string(&datalayer);
+    ap.arg().long_name("snapshot")
+            .description("with --datalayer=memory, save the data in --data at shutdown and reload it at startup")
+            .set_true(&snapshot);
+    ap.arg().long_name("commit-delay")
+            .description("hold each group commit open this long for more writes to join (default: 0)")
+            .metavar("us").as_long(&commit_delay);
+    ap.arg().long_name("value-log-threshold")
+            .description("with --datalayer=leveldb, keep values this large or larger in a separate value log (default: 0, disabled)")
+            .metavar("bytes").as_long(&value_threshold);
+    ap.arg().long_name("row-cache")
+            .description("cache the newest version of hot keys in this much memory (default: 0, disabled)")
+            .metavar("MB").as_long(&row_cache);
+    ap.arg().long_name("gc-horizon")
+            .description("discard versions hidden by a newer version this many seconds old (default: 0, keep every version)")
+            .metavar("S").as_long(&gc_horizon);
+    ap.arg().long_name("rocksdb-block-cache")
+            .description("with --datalayer=rocksdb, cache this much of the data's blocks (default: 128)")
+            .metavar("MB").as_long(&rocksdb_block_cache);
+    ap.arg().long_name("rocksdb-bloom-bits")
+            .description("with --datalayer=rocksdb, spend this many bloom filter bits per key (default: 10, 0 disables)")
+            .metavar("N").as_long(&rocksdb_bloom_bits);
+    ap.arg().long_name("rocksdb-compaction-rate")
+            .description("with --datalayer=rocksdb, limit flushes and compactions to this rate (default: 0, unlimited)")
+            .metavar("MB/s").as_long(&rocksdb_compaction_rate);
+    ap.arg().long_name("batch-delay")
+            .description("hold messages to each key value store this long to send them as one (default: 0, disabled)")
+            .metavar("us").as_long(&batch_delay);
     ap.arg().long_name("log-immediate")
             .description("immediately flush all log output")
             .set_true(&log_immediate).hidden();
@@ -204,6 +249,84 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    const bool in_memory = strcmp(datalayer, "memory") == 0;
+    const bool rocksdb = strcmp(datalayer, "rocksdb") == 0;
+
+    if (!in_memory && !rocksdb && strcmp(datalayer, "leveldb") != 0)
+    {
+        std::cerr << "unknown datalayer \"" << datalayer << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#ifndef CONSUS_ROCKSDB
+    if (rocksdb)
+    {
+        std::cerr << "this build does not support --datalayer=rocksdb; "
+                  << "reconfigure with --enable-rocksdb" << std::endl;
+        return EXIT_FAILURE;
+    }
+#endif
+
+    if (snapshot && !in_memory)
+    {
+        std::cerr << "--snapshot requires --datalayer=memory" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (commit_delay < 0)
+    {
+        std::cerr << "commit-delay must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (value_threshold < 0)
+    {
+        std::cerr << "value-log-threshold must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (value_threshold > 0 && strcmp(datalayer, "leveldb") != 0)
+    {
+        std::cerr << "--value-log-threshold requires --datalayer=leveldb" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (row_cache < 0)
+    {
+        std::cerr << "row-cache must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (gc_horizon < 0)
+    {
+        std::cerr << "gc-horizon must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (rocksdb_block_cache < 0)
+    {
+        std::cerr << "rocksdb-block-cache must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (rocksdb_bloom_bits < 0 || rocksdb_bloom_bits > 64)
+    {
+        std::cerr << "rocksdb-bloom-bits must be between 0 and 64" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (rocksdb_compaction_rate < 0)
+    {
+        std::cerr << "rocksdb-compaction-rate must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (batch_delay < 0)
+    {
+        std::cerr << "batch-delay must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     try
     {
         consus::daemon d;
@@ -213,7 +336,15 @@ main(int argc, const char* argv[])
                      std::string(pidfile), has_pidfile,
                      listen, bind_to,
                      conn.isset(), conn.conn_str(),
-                     data_center, threads);
+                     data_center, threads, datalayer, snapshot,
+                     commit_delay * PO6_MICROS,
+                     value_threshold,
+                     uint64_t(row_cache) * 1024ULL * 1024ULL,
+                     uint64_t(gc_horizon) * PO6_SECONDS,
+                     uint64_t(rocksdb_block_cache) * 1024ULL * 1024ULL,
+                     rocksdb_bloom_bits,
+                     uint64_t(rocksdb_compaction_rate) * 1024ULL * 1024ULL,
+                     uint64_t(batch_delay) * PO6_MICROS);
     }
     catch (std::exception& e)
     {
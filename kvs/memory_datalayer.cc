@@ -0,0 +1,709 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/path.h>
+
+// e
+#include <e/atomic.h>
+#include <e/serialization.h>
+
+// consus
+#include "kvs/memory_datalayer.h"
+
+using consus::memory_datalayer;
+
+// skiplist shape, as in LevelDB's memtable:  each level links a quarter of
+// the nodes of the level below
+#define MAX_HEIGHT 12
+#define BRANCHING 4
+// snapshot file layout:  a header, then one record per version or lock
+#define SNAPSHOT_FILE "MEMORY"
+#define SNAPSHOT_MAGIC "consus.memory"
+#define SNAPSHOT_FORMAT 1
+#define SNAPSHOT_VERSION 'v'
+#define SNAPSHOT_TOMBSTONE 't'
+#define SNAPSHOT_LOCK 'l'
+#define SNAPSHOT_BUFFER (1ULL * 1024ULL * 1024ULL)
+
+namespace
+{
+
+int
+compare(const std::string& a, const e::slice& b)
+{
+    const size_t sz = std::min(a.size(), b.size());
+    int cmp = memcmp(a.data(), b.data(), sz);
+
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+
+    return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+} // namespace
+
+// One version of a key; refcounted so that a reader's value outlives pruning.
+struct memory_datalayer::version
+{
+    version(uint64_t timestamp, bool tombstone, const e::slice& value);
+    ~version() throw ();
+
+    void inc() { e::atomic::increment_64_nobarrier(&ref, 1); }
+    void dec() { if (e::atomic::increment_64_fullbarrier(&ref, -1) == 0) delete this; }
+
+    const uint64_t timestamp;
+    const bool tombstone;
+    const std::string value;
+    version* next;
+    uint64_t ref;
+
+    private:
+        version(const version&);
+        version& operator = (const version&);
+};
+
+memory_datalayer :: version :: version(uint64_t t, bool tomb, const e::slice& v)
+    : timestamp(t)
+    , tombstone(tomb)
+    , value(v.cdata(), v.size())
+    , next(NULL)
+    , ref(1)
+{
+}
+
+memory_datalayer :: version :: ~version() throw ()
+{
+}
+
+// A key in the skiplist.  Nodes are never removed, so a reader may follow
+// the links without a lock; everything else in the node is under mtx.
+struct memory_datalayer::node
+{
+    node(const e::slice& table, const e::slice& key);
+    ~node() throw ();
+
+    int compare(const e::slice& table, const e::slice& key) const;
+    node* next(uint64_t level) { return e::atomic::load_ptr_acquire(&links[level]); }
+    void set_next(uint64_t level, node* n) { e::atomic::store_ptr_release(&links[level], n); }
+
+    const std::string table;
+    const std::string key;
+    node* links[MAX_HEIGHT];
+    po6::threads::mutex mtx;
+    // newest first
+    version* versions;
+    transaction_group lock;
+    bool locked;
+
+    private:
+        node(const node&);
+        node& operator = (const node&);
+};
+
+memory_datalayer :: node :: node(const e::slice& t, const e::slice& k)
+    : table(t.cdata(), t.size())
+    , key(k.cdata(), k.size())
+    , mtx()
+    , versions(NULL)
+    , lock()
+    , locked(false)
+{
+    for (size_t i = 0; i < MAX_HEIGHT; ++i)
+    {
+        links[i] = NULL;
+    }
+}
+
+memory_datalayer :: node :: ~node() throw ()
+{
+    while (versions)
+    {
+        version* v = versions;
+        versions = v->next;
+        v->dec();
+    }
+}
+
+int
+memory_datalayer :: node :: compare(const e::slice& t, const e::slice& k) const
+{
+    int cmp = ::compare(table, t);
+    return cmp != 0 ? cmp : ::compare(key, k);
+}
+
+struct memory_datalayer::reference : public datalayer::reference
+{
+    reference(version* v);
+    virtual ~reference() throw ();
+
+    version* v;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+memory_datalayer :: reference :: reference(version* _v)
+    : datalayer::reference()
+    , v(_v)
+{
+    v->inc();
+}
+
+memory_datalayer :: reference :: ~reference() throw ()
+{
+    v->dec();
+}
+
+memory_datalayer :: memory_datalayer(bool snapshot)
+    : m_snapshot(snapshot)
+    , m_data()
+    , m_head(new node(e::slice(), e::slice()))
+    , m_height(1)
+    , m_insert_mtx()
+    , m_random(0x9e3779b97f4a7c15ULL)
+{
+}
+
+memory_datalayer :: ~memory_datalayer() throw ()
+{
+    node* n = m_head;
+
+    while (n)
+    {
+        node* next = n->next(0);
+        delete n;
+        n = next;
+    }
+}
+
+bool
+memory_datalayer :: init(std::string data)
+{
+    m_data = data;
+    return !m_snapshot || load(po6::path::join(m_data, SNAPSHOT_FILE));
+}
+
+consus_returncode
+memory_datalayer :: get(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp_le,
+                        uint64_t* timestamp,
+                        e::slice* value,
+                        datalayer::reference** ref)
+{
+    *timestamp = 0;
+    *value = e::slice();
+    *ref = NULL;
+    node* n = find(table, key);
+
+    if (!n)
+    {
+        return CONSUS_NOT_FOUND;
+    }
+
+    po6::threads::mutex::hold hold(&n->mtx);
+    version* v = n->versions;
+
+    while (v && v->timestamp > timestamp_le)
+    {
+        v = v->next;
+    }
+
+    if (!v)
+    {
+        return CONSUS_NOT_FOUND;
+    }
+
+    *timestamp = v->timestamp;
+    *value = e::slice(v->value);
+    *ref = new reference(v);
+    return v->tombstone ? CONSUS_NOT_FOUND : CONSUS_SUCCESS;
+}
+
+consus_returncode
+memory_datalayer :: put(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp,
+                        const e::slice& value)
+{
+    assert(!value.empty()); /* XXX */
+    insert_version(find_or_create(table, key), timestamp, false, value);
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+memory_datalayer :: del(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp)
+{
+    insert_version(find_or_create(table, key), timestamp, true, e::slice());
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+memory_datalayer :: read_lock(const e::slice& table,
+                              const e::slice& key,
+                              transaction_group* tg)
+{
+    *tg = transaction_group();
+    node* n = find(table, key);
+
+    if (!n)
+    {
+        return CONSUS_NOT_FOUND;
+    }
+
+    po6::threads::mutex::hold hold(&n->mtx);
+
+    if (!n->locked)
+    {
+        return CONSUS_NOT_FOUND;
+    }
+
+    *tg = n->lock;
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+memory_datalayer :: write_lock(const e::slice& table,
+                               const e::slice& key,
+                               const transaction_group& tg)
+{
+    node* n = find_or_create(table, key);
+    po6::threads::mutex::hold hold(&n->mtx);
+    n->lock = tg;
+    n->locked = true;
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+memory_datalayer :: apply(const datalayer::write* writes, size_t writes_sz)
+{
+    for (size_t i = 0; i < writes_sz; ++i)
+    {
+        const datalayer::write& w(writes[i]);
+        assert(w.tombstone || !w.value.empty()); /* XXX */
+        insert_version(find_or_create(w.table, w.key), w.timestamp,
+                       w.tombstone, w.tombstone ? e::slice() : w.value);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+memory_datalayer :: prune(uint64_t watermark,
+                          std::string* position,
+                          size_t max_keys,
+                          uint64_t* pruned)
+{
+    *pruned = 0;
+    node* n = m_head->next(0);
+
+    if (!position->empty())
+    {
+        e::slice table;
+        e::slice key;
+        e::unpacker up(*position);
+        up = up >> table >> key;
+
+        if (up.error())
+        {
+            position->clear();
+            return CONSUS_INVALID;
+        }
+
+        n = find_greater_or_equal(table, key, NULL);
+    }
+
+    position->clear();
+
+    for (size_t examined = 0; n; n = n->next(0), ++examined)
+    {
+        if (examined >= max_keys)
+        {
+            e::packer(position) << e::slice(n->table) << e::slice(n->key);
+            break;
+        }
+
+        version* garbage = NULL;
+
+        {
+            po6::threads::mutex::hold hold(&n->mtx);
+            version* v = n->versions;
+
+            while (v && v->timestamp > watermark)
+            {
+                v = v->next;
+            }
+
+            if (v)
+            {
+                garbage = v->next;
+                v->next = NULL;
+            }
+        }
+
+        while (garbage)
+        {
+            version* v = garbage;
+            garbage = v->next;
+            v->dec();
+            ++*pruned;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+bool
+memory_datalayer :: checkpoint()
+{
+    return !m_snapshot || save(po6::path::join(m_data, SNAPSHOT_FILE));
+}
+
+memory_datalayer::node*
+memory_datalayer :: find_greater_or_equal(const e::slice& table,
+                                          const e::slice& key,
+                                          node** prev)
+{
+    node* x = m_head;
+    uint64_t level = e::atomic::load_64_nobarrier(&m_height) - 1;
+
+    while (true)
+    {
+        node* next = x->next(level);
+
+        if (next && next->compare(table, key) < 0)
+        {
+            x = next;
+        }
+        else
+        {
+            if (prev)
+            {
+                prev[level] = x;
+            }
+
+            if (level == 0)
+            {
+                return next;
+            }
+
+            --level;
+        }
+    }
+}
+
+memory_datalayer::node*
+memory_datalayer :: find(const e::slice& table, const e::slice& key)
+{
+    node* n = find_greater_or_equal(table, key, NULL);
+    return n && n->compare(table, key) == 0 ? n : NULL;
+}
+
+memory_datalayer::node*
+memory_datalayer :: find_or_create(const e::slice& table, const e::slice& key)
+{
+    node* n = find(table, key);
+
+    if (n)
+    {
+        return n;
+    }
+
+    po6::threads::mutex::hold hold(&m_insert_mtx);
+    node* prev[MAX_HEIGHT];
+    n = find_greater_or_equal(table, key, prev);
+
+    if (n && n->compare(table, key) == 0)
+    {
+        return n;
+    }
+
+    const uint64_t height = random_height();
+    const uint64_t old_height = e::atomic::load_64_nobarrier(&m_height);
+
+    if (height > old_height)
+    {
+        for (uint64_t i = old_height; i < height; ++i)
+        {
+            prev[i] = m_head;
+        }
+
+        // a reader that sees the new height before the new links finds
+        // NULL at the upper levels of m_head and drops down
+        e::atomic::store_64_release(&m_height, height);
+    }
+
+    n = new node(table, key);
+
+    for (uint64_t i = 0; i < height; ++i)
+    {
+        n->set_next(i, prev[i]->next(i));
+        prev[i]->set_next(i, n);
+    }
+
+    return n;
+}
+
+uint64_t
+memory_datalayer :: random_height()
+{
+    uint64_t height = 1;
+
+    while (height < MAX_HEIGHT)
+    {
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 7;
+        m_random ^= m_random << 17;
+
+        if (m_random % BRANCHING != 0)
+        {
+            break;
+        }
+
+        ++height;
+    }
+
+    return height;
+}
+
+void
+memory_datalayer :: insert_version(node* n, uint64_t timestamp,
+                                   bool tombstone, const e::slice& value)
+{
+    version* v = new version(timestamp, tombstone, value);
+    po6::threads::mutex::hold hold(&n->mtx);
+    version** pos = &n->versions;
+
+    while (*pos && (*pos)->timestamp > timestamp)
+    {
+        pos = &(*pos)->next;
+    }
+
+    if (*pos && (*pos)->timestamp == timestamp)
+    {
+        version* old = *pos;
+        v->next = old->next;
+        *pos = v;
+        old->dec();
+    }
+    else
+    {
+        v->next = *pos;
+        *pos = v;
+    }
+}
+
+bool
+memory_datalayer :: load(const std::string& path)
+{
+    po6::io::fd fd(open(path.c_str(), O_RDONLY));
+
+    if (fd.get() < 0 && errno == ENOENT)
+    {
+        return true;
+    }
+
+    struct stat st;
+
+    if (fd.get() < 0 || fstat(fd.get(), &st) < 0)
+    {
+        PLOG(ERROR) << "could not open snapshot " << path;
+        return false;
+    }
+
+    std::string buf(st.st_size, '\0');
+
+    if (fd.xread(&buf[0], buf.size()) != static_cast<ssize_t>(buf.size()))
+    {
+        PLOG(ERROR) << "could not read snapshot " << path;
+        return false;
+    }
+
+    e::unpacker up(buf);
+    e::slice magic;
+    uint64_t format = 0;
+    up = up >> magic >> format;
+
+    if (up.error() || magic != e::slice(SNAPSHOT_MAGIC) || format != SNAPSHOT_FORMAT)
+    {
+        LOG(ERROR) << path << " is not a snapshot this version can read";
+        return false;
+    }
+
+    while (!up.error() && up.remain() > 0)
+    {
+        uint8_t type = 0;
+        e::slice table;
+        e::slice key;
+        up = up >> type >> table >> key;
+        uint64_t timestamp = 0;
+        e::slice value;
+        transaction_group tg;
+
+        switch (type)
+        {
+            case SNAPSHOT_VERSION:
+                up = up >> timestamp >> value;
+                break;
+            case SNAPSHOT_TOMBSTONE:
+                up = up >> timestamp;
+                break;
+            case SNAPSHOT_LOCK:
+                up = up >> tg;
+                break;
+            default:
+                up = up.error_out();
+                break;
+        }
+
+        if (up.error())
+        {
+            break;
+        }
+        else if (type == SNAPSHOT_LOCK)
+        {
+            write_lock(table, key, tg);
+        }
+        else
+        {
+            insert_version(find_or_create(table, key), timestamp,
+                           type == SNAPSHOT_TOMBSTONE, value);
+        }
+    }
+
+    if (up.error())
+    {
+        LOG(ERROR) << "snapshot " << path << " is corrupt";
+        return false;
+    }
+
+    return true;
+}
+
+// Writes versions oldest first so that load prepends each one.  The snapshot
+// is not a point-in-time image; it is complete when nothing writes during
+// the checkpoint, as at shutdown.
+bool
+memory_datalayer :: save(const std::string& path)
+{
+    const std::string tmp = path + ".tmp";
+    po6::io::fd fd(open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    if (fd.get() < 0)
+    {
+        PLOG(ERROR) << "could not create snapshot " << tmp;
+        return false;
+    }
+
+    std::string buf;
+    e::packer(&buf) << e::slice(SNAPSHOT_MAGIC) << uint64_t(SNAPSHOT_FORMAT);
+    std::vector<version*> versions;
+
+    for (node* n = m_head->next(0); n; n = n->next(0))
+    {
+        const e::slice table(n->table);
+        const e::slice key(n->key);
+
+        {
+            po6::threads::mutex::hold hold(&n->mtx);
+            versions.clear();
+
+            for (version* v = n->versions; v; v = v->next)
+            {
+                versions.push_back(v);
+            }
+
+            for (size_t i = versions.size(); i > 0; --i)
+            {
+                const version* v = versions[i - 1];
+
+                if (v->tombstone)
+                {
+                    e::packer(&buf) << uint8_t(SNAPSHOT_TOMBSTONE) << table << key
+                                    << v->timestamp;
+                }
+                else
+                {
+                    e::packer(&buf) << uint8_t(SNAPSHOT_VERSION) << table << key
+                                    << v->timestamp << e::slice(v->value);
+                }
+            }
+
+            if (n->locked)
+            {
+                e::packer(&buf) << uint8_t(SNAPSHOT_LOCK) << table << key << n->lock;
+            }
+        }
+
+        if (buf.size() >= SNAPSHOT_BUFFER)
+        {
+            if (fd.xwrite(buf.data(), buf.size()) != static_cast<ssize_t>(buf.size()))
+            {
+                PLOG(ERROR) << "could not write snapshot " << tmp;
+                return false;
+            }
+
+            buf.clear();
+        }
+    }
+
+    if ((!buf.empty() &&
+         fd.xwrite(buf.data(), buf.size()) != static_cast<ssize_t>(buf.size())) ||
+        fsync(fd.get()) < 0 ||
+        rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        PLOG(ERROR) << "could not write snapshot " << path;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_memory_datalayer_h_
+#define consus_kvs_memory_datalayer_h_
+
+// STL
+#include <string>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Keeps every key in an ordered skiplist in memory.  Reads never block on
+// the list itself; inserting a new key takes a single mutex, and each key's
+// versions and lock sit behind a mutex of their own.  Nothing is durable
+// unless snapshots are enabled, in which case checkpoint writes the data to
+// the data directory and init reads it back.
+class memory_datalayer : public datalayer
+{
+    public:
+        memory_datalayer(bool snapshot);
+        virtual ~memory_datalayer() throw ();
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            transaction_group* tg);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const transaction_group& tg);
+        virtual consus_returncode apply(const datalayer::write* writes, size_t writes_sz);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        std::string* position,
+                                        size_t max_keys,
+                                        uint64_t* pruned);
+        virtual bool checkpoint();
+
+    private:
+        struct version;
+        struct node;
+        struct reference;
+
+    private:
+        node* find_greater_or_equal(const e::slice& table,
+                                    const e::slice& key,
+                                    node** prev);
+        node* find(const e::slice& table, const e::slice& key);
+        node* find_or_create(const e::slice& table, const e::slice& key);
+        uint64_t random_height();
+        void insert_version(node* n, uint64_t timestamp,
+                            bool tombstone, const e::slice& value);
+        bool load(const std::string& path);
+        bool save(const std::string& path);
+
+    private:
+        const bool m_snapshot;
+        std::string m_data;
+        node* m_head;
+        // highest level in use; readers may see a stale value, which is safe
+        uint64_t m_height;
+        po6::threads::mutex m_insert_mtx;
+        uint64_t m_random;
+
+    private:
+        memory_datalayer(const memory_datalayer&);
+        memory_datalayer& operator = (const memory_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_memory_datalayer_h_
@@ -79,6 +79,9 @@ read_replicator :: read_replicator(uint64_t key)
     , m_vbacking()
     , m_timestamp(0)
     , m_requests()
+    , m_lease_target()
+    , m_lease_request_time(0)
+    , m_lease_abandoned(false)
 {
 }
 
@@ -189,6 +192,43 @@ read_replicator :: response(comm_id id, consus_returncode rc,
     work_state_machine(d);
 }
 
+void
+read_replicator :: lease_response(comm_id id, bool leased, consus_returncode rc,
+                                  uint64_t timestamp, const e::slice& value,
+                                  const replica_set& rs,
+                                  std::auto_ptr<e::buffer> backing, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_init || m_finished || m_lease_abandoned || id != m_lease_target)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " dropped lease response from " << id;
+        return;
+    }
+
+    configuration* c = d->get_config();
+    const replica_set* ours = NULL;
+    c->hash(d->m_us.dc, m_table, m_key, &ours);
+
+    if (leased && returncode_is_final(rc) &&
+        d->leaseholder(c, *ours) == id &&
+        replica_sets_agree(id, *ours, rs))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " leased response rc=" << rc
+                                   << " timestamp=" << timestamp << " from=" << id;
+        m_status = rc;
+        m_value = value;
+        m_vbacking = backing;
+        m_timestamp = timestamp;
+        send_response(d);
+        return;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << " " << id << " did not answer under lease; reading from quorum";
+    m_lease_abandoned = true;
+    work_state_machine(d);
+}
+
 void
 read_replicator :: externally_work_state_machine(daemon* d)
 {
@@ -233,7 +273,7 @@ read_replicator :: work_state_machine(daemon* d)
 {
     assert(m_init);
     configuration* c = d->get_config();
-    replica_set rs;
+    const replica_set* rs = NULL;
 
     if (!c->hash(d->m_us.dc, m_table, m_key, &rs))
     {
@@ -241,19 +281,25 @@ read_replicator :: work_state_machine(daemon* d)
     }
 
     const uint64_t now = po6::monotonic_time();
+
+    if (!m_lease_abandoned && work_lease(c, *rs, now, d))
+    {
+        return;
+    }
+
     unsigned complete = 0;
 
-    for (unsigned i = 0; i < rs.num_replicas; ++i)
+    for (unsigned i = 0; i < rs->num_replicas; ++i)
     {
-        read_stub* stub = get_stub(rs.replicas[i]);
+        read_stub* stub = get_stub(rs->replicas[i]);
 
         if (!stub)
         {
-            m_requests.push_back(read_stub(rs.replicas[i]));
+            m_requests.push_back(read_stub(rs->replicas[i]));
             stub = &m_requests.back();
         }
 
-        if (replica_sets_agree(rs.replicas[i], rs, stub->rs))
+        if (replica_sets_agree(rs->replicas[i], *rs, stub->rs))
         {
             ++complete;
         }
@@ -263,34 +309,80 @@ read_replicator :: work_state_machine(daemon* d)
         }
     }
 
-    if (rs.desired_replication > rs.num_replicas)
+    unsigned desired_replication = rs->desired_replication;
+
+    if (desired_replication > rs->num_replicas)
     {
         LOG_EVERY_N(WARNING, 1000) << "too few kvs daemons to achieve desired replication factor: "
-                                   << rs.desired_replication - rs.num_replicas
+                                   << desired_replication - rs->num_replicas
                                    << " more daemons needed";
-        rs.desired_replication = rs.num_replicas;
+        desired_replication = rs->num_replicas;
     }
 
-    const unsigned quorum = rs.desired_replication / 2 + 1;
+    const unsigned quorum = desired_replication / 2 + 1;
 
     if (complete >= quorum)
     {
-        m_finished = true;
-        const size_t sz = BUSYBEE_HEADER_SIZE
-                        + pack_size(KVS_REP_RD_RESP)
-                        + sizeof(uint64_t)
-                        + pack_size(m_status)
-                        + sizeof(uint64_t)
-                        + pack_size(m_value);
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE)
-            << KVS_REP_RD_RESP << m_nonce << m_status << m_timestamp << m_value;
-        d->send(m_id, msg);
-        LOG_IF(INFO, s_debug_mode) << "sending read response " << m_status
-                                   << " nonce=" << m_nonce << " to " << m_id;
+        send_response(d);
     }
 }
 
+// Returns true while the leaseholder is expected to answer the read by
+// itself, and false once the read must go to a quorum.  Writes do not
+// complete without the leaseholder, so whatever it holds is at least as new
+// as anything a quorum could return.
+bool
+read_replicator :: work_lease(configuration* c, const replica_set& rs, uint64_t now, daemon* d)
+{
+    const comm_id holder = d->leaseholder(c, rs);
+
+    if (holder == comm_id() ||
+        (m_lease_target != comm_id() && m_lease_target != holder))
+    {
+        m_lease_abandoned = true;
+        return false;
+    }
+
+    if (holder == d->m_us.id)
+    {
+        m_lease_abandoned = true;
+
+        if (!d->holds_lease(c, rs))
+        {
+            return false;
+        }
+
+        uint64_t timestamp = 0;
+        e::slice value;
+        datalayer::reference* ref = NULL;
+        m_status = d->m_data->get(m_table, m_key, UINT64_MAX, &timestamp, &value, &ref);
+        // value points into ref; it must outlive the response
+        std::auto_ptr<datalayer::reference> pin(ref);
+        m_timestamp = timestamp;
+        m_value = value;
+        LOG_IF(INFO, s_debug_mode) << logid() << " read under lease rc=" << m_status
+                                   << " timestamp=" << m_timestamp;
+        send_response(d);
+        m_value = e::slice();
+        return true;
+    }
+
+    if (m_lease_request_time == 0)
+    {
+        send_lease_request(holder, now, d);
+        return true;
+    }
+
+    if (m_lease_request_time + d->resend_interval() < now)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " lease read to " << holder << " timed out; reading from quorum";
+        m_lease_abandoned = true;
+        return false;
+    }
+
+    return true;
+}
+
 // It's tempting to dedupe this with {write,lock}-replicator.  Reads and writes
 // may have different sets of "terminal" returncodes in the future that
 // represent non-transient errors; keeping them as different functions reminds
@@ -344,3 +436,42 @@ read_replicator :: send_read_request(read_stub* stub, uint64_t now, daemon* d)
     d->send(stub->target, msg);
     stub->last_request_time = now;
 }
+
+void
+read_replicator :: send_lease_request(comm_id target, uint64_t now, daemon* d)
+{
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid() << " sending lease read target=" << target;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_LEASE_RD)
+                    + sizeof(uint64_t)
+                    + pack_size(m_table)
+                    + pack_size(m_key);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_LEASE_RD << m_state_key << m_table << m_key;
+    d->send(target, msg);
+    m_lease_target = target;
+    m_lease_request_time = now;
+}
+
+void
+read_replicator :: send_response(daemon* d)
+{
+    m_finished = true;
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_REP_RD_RESP)
+                    + sizeof(uint64_t)
+                    + pack_size(m_status)
+                    + sizeof(uint64_t)
+                    + pack_size(m_value);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_REP_RD_RESP << m_nonce << m_status << m_timestamp << m_value;
+    d->send(m_id, msg);
+    LOG_IF(INFO, s_debug_mode) << "sending read response " << m_status
+                               << " nonce=" << m_nonce << " to " << m_id;
+}
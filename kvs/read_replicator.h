@@ -40,6 +40,7 @@
 #include "common/ids.h"
 
 BEGIN_CONSUS_NAMESPACE
+class configuration;
 class daemon;
 
 class read_replicator
@@ -60,6 +61,10 @@ class read_replicator
                       uint64_t timestamp, const e::slice& value,
                       const replica_set& rs,
                       std::auto_ptr<e::buffer> backing, daemon* d);
+        void lease_response(comm_id id, bool leased, consus_returncode rc,
+                            uint64_t timestamp, const e::slice& value,
+                            const replica_set& rs,
+                            std::auto_ptr<e::buffer> backing, daemon* d);
         void externally_work_state_machine(daemon* d);
         std::string debug_dump();
 
@@ -70,8 +75,11 @@ class read_replicator
         std::string logid();
         read_stub* get_stub(comm_id id);
         void work_state_machine(daemon* d);
+        bool work_lease(configuration* c, const replica_set& rs, uint64_t now, daemon* d);
         bool returncode_is_final(consus_returncode rc);
         void send_read_request(read_stub* stub, uint64_t now, daemon* d);
+        void send_lease_request(comm_id target, uint64_t now, daemon* d);
+        void send_response(daemon* d);
 
     private:
         const uint64_t m_state_key;
@@ -88,6 +96,11 @@ class read_replicator
         std::auto_ptr<e::buffer> m_vbacking;
         uint64_t m_timestamp;
         std::vector<read_stub> m_requests;
+        // the leaseholder asked to answer alone; once it fails to, the
+        // read goes to the quorum and never back
+        comm_id m_lease_target;
+        uint64_t m_lease_request_time;
+        bool m_lease_abandoned;
 };
 
 END_CONSUS_NAMESPACE
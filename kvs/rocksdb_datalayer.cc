@@ -0,0 +1,468 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef CONSUS_ROCKSDB
+
+// C
+#include <assert.h>
+#include <string.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// Google Log
+#include <glog/logging.h>
+
+// RocksDB
+#include <rocksdb/cache.h>
+#include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/rate_limiter.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
+
+// e
+#include <e/serialization.h>
+#include <e/strescape.h>
+
+// consus
+#include "kvs/leveldb_keys.h"
+#include "kvs/rocksdb_datalayer.h"
+
+using consus::rocksdb_datalayer;
+
+// the column family holding locks; versions live in the default one
+#define LOCKS_COLUMN_FAMILY "locks"
+// flush the deletes of a prune pass once a batch grows this large
+#define PRUNE_BATCH_BYTES (1ULL * 1024ULL * 1024ULL)
+
+namespace
+{
+
+// Every version of a key shares the encoded key minus its trailing
+// timestamp, so building the bloom filters over that prefix lets the seek in
+// get skip any table that holds no version of the key at all.
+class version_prefix : public rocksdb::SliceTransform
+{
+    public:
+        version_prefix() {}
+        virtual ~version_prefix() throw () {}
+
+    public:
+        virtual const char* Name() const { return "consus.version_prefix"; }
+        virtual rocksdb::Slice Transform(const rocksdb::Slice& key) const
+        { return rocksdb::Slice(key.data(), key.size() - LEVELDB_TIMESTAMP_SZ); }
+        virtual bool InDomain(const rocksdb::Slice& key) const
+        { return key.size() > LEVELDB_TIMESTAMP_SZ; }
+};
+
+} // namespace
+
+// pins the value returned by get
+struct rocksdb_datalayer::reference : public datalayer::reference
+{
+    reference(rocksdb::Iterator* it);
+    virtual ~reference() throw ();
+
+    std::auto_ptr<rocksdb::Iterator> it;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+rocksdb_datalayer :: reference :: reference(rocksdb::Iterator* _it)
+    : datalayer::reference()
+    , it(_it)
+{
+}
+
+rocksdb_datalayer :: reference :: ~reference() throw ()
+{
+}
+
+rocksdb_datalayer :: rocksdb_datalayer(uint64_t block_cache,
+                                       unsigned bloom_bits,
+                                       uint64_t compaction_rate)
+    : m_block_cache(block_cache)
+    , m_bloom_bits(bloom_bits)
+    , m_compaction_rate(compaction_rate)
+    , m_db(NULL)
+    , m_data(NULL)
+    , m_locks(NULL)
+{
+}
+
+rocksdb_datalayer :: ~rocksdb_datalayer() throw ()
+{
+    delete m_data;
+    delete m_locks;
+    delete m_db;
+}
+
+bool
+rocksdb_datalayer :: init(std::string data)
+{
+    rocksdb::Options opts;
+    opts.create_if_missing = true;
+    opts.create_missing_column_families = true;
+    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L);
+    opts.IncreaseParallelism(std::max(sysconf(_SC_NPROCESSORS_ONLN), 2L));
+
+    if (m_compaction_rate > 0)
+    {
+        opts.rate_limiter.reset(rocksdb::NewGenericRateLimiter(m_compaction_rate));
+    }
+
+    rocksdb::BlockBasedTableOptions table;
+    table.block_cache = rocksdb::NewLRUCache(m_block_cache);
+
+    if (m_bloom_bits > 0)
+    {
+        table.filter_policy.reset(rocksdb::NewBloomFilterPolicy(m_bloom_bits, false));
+    }
+
+    // locks are only ever read with point lookups on the whole key
+    rocksdb::ColumnFamilyOptions locks_opts(opts);
+    locks_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table));
+
+    // versions are only ever read by seeking within one key's versions
+    rocksdb::ColumnFamilyOptions data_opts(opts);
+    table.whole_key_filtering = false;
+    data_opts.prefix_extractor.reset(new version_prefix());
+    data_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table));
+
+    std::vector<rocksdb::ColumnFamilyDescriptor> families;
+    families.push_back(rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, data_opts));
+    families.push_back(rocksdb::ColumnFamilyDescriptor(LOCKS_COLUMN_FAMILY, locks_opts));
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+    rocksdb::Status st = rocksdb::DB::Open(rocksdb::DBOptions(opts), data, families, &handles, &m_db);
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "could not open rocksdb: " << st.ToString();
+        return false;
+    }
+
+    assert(handles.size() == 2);
+    m_data = handles[0];
+    m_locks = handles[1];
+    return true;
+}
+
+consus_returncode
+rocksdb_datalayer :: get(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp_le,
+                         uint64_t* timestamp,
+                         e::slice* value,
+                         datalayer::reference** ref)
+{
+    *timestamp = 0;
+    *value = e::slice();
+    *ref = NULL;
+    std::string dk;
+    leveldb_data_key(table, key, timestamp_le, &dk);
+    rocksdb::ReadOptions opts;
+    opts.prefix_same_as_start = true;
+    std::auto_ptr<rocksdb::Iterator> it(m_db->NewIterator(opts, m_data));
+    it->Seek(dk);
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << it->status().ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+    else if (!it->Valid() || dk.size() != it->key().size() ||
+             memcmp(dk.data(), it->key().data(),
+                    dk.size() - LEVELDB_TIMESTAMP_SZ) != 0)
+    {
+        return CONSUS_NOT_FOUND;
+    }
+
+    *timestamp = leveldb_data_key_timestamp(it->key().data(), it->key().size());
+    *value = e::slice(it->value().data(), it->value().size());
+    *ref = new reference(it.release());
+
+    if (value->empty())
+    {
+        return CONSUS_NOT_FOUND;
+    }
+    else
+    {
+        return CONSUS_SUCCESS;
+    }
+}
+
+consus_returncode
+rocksdb_datalayer :: put(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp,
+                         const e::slice& value)
+{
+    assert(!value.empty()); /* XXX */
+    std::string dk;
+    leveldb_data_key(table, key, timestamp, &dk);
+    rocksdb::WriteBatch batch;
+    batch.Put(m_data, dk, rocksdb::Slice(value.cdata(), value.size()));
+    return commit(&batch);
+}
+
+consus_returncode
+rocksdb_datalayer :: del(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp)
+{
+    std::string dk;
+    leveldb_data_key(table, key, timestamp, &dk);
+    rocksdb::WriteBatch batch;
+    batch.Put(m_data, dk, rocksdb::Slice());
+    return commit(&batch);
+}
+
+consus_returncode
+rocksdb_datalayer :: read_lock(const e::slice& table,
+                               const e::slice& key,
+                               transaction_group* tg)
+{
+    std::string lk;
+    leveldb_lock_key(table, key, &lk);
+    std::string val;
+    rocksdb::Status st = m_db->Get(rocksdb::ReadOptions(), m_locks, lk, &val);
+
+    if (st.IsNotFound())
+    {
+        *tg = transaction_group();
+        return CONSUS_NOT_FOUND;
+    }
+    else if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    e::unpacker up(val);
+    up = up >> *tg;
+
+    if (up.error())
+    {
+        LOG(ERROR) << "corrupt lock (\""
+                   << e::strescape(table.str()) << "\", \""
+                   << e::strescape(key.str()) << "\")";
+        return CONSUS_INVALID;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+rocksdb_datalayer :: write_lock(const e::slice& table,
+                                const e::slice& key,
+                                const transaction_group& tg)
+{
+    std::string lk;
+    leveldb_lock_key(table, key, &lk);
+    std::string val;
+    e::packer(&val) << tg;
+    rocksdb::WriteBatch batch;
+    batch.Put(m_locks, lk, val);
+    return commit(&batch);
+}
+
+consus_returncode
+rocksdb_datalayer :: apply(const datalayer::write* writes, size_t writes_sz)
+{
+    if (writes_sz == 0)
+    {
+        return CONSUS_SUCCESS;
+    }
+
+    rocksdb::WriteBatch batch;
+    std::string dk;
+
+    for (size_t i = 0; i < writes_sz; ++i)
+    {
+        assert(writes[i].tombstone || !writes[i].value.empty()); /* XXX */
+        leveldb_data_key(writes[i].table, writes[i].key, writes[i].timestamp, &dk);
+        rocksdb::Slice val;
+
+        if (!writes[i].tombstone)
+        {
+            val = rocksdb::Slice(writes[i].value.cdata(), writes[i].value.size());
+        }
+
+        batch.Put(m_data, dk, val);
+    }
+
+    return commit(&batch);
+}
+
+// Identical to leveldb_datalayer::prune, but for the data column family.  The
+// scan asks for total order because the prefix bloom filters only know how
+// to find the versions of one key.
+consus_returncode
+rocksdb_datalayer :: prune(uint64_t watermark,
+                           std::string* position,
+                           size_t max_keys,
+                           uint64_t* pruned)
+{
+    *pruned = 0;
+    rocksdb::ReadOptions ropts;
+    ropts.fill_cache = false;
+    ropts.total_order_seek = true;
+    std::auto_ptr<rocksdb::Iterator> it(m_db->NewIterator(ropts, m_data));
+
+    if (position->empty())
+    {
+        it->SeekToFirst();
+    }
+    else
+    {
+        it->Seek(*position);
+    }
+
+    rocksdb::WriteBatch batch;
+    size_t batch_bytes = 0;
+    std::string group;
+    bool shadowed = false;
+    size_t examined = 0;
+    position->clear();
+
+    for (; it->Valid(); it->Next())
+    {
+        const rocksdb::Slice k = it->key();
+
+        if (k.size() <= LEVELDB_TIMESTAMP_SZ || k[0] != LEVELDB_DATA_KEY_TAG)
+        {
+            break;
+        }
+
+        const size_t prefix_sz = k.size() - LEVELDB_TIMESTAMP_SZ;
+
+        if (group.size() != prefix_sz ||
+            memcmp(group.data(), k.data(), prefix_sz) != 0)
+        {
+            // only stop between keys, so the next call starts on a newest
+            // version
+            if (examined >= max_keys)
+            {
+                position->assign(k.data(), k.size());
+                break;
+            }
+
+            group.assign(k.data(), prefix_sz);
+            shadowed = false;
+            ++examined;
+        }
+
+        if (shadowed)
+        {
+            batch.Delete(m_data, k);
+            batch_bytes += k.size();
+            ++*pruned;
+        }
+        else if (leveldb_data_key_timestamp(k.data(), k.size()) <= watermark)
+        {
+            shadowed = true;
+        }
+
+        if (batch_bytes >= PRUNE_BATCH_BYTES)
+        {
+            rocksdb::Status st = m_db->Write(rocksdb::WriteOptions(), &batch);
+
+            if (!st.ok())
+            {
+                LOG(ERROR) << "rocksdb error: " << st.ToString();
+                position->clear();
+                return CONSUS_SERVER_ERROR;
+            }
+
+            batch.Clear();
+            batch_bytes = 0;
+        }
+    }
+
+    rocksdb::Status st = it->status();
+
+    if (st.ok())
+    {
+        st = m_db->Write(rocksdb::WriteOptions(), &batch);
+    }
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        position->clear();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+std::string
+rocksdb_datalayer :: debug_dump()
+{
+    std::string stats;
+
+    if (!m_db->GetProperty(m_data, "rocksdb.stats", &stats))
+    {
+        stats.clear();
+    }
+
+    return stats;
+}
+
+// RocksDB already group commits:  concurrent synchronous writers queue behind
+// one leader that appends all of their batches to the write-ahead log and
+// syncs it once, so unlike leveldb_datalayer there is no staging here.
+consus_returncode
+rocksdb_datalayer :: commit(rocksdb::WriteBatch* batch)
+{
+    rocksdb::WriteOptions opts;
+    opts.sync = true;
+    rocksdb::Status st = m_db->Write(opts, batch);
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+#endif // CONSUS_ROCKSDB
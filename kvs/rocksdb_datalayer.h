@@ -0,0 +1,112 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_rocksdb_datalayer_h_
+#define consus_kvs_rocksdb_datalayer_h_
+
+// STL
+#include <string>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+namespace rocksdb
+{
+class ColumnFamilyHandle;
+class DB;
+class WriteBatch;
+}
+
+BEGIN_CONSUS_NAMESPACE
+
+// Stores versions and locks in two column families of one RocksDB instance,
+// so that lock traffic neither dilutes the bloom filters nor churns the
+// compactions of the data.  Only built when configured with
+// --enable-rocksdb; the daemon refuses to select it otherwise.
+class rocksdb_datalayer : public datalayer
+{
+    public:
+        // block_cache is in bytes and shared by both column families,
+        // bloom_bits is the bloom filter bits per key (zero disables them),
+        // and compaction_rate caps flush and compaction writes in bytes per
+        // second (zero leaves them unthrottled)
+        rocksdb_datalayer(uint64_t block_cache,
+                          unsigned bloom_bits,
+                          uint64_t compaction_rate);
+        virtual ~rocksdb_datalayer() throw ();
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            transaction_group* tg);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const transaction_group& tg);
+        virtual consus_returncode apply(const datalayer::write* writes, size_t writes_sz);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        std::string* position,
+                                        size_t max_keys,
+                                        uint64_t* pruned);
+        virtual std::string debug_dump();
+
+    private:
+        struct reference;
+
+    private:
+        consus_returncode commit(rocksdb::WriteBatch* batch);
+
+    private:
+        const uint64_t m_block_cache;
+        const unsigned m_bloom_bits;
+        const uint64_t m_compaction_rate;
+        rocksdb::DB* m_db;
+        rocksdb::ColumnFamilyHandle* m_data;
+        rocksdb::ColumnFamilyHandle* m_locks;
+
+    private:
+        rocksdb_datalayer(const rocksdb_datalayer&);
+        rocksdb_datalayer& operator = (const rocksdb_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_rocksdb_datalayer_h_
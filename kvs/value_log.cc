@@ -0,0 +1,601 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <memory>
+
+// Google Log
+#include <glog/logging.h>
+
+// e
+#include <e/atomic.h>
+#include <e/guard.h>
+
+// consus
+#include "common/crc32c.h"
+#include "kvs/value_log.h"
+
+using consus::value_log;
+
+#define VALUE_LOG_PREFIX "value-log-"
+#define VALUE_LOG_NAME_SIZE 32
+// start a new file once the current one would grow past this size
+#define VALUE_LOG_FILE_BYTES (64ULL * 1024ULL * 1024ULL)
+
+static void
+file_name(uint64_t number, char* name)
+{
+    snprintf(name, VALUE_LOG_NAME_SIZE, VALUE_LOG_PREFIX "%016llx", (unsigned long long)number);
+}
+
+static bool
+parse_file_name(const char* name, uint64_t* number)
+{
+    const size_t prefix_sz = strlen(VALUE_LOG_PREFIX);
+
+    if (strncmp(name, VALUE_LOG_PREFIX, prefix_sz) != 0 ||
+        strlen(name) != prefix_sz + 16)
+    {
+        return false;
+    }
+
+    char* end = NULL;
+    *number = strtoull(name + prefix_sz, &end, 16);
+    return *end == '\0';
+}
+
+static bool
+write_fully(int fd, const char* buf, size_t buf_sz, uint64_t offset)
+{
+    while (buf_sz > 0)
+    {
+        ssize_t ret = pwrite(fd, buf, buf_sz, offset);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret <= 0)
+        {
+            return false;
+        }
+
+        buf += ret;
+        buf_sz -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+// A read-only view of one file.  Files only grow, so a mapping stays correct
+// for everything appended before it was made; reads beyond it make a larger
+// one, and the old view lives on until the last value read through it is
+// released.
+class value_log::mapping
+{
+    public:
+        mapping(const char* base, size_t size);
+        ~mapping() throw ();
+
+    public:
+        void inc() { e::atomic::increment_64_nobarrier(&ref, 1); }
+        void dec() { if (e::atomic::increment_64_fullbarrier(&ref, -1) == 0) delete this; }
+
+    public:
+        const char* const base;
+        const size_t size;
+
+    private:
+        uint64_t ref;
+
+    private:
+        mapping(const mapping&);
+        mapping& operator = (const mapping&);
+};
+
+value_log :: mapping :: mapping(const char* b, size_t sz)
+    : base(b)
+    , size(sz)
+    , ref(1)
+{
+}
+
+value_log :: mapping :: ~mapping() throw ()
+{
+    munmap(const_cast<char*>(base), size);
+}
+
+struct value_log::file
+{
+    file(uint64_t number, int fd, uint64_t size);
+    ~file() throw ();
+
+    const uint64_t number;
+    po6::io::fd fd;
+    uint64_t size;
+    uint64_t garbage;
+    mapping* map;
+    // writes in flight that carry a pointer into the file, and how many
+    // there have ever been
+    uint64_t pinned;
+    uint64_t pins;
+
+    private:
+        file(const file&);
+        file& operator = (const file&);
+};
+
+value_log :: file :: file(uint64_t n, int f, uint64_t sz)
+    : number(n)
+    , fd(f)
+    , size(sz)
+    , garbage(0)
+    , map(NULL)
+    , pinned(0)
+    , pins(0)
+{
+}
+
+value_log :: file :: ~file() throw ()
+{
+    if (map)
+    {
+        map->dec();
+    }
+}
+
+value_log :: value_log()
+    : m_path()
+    , m_dir()
+    , m_mtx()
+    , m_files()
+    , m_active(NULL)
+    , m_next_file(1)
+    , m_appended(0)
+    , m_synced(0)
+{
+}
+
+value_log :: ~value_log() throw ()
+{
+    for (file_map_t::iterator it = m_files.begin(); it != m_files.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+bool
+value_log :: open(const std::string& dir)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_path = dir;
+    struct stat st;
+    int ret = stat(m_path.c_str(), &st);
+
+    if (ret < 0 && errno == ENOENT)
+    {
+        if (mkdir(m_path.c_str(), S_IRWXU) < 0)
+        {
+            PLOG(ERROR) << "could not create value log " << m_path;
+            return false;
+        }
+
+        ret = stat(m_path.c_str(), &st);
+    }
+
+    if (ret < 0)
+    {
+        PLOG(ERROR) << "could not stat value log " << m_path;
+        return false;
+    }
+    else if (!S_ISDIR(st.st_mode))
+    {
+        LOG(ERROR) << "value log " << m_path << " is not a directory";
+        return false;
+    }
+
+    m_dir = ::open(m_path.c_str(), O_RDONLY);
+    std::vector<uint64_t> numbers;
+
+    if (m_dir.get() < 0 || !list_files(&numbers))
+    {
+        PLOG(ERROR) << "could not read value log " << m_path;
+        return false;
+    }
+
+    for (size_t i = 0; i < numbers.size(); ++i)
+    {
+        char name[VALUE_LOG_NAME_SIZE];
+        file_name(numbers[i], name);
+        std::auto_ptr<file> f(new file(numbers[i], openat(m_dir.get(), name, O_RDONLY), 0));
+        struct stat fst;
+        m_next_file = std::max(m_next_file, numbers[i] + 1);
+
+        if (f->fd.get() < 0 || fstat(f->fd.get(), &fst) < 0)
+        {
+            PLOG(ERROR) << "could not open value log file " << name;
+            return false;
+        }
+
+        // nothing can point into a file that was never appended to
+        if (fst.st_size == 0)
+        {
+            unlinkat(m_dir.get(), name, 0);
+            continue;
+        }
+
+        f->size = fst.st_size;
+        m_files[numbers[i]] = f.release();
+    }
+
+    return true;
+}
+
+bool
+value_log :: append(const e::slice& value, pointer* ptr)
+{
+    ptr->length = value.size();
+    ptr->checksum = crc32c(0, value.data(), value.size());
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_active && m_active->size > 0 &&
+        m_active->size + value.size() > VALUE_LOG_FILE_BYTES)
+    {
+        // only the active file is synced by sync, so make the rest of this
+        // one durable before moving on
+        if (fdatasync(m_active->fd.get()) < 0)
+        {
+            PLOG(ERROR) << "could not sync value log file " << m_active->number;
+            return false;
+        }
+
+        file* retired = m_active;
+        m_active = NULL;
+
+        if (retired->garbage >= retired->size)
+        {
+            remove(m_files.find(retired->number));
+        }
+    }
+
+    if (!m_active)
+    {
+        m_active = create(m_next_file);
+
+        if (!m_active)
+        {
+            PLOG(ERROR) << "could not create value log file " << m_next_file;
+            return false;
+        }
+
+        ++m_next_file;
+    }
+
+    if (!write_fully(m_active->fd.get(), value.cdata(), value.size(), m_active->size))
+    {
+        PLOG(ERROR) << "could not append to value log file " << m_active->number;
+        return false;
+    }
+
+    ptr->file = m_active->number;
+    ptr->offset = m_active->size;
+    m_active->size += value.size();
+    ++m_active->pinned;
+    ++m_active->pins;
+    ++m_appended;
+    return true;
+}
+
+bool
+value_log :: pin(uint64_t number)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    file_map_t::iterator it = m_files.find(number);
+
+    if (it == m_files.end())
+    {
+        return false;
+    }
+
+    ++it->second->pinned;
+    ++it->second->pins;
+    return true;
+}
+
+void
+value_log :: unpin(uint64_t number)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    file_map_t::iterator it = m_files.find(number);
+
+    if (it != m_files.end())
+    {
+        assert(it->second->pinned > 0);
+        --it->second->pinned;
+    }
+}
+
+bool
+value_log :: sync()
+{
+    uint64_t appended;
+    po6::io::fd fd;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (!m_active || m_synced >= m_appended)
+        {
+            return true;
+        }
+
+        appended = m_appended;
+        // an append may retire the active file and a collect may then remove
+        // it, closing its descriptor, so sync a duplicate of our own
+        fd = dup(m_active->fd.get());
+
+        if (fd.get() < 0)
+        {
+            PLOG(ERROR) << "could not sync value log";
+            return false;
+        }
+    }
+
+    if (fdatasync(fd.get()) < 0)
+    {
+        PLOG(ERROR) << "could not sync value log";
+        return false;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_synced = std::max(m_synced, appended);
+    return true;
+}
+
+consus_returncode
+value_log :: read(const pointer& ptr, e::slice* value, mapping** m)
+{
+    *value = e::slice();
+    *m = NULL;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        file_map_t::iterator it = m_files.find(ptr.file);
+
+        if (it == m_files.end() || ptr.offset + ptr.length > it->second->size)
+        {
+            LOG(ERROR) << "value log pointer to missing data (file="
+                       << ptr.file << " offset=" << ptr.offset
+                       << " length=" << ptr.length << ")";
+            return CONSUS_SERVER_ERROR;
+        }
+
+        file* f = it->second;
+
+        if (!f->map || ptr.offset + ptr.length > f->map->size)
+        {
+            const size_t sz = std::max(f->size, uint64_t(VALUE_LOG_FILE_BYTES));
+            void* base = mmap(NULL, sz, PROT_READ, MAP_SHARED, f->fd.get(), 0);
+
+            if (base == MAP_FAILED)
+            {
+                PLOG(ERROR) << "could not map value log file " << f->number;
+                return CONSUS_SERVER_ERROR;
+            }
+
+            if (f->map)
+            {
+                f->map->dec();
+            }
+
+            f->map = new mapping(static_cast<const char*>(base), sz);
+        }
+
+        f->map->inc();
+        *m = f->map;
+    }
+
+    const char* data = (*m)->base + ptr.offset;
+
+    if (crc32c(0, reinterpret_cast<const unsigned char*>(data), ptr.length) != ptr.checksum)
+    {
+        LOG(ERROR) << "corrupt value in value log (file="
+                   << ptr.file << " offset=" << ptr.offset
+                   << " length=" << ptr.length << ")";
+        release(*m);
+        *m = NULL;
+        return CONSUS_SERVER_ERROR;
+    }
+
+    *value = e::slice(data, ptr.length);
+    return CONSUS_SUCCESS;
+}
+
+void
+value_log :: release(mapping* m)
+{
+    m->dec();
+}
+
+uint64_t
+value_log :: garbage(uint64_t number)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    file_map_t::iterator it = m_files.find(number);
+    return it != m_files.end() ? it->second->garbage : 0;
+}
+
+bool
+value_log :: collect(uint64_t number, uint64_t bytes)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    file_map_t::iterator it = m_files.find(number);
+
+    if (it == m_files.end())
+    {
+        return true;
+    }
+
+    file* f = it->second;
+    f->garbage = std::max(f->garbage, bytes);
+
+    // the active file may still grow
+    if (f == m_active || f->garbage < f->size)
+    {
+        return false;
+    }
+
+    remove(it);
+    return true;
+}
+
+void
+value_log :: reclaimable(std::map<uint64_t, uint64_t>* files)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (file_map_t::iterator it = m_files.begin(); it != m_files.end(); ++it)
+    {
+        const file* f = it->second;
+
+        if (f != m_active && f->pinned == 0)
+        {
+            (*files)[f->number] = f->pins;
+        }
+    }
+}
+
+bool
+value_log :: reclaim(uint64_t number, uint64_t pins)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    file_map_t::iterator it = m_files.find(number);
+
+    if (it == m_files.end())
+    {
+        return true;
+    }
+
+    const file* f = it->second;
+
+    // a pin since the scan began may have put a pointer where the scan had
+    // already looked
+    if (f == m_active || f->pinned > 0 || f->pins != pins)
+    {
+        return false;
+    }
+
+    LOG(INFO) << "removing value log file " << number
+              << " that no pointer reaches (" << f->size - std::min(f->size, f->garbage)
+              << " bytes were never counted as garbage)";
+    remove(it);
+    return true;
+}
+
+bool
+value_log :: list_files(std::vector<uint64_t>* numbers)
+{
+    DIR* dir = opendir(m_path.c_str());
+
+    if (!dir)
+    {
+        return false;
+    }
+
+    e::guard g = e::makeguard(closedir, dir);
+    g.use_variable();
+    struct dirent* ent = NULL;
+    errno = 0;
+
+    while ((ent = readdir(dir)))
+    {
+        uint64_t number;
+
+        if (parse_file_name(ent->d_name, &number))
+        {
+            numbers->push_back(number);
+        }
+    }
+
+    return errno == 0;
+}
+
+value_log::file*
+value_log :: create(uint64_t number)
+{
+    char name[VALUE_LOG_NAME_SIZE];
+    file_name(number, name);
+    int fd = openat(m_dir.get(), name, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    std::auto_ptr<file> f(new file(number, fd, 0));
+
+    if (fsync(m_dir.get()) < 0)
+    {
+        return NULL;
+    }
+
+    m_files[number] = f.get();
+    return f.release();
+}
+
+// values read earlier stay readable:  unlinking leaves the mappings intact
+void
+value_log :: remove(file_map_t::iterator it)
+{
+    char name[VALUE_LOG_NAME_SIZE];
+    file_name(it->first, name);
+
+    if (unlinkat(m_dir.get(), name, 0) < 0)
+    {
+        PLOG(WARNING) << "could not remove value log file " << name;
+    }
+
+    delete it->second;
+    m_files.erase(it);
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_value_log_h_
+#define consus_kvs_value_log_h_
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// An append-only directory of numbered files holding the values too large to
+// keep inline in the LSM.  The LSM stores a pointer to each value instead, so
+// compactions move a fixed-size pointer rather than the value itself.
+//
+// Nothing in a file is ever rewritten.  Space is reclaimed a whole file at a
+// time:  the datalayer reports the bytes of every pointer it prunes, and once
+// the garbage in a file covers everything ever appended to it, the file is
+// removed.  Bytes that escape the count, such as an append whose pointer
+// never committed, are found by a scan instead:  a sealed file that no
+// pointer reaches is removed, provided no write pinned it during the scan.
+class value_log
+{
+    public:
+        struct pointer
+        {
+            pointer() : file(0), offset(0), length(0), checksum(0) {}
+
+            uint64_t file;
+            uint64_t offset;
+            uint32_t length;
+            uint32_t checksum;
+        };
+        class mapping;
+
+    public:
+        value_log();
+        ~value_log() throw ();
+
+    public:
+        bool open(const std::string& dir);
+        // the value is readable immediately, but durable only after sync;
+        // the file it lands in is pinned
+        bool append(const e::slice& value, pointer* ptr);
+        // pin the file of a pointer about to be written again; false if the
+        // file is gone.  Each pin, and each append, is matched by one unpin
+        // once the write that carries the pointer commits or fails.
+        bool pin(uint64_t file);
+        void unpin(uint64_t file);
+        bool sync();
+        // on success, value points into a read-only mapping of the file that
+        // stays valid until m is released
+        consus_returncode read(const pointer& ptr, e::slice* value, mapping** m);
+        static void release(mapping* m);
+        // the garbage recorded against a file, or zero if it is gone
+        uint64_t garbage(uint64_t file);
+        // record that bytes of the file are garbage; returns true if that
+        // covers the whole file and it was removed (or was already gone)
+        bool collect(uint64_t file, uint64_t bytes);
+        // every sealed file that is not pinned, with the number of times it
+        // has ever been pinned
+        void reclaimable(std::map<uint64_t, uint64_t>* files);
+        // remove a file that reclaimable returned and that no pointer
+        // reaches, unless it has been pinned since; returns true if removed
+        bool reclaim(uint64_t file, uint64_t pins);
+
+    private:
+        struct file;
+        typedef std::map<uint64_t, file*> file_map_t;
+
+    private:
+        bool list_files(std::vector<uint64_t>* numbers);
+        file* create(uint64_t number);
+        void remove(file_map_t::iterator it);
+
+    private:
+        std::string m_path;
+        po6::io::fd m_dir;
+        po6::threads::mutex m_mtx;
+        file_map_t m_files;
+        file* m_active;
+        uint64_t m_next_file;
+        // appends so far, and the appends known to be durable
+        uint64_t m_appended;
+        uint64_t m_synced;
+
+    private:
+        value_log(const value_log&);
+        value_log& operator = (const value_log&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_value_log_h_
@@ -52,13 +52,17 @@ struct write_replicator :: write_stub
     comm_id target;
     uint64_t last_request_time;
     consus_returncode status;
-    replica_set rs;
+    // indices into m_writes of the writes sent to target, and the replica set
+    // target reported for each
+    std::vector<size_t> writes;
+    std::vector<replica_set> rs;
 };
 
 write_replicator :: write_stub :: write_stub(comm_id t)
     : target(t)
     , last_request_time(0)
     , status(CONSUS_GARBAGE)
+    , writes()
     , rs()
 {
 }
@@ -70,11 +74,7 @@ write_replicator :: write_replicator(uint64_t key)
     , m_finished(false)
     , m_id()
     , m_nonce()
-    , m_flags()
-    , m_table()
-    , m_key()
-    , m_timestamp()
-    , m_value()
+    , m_writes()
     , m_backing()
     , m_requests()
 {
@@ -102,40 +102,54 @@ write_replicator :: init(comm_id id, uint64_t nonce, unsigned flags,
                          const e::slice& table, const e::slice& key,
                          uint64_t timestamp, const e::slice& value,
                          std::auto_ptr<e::buffer> msg)
+{
+    std::vector<datalayer::write> writes(1);
+    writes[0].tombstone = (CONSUS_WRITE_TOMBSTONE & flags);
+    writes[0].table = table;
+    writes[0].key = key;
+    writes[0].timestamp = timestamp;
+    writes[0].value = value;
+    init(id, nonce, writes, msg);
+}
+
+void
+write_replicator :: init(comm_id id, uint64_t nonce,
+                         const std::vector<datalayer::write>& writes,
+                         std::auto_ptr<e::buffer> msg)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     assert(!m_init);
+    assert(!writes.empty());
     m_id = id;
     m_nonce = nonce;
-    m_flags = flags;
-    m_table = table;
-    m_key = key;
-    m_timestamp = timestamp;
-    m_value = value;
+    m_writes = writes;
     m_backing = msg;
     m_init = true;
 
     if (s_debug_mode)
     {
-        std::string tmp;
-        const char* v = NULL;
-
-        if ((CONSUS_WRITE_TOMBSTONE & flags))
-        {
-            v = "TOMBSTONE";
-        }
-        else
+        for (size_t i = 0; i < m_writes.size(); ++i)
         {
-            tmp = e::strescape(value.str());
-            tmp = "\"" + tmp + "\"";
-            v = tmp.c_str();
-        }
+            std::string tmp;
+            const char* v = NULL;
+
+            if (m_writes[i].tombstone)
+            {
+                v = "TOMBSTONE";
+            }
+            else
+            {
+                tmp = e::strescape(m_writes[i].value.str());
+                tmp = "\"" + tmp + "\"";
+                v = tmp.c_str();
+            }
 
-        LOG(INFO) << logid() << " write(\""
-                  << e::strescape(table.str()) << "\", \""
-                  << e::strescape(key.str())
-                  << "\", " << v << ")@" << timestamp
-                  << " from nonce=" << m_nonce << " id=" << m_id;
+            LOG(INFO) << logid() << " write(\""
+                      << e::strescape(m_writes[i].table.str()) << "\", \""
+                      << e::strescape(m_writes[i].key.str())
+                      << "\", " << v << ")@" << m_writes[i].timestamp
+                      << " from nonce=" << m_nonce << " id=" << m_id;
+        }
     }
 }
 
@@ -144,6 +158,16 @@ write_replicator :: response(comm_id id,
                              consus_returncode rc,
                              const replica_set& rs,
                              daemon* d)
+{
+    std::vector<replica_set> rss(1, rs);
+    response(id, rc, rss, d);
+}
+
+void
+write_replicator :: response(comm_id id,
+                             consus_returncode rc,
+                             const std::vector<replica_set>& rs,
+                             daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
 
@@ -165,6 +189,18 @@ write_replicator :: response(comm_id id,
         return;
     }
 
+    if (rs.size() != stub->writes.size())
+    {
+        if (s_debug_mode)
+        {
+            LOG(INFO) << logid() << " dropped response covering " << rs.size()
+                      << " writes; outstanding request to " << id
+                      << " covers " << stub->writes.size();
+        }
+
+        return;
+    }
+
     if (stub->status == CONSUS_GARBAGE)
     {
         stub->status = rc;
@@ -207,12 +243,17 @@ write_replicator :: debug_dump()
     ostr << "init=" << (m_init ? "yes" : "no") << "\n";
     ostr << "finished=" << (m_finished ? "yes" : "no") << "\n";
     ostr << "request id=" << m_id << " nonce=" << m_nonce << "\n";
-    ostr << "flags=" << m_flags << "\n";
-    ostr << "table=\"" << e::strescape(m_table.str()) << "\"\n";
-    ostr << "key=\"" << e::strescape(m_key.str()) << "\"\n";
-    ostr << "t/k logid=" << daemon::logid(m_table, m_key) << "\n";
-    ostr << "timestamp=" << m_timestamp;
-    ostr << "value=\"" << e::strescape(m_value.str()) << "\"\n";
+
+    for (size_t i = 0; i < m_writes.size(); ++i)
+    {
+        ostr << "write[" << i << "]"
+             << " tombstone=" << (m_writes[i].tombstone ? "yes" : "no")
+             << " table=\"" << e::strescape(m_writes[i].table.str()) << "\""
+             << " key=\"" << e::strescape(m_writes[i].key.str()) << "\""
+             << " t/k logid=" << daemon::logid(m_writes[i].table, m_writes[i].key)
+             << " timestamp=" << m_writes[i].timestamp
+             << " value=\"" << e::strescape(m_writes[i].value.str()) << "\"\n";
+    }
 
     for (size_t i = 0; i < m_requests.size(); ++i)
     {
@@ -220,7 +261,7 @@ write_replicator :: debug_dump()
              << " target=" << m_requests[i].target
              << " last_request_time=" << m_requests[i].last_request_time
              << " status=" << m_requests[i].status
-             << " replica_set=" << m_requests[i].rs
+             << " writes=" << m_requests[i].writes.size()
              << "\n";
     }
 
@@ -230,7 +271,12 @@ write_replicator :: debug_dump()
 std::string
 write_replicator :: logid()
 {
-    return daemon::logid(m_table, m_key) + "-W-REP";
+    if (m_writes.empty())
+    {
+        return "-W-REP";
+    }
+
+    return daemon::logid(m_writes[0].table, m_writes[0].key) + "-W-REP";
 }
 
 write_replicator::write_stub*
@@ -266,119 +312,177 @@ write_replicator :: work_state_machine(daemon* d)
 {
     assert(m_init);
     configuration* c = d->get_config();
-    replica_set rs;
+    std::vector<const replica_set*> hashed(m_writes.size());
 
-    if (!c->hash(d->m_us.dc, m_table, m_key, &rs))
+    for (size_t w = 0; w < m_writes.size(); ++w)
     {
-        // XXX
+        if (!c->hash(d->m_us.dc, m_writes[w].table, m_writes[w].key, &hashed[w]))
+        {
+            // XXX
+        }
+
+        // create every stub up front; creating one may invalidate pointers
+        // to the others
+        for (unsigned i = 0; i < hashed[w]->num_replicas; ++i)
+        {
+            ensure_stub_exists(hashed[w]->replicas[i]);
+            ensure_stub_exists(hashed[w]->transitioning[i]);
+        }
     }
 
     const uint64_t now = po6::monotonic_time();
-    unsigned complete_success = 0;
-    unsigned complete_unknown = 0;
-    unsigned complete_invalid = 0;
+    consus_returncode status = CONSUS_SUCCESS;
+    bool pending = false;
+    bool short_write = false;
 
-    for (unsigned i = 0; i < rs.num_replicas; ++i)
+    // every write must independently reach a quorum of its replica set
+    for (size_t w = 0; w < m_writes.size(); ++w)
     {
-        ensure_stub_exists(rs.replicas[i]);
-        ensure_stub_exists(rs.transitioning[i]);
-        // need to do it again in case anything was created
-        write_stub* owner1 = get_stub(rs.replicas[i]);
-        write_stub* owner2 = get_stub(rs.transitioning[i]);
-        assert(owner1);
+        const replica_set& rs(*hashed[w]);
+        unsigned complete_success = 0;
+        unsigned complete_unknown = 0;
+        unsigned complete_invalid = 0;
+        // reads served under lease see only what the leaseholder has, so a
+        // write is not done until the first replica has it too; this holds
+        // while the first replica is handing off so that the next owner
+        // starts with every write
+        bool first_success = !c->leases();
+
+        for (unsigned i = 0; i < rs.num_replicas; ++i)
+        {
+            write_stub* owner1 = get_stub(rs.replicas[i]);
+            write_stub* owner2 = get_stub(rs.transitioning[i]);
+            assert(owner1);
+
+            // a final status from a request that did not carry this write
+            // (the configuration changed since it was sent) says nothing
+            // about this write; ask again
+            if (returncode_is_final(owner1->status) &&
+                stub_status(owner1, w) == CONSUS_GARBAGE)
+            {
+                owner1->status = CONSUS_GARBAGE;
+                owner1->last_request_time = 0;
+            }
+
+            if (owner2 && returncode_is_final(owner2->status) &&
+                stub_status(owner2, w) == CONSUS_GARBAGE)
+            {
+                owner2->status = CONSUS_GARBAGE;
+                owner2->last_request_time = 0;
+            }
 
-        consus_returncode rc = owner1->status;
+            consus_returncode rc = stub_status(owner1, w);
 
-        if (owner2)
-        {
-            if (owner2->status == CONSUS_GARBAGE)
+            if (owner2)
             {
-                rc = CONSUS_GARBAGE;
+                consus_returncode rc2 = stub_status(owner2, w);
+
+                if (rc2 == CONSUS_GARBAGE)
+                {
+                    rc = CONSUS_GARBAGE;
+                }
+                else if (rc != rc2 ||
+                         !replica_sets_agree(rs.replicas[i],
+                                             stub_replica_set(owner1, w),
+                                             stub_replica_set(owner2, w)))
+                {
+                    rc = owner1->status = owner2->status = CONSUS_GARBAGE;
+                }
+                else
+                {
+                    assert(rc != CONSUS_GARBAGE);
+                    assert(rc == rc2);
+                }
             }
-            else if (owner1->status != owner2->status ||
-                     !replica_sets_agree(rs.replicas[i], owner1->rs, owner2->rs))
+
+            if (rc == CONSUS_SUCCESS)
             {
-                rc = owner1->status = owner2->status = CONSUS_GARBAGE;
+                ++complete_success;
+                first_success = first_success || i == 0;
             }
-            else
+            else if (rc == CONSUS_UNKNOWN_TABLE)
+            {
+                ++complete_unknown;
+            }
+            else if (rc == CONSUS_INVALID)
+            {
+                ++complete_invalid;
+            }
+            else if (owner1->last_request_time + d->resend_interval() < now)
             {
-                assert(owner1->status != CONSUS_GARBAGE);
-                assert(owner1->status == owner2->status);
-                assert(replica_sets_agree(rs.replicas[i], owner1->rs, owner2->rs));
+                if (owner1 && !returncode_is_final(owner1->status))
+                {
+                    send_write_request(owner1, hashed, now, d);
+                }
+
+                if (owner2 && !returncode_is_final(owner2->status))
+                {
+                    send_write_request(owner2, hashed, now, d);
+                }
             }
         }
 
-        if (rc == CONSUS_SUCCESS)
+        unsigned desired_replication = rs.desired_replication;
+
+        if (desired_replication > rs.num_replicas)
         {
-            ++complete_success;
+            LOG_EVERY_N(WARNING, 1000) << "too few kvs daemons to achieve desired replication factor: "
+                                       << desired_replication - rs.num_replicas
+                                       << " more daemons needed";
+            desired_replication = rs.num_replicas;
+            short_write = true;
         }
-        else if (rc == CONSUS_UNKNOWN_TABLE)
+
+        const unsigned quorum = desired_replication / 2 + 1;
+        const unsigned sum = complete_success + complete_unknown + complete_invalid;
+
+        // we're very draconian here and require complete agreement among the
+        // live quroum
+        // if this proves problematic, we should revisit
+        //
+        // also, this only writes a quorum, and {c,sh}ould be modified to write
+        // the remaining nodes after returning to the client.
+        if (sum > 0 && sum == complete_success && complete_success >= quorum &&
+            first_success)
         {
-            ++complete_unknown;
+            // this write is done
         }
-        else if (rc == CONSUS_INVALID)
+        else if (sum > 0 && sum == complete_unknown && complete_unknown >= quorum)
         {
-            ++complete_invalid;
+            status = status == CONSUS_SUCCESS ? CONSUS_UNKNOWN_TABLE : status;
         }
-        else if (owner1->last_request_time + d->resend_interval() < now)
+        else if (sum > 0 && sum == complete_invalid && complete_invalid >= quorum)
         {
-            if (owner1 && !returncode_is_final(owner1->status))
-            {
-                send_write_request(owner1, now, d);
-            }
-
-            if (owner2 && !returncode_is_final(owner2->status))
-            {
-                send_write_request(owner2, now, d);
-            }
+            status = status == CONSUS_SUCCESS ? CONSUS_INVALID : status;
+        }
+        else if (sum > 0 &&
+                 sum != complete_success &&
+                 sum != complete_unknown &&
+                 sum != complete_invalid)
+        {
+            // We have mixed responses; try again
+            m_requests.clear();
+            return work_state_machine(d);
+        }
+        else
+        {
+            pending = true;
         }
     }
 
-    bool short_write = false;
-
-    if (rs.desired_replication > rs.num_replicas)
+    // see daemon::coordinator_callback::new_config
+    if (!pending && c->leases() && now < d->lease_fence())
     {
-        LOG_EVERY_N(WARNING, 1000) << "too few kvs daemons to achieve desired replication factor: "
-                                   << rs.desired_replication - rs.num_replicas
-                                   << " more daemons needed";
-        rs.desired_replication = rs.num_replicas;
-        short_write = true;
+        pending = true;
     }
 
-    consus_returncode status = CONSUS_GARBAGE;
-    const unsigned quorum = rs.desired_replication / 2 + 1;
-    const unsigned sum = complete_success + complete_unknown + complete_invalid;
-
-    // we're very draconian here and require complete agreement among the live
-    // quroum
-    // if this proves problematic, we should revisit
-    //
-    // also, this only writes a quorum, and {c,sh}ould be modified to write the
-    // remaining nodes after returning to the client.
-    if (sum > 0 && sum == complete_success && complete_success >= quorum)
-    {
-        status = !short_write ? CONSUS_SUCCESS : CONSUS_LESS_DURABLE;
-    }
-    else if (sum > 0 && sum == complete_unknown && complete_unknown >= quorum)
+    if (!pending)
     {
-        status = CONSUS_UNKNOWN_TABLE;
-    }
-    else if (sum > 0 && sum == complete_invalid && complete_invalid >= quorum)
-    {
-        status = CONSUS_INVALID;
-    }
-    else if (sum > 0 &&
-             sum != complete_success &&
-             sum != complete_unknown &&
-             sum != complete_invalid)
-    {
-        // We have mixed responses; try again
-        m_requests.clear();
-        work_state_machine(d);
-    }
+        if (status == CONSUS_SUCCESS && short_write)
+        {
+            status = CONSUS_LESS_DURABLE;
+        }
 
-    if (status != CONSUS_GARBAGE)
-    {
         m_finished = true;
         const size_t sz = BUSYBEE_HEADER_SIZE
                         + pack_size(KVS_REP_WR_RESP)
@@ -422,8 +526,40 @@ write_replicator :: returncode_is_final(consus_returncode rc)
     }
 }
 
+consus_returncode
+write_replicator :: stub_status(write_stub* stub, size_t w)
+{
+    for (size_t i = 0; i < stub->writes.size(); ++i)
+    {
+        if (stub->writes[i] == w)
+        {
+            return stub->status;
+        }
+    }
+
+    return CONSUS_GARBAGE;
+}
+
+const consus::replica_set&
+write_replicator :: stub_replica_set(write_stub* stub, size_t w)
+{
+    static const replica_set none;
+
+    for (size_t i = 0; i < stub->writes.size() && i < stub->rs.size(); ++i)
+    {
+        if (stub->writes[i] == w)
+        {
+            return stub->rs[i];
+        }
+    }
+
+    return none;
+}
+
 void
-write_replicator :: send_write_request(write_stub* stub, uint64_t now, daemon* d)
+write_replicator :: send_write_request(write_stub* stub,
+                                       const std::vector<const replica_set*>& hashed,
+                                       uint64_t now, daemon* d)
 {
     if (s_debug_mode)
     {
@@ -431,17 +567,79 @@ write_replicator :: send_write_request(write_stub* stub, uint64_t now, daemon* d
     }
 
     assert(!returncode_is_final(stub->status));
-    const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(KVS_RAW_WR)
-                    + sizeof(uint64_t)
-                    + sizeof(uint8_t)
-                    + pack_size(m_table)
-                    + pack_size(m_key)
-                    + sizeof(uint64_t)
-                    + pack_size(m_value);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_RAW_WR << m_state_key << uint8_t(m_flags) << m_table << m_key << m_timestamp << m_value;
-    d->send(stub->target, msg);
+    assert(hashed.size() == m_writes.size());
+    stub->writes.clear();
+    stub->rs.clear();
+
+    // send the target exactly those writes it stores (or will store)
+    for (size_t w = 0; w < hashed.size(); ++w)
+    {
+        for (unsigned i = 0; i < hashed[w]->num_replicas; ++i)
+        {
+            if (hashed[w]->replicas[i] == stub->target ||
+                hashed[w]->transitioning[i] == stub->target)
+            {
+                stub->writes.push_back(w);
+                break;
+            }
+        }
+    }
+
     stub->last_request_time = now;
+
+    if (stub->writes.empty())
+    {
+        return;
+    }
+
+    std::auto_ptr<e::buffer> msg;
+
+    // a lone write uses the original message so that it interoperates with
+    // every daemon
+    if (m_writes.size() == 1)
+    {
+        const datalayer::write& w(m_writes[0]);
+        const uint8_t flags = w.tombstone ? CONSUS_WRITE_TOMBSTONE : 0;
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(KVS_RAW_WR)
+                        + sizeof(uint64_t)
+                        + sizeof(uint8_t)
+                        + pack_size(w.table)
+                        + pack_size(w.key)
+                        + sizeof(uint64_t)
+                        + pack_size(w.value);
+        msg.reset(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << KVS_RAW_WR << m_state_key << flags << w.table << w.key << w.timestamp << w.value;
+    }
+    else
+    {
+        size_t sz = BUSYBEE_HEADER_SIZE
+                  + pack_size(KVS_RAW_WR_MULTI)
+                  + sizeof(uint64_t)
+                  + sizeof(uint64_t);
+
+        for (size_t i = 0; i < stub->writes.size(); ++i)
+        {
+            const datalayer::write& w(m_writes[stub->writes[i]]);
+            sz += sizeof(uint8_t)
+                + pack_size(w.table)
+                + pack_size(w.key)
+                + sizeof(uint64_t)
+                + pack_size(w.value);
+        }
+
+        msg.reset(e::buffer::create(sz));
+        e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE);
+        pa = pa << KVS_RAW_WR_MULTI << m_state_key << uint64_t(stub->writes.size());
+
+        for (size_t i = 0; i < stub->writes.size(); ++i)
+        {
+            const datalayer::write& w(m_writes[stub->writes[i]]);
+            const uint8_t flags = w.tombstone ? CONSUS_WRITE_TOMBSTONE : 0;
+            pa = pa << flags << w.table << w.key << w.timestamp << w.value;
+        }
+    }
+
+    d->send(stub->target, msg);
 }
@@ -28,6 +28,9 @@
 #ifndef consus_kvs_write_replicator_h_
 #define consus_kvs_write_replicator_h_
 
+// STL
+#include <vector>
+
 // po6
 #include <po6/threads/mutex.h>
 
@@ -38,6 +41,7 @@
 #include <consus.h>
 #include "namespace.h"
 #include "common/ids.h"
+#include "kvs/datalayer.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
@@ -57,8 +61,15 @@ class write_replicator
                   const e::slice& table, const e::slice& key,
                   uint64_t timestamp, const e::slice& value,
                   std::auto_ptr<e::buffer> msg);
+        // replicate several writes that each replica applies atomically; the
+        // slices in writes must point into msg
+        void init(comm_id id, uint64_t nonce,
+                  const std::vector<datalayer::write>& writes,
+                  std::auto_ptr<e::buffer> msg);
         void response(comm_id id, consus_returncode rc,
                       const replica_set& rs, daemon* d);
+        void response(comm_id id, consus_returncode rc,
+                      const std::vector<replica_set>& rs, daemon* d);
         void externally_work_state_machine(daemon* d);
         std::string debug_dump();
 
@@ -77,7 +88,12 @@ class write_replicator
         void ensure_stub_exists(comm_id id) { get_or_create_stub(id); }
         void work_state_machine(daemon* d);
         bool returncode_is_final(consus_returncode rc);
-        void send_write_request(write_stub* stub, uint64_t now, daemon* d);
+        // the status of stub, if its outstanding request covered the write
+        consus_returncode stub_status(write_stub* stub, size_t w);
+        const replica_set& stub_replica_set(write_stub* stub, size_t w);
+        void send_write_request(write_stub* stub,
+                                const std::vector<const replica_set*>& hashed,
+                                uint64_t now, daemon* d);
 
     private:
         const uint64_t m_state_key;
@@ -86,11 +102,7 @@ class write_replicator
         bool m_finished;
         comm_id m_id;
         uint64_t m_nonce;
-        unsigned m_flags;
-        e::slice m_table;
-        e::slice m_key;
-        uint64_t m_timestamp;
-        e::slice m_value;
+        std::vector<datalayer::write> m_writes;
         std::auto_ptr<e::buffer> m_backing;
         std::vector<write_stub> m_requests;
 };
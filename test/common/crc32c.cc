@@ -0,0 +1,109 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// STL
+#include <vector>
+
+// consus
+#include "test/th.h"
+#include "common/crc32c.h"
+
+using namespace consus;
+
+// a cheap deterministic byte stream so failures are reproducible
+static void
+fill(std::vector<unsigned char>* buf)
+{
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+    for (size_t i = 0; i < buf->size(); ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        (*buf)[i] = x & 0xff;
+    }
+}
+
+TEST(CRC32C, KnownAnswer)
+{
+    const unsigned char* digits = reinterpret_cast<const unsigned char*>("123456789");
+    ASSERT_EQ(crc32c(0, digits, 9), 0xe3069283U);
+    ASSERT_EQ(crc32c_portable(0, digits, 9), 0xe3069283U);
+    ASSERT_EQ(crc32c(0, digits, 0), 0U);
+}
+
+TEST(CRC32C, EveryAlignmentAndShortLength)
+{
+    std::vector<unsigned char> buf(4096 + 8);
+    fill(&buf);
+
+    for (size_t align = 0; align < 8; ++align)
+    {
+        for (size_t n = 0; n <= 4096; ++n)
+        {
+            const unsigned char* data = &buf[0] + align;
+            ASSERT_EQ(crc32c(0, data, n), crc32c_portable(0, data, n));
+        }
+    }
+}
+
+TEST(CRC32C, LongLengths)
+{
+    std::vector<unsigned char> buf((1 << 20) + 8);
+    fill(&buf);
+    // straddle every block boundary the multi-stream kernel uses
+    const size_t lengths[] = {767, 768, 769, 775, 776, 1536, 2303,
+                              24575, 24576, 24577, 24576 + 768,
+                              49152 + 767, 65536, 100003, 1 << 20};
+
+    for (size_t align = 0; align < 8; ++align)
+    {
+        for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+        {
+            const unsigned char* data = &buf[0] + align;
+            ASSERT_EQ(crc32c(0, data, lengths[i]), crc32c_portable(0, data, lengths[i]));
+        }
+    }
+}
+
+TEST(CRC32C, Chaining)
+{
+    std::vector<unsigned char> buf(200000);
+    fill(&buf);
+    const uint32_t whole = crc32c_portable(0, &buf[0], buf.size());
+
+    for (size_t split = 0; split < buf.size(); split += 4999)
+    {
+        uint32_t crc = crc32c(0, &buf[0], split);
+        crc = crc32c(crc, &buf[0] + split, buf.size() - split);
+        ASSERT_EQ(crc, whole);
+    }
+}
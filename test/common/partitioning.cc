@@ -0,0 +1,134 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// STL
+#include <vector>
+
+// consus
+#include "test/th.h"
+#include "common/constants.h"
+#include "common/partitioning.h"
+
+using namespace consus;
+
+TEST(Partitioning, PrefixIsFirstTwoBytes)
+{
+    e::slice table("t");
+    ASSERT_EQ(partition_index(PARTITION_PREFIX, table, e::slice("")), 0U);
+    ASSERT_EQ(partition_index(PARTITION_PREFIX, table, e::slice("a")), 0x6100U);
+    ASSERT_EQ(partition_index(PARTITION_PREFIX, table, e::slice("ab")), 0x6162U);
+    ASSERT_EQ(partition_index(PARTITION_PREFIX, table, e::slice("abc")), 0x6162U);
+    ASSERT_EQ(partition_index(PARTITION_PREFIX, e::slice("other"), e::slice("abc")), 0x6162U);
+}
+
+TEST(Partitioning, Flags)
+{
+    ASSERT_EQ(partitioning_from_flags(0), PARTITION_PREFIX);
+    ASSERT_EQ(partitioning_from_flags(0xf0ULL | PARTITION_HASH), PARTITION_HASH);
+    ASSERT_EQ(partitioning_from_flags(0xf), PARTITION_PREFIX);
+    ASSERT_EQ(partitioning_to_flags(0xf0ULL, PARTITION_ORDERED), 0xf0ULL | PARTITION_ORDERED);
+    ASSERT_EQ(partitioning_to_flags(0xf0ULL | PARTITION_ORDERED, PARTITION_HASH), 0xf0ULL | PARTITION_HASH);
+    partitioning p;
+    ASSERT_TRUE(partitioning_from_string("hash", &p));
+    ASSERT_EQ(p, PARTITION_HASH);
+    ASSERT_TRUE(partitioning_from_string(partitioning_to_string(PARTITION_ORDERED), &p));
+    ASSERT_EQ(p, PARTITION_ORDERED);
+    ASSERT_FALSE(partitioning_from_string("random", &p));
+}
+
+// keys that share a prefix all land on one partition under the legacy scheme;
+// the hash should spread them evenly
+TEST(Partitioning, HashIsUniform)
+{
+    const unsigned keys = 16 * CONSUS_KVS_PARTITIONS;
+    std::vector<unsigned> counts(CONSUS_KVS_PARTITIONS, 0);
+    char buf[32];
+
+    for (unsigned i = 0; i < keys; ++i)
+    {
+        int sz = sprintf(buf, "user%08u", i);
+        ++counts[partition_index(PARTITION_HASH, e::slice("users"), e::slice(buf, sz))];
+    }
+
+    unsigned empty = 0;
+    unsigned max = 0;
+
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        empty += counts[i] == 0 ? 1 : 0;
+        max = counts[i] > max ? counts[i] : max;
+    }
+
+    // with a mean of 16 keys, a uniform hash leaves essentially no partition
+    // empty and none more than a few times the mean
+    ASSERT_LT(empty, 16U);
+    ASSERT_LT(max, 64U);
+}
+
+TEST(Partitioning, HashCoversTable)
+{
+    unsigned same = 0;
+
+    for (unsigned i = 0; i < 1024; ++i)
+    {
+        uint32_t x = i;
+        e::slice key(reinterpret_cast<const char*>(&x), sizeof(x));
+        same += partition_index(PARTITION_HASH, e::slice("a"), key) ==
+                partition_index(PARTITION_HASH, e::slice("b"), key) ? 1 : 0;
+    }
+
+    ASSERT_LT(same, 8U);
+    ASSERT_NE(partition_index(PARTITION_HASH, e::slice("ab"), e::slice("c")),
+              partition_index(PARTITION_HASH, e::slice("a"), e::slice("bc")));
+}
+
+TEST(Partitioning, OrderedPreservesOrder)
+{
+    e::slice table("events");
+    uint16_t base = partition_index(PARTITION_ORDERED, table, e::slice(""));
+    uint16_t prev = 0;
+
+    for (unsigned i = 0; i < CONSUS_KVS_PARTITIONS; i += 257)
+    {
+        char key[3];
+        key[0] = i >> 8;
+        key[1] = i & 0xff;
+        key[2] = 'x';
+        // measure distance from the table's starting point on the ring so
+        // wrap-around does not break the ordering
+        uint16_t off = partition_index(PARTITION_ORDERED, table, e::slice(key, 3)) - base;
+        ASSERT_EQ(off, i);
+        ASSERT_LE(prev, off);
+        prev = off;
+    }
+
+    ASSERT_NE(base, partition_index(PARTITION_ORDERED, e::slice("metrics"), e::slice("")));
+}
@@ -0,0 +1,227 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <string>
+#include <vector>
+
+// e
+#include <e/compat.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "test/th.h"
+#include "common/network_msgtype.h"
+#include "kvs/batcher.h"
+
+using namespace consus;
+
+static std::auto_ptr<e::buffer>
+message(network_msgtype mt, uint64_t nonce, const std::string& payload = "")
+{
+    e::slice p(payload);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(mt)
+                    + sizeof(uint64_t)
+                    + pack_size(p);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << mt << nonce << p;
+    return msg;
+}
+
+static network_msgtype
+msgtype(e::unpacker up)
+{
+    network_msgtype mt = CONSUS_NOP;
+    up = up >> mt;
+    return up.error() ? CONSUS_NOP : mt;
+}
+
+static network_msgtype
+msgtype(e::buffer* msg)
+{
+    return msgtype(msg->unpack_from(BUSYBEE_HEADER_SIZE));
+}
+
+static network_msgtype
+msgtype(const e::slice& msg)
+{
+    return msgtype(e::unpacker(msg.cdata(), msg.size()));
+}
+
+static uint64_t
+nonce(e::unpacker up)
+{
+    network_msgtype mt;
+    uint64_t n = 0;
+    up = up >> mt >> n;
+    return up.error() ? 0 : n;
+}
+
+static uint64_t
+nonce(e::buffer* msg)
+{
+    return nonce(msg->unpack_from(BUSYBEE_HEADER_SIZE));
+}
+
+static uint64_t
+nonce(const e::slice& msg)
+{
+    return nonce(e::unpacker(msg.cdata(), msg.size()));
+}
+
+// the slices point into msg
+static std::vector<e::slice>
+unpack(e::buffer* msg)
+{
+    network_msgtype mt;
+    std::vector<e::slice> msgs;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt;
+
+    if (up.error() || mt != KVS_BATCH || !batcher::unpack(up, &msgs))
+    {
+        msgs.clear();
+    }
+
+    return msgs;
+}
+
+TEST(Batcher, Batchable)
+{
+    std::auto_ptr<e::buffer> msg;
+    msg = message(KVS_RAW_RD, 1);
+    ASSERT_TRUE(batcher::batchable(msg.get()));
+    msg = message(KVS_RAW_WR_RESP, 1);
+    ASSERT_TRUE(batcher::batchable(msg.get()));
+    msg = message(KVS_RAW_LK, 1);
+    ASSERT_TRUE(batcher::batchable(msg.get()));
+    // these cross to transaction managers and clients
+    msg = message(KVS_REP_RD_RESP, 1);
+    ASSERT_FALSE(batcher::batchable(msg.get()));
+    msg = message(KVS_WOUND_XACT, 1);
+    ASSERT_FALSE(batcher::batchable(msg.get()));
+    msg = message(KVS_BATCH, 1);
+    ASSERT_FALSE(batcher::batchable(msg.get()));
+}
+
+TEST(Batcher, HoldsForWindow)
+{
+    batcher b(50);
+    std::auto_ptr<e::buffer> full;
+    ASSERT_EQ(b.deadline(), 0U);
+    ASSERT_TRUE(b.enqueue(comm_id(1), message(KVS_RAW_RD, 7), 100, &full));
+    ASSERT_FALSE(b.enqueue(comm_id(1), message(KVS_RAW_WR, 8), 120, &full));
+    ASSERT_TRUE(full.get() == NULL);
+    ASSERT_EQ(b.deadline(), 150U);
+
+    comm_id id;
+    std::auto_ptr<e::buffer> msg;
+    ASSERT_FALSE(b.dequeue(149, &id, &msg));
+    ASSERT_TRUE(b.dequeue(150, &id, &msg));
+    ASSERT_EQ(id, comm_id(1));
+    ASSERT_EQ(msgtype(msg.get()), KVS_BATCH);
+    ASSERT_EQ(b.deadline(), 0U);
+
+    std::vector<e::slice> msgs = unpack(msg.get());
+    ASSERT_EQ(msgs.size(), 2U);
+    ASSERT_EQ(msgtype(msgs[0]), KVS_RAW_RD);
+    ASSERT_EQ(nonce(msgs[0]), 7U);
+    ASSERT_EQ(msgtype(msgs[1]), KVS_RAW_WR);
+    ASSERT_EQ(nonce(msgs[1]), 8U);
+}
+
+TEST(Batcher, LoneMessageGoesUnwrapped)
+{
+    batcher b(50);
+    std::auto_ptr<e::buffer> full;
+    ASSERT_TRUE(b.enqueue(comm_id(1), message(KVS_RAW_LK_RESP, 9), 100, &full));
+
+    comm_id id;
+    std::auto_ptr<e::buffer> msg;
+    ASSERT_TRUE(b.dequeue(1000, &id, &msg));
+    ASSERT_EQ(msgtype(msg.get()), KVS_RAW_LK_RESP);
+    ASSERT_EQ(nonce(msg.get()), 9U);
+}
+
+TEST(Batcher, OneBatchPerDestination)
+{
+    batcher b(50);
+    std::auto_ptr<e::buffer> full;
+    ASSERT_TRUE(b.enqueue(comm_id(1), message(KVS_RAW_RD, 1), 100, &full));
+    ASSERT_FALSE(b.enqueue(comm_id(2), message(KVS_RAW_RD, 2), 120, &full));
+    ASSERT_EQ(b.deadline(), 150U);
+
+    comm_id id;
+    std::auto_ptr<e::buffer> msg;
+    ASSERT_TRUE(b.dequeue(150, &id, &msg));
+    ASSERT_EQ(id, comm_id(1));
+    ASSERT_EQ(nonce(msg.get()), 1U);
+    ASSERT_FALSE(b.dequeue(150, &id, &msg));
+    ASSERT_EQ(b.deadline(), 170U);
+    ASSERT_TRUE(b.dequeue(170, &id, &msg));
+    ASSERT_EQ(id, comm_id(2));
+    ASSERT_EQ(nonce(msg.get()), 2U);
+}
+
+TEST(Batcher, FullBatchGoesEarly)
+{
+    batcher b(50);
+    std::string value(4096, 'v');
+    std::auto_ptr<e::buffer> full;
+    uint64_t n = 0;
+
+    while (!full.get())
+    {
+        ASSERT_LT(n, 1000U);
+        b.enqueue(comm_id(1), message(KVS_RAW_WR, n, value), 100, &full);
+        ++n;
+    }
+
+    std::vector<e::slice> msgs = unpack(full.get());
+    ASSERT_EQ(msgs.size(), n);
+    ASSERT_EQ(nonce(msgs[n - 1]), n - 1);
+    ASSERT_EQ(full->size(), full->capacity());
+    ASSERT_EQ(b.deadline(), 0U);
+}
+
+TEST(Batcher, RejectsMalformed)
+{
+    batcher b(50);
+    std::auto_ptr<e::buffer> full;
+    b.enqueue(comm_id(1), message(KVS_RAW_RD, 1), 100, &full);
+    b.enqueue(comm_id(1), message(KVS_RAW_RD, 2), 100, &full);
+
+    comm_id id;
+    std::auto_ptr<e::buffer> msg;
+    ASSERT_TRUE(b.dequeue(150, &id, &msg));
+    std::string truncated(reinterpret_cast<const char*>(msg->data()), msg->size() - 1);
+    std::auto_ptr<e::buffer> bad(e::buffer::create(truncated.data(), truncated.size()));
+    ASSERT_TRUE(unpack(bad.get()).empty());
+}
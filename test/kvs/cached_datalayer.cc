@@ -0,0 +1,285 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+
+// STL
+#include <map>
+#include <string>
+#include <utility>
+
+// consus
+#include "test/th.h"
+#include "kvs/cached_datalayer.h"
+
+using namespace consus;
+
+namespace
+{
+
+// A multiversion map that counts the reads that reach it.  An empty string
+// is a tombstone, as with the LevelDB datalayer.
+class versions : public datalayer
+{
+    public:
+        versions() : gets(0), rows() {}
+        virtual ~versions() throw () {}
+
+    public:
+        virtual bool init(std::string) { return true; }
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref)
+        {
+            ++gets;
+            *timestamp = 0;
+            *value = e::slice();
+            *ref = NULL;
+            std::map<version, std::string>::iterator it;
+            it = rows.lower_bound(version(table_key(table, key), ~timestamp_le));
+
+            if (it == rows.end() || it->first.first != table_key(table, key))
+            {
+                return CONSUS_NOT_FOUND;
+            }
+
+            *timestamp = ~it->first.second;
+            *value = e::slice(it->second);
+            return value->empty() ? CONSUS_NOT_FOUND : CONSUS_SUCCESS;
+        }
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value)
+        {
+            rows[version(table_key(table, key), ~timestamp)] = value.str();
+            return CONSUS_SUCCESS;
+        }
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp)
+        {
+            rows[version(table_key(table, key), ~timestamp)] = std::string();
+            return CONSUS_SUCCESS;
+        }
+        virtual consus_returncode read_lock(const e::slice&,
+                                            const e::slice&,
+                                            transaction_group*)
+        {
+            return CONSUS_NOT_FOUND;
+        }
+        virtual consus_returncode write_lock(const e::slice&,
+                                             const e::slice&,
+                                             const transaction_group&)
+        {
+            return CONSUS_SUCCESS;
+        }
+        virtual consus_returncode apply(const write* writes, size_t writes_sz)
+        {
+            for (size_t i = 0; i < writes_sz; ++i)
+            {
+                if (writes[i].tombstone)
+                {
+                    del(writes[i].table, writes[i].key, writes[i].timestamp);
+                }
+                else
+                {
+                    put(writes[i].table, writes[i].key, writes[i].timestamp, writes[i].value);
+                }
+            }
+
+            return CONSUS_SUCCESS;
+        }
+        virtual consus_returncode prune(uint64_t, std::string* position,
+                                        size_t, uint64_t* pruned)
+        {
+            position->clear();
+            *pruned = 0;
+            return CONSUS_SUCCESS;
+        }
+
+    public:
+        uint64_t gets;
+
+    private:
+        typedef std::pair<std::string, uint64_t> version;
+        static std::string table_key(const e::slice& table, const e::slice& key)
+        { return table.str() + std::string(1, '\0') + key.str(); }
+        std::map<version, std::string> rows;
+};
+
+consus_returncode
+read(datalayer* dl, const char* key, uint64_t timestamp_le,
+     uint64_t* timestamp, std::string* value)
+{
+    e::slice v;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = dl->get("t", key, timestamp_le, timestamp, &v, &ref);
+    *value = v.str();
+    delete ref;
+    return rc;
+}
+
+} // namespace
+
+TEST(CachedDatalayer, HitsAfterFirstRead)
+{
+    versions* v = new versions();
+    cached_datalayer dl(v, 1 << 20);
+    uint64_t ts;
+    std::string val;
+    ASSERT_EQ(dl.put("t", "k", 5, "five"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(v->gets, 1U);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+        ASSERT_EQ(ts, 5U);
+        ASSERT_EQ(val, "five");
+    }
+
+    // reads at or after the cached version hit; older reads go through
+    ASSERT_EQ(read(&dl, "k", 5, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(v->gets, 1U);
+    ASSERT_EQ(read(&dl, "k", 4, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 0U);
+    ASSERT_EQ(v->gets, 2U);
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytes;
+    dl.stats(&hits, &misses, &bytes);
+    ASSERT_EQ(hits, 11U);
+    ASSERT_EQ(misses, 2U);
+    ASSERT_GT(bytes, 0U);
+}
+
+TEST(CachedDatalayer, WritesUpdateTheCache)
+{
+    versions* v = new versions();
+    cached_datalayer dl(v, 1 << 20);
+    uint64_t ts;
+    std::string val;
+    ASSERT_EQ(dl.put("t", "k", 5, "five"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+
+    // an older write does not displace the newest version
+    ASSERT_EQ(dl.put("t", "k", 3, "three"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 5U);
+    ASSERT_EQ(val, "five");
+    ASSERT_EQ(read(&dl, "k", 4, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "three");
+
+    // a newer write replaces it without another read
+    const uint64_t gets = v->gets;
+    ASSERT_EQ(dl.put("t", "k", 7, "seven"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 7U);
+    ASSERT_EQ(val, "seven");
+    ASSERT_EQ(v->gets, gets);
+
+    // as does a delete
+    ASSERT_EQ(dl.del("t", "k", 8), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 8U);
+    ASSERT_EQ(v->gets, gets);
+    ASSERT_EQ(read(&dl, "k", 7, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "seven");
+
+    // a second write at the cached timestamp drops the row
+    ASSERT_EQ(dl.put("t", "k", 8, "eight"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "eight");
+    ASSERT_EQ(v->gets, gets + 2);
+
+    datalayer::write w[2];
+    w[0].table = "t";
+    w[0].key = "k";
+    w[0].timestamp = 9;
+    w[0].value = "nine";
+    w[1].table = "t";
+    w[1].key = "other";
+    w[1].timestamp = 9;
+    w[1].value = "nine";
+    ASSERT_EQ(dl.apply(w, 2), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "nine");
+    ASSERT_EQ(v->gets, gets + 2);
+}
+
+TEST(CachedDatalayer, MissingKeysAreCached)
+{
+    versions* v = new versions();
+    cached_datalayer dl(v, 1 << 20);
+    uint64_t ts;
+    std::string val;
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(v->gets, 1U);
+    ASSERT_EQ(dl.put("t", "k", 1, "one"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "one");
+    ASSERT_EQ(v->gets, 1U);
+}
+
+TEST(CachedDatalayer, StaysWithinCapacity)
+{
+    versions* v = new versions();
+    const uint64_t capacity = 64 * 1024;
+    cached_datalayer dl(v, capacity);
+    std::string value(100, 'v');
+    char key[32];
+    uint64_t ts;
+    std::string val;
+
+    for (int i = 0; i < 4096; ++i)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        ASSERT_EQ(dl.put("t", key, 1, value), CONSUS_SUCCESS);
+        ASSERT_EQ(read(&dl, key, UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    }
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytes;
+    dl.stats(&hits, &misses, &bytes);
+    ASSERT_LE(bytes, capacity);
+    ASSERT_GT(bytes, 0U);
+
+    // the most recently read key survives eviction
+    const uint64_t gets = v->gets;
+    ASSERT_EQ(read(&dl, key, UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(v->gets, gets);
+}
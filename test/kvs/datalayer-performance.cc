@@ -0,0 +1,518 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+#include <e/compat.h>
+#include <e/popt.h>
+
+// consus
+#include "common/latency_histogram.h"
+#include "common/transaction_group.h"
+#include "kvs/cached_datalayer.h"
+#include "kvs/leveldb_datalayer.h"
+#include "kvs/memory_datalayer.h"
+#include "kvs/rocksdb_datalayer.h"
+
+using namespace consus;
+
+// Drives a datalayer through its public interface only, so the same numbers
+// can be gathered for every backend and every key encoding behind one.
+
+#define TABLE "bench"
+
+enum operation
+{
+    OP_GET,
+    OP_GET_HISTORICAL,
+    OP_PUT,
+    OP_DEL,
+    OP_READ_LOCK,
+    OP_WRITE_LOCK,
+    OP_COUNT
+};
+
+static const char* const operation_names[OP_COUNT] = {
+    "get",
+    "get-historical",
+    "put",
+    "del",
+    "read-lock",
+    "write-lock"
+};
+
+struct workload
+{
+    workload() : key_size(0), value_size(0), keys(0), versions(0), read_pct(0), timestamp(0) {}
+
+    long key_size;
+    long value_size;
+    long keys;
+    long versions;
+    long read_pct;
+    // writes during the run take strictly increasing timestamps, all newer
+    // than the preloaded versions
+    uint64_t timestamp;
+};
+
+static void
+make_key(const workload& wl, uint64_t idx, std::string* key)
+{
+    char buf[32];
+    int sz = snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)idx);
+    key->assign(std::max(wl.key_size - sz, 0L), 'k');
+    key->append(buf, sz);
+}
+
+// Each worker runs one phase:  either a single operation on uniformly random
+// keys, or the mixed workload of reads at the latest timestamp and writes.
+class worker
+{
+    public:
+        worker(datalayer* dl, workload* wl, unsigned id, const char* phase, long ops);
+        ~worker() throw ();
+
+    public:
+        void run();
+        bool failed() const { return m_failed; }
+        const latency_histogram& latency(operation op) const { return m_latency[op]; }
+
+    private:
+        uint64_t random();
+        bool one(operation op, uint64_t idx);
+
+    private:
+        datalayer* m_dl;
+        workload* m_wl;
+        unsigned m_id;
+        std::string m_phase;
+        long m_ops;
+        uint64_t m_rng;
+        std::string m_key;
+        std::string m_value;
+        latency_histogram m_latency[OP_COUNT];
+        bool m_failed;
+
+    private:
+        worker(const worker&);
+        worker& operator = (const worker&);
+};
+
+worker :: worker(datalayer* dl, workload* wl, unsigned id, const char* phase, long ops)
+    : m_dl(dl)
+    , m_wl(wl)
+    , m_id(id)
+    , m_phase(phase)
+    , m_ops(ops)
+    , m_rng(0x9e3779b97f4a7c15ULL * (id + 1))
+    , m_key()
+    , m_value(wl->value_size, 'v')
+    , m_failed(false)
+{
+}
+
+worker :: ~worker() throw ()
+{
+}
+
+void
+worker :: run()
+{
+    for (long i = 0; i < m_ops && !m_failed; ++i)
+    {
+        const uint64_t idx = random() % m_wl->keys;
+        operation op = OP_COUNT;
+
+        if (m_phase == "mixed")
+        {
+            op = long(random() % 100) < m_wl->read_pct ? OP_GET : OP_PUT;
+        }
+        else if (m_phase == "lock")
+        {
+            op = i % 2 == 0 ? OP_WRITE_LOCK : OP_READ_LOCK;
+        }
+        else
+        {
+            for (unsigned o = 0; o < OP_COUNT; ++o)
+            {
+                if (m_phase == operation_names[o])
+                {
+                    op = operation(o);
+                }
+            }
+        }
+
+        assert(op != OP_COUNT);
+
+        if (!one(op, op == OP_READ_LOCK ? (random() % m_wl->keys) : idx))
+        {
+            m_failed = true;
+        }
+    }
+}
+
+// xorshift64*; the benchmark only needs keys spread evenly, cheaply
+uint64_t
+worker :: random()
+{
+    m_rng ^= m_rng >> 12;
+    m_rng ^= m_rng << 25;
+    m_rng ^= m_rng >> 27;
+    return m_rng * 2685821657736338717ULL;
+}
+
+bool
+worker :: one(operation op, uint64_t idx)
+{
+    make_key(*m_wl, idx, &m_key);
+    uint64_t ts = 0;
+    e::slice v;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = CONSUS_SUCCESS;
+    transaction_group tg;
+    const uint64_t start = po6::monotonic_time();
+
+    switch (op)
+    {
+        case OP_GET:
+            rc = m_dl->get(TABLE, m_key, UINT64_MAX, &ts, &v, &ref);
+            delete ref;
+            break;
+        case OP_GET_HISTORICAL:
+            rc = m_dl->get(TABLE, m_key, 1 + random() % m_wl->versions, &ts, &v, &ref);
+            delete ref;
+            break;
+        case OP_PUT:
+            ts = e::atomic::increment_64_nobarrier(&m_wl->timestamp, 1);
+            rc = m_dl->put(TABLE, m_key, ts, m_value);
+            break;
+        case OP_DEL:
+            ts = e::atomic::increment_64_nobarrier(&m_wl->timestamp, 1);
+            rc = m_dl->del(TABLE, m_key, ts);
+            break;
+        case OP_READ_LOCK:
+            rc = m_dl->read_lock(TABLE, m_key, &tg);
+            break;
+        case OP_WRITE_LOCK:
+            tg = transaction_group(transaction_id(paxos_group_id(1), m_id, idx));
+            rc = m_dl->write_lock(TABLE, m_key, tg);
+            break;
+        case OP_COUNT:
+        default:
+            abort();
+    }
+
+    m_latency[op].add(po6::monotonic_time() - start);
+
+    if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+    {
+        std::cerr << operation_names[op] << " failed: " << rc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+preload(datalayer* dl, const workload& wl)
+{
+    const size_t batch = 128;
+    std::vector<std::string> keys(batch);
+    std::vector<datalayer::write> writes(batch);
+    std::string value(wl.value_size, 'v');
+
+    for (long v = 1; v <= wl.versions; ++v)
+    {
+        for (long k = 0; k < wl.keys; k += batch)
+        {
+            size_t sz = 0;
+
+            for (; sz < batch && k + long(sz) < wl.keys; ++sz)
+            {
+                make_key(wl, k + sz, &keys[sz]);
+                writes[sz].table = TABLE;
+                writes[sz].key = keys[sz];
+                writes[sz].timestamp = v;
+                writes[sz].value = value;
+            }
+
+            if (dl->apply(&writes[0], sz) != CONSUS_SUCCESS)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool
+run_phase(datalayer* dl, workload* wl, const char* phase, long threads, long ops)
+{
+    std::vector<e::compat::shared_ptr<worker> > workers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (long i = 0; i < threads; ++i)
+    {
+        using namespace po6::threads;
+        e::compat::shared_ptr<worker> w(new worker(dl, wl, i, phase, ops));
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(&worker::run, w.get())));
+        workers.push_back(w);
+        ts.push_back(t);
+    }
+
+    const uint64_t start = po6::monotonic_time();
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    const double elapsed = double(po6::monotonic_time() - start) / PO6_SECONDS;
+    bool failed = false;
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        failed = failed || workers[i]->failed();
+    }
+
+    if (failed)
+    {
+        return false;
+    }
+
+    for (unsigned op = 0; op < OP_COUNT; ++op)
+    {
+        latency_histogram lat;
+
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            lat.merge(workers[i]->latency(operation(op)));
+        }
+
+        if (lat.count() == 0)
+        {
+            continue;
+        }
+
+        const std::string label(strcmp(phase, operation_names[op]) == 0 ? phase :
+                                std::string(phase) + " " + operation_names[op]);
+        std::cout << label << ": "
+                  << (elapsed > 0 ? lat.count() / elapsed : 0) << " ops per second, "
+                  << "p50 " << double(lat.percentile(0.5)) / PO6_MICROS << " us, "
+                  << "p99 " << double(lat.percentile(0.99)) / PO6_MICROS << " us, "
+                  << "p999 " << double(lat.percentile(0.999)) / PO6_MICROS << " us"
+                  << std::endl;
+    }
+
+    return true;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* data = "datalayer-performance";
+    const char* backend = "leveldb";
+    const char* phases = "get,get-historical,put,del,lock,mixed";
+    long threads = 1;
+    long ops = 100000;
+    workload wl;
+    wl.key_size = 16;
+    wl.value_size = 128;
+    wl.keys = 100000;
+    wl.versions = 4;
+    wl.read_pct = 90;
+    long commit_delay = 0;
+    long value_threshold = 0;
+    long row_cache = 0;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('D', "data")
+            .description("directory holding the data (default: datalayer-performance)")
+            .metavar("dir").as_string(&data);
+    ap.arg().long_name("datalayer")
+            .description("leveldb, memory, or rocksdb (default: leveldb)")
+            .metavar("name").as_string(&backend);
+    ap.arg().name('w', "workloads")
+            .description("comma-separated phases to run, in order (default: get,get-historical,put,del,lock,mixed)")
+            .metavar("list").as_string(&phases);
+    ap.arg().name('t', "threads")
+            .description("number of threads issuing operations (default: 1)")
+            .as_long(&threads);
+    ap.arg().name('n', "ops")
+            .description("operations issued by each thread in each phase (default: 100,000)")
+            .as_long(&ops);
+    ap.arg().name('k', "keys")
+            .description("number of distinct keys (default: 100,000)")
+            .as_long(&wl.keys);
+    ap.arg().long_name("key-size")
+            .description("size of each key in bytes (default: 16)")
+            .as_long(&wl.key_size);
+    ap.arg().name('s', "value-size")
+            .description("size of each value in bytes (default: 128)")
+            .as_long(&wl.value_size);
+    ap.arg().long_name("versions")
+            .description("versions of each key written before the run (default: 4)")
+            .as_long(&wl.versions);
+    ap.arg().long_name("read-percent")
+            .description("percentage of reads in the mixed phase (default: 90)")
+            .as_long(&wl.read_pct);
+    ap.arg().long_name("commit-delay")
+            .description("leveldb group commit delay in microseconds (default: 0)")
+            .as_long(&commit_delay);
+    ap.arg().long_name("value-log-threshold")
+            .description("leveldb value log threshold in bytes (default: 0, disabled)")
+            .as_long(&value_threshold);
+    ap.arg().long_name("row-cache")
+            .description("row cache in front of the datalayer in MB (default: 0, disabled)")
+            .as_long(&row_cache);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (threads <= 0 || ops < 0 || wl.keys <= 0 || wl.key_size <= 0 ||
+        wl.value_size <= 0 || wl.versions <= 0 || commit_delay < 0 ||
+        value_threshold < 0 || row_cache < 0 ||
+        wl.read_pct < 0 || wl.read_pct > 100)
+    {
+        std::cerr << "numeric arguments must be positive\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    std::auto_ptr<datalayer> dl;
+
+    if (strcmp(backend, "leveldb") == 0)
+    {
+        dl.reset(new leveldb_datalayer(commit_delay * PO6_MICROS, value_threshold));
+    }
+    else if (strcmp(backend, "memory") == 0)
+    {
+        dl.reset(new memory_datalayer(false));
+    }
+#ifdef CONSUS_ROCKSDB
+    else if (strcmp(backend, "rocksdb") == 0)
+    {
+        dl.reset(new rocksdb_datalayer(128ULL * 1024ULL * 1024ULL, 10, 0));
+    }
+#endif
+    else
+    {
+        std::cerr << "unknown datalayer \"" << backend << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (row_cache > 0)
+    {
+        dl.reset(new cached_datalayer(dl.release(), uint64_t(row_cache) * 1024ULL * 1024ULL));
+    }
+
+    if (!dl->init(data))
+    {
+        std::cerr << "could not open the datalayer in " << data << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const uint64_t start = po6::monotonic_time();
+
+    if (!preload(dl.get(), wl))
+    {
+        std::cerr << "could not preload the data" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "preloaded " << wl.keys << " keys x " << wl.versions << " versions in "
+              << double(po6::monotonic_time() - start) / PO6_SECONDS << " seconds" << std::endl;
+    wl.timestamp = wl.versions;
+    std::string list(phases);
+    size_t pos = 0;
+
+    while (pos <= list.size())
+    {
+        size_t comma = list.find(',', pos);
+        comma = comma == std::string::npos ? list.size() : comma;
+        const std::string phase(list, pos, comma - pos);
+        pos = comma + 1;
+        bool known = phase == "lock" || phase == "mixed";
+
+        for (unsigned o = 0; o < OP_COUNT; ++o)
+        {
+            known = known || (phase == operation_names[o] &&
+                              o != OP_READ_LOCK && o != OP_WRITE_LOCK);
+        }
+
+        if (!known)
+        {
+            std::cerr << "unknown workload \"" << phase << "\"" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (!run_phase(dl.get(), &wl, phase.c_str(), threads, ops))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::string debug = dl->debug_dump();
+
+    if (!debug.empty())
+    {
+        std::cout << debug;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// consus
+#include "test/th.h"
+#include "kvs/leveldb_keys.h"
+
+using namespace consus;
+
+static std::string
+data_key(const std::string& table, const std::string& key, uint64_t timestamp)
+{
+    std::string out;
+    leveldb_data_key(e::slice(table), e::slice(key), timestamp, &out);
+    return out;
+}
+
+static std::string
+lock_key(const std::string& table, const std::string& key)
+{
+    std::string out;
+    leveldb_lock_key(e::slice(table), e::slice(key), &out);
+    return out;
+}
+
+TEST(LevelDBKeys, TimestampRoundTrip)
+{
+    const uint64_t timestamps[] = {0, 1, 0xffULL, 0x0123456789abcdefULL, UINT64_MAX};
+
+    for (size_t i = 0; i < sizeof(timestamps) / sizeof(timestamps[0]); ++i)
+    {
+        std::string k = data_key("table", "key", timestamps[i]);
+        ASSERT_EQ(leveldb_data_key_timestamp(k.data(), k.size()), timestamps[i]);
+    }
+}
+
+TEST(LevelDBKeys, NewestVersionFirst)
+{
+    ASSERT_LT(data_key("t", "k", 5), data_key("t", "k", 4));
+    ASSERT_LT(data_key("t", "k", UINT64_MAX), data_key("t", "k", 0));
+    ASSERT_LT(data_key("t", "k", 0), data_key("t", std::string("k\x00", 2), 1000));
+}
+
+TEST(LevelDBKeys, OrderMatchesTableThenKey)
+{
+    // strings with embedded and trailing zeros, and prefixes of one another
+    std::vector<std::string> strs;
+    strs.push_back(std::string());
+    strs.push_back(std::string("\x00", 1));
+    strs.push_back(std::string("\x00\x00", 2));
+    strs.push_back(std::string("\x00\x01", 2));
+    strs.push_back(std::string("\x00\xff", 2));
+    strs.push_back(std::string("\x01", 1));
+    strs.push_back(std::string("a"));
+    strs.push_back(std::string("a\x00", 2));
+    strs.push_back(std::string("a\x00z", 3));
+    strs.push_back(std::string("ab"));
+    strs.push_back(std::string("\xff", 1));
+    std::sort(strs.begin(), strs.end());
+
+    for (size_t ti = 0; ti < strs.size(); ++ti)
+    for (size_t ki = 0; ki < strs.size(); ++ki)
+    for (size_t tj = 0; tj < strs.size(); ++tj)
+    for (size_t kj = 0; kj < strs.size(); ++kj)
+    {
+        std::pair<size_t, size_t> x(ti, ki);
+        std::pair<size_t, size_t> y(tj, kj);
+        std::string a = data_key(strs[ti], strs[ki], 7);
+        std::string b = data_key(strs[tj], strs[kj], 7);
+        ASSERT_EQ(x < y, a < b);
+        ASSERT_EQ(x == y, a == b);
+        std::string c = lock_key(strs[ti], strs[ki]);
+        std::string d = lock_key(strs[tj], strs[kj]);
+        ASSERT_EQ(x < y, c < d);
+        // the prefix the datalayer compares when it seeks to a key
+        ASSERT_EQ(x == y, a.compare(0, a.size() - LEVELDB_TIMESTAMP_SZ,
+                                    b, 0, b.size() - LEVELDB_TIMESTAMP_SZ) == 0);
+    }
+}
+
+TEST(LevelDBKeys, LocksAndDataAreDisjoint)
+{
+    std::string d = data_key("t", "k", 0);
+    std::string l = lock_key("t", "k");
+    ASSERT_NE(d[0], l[0]);
+}
+
+TEST(LevelDBKeys, ParseDataKey)
+{
+    const std::string strs[] = {std::string(), std::string("\x00", 1),
+                                std::string("a\x00\x01z", 4), std::string("\xff\x00", 2)};
+    const size_t strs_sz = sizeof(strs) / sizeof(strs[0]);
+
+    for (size_t t = 0; t < strs_sz; ++t)
+    for (size_t k = 0; k < strs_sz; ++k)
+    {
+        std::string d = data_key(strs[t], strs[k], 42);
+        std::string table;
+        std::string key;
+        uint64_t timestamp = 0;
+        ASSERT_TRUE(leveldb_parse_data_key(d.data(), d.size(), &table, &key, &timestamp));
+        ASSERT_EQ(table, strs[t]);
+        ASSERT_EQ(key, strs[k]);
+        ASSERT_EQ(timestamp, 42U);
+    }
+
+    std::string table;
+    std::string key;
+    uint64_t timestamp;
+    std::string l = lock_key("t", "k");
+    ASSERT_FALSE(leveldb_parse_data_key(l.data(), l.size(), &table, &key, &timestamp));
+    std::string d = data_key("t", "k", 0);
+    d.erase(d.size() - LEVELDB_TIMESTAMP_SZ - 1, 1);
+    ASSERT_FALSE(leveldb_parse_data_key(d.data(), d.size(), &table, &key, &timestamp));
+}
@@ -0,0 +1,293 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+
+// e
+#include <e/compat.h>
+
+// consus
+#include "test/th.h"
+#include "kvs/memory_datalayer.h"
+
+using namespace consus;
+
+static consus_returncode
+read(datalayer* dl, const std::string& key, uint64_t timestamp_le,
+     uint64_t* timestamp, std::string* value)
+{
+    e::slice v;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = dl->get("t", key, timestamp_le, timestamp, &v, &ref);
+    *value = v.str();
+    delete ref;
+    return rc;
+}
+
+TEST(MemoryDatalayer, Versions)
+{
+    memory_datalayer dl(false);
+    ASSERT_TRUE(dl.init("."));
+    uint64_t ts;
+    std::string val;
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 0U);
+
+    ASSERT_EQ(dl.put("t", "k", 10, "ten"), CONSUS_SUCCESS);
+    ASSERT_EQ(dl.put("t", "k", 30, "thirty"), CONSUS_SUCCESS);
+    ASSERT_EQ(dl.put("t", "k", 20, "twenty"), CONSUS_SUCCESS);
+    ASSERT_EQ(dl.del("t", "k", 40), CONSUS_SUCCESS);
+    ASSERT_EQ(dl.put("t", "j", 25, "other"), CONSUS_SUCCESS);
+
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 40U);
+    ASSERT_EQ(read(&dl, "k", 39, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 30U);
+    ASSERT_EQ(val, "thirty");
+    ASSERT_EQ(read(&dl, "k", 29, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "twenty");
+    ASSERT_EQ(read(&dl, "k", 10, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "ten");
+    ASSERT_EQ(read(&dl, "k", 9, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 0U);
+
+    // a write at an existing timestamp replaces that version
+    ASSERT_EQ(dl.put("t", "k", 20, "TWENTY"), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", 29, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "TWENTY");
+
+    datalayer::write w[2];
+    w[0].table = "t";
+    w[0].key = "k";
+    w[0].timestamp = 50;
+    w[0].value = "fifty";
+    w[1].tombstone = true;
+    w[1].table = "t";
+    w[1].key = "j";
+    w[1].timestamp = 50;
+    ASSERT_EQ(dl.apply(w, 2), CONSUS_SUCCESS);
+    ASSERT_EQ(read(&dl, "k", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "fifty");
+    ASSERT_EQ(read(&dl, "j", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 50U);
+}
+
+TEST(MemoryDatalayer, ValuesOutliveOverwrites)
+{
+    memory_datalayer dl(false);
+    ASSERT_TRUE(dl.init("."));
+    ASSERT_EQ(dl.put("t", "k", 1, "first"), CONSUS_SUCCESS);
+    uint64_t ts;
+    e::slice v;
+    datalayer::reference* ref = NULL;
+    ASSERT_EQ(dl.get("t", "k", UINT64_MAX, &ts, &v, &ref), CONSUS_SUCCESS);
+    ASSERT_EQ(dl.put("t", "k", 1, "second"), CONSUS_SUCCESS);
+    ASSERT_EQ(v.str(), "first");
+    delete ref;
+}
+
+TEST(MemoryDatalayer, Prune)
+{
+    memory_datalayer dl(false);
+    ASSERT_TRUE(dl.init("."));
+    char key[16];
+
+    for (int k = 0; k < 100; ++k)
+    {
+        snprintf(key, sizeof(key), "key%03d", k);
+
+        for (uint64_t t = 10; t <= 100; t += 10)
+        {
+            ASSERT_EQ(dl.put("t", key, t, "v"), CONSUS_SUCCESS);
+        }
+    }
+
+    std::string position;
+    uint64_t total = 0;
+    unsigned calls = 0;
+
+    do
+    {
+        uint64_t pruned = 0;
+        ASSERT_EQ(dl.prune(55, &position, 16, &pruned), CONSUS_SUCCESS);
+        total += pruned;
+        ++calls;
+    } while (!position.empty());
+
+    ASSERT_EQ(calls, 7U);
+    ASSERT_EQ(total, 400U);
+    uint64_t ts;
+    std::string val;
+
+    for (int k = 0; k < 100; ++k)
+    {
+        snprintf(key, sizeof(key), "key%03d", k);
+        ASSERT_EQ(read(&dl, key, 55, &ts, &val), CONSUS_SUCCESS);
+        ASSERT_EQ(ts, 50U);
+        ASSERT_EQ(read(&dl, key, 45, &ts, &val), CONSUS_NOT_FOUND);
+        ASSERT_EQ(read(&dl, key, UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+        ASSERT_EQ(ts, 100U);
+    }
+}
+
+TEST(MemoryDatalayer, Locks)
+{
+    memory_datalayer dl(false);
+    ASSERT_TRUE(dl.init("."));
+    transaction_group tg;
+    ASSERT_EQ(dl.read_lock("t", "k", &tg), CONSUS_NOT_FOUND);
+    transaction_group held(transaction_id(paxos_group_id(1), 2, 3));
+    ASSERT_EQ(dl.write_lock("t", "k", held), CONSUS_SUCCESS);
+    ASSERT_EQ(dl.read_lock("t", "k", &tg), CONSUS_SUCCESS);
+    ASSERT_EQ(tg, held);
+}
+
+TEST(MemoryDatalayer, Snapshot)
+{
+    char dir[] = "/tmp/consus-memory-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    transaction_group held(transaction_id(paxos_group_id(1), 2, 3));
+
+    {
+        memory_datalayer dl(true);
+        ASSERT_TRUE(dl.init(dir));
+        ASSERT_EQ(dl.put("t", "a", 1, "one"), CONSUS_SUCCESS);
+        ASSERT_EQ(dl.put("t", "a", 2, "two"), CONSUS_SUCCESS);
+        ASSERT_EQ(dl.del("t", "b", 3), CONSUS_SUCCESS);
+        ASSERT_EQ(dl.put("u", std::string("\0key", 4), 4, "four"), CONSUS_SUCCESS);
+        ASSERT_EQ(dl.write_lock("t", "c", held), CONSUS_SUCCESS);
+        ASSERT_TRUE(dl.checkpoint());
+    }
+
+    memory_datalayer dl(true);
+    ASSERT_TRUE(dl.init(dir));
+    uint64_t ts;
+    std::string val;
+    ASSERT_EQ(read(&dl, "a", UINT64_MAX, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "two");
+    ASSERT_EQ(read(&dl, "a", 1, &ts, &val), CONSUS_SUCCESS);
+    ASSERT_EQ(val, "one");
+    ASSERT_EQ(read(&dl, "b", UINT64_MAX, &ts, &val), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 3U);
+    e::slice v;
+    datalayer::reference* ref = NULL;
+    ASSERT_EQ(dl.get("u", std::string("\0key", 4), UINT64_MAX, &ts, &v, &ref), CONSUS_SUCCESS);
+    ASSERT_EQ(v.str(), "four");
+    delete ref;
+    transaction_group tg;
+    ASSERT_EQ(dl.read_lock("t", "c", &tg), CONSUS_SUCCESS);
+    ASSERT_EQ(tg, held);
+
+    std::string path = std::string(dir) + "/MEMORY";
+    ASSERT_EQ(unlink(path.c_str()), 0);
+    ASSERT_EQ(rmdir(dir), 0);
+}
+
+namespace
+{
+
+struct writer
+{
+    writer(datalayer* _dl, int _id) : dl(_dl), id(_id), failed(false) {}
+    void run();
+
+    datalayer* dl;
+    int id;
+    bool failed;
+};
+
+void
+writer :: run()
+{
+    char key[32];
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        snprintf(key, sizeof(key), "k%d", (i * 7919 + id * 104729) % 5000);
+        uint64_t ts = i + 1;
+
+        if (dl->put("t", key, ts, "value") != CONSUS_SUCCESS)
+        {
+            failed = true;
+        }
+
+        std::string val;
+
+        if (read(dl, key, UINT64_MAX, &ts, &val) != CONSUS_SUCCESS ||
+            val != "value")
+        {
+            failed = true;
+        }
+    }
+}
+
+} // namespace
+
+TEST(MemoryDatalayer, Concurrent)
+{
+    memory_datalayer dl(false);
+    ASSERT_TRUE(dl.init("."));
+    std::vector<writer*> writers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > threads;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        writers.push_back(new writer(&dl, i));
+        threads.push_back(e::compat::shared_ptr<po6::threads::thread>(
+            new po6::threads::thread(po6::threads::make_obj_func(&writer::run, writers.back()))));
+        threads.back()->start();
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->join();
+        ASSERT_FALSE(writers[i]->failed);
+        delete writers[i];
+    }
+
+    // every key was written, and the list is still in order
+    std::string position;
+    uint64_t pruned = 0;
+    ASSERT_EQ(dl.prune(0, &position, 4999, &pruned), CONSUS_SUCCESS);
+    ASSERT_FALSE(position.empty());
+    ASSERT_EQ(dl.prune(0, &position, 1, &pruned), CONSUS_SUCCESS);
+    ASSERT_TRUE(position.empty());
+}
@@ -0,0 +1,213 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <fcntl.h>
+#include <unistd.h>
+
+// STL
+#include <map>
+#include <string>
+
+// e
+#include <e/compat.h>
+
+// consus
+#include "test/th.h"
+#include "kvs/value_log.h"
+
+using namespace consus;
+
+static std::string
+read(value_log* vl, const value_log::pointer& ptr)
+{
+    e::slice v;
+    value_log::mapping* m = NULL;
+
+    if (vl->read(ptr, &v, &m) != CONSUS_SUCCESS)
+    {
+        return "<error>";
+    }
+
+    std::string s = v.str();
+    value_log::release(m);
+    return s;
+}
+
+static std::string
+file_path(const char* dir, uint64_t number)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s/value-log-%016llx", dir, (unsigned long long)number);
+    return name;
+}
+
+TEST(ValueLog, AppendAndRead)
+{
+    char dir[] = "/tmp/consus-value-log-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    value_log::pointer a;
+    value_log::pointer b;
+    std::string big(100000, 'x');
+
+    {
+        value_log vl;
+        ASSERT_TRUE(vl.open(dir));
+        ASSERT_TRUE(vl.append("first value", &a));
+        ASSERT_TRUE(vl.append(big, &b));
+        ASSERT_EQ(a.file, b.file);
+        ASSERT_EQ(b.offset, a.offset + a.length);
+        ASSERT_EQ(read(&vl, a), "first value");
+        ASSERT_TRUE(vl.sync());
+        ASSERT_EQ(read(&vl, b), big);
+    }
+
+    // a reopened log reads what was synced and appends to a new file
+    value_log vl;
+    ASSERT_TRUE(vl.open(dir));
+    ASSERT_EQ(read(&vl, a), "first value");
+    ASSERT_EQ(read(&vl, b), big);
+    value_log::pointer c;
+    ASSERT_TRUE(vl.append("after reopen", &c));
+    ASSERT_NE(c.file, a.file);
+    ASSERT_EQ(read(&vl, c), "after reopen");
+
+    ASSERT_TRUE(vl.collect(a.file, a.length + b.length));
+    ASSERT_EQ(unlink(file_path(dir, c.file).c_str()), 0);
+    ASSERT_EQ(rmdir(dir), 0);
+}
+
+TEST(ValueLog, Collect)
+{
+    char dir[] = "/tmp/consus-value-log-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    value_log::pointer a;
+    value_log::pointer b;
+
+    {
+        value_log vl;
+        ASSERT_TRUE(vl.open(dir));
+        ASSERT_TRUE(vl.append("aaaa", &a));
+        ASSERT_TRUE(vl.append("bbbbbb", &b));
+        ASSERT_TRUE(vl.sync());
+        // the file being appended to is never removed
+        ASSERT_FALSE(vl.collect(a.file, 10));
+    }
+
+    value_log vl;
+    ASSERT_TRUE(vl.open(dir));
+    ASSERT_FALSE(vl.collect(a.file, a.length));
+    ASSERT_EQ(vl.garbage(a.file), a.length);
+    ASSERT_EQ(read(&vl, b), "bbbbbb");
+
+    // values read before the file goes stay readable through their mapping
+    e::slice v;
+    value_log::mapping* m = NULL;
+    ASSERT_EQ(vl.read(b, &v, &m), CONSUS_SUCCESS);
+    ASSERT_TRUE(vl.collect(a.file, a.length + b.length));
+    ASSERT_EQ(vl.garbage(a.file), 0U);
+    ASSERT_EQ(access(file_path(dir, a.file).c_str(), F_OK), -1);
+    ASSERT_EQ(v.str(), "bbbbbb");
+    value_log::release(m);
+    ASSERT_EQ(read(&vl, b), "<error>");
+    ASSERT_EQ(rmdir(dir), 0);
+}
+
+TEST(ValueLog, Reclaim)
+{
+    char dir[] = "/tmp/consus-value-log-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    value_log::pointer a;
+    value_log::pointer b;
+
+    {
+        value_log vl;
+        ASSERT_TRUE(vl.open(dir));
+        ASSERT_TRUE(vl.append("never committed", &a));
+        ASSERT_TRUE(vl.sync());
+        // the file being appended to is never reclaimable
+        std::map<uint64_t, uint64_t> files;
+        vl.reclaimable(&files);
+        ASSERT_TRUE(files.empty());
+    }
+
+    value_log vl;
+    ASSERT_TRUE(vl.open(dir));
+    std::map<uint64_t, uint64_t> files;
+    vl.reclaimable(&files);
+    ASSERT_EQ(files.size(), 1U);
+    ASSERT_TRUE(files.find(a.file) != files.end());
+
+    // a pin after the scan began keeps the file
+    ASSERT_TRUE(vl.pin(a.file));
+    ASSERT_FALSE(vl.reclaim(a.file, files[a.file]));
+    files.clear();
+    vl.reclaimable(&files);
+    ASSERT_TRUE(files.empty());
+    vl.unpin(a.file);
+    vl.reclaimable(&files);
+    ASSERT_EQ(files.size(), 1U);
+    ASSERT_EQ(read(&vl, a), "never committed");
+
+    // no garbage was ever counted, yet the file goes
+    ASSERT_EQ(vl.garbage(a.file), 0U);
+    ASSERT_TRUE(vl.reclaim(a.file, files[a.file]));
+    ASSERT_EQ(access(file_path(dir, a.file).c_str(), F_OK), -1);
+    ASSERT_FALSE(vl.pin(a.file));
+    ASSERT_TRUE(vl.append("after reclaim", &b));
+    ASSERT_NE(b.file, a.file);
+    ASSERT_EQ(unlink(file_path(dir, b.file).c_str()), 0);
+    ASSERT_EQ(rmdir(dir), 0);
+}
+
+TEST(ValueLog, DetectsCorruption)
+{
+    char dir[] = "/tmp/consus-value-log-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    value_log vl;
+    ASSERT_TRUE(vl.open(dir));
+    value_log::pointer a;
+    ASSERT_TRUE(vl.append("checksummed", &a));
+
+    int fd = open(file_path(dir, a.file).c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pwrite(fd, "C", 1, a.offset), 1);
+    close(fd);
+    ASSERT_EQ(read(&vl, a), "<error>");
+
+    // pointers past the end of the file are refused rather than mapped
+    value_log::pointer past(a);
+    past.offset += 1000;
+    ASSERT_EQ(read(&vl, past), "<error>");
+
+    ASSERT_EQ(unlink(file_path(dir, a.file).c_str()), 0);
+    ASSERT_EQ(rmdir(dir), 0);
+}
@@ -0,0 +1,268 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <iostream>
+#include <vector>
+
+// po6
+#include <po6/errno.h>
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+#include <e/compat.h>
+#include <e/endian.h>
+#include <e/popt.h>
+
+// consus
+#include "txman/durable_log.h"
+
+using namespace consus;
+
+// Each worker appends "window" records, waits until the last of them is
+// durable, and repeats; this mirrors txman state machines that must hear
+// back from the log before they answer.
+class worker
+{
+    public:
+        worker(durable_log* log, unsigned id, long records, long size, long window);
+        ~worker() throw ();
+
+    public:
+        void run();
+        bool failed() const { return m_failed; }
+
+    private:
+        durable_log* m_log;
+        unsigned m_id;
+        long m_records;
+        long m_window;
+        std::vector<unsigned char> m_entry;
+        bool m_failed;
+
+    private:
+        worker(const worker&);
+        worker& operator = (const worker&);
+};
+
+worker :: worker(durable_log* log, unsigned id, long records, long size, long window)
+    : m_log(log)
+    , m_id(id)
+    , m_records(records)
+    , m_window(window)
+    , m_entry(std::max(size, 2 * long(sizeof(uint64_t))), 'A')
+    , m_failed(false)
+{
+}
+
+worker :: ~worker() throw ()
+{
+}
+
+void
+worker :: run()
+{
+    long i = 0;
+
+    while (i < m_records)
+    {
+        int64_t last = 0;
+
+        for (long j = 0; j < m_window && i < m_records; ++i, ++j)
+        {
+            // make each entry unique, but leave the rest as compressible as
+            // the log entries txman writes
+            e::pack64be(m_id, &m_entry[0]);
+            e::pack64be(i, &m_entry[sizeof(uint64_t)]);
+            last = m_log->append(&m_entry[0], m_entry.size());
+
+            if (last < 0)
+            {
+                m_failed = true;
+                return;
+            }
+        }
+
+        int64_t x = m_log->durable();
+
+        while (x <= last)
+        {
+            x = m_log->wait(x);
+
+            if (m_log->error() != 0)
+            {
+                m_failed = true;
+                return;
+            }
+        }
+    }
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* data = "append-performance";
+    long threads = 1;
+    long records = 100000;
+    long size = 128;
+    long window = 1;
+    long delay = 0;
+    long batch = 0;
+    const char* sync = "fsync";
+    long shards = 1;
+    bool compress = false;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('D', "data")
+            .description("directory holding the log (default: append-performance)")
+            .metavar("dir").as_string(&data);
+    ap.arg().name('t', "threads")
+            .description("number of threads appending concurrently (default: 1)")
+            .as_long(&threads);
+    ap.arg().name('n', "records")
+            .description("records appended by each thread (default: 100,000)")
+            .as_long(&records);
+    ap.arg().name('s', "size")
+            .description("size of each record in bytes (default: 128)")
+            .as_long(&size);
+    ap.arg().name('w', "window")
+            .description("records each thread appends before waiting for durability (default: 1)")
+            .as_long(&window);
+    ap.arg().long_name("delay")
+            .description("durability delay in microseconds (default: 0)")
+            .as_long(&delay);
+    ap.arg().long_name("batch")
+            .description("durability batch size in bytes (default: no limit)")
+            .as_long(&batch);
+    ap.arg().long_name("sync")
+            .description("fsync, fdatasync, or dsync (default: fsync)")
+            .as_string(&sync);
+    ap.arg().long_name("shards")
+            .description("number of log shards (default: 1)")
+            .as_long(&shards);
+    ap.arg().name('c', "compress")
+            .description("compress batches before writing them")
+            .set_true(&compress);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (threads <= 0 || records < 0 || size <= 0 || window <= 0 ||
+        delay < 0 || batch < 0 || shards <= 0)
+    {
+        std::cerr << "threads, size, window, and shards must be positive; "
+                  << "records, delay, and batch must not be negative\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    durability_policy policy;
+    policy.max_delay = delay * PO6_MICROS;
+    policy.max_batch_bytes = batch;
+    policy.shards = shards;
+    policy.compress = compress;
+
+    if (!parse_durability_sync(sync, &policy.sync))
+    {
+        std::cerr << "sync must be one of fsync, fdatasync, or dsync\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    durable_log log;
+
+    if (!log.open(data, policy))
+    {
+        std::cerr << "could not open log: " << po6::strerror(log.error()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // nothing here needs records from an earlier run; retire their segments
+    // so that reruns against the same directory start from the same state
+    log.checkpoint(log.next_entry());
+
+    std::vector<e::compat::shared_ptr<worker> > workers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (long i = 0; i < threads; ++i)
+    {
+        using namespace po6::threads;
+        e::compat::shared_ptr<worker> w(new worker(&log, i, records, size, window));
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(&worker::run, w.get())));
+        workers.push_back(w);
+        ts.push_back(t);
+    }
+
+    const uint64_t start = po6::monotonic_time();
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    const uint64_t end = po6::monotonic_time();
+    bool failed = false;
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        failed = failed || workers[i]->failed();
+    }
+
+    if (failed)
+    {
+        std::cerr << "log failed: " << po6::strerror(log.error()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double elapsed = double(end - start) / PO6_SECONDS;
+    const durable_log_stats stats = log.stats();
+    const latency_histogram ttd = log.time_to_durable();
+    std::cout << "elapsed: " << elapsed << " seconds\n"
+              << "appends per second: " << (elapsed > 0 ? stats.records / elapsed : 0) << "\n"
+              << "syncs per second: " << (elapsed > 0 ? stats.syncs / elapsed : 0) << "\n"
+              << "records per sync: " << (stats.syncs > 0 ? double(stats.records) / stats.syncs : 0) << "\n"
+              << "bytes written per sync: " << (stats.syncs > 0 ? double(stats.bytes_written) / stats.syncs : 0) << "\n"
+              << "time to durable p50: " << double(ttd.percentile(0.5)) / PO6_MICROS << " us\n"
+              << "time to durable p99: " << double(ttd.percentile(0.99)) / PO6_MICROS << " us\n"
+              << "time to durable p999: " << double(ttd.percentile(0.999)) / PO6_MICROS << " us" << std::endl;
+    log.checkpoint(log.next_entry());
+    log.close();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <iostream>
+#include <vector>
+
+// po6
+#include <po6/errno.h>
+#include <po6/time.h>
+
+// e
+#include <e/popt.h>
+
+// consus
+#include "txman/durable_log.h"
+
+using namespace consus;
+
+struct replay_stats
+{
+    replay_stats() : records(0), bytes(0) {}
+    uint64_t records;
+    uint64_t bytes;
+};
+
+static void
+count_entry(void* p, int64_t, const unsigned char*, size_t entry_sz)
+{
+    replay_stats* stats = static_cast<replay_stats*>(p);
+    ++stats->records;
+    stats->bytes += entry_sz;
+}
+
+static bool
+fill_log(const char* data, long records, long size, bool compress)
+{
+    durable_log log;
+    durability_policy policy;
+    policy.compress = compress;
+
+    if (!log.open(data, policy))
+    {
+        std::cerr << "could not open log: " << po6::strerror(log.error()) << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> entry(size);
+    memset(&entry[0], 'A', entry.size());
+    int64_t last = 0;
+
+    for (long i = 0; i < records; ++i)
+    {
+        last = log.append(&entry[0], entry.size());
+
+        if (last < 0)
+        {
+            std::cerr << "could not append: " << po6::strerror(log.error()) << std::endl;
+            return false;
+        }
+    }
+
+    int64_t x = log.durable();
+
+    while (x <= last)
+    {
+        x = log.wait(x);
+
+        if (log.error() != 0)
+        {
+            std::cerr << "could not sync: " << po6::strerror(log.error()) << std::endl;
+            return false;
+        }
+    }
+
+    durable_log_stats stats = log.stats();
+    std::cout << "wrote " << stats.records << " records in " << stats.syncs << " syncs\n"
+              << "bytes staged: " << stats.bytes_staged << "\n"
+              << "bytes written: " << stats.bytes_written << "\n";
+
+    if (compress)
+    {
+        std::cout << "compression ratio: " << (stats.bytes_written > 0 ? double(stats.bytes_staged) / stats.bytes_written : 0) << "\n"
+                  << "compression time: " << double(stats.compress_time) / PO6_SECONDS << " seconds\n";
+    }
+
+    return true;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* data = "replay-performance";
+    long records = 1000000;
+    long size = 128;
+    bool compress = false;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('D', "data")
+            .description("directory holding the log (default: replay-performance)")
+            .metavar("dir").as_string(&data);
+    ap.arg().name('n', "records")
+            .description("how many records to write before replaying (default: 1,000,000)")
+            .as_long(&records);
+    ap.arg().name('s', "size")
+            .description("size of each record in bytes (default: 128)")
+            .as_long(&size);
+    ap.arg().name('c', "compress")
+            .description("compress batches while filling the log")
+            .set_true(&compress);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (records < 0)
+    {
+        std::cerr << "must specify a non-negative number of records\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (size <= 0)
+    {
+        std::cerr << "must specify a positive record size\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (records > 0 && !fill_log(data, records, size, compress))
+    {
+        return EXIT_FAILURE;
+    }
+
+    durable_log log;
+    const uint64_t start = po6::monotonic_time();
+
+    if (!log.open(data))
+    {
+        std::cerr << "could not open log: " << po6::strerror(log.error()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const uint64_t opened = po6::monotonic_time();
+    replay_stats stats;
+    log.replay(count_entry, &stats);
+    const uint64_t end = po6::monotonic_time();
+    const double total = double(end - start) / PO6_SECONDS;
+    std::cout << "recovered " << stats.records << " records (" << stats.bytes << " bytes)\n"
+              << "index and verify: " << double(opened - start) / PO6_SECONDS << " seconds\n"
+              << "replay: " << double(end - opened) / PO6_SECONDS << " seconds\n"
+              << "records per second: " << (total > 0 ? stats.records / total : 0) << std::endl;
+    return EXIT_SUCCESS;
+}
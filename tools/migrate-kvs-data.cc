@@ -0,0 +1,279 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+
+// STL
+#include <iostream>
+#include <memory>
+
+// LevelDB
+#include <leveldb/comparator.h>
+#include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+
+// e
+#include <e/endian.h>
+#include <e/popt.h>
+#include <e/serialization.h>
+
+// consus
+#include "kvs/leveldb_keys.h"
+
+// flush the converted keys once a batch grows this large
+#define BATCH_BYTES (4ULL * 1024ULL * 1024ULL)
+
+// The comparator of the key format that predates kvs/leveldb_keys.h.  Data
+// keys were the packed table, the raw key, and a big-endian timestamp; lock
+// keys were the packed string "consus.lock", the packed table, and the raw
+// key.  LevelDB refuses to open a directory under any other comparator name.
+class legacy_comparator : public leveldb::Comparator
+{
+    public:
+        legacy_comparator() {}
+        virtual ~legacy_comparator() throw () {}
+
+    public:
+        virtual int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const;
+        virtual const char* Name() const { return "ConsusComparator"; }
+        virtual void FindShortestSeparator(std::string*,
+                                           const leveldb::Slice&) const {}
+        virtual void FindShortSuccessor(std::string*) const {}
+};
+
+static const leveldb::Slice legacy_lock_prefix("\x0bconsus.lock", 12);
+
+int
+legacy_comparator :: Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+{
+    if (a.starts_with(legacy_lock_prefix) && b.starts_with(legacy_lock_prefix))
+    {
+        return a.compare(b);
+    }
+    else if (a.starts_with(legacy_lock_prefix))
+    {
+        return -1;
+    }
+    else if (b.starts_with(legacy_lock_prefix))
+    {
+        return 1;
+    }
+
+    if (a.size() < 8 || b.size() < 8)
+    {
+        return -1;
+    }
+
+    leveldb::Slice x(a.data(), a.size() - 8);
+    leveldb::Slice y(b.data(), b.size() - 8);
+    int cmp = x.compare(y);
+
+    if (cmp != 0)
+    {
+        return cmp < 0 ? -1 : 1;
+    }
+
+    uint64_t at;
+    uint64_t bt;
+    e::unpack64be(a.data() + a.size() - 8, &at);
+    e::unpack64be(b.data() + b.size() - 8, &bt);
+
+    if (at > bt)
+    {
+        return -1;
+    }
+    if (at < bt)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+static bool
+convert_key(const leveldb::Slice& old, std::string* out, bool* is_lock)
+{
+    e::slice k(old.data(), old.size());
+    e::slice table;
+    *is_lock = old.starts_with(legacy_lock_prefix);
+
+    if (*is_lock)
+    {
+        e::unpacker up(e::slice(k.data() + legacy_lock_prefix.size(),
+                                k.size() - legacy_lock_prefix.size()));
+        up = up >> table;
+
+        if (up.error())
+        {
+            return false;
+        }
+
+        consus::leveldb_lock_key(table, up.remainder(), out);
+        return true;
+    }
+
+    e::unpacker up(k);
+    up = up >> table;
+
+    if (up.error() || up.remainder().size() < 8)
+    {
+        return false;
+    }
+
+    e::slice rem = up.remainder();
+    uint64_t timestamp;
+    e::unpack64be(rem.cdata() + rem.size() - 8, &timestamp);
+    consus::leveldb_data_key(table, e::slice(rem.data(), rem.size() - 8), timestamp, out);
+    return true;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS] <old-data-dir> <new-data-dir>");
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 2)
+    {
+        std::cerr << "consus-migrate-kvs-data takes two positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const char* old_dir = ap.args()[0];
+    const char* new_dir = ap.args()[1];
+    legacy_comparator cmp;
+    std::auto_ptr<const leveldb::FilterPolicy> old_bf(leveldb::NewBloomFilterPolicy(10));
+    std::auto_ptr<const leveldb::FilterPolicy> new_bf(leveldb::NewBloomFilterPolicy(10));
+    leveldb::Options opts;
+    opts.comparator = &cmp;
+    opts.filter_policy = old_bf.get();
+    leveldb::DB* db = NULL;
+    leveldb::Status st = leveldb::DB::Open(opts, old_dir, &db);
+
+    if (!st.ok())
+    {
+        std::cerr << "consus-migrate-kvs-data: could not open " << old_dir
+                  << ": " << st.ToString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::auto_ptr<leveldb::DB> old_db(db);
+    opts = leveldb::Options();
+    opts.create_if_missing = true;
+    opts.error_if_exists = true;
+    opts.filter_policy = new_bf.get();
+    db = NULL;
+    st = leveldb::DB::Open(opts, new_dir, &db);
+
+    if (!st.ok())
+    {
+        std::cerr << "consus-migrate-kvs-data: could not create " << new_dir
+                  << ": " << st.ToString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::auto_ptr<leveldb::DB> new_db(db);
+    leveldb::ReadOptions ropts;
+    ropts.fill_cache = false;
+    std::auto_ptr<leveldb::Iterator> it(old_db->NewIterator(ropts));
+    leveldb::WriteBatch batch;
+    size_t batch_bytes = 0;
+    uint64_t data_keys = 0;
+    uint64_t lock_keys = 0;
+    std::string key;
+    std::string value;
+
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+    {
+        bool is_lock = false;
+
+        if (!convert_key(it->key(), &key, &is_lock))
+        {
+            std::cerr << "consus-migrate-kvs-data: corrupt key after "
+                      << data_keys + lock_keys << " keys" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        value.assign(it->value().data(), it->value().size());
+
+        // tag live values so the new directory can use the value log
+        if (!is_lock && !value.empty())
+        {
+            value.insert(value.begin(), LEVELDB_VALUE_INLINE);
+        }
+
+        batch.Put(key, value);
+        batch_bytes += key.size() + value.size();
+        ++(is_lock ? lock_keys : data_keys);
+
+        if (batch_bytes >= BATCH_BYTES)
+        {
+            st = new_db->Write(leveldb::WriteOptions(), &batch);
+
+            if (!st.ok())
+            {
+                break;
+            }
+
+            batch.Clear();
+            batch_bytes = 0;
+        }
+    }
+
+    if (st.ok())
+    {
+        st = it->status();
+    }
+
+    if (st.ok())
+    {
+        const char tag = LEVELDB_FORMAT_KEY_TAG;
+        batch.Put(leveldb::Slice(&tag, 1), leveldb::Slice());
+        leveldb::WriteOptions wopts;
+        wopts.sync = true;
+        st = new_db->Write(wopts, &batch);
+    }
+
+    if (!st.ok())
+    {
+        std::cerr << "consus-migrate-kvs-data: " << st.ToString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "converted " << data_keys << " data keys and "
+              << lock_keys << " lock keys" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <math.h>
+#include <stdlib.h>
+
+// STL
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// LevelDB
+#include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+
+// e
+#include <e/popt.h>
+
+// consus
+#include "common/constants.h"
+#include "common/partitioning.h"
+#include "kvs/leveldb_keys.h"
+
+using consus::partitioning;
+
+static const partitioning functions[] = {consus::PARTITION_HASH,
+                                         consus::PARTITION_ORDERED,
+                                         consus::PARTITION_PREFIX};
+static const size_t functions_sz = sizeof(functions) / sizeof(functions[0]);
+
+static bool
+by_count(const std::pair<uint64_t, unsigned>& lhs,
+         const std::pair<uint64_t, unsigned>& rhs)
+{
+    return lhs.first > rhs.first ||
+           (lhs.first == rhs.first && lhs.second < rhs.second);
+}
+
+static void
+report(partitioning p, const std::vector<uint64_t>& counts, uint64_t keys, long top)
+{
+    std::vector<std::pair<uint64_t, unsigned> > ranked;
+    double sumsq = 0;
+
+    for (unsigned i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    {
+        if (counts[i] > 0)
+        {
+            ranked.push_back(std::make_pair(counts[i], i));
+        }
+
+        sumsq += double(counts[i]) * double(counts[i]);
+    }
+
+    std::sort(ranked.begin(), ranked.end(), by_count);
+    double mean = double(keys) / CONSUS_KVS_PARTITIONS;
+    double stddev = sqrt(std::max(0., sumsq / CONSUS_KVS_PARTITIONS - mean * mean));
+    uint64_t max = ranked.empty() ? 0 : ranked[0].first;
+    std::cout << consus::partitioning_to_string(p) << ":\n"
+              << "  partitions used: " << ranked.size() << "/" << CONSUS_KVS_PARTITIONS << "\n"
+              << std::fixed << std::setprecision(2)
+              << "  mean keys/partition: " << mean << "\n"
+              << "  stddev: " << stddev << "\n"
+              << "  max: " << max;
+
+    if (mean > 0)
+    {
+        std::cout << " (" << max / mean << "x mean)";
+    }
+
+    std::cout << "\n";
+
+    for (size_t i = 0; i < ranked.size() && i < size_t(top); ++i)
+    {
+        std::cout << "  partition " << std::setw(5) << ranked[i].second
+                  << ": " << ranked[i].first << " keys\n";
+    }
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* function = NULL;
+    long top = 10;
+    bool all = false;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS] <data-dir>");
+    ap.arg().name('f', "function")
+            .description("only report on this partitioning function (hash, ordered, or prefix)")
+            .metavar("F").as_string(&function);
+    ap.arg().name('t', "top")
+            .description("list this many of the most heavily loaded partitions (default: 10)")
+            .metavar("N").as_long(&top);
+    ap.arg().name('a', "all")
+            .description("print the key count of every partition, one per line")
+            .set_true(&all);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 1)
+    {
+        std::cerr << "consus-partition-skew takes one positional argument\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<partitioning> ps(functions, functions + functions_sz);
+
+    if (function)
+    {
+        partitioning p;
+
+        if (!consus::partitioning_from_string(function, &p))
+        {
+            std::cerr << "consus-partition-skew: unknown partitioning function \""
+                      << function << "\"" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        ps.assign(1, p);
+    }
+
+    if (all && ps.size() != 1)
+    {
+        std::cerr << "consus-partition-skew: --all requires --function\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    // the directory belongs to a stopped key value store; LevelDB's lock
+    // keeps us from reading one that is running
+    const char* dir = ap.args()[0];
+    std::auto_ptr<const leveldb::FilterPolicy> bf(leveldb::NewBloomFilterPolicy(10));
+    leveldb::Options opts;
+    opts.filter_policy = bf.get();
+    leveldb::DB* db = NULL;
+    leveldb::Status st = leveldb::DB::Open(opts, dir, &db);
+
+    if (!st.ok())
+    {
+        std::cerr << "consus-partition-skew: could not open " << dir
+                  << ": " << st.ToString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::auto_ptr<leveldb::DB> guard(db);
+    std::vector<std::vector<uint64_t> > counts(ps.size(), std::vector<uint64_t>(CONSUS_KVS_PARTITIONS, 0));
+    leveldb::ReadOptions ropts;
+    ropts.fill_cache = false;
+    std::auto_ptr<leveldb::Iterator> it(db->NewIterator(ropts));
+    const char data_tag = LEVELDB_DATA_KEY_TAG;
+    std::string table;
+    std::string key;
+    std::string prev;
+    uint64_t keys = 0;
+
+    // versions of one key are adjacent with the newest first, so a key is
+    // live when the first version seen is not a tombstone
+    for (it->Seek(leveldb::Slice(&data_tag, 1));
+            it->Valid() && it->key()[0] == LEVELDB_DATA_KEY_TAG; it->Next())
+    {
+        leveldb::Slice k = it->key();
+
+        if (k.size() < LEVELDB_TIMESTAMP_SZ)
+        {
+            std::cerr << "consus-partition-skew: corrupt key after " << keys << " keys" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        leveldb::Slice tk(k.data(), k.size() - LEVELDB_TIMESTAMP_SZ);
+
+        if (tk == leveldb::Slice(prev))
+        {
+            continue;
+        }
+
+        prev.assign(tk.data(), tk.size());
+
+        if (it->value().empty())
+        {
+            continue;
+        }
+
+        uint64_t timestamp;
+
+        if (!consus::leveldb_parse_data_key(k.data(), k.size(), &table, &key, &timestamp))
+        {
+            std::cerr << "consus-partition-skew: corrupt key after " << keys << " keys" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        for (size_t i = 0; i < ps.size(); ++i)
+        {
+            ++counts[i][consus::partition_index(ps[i], e::slice(table), e::slice(key))];
+        }
+
+        ++keys;
+    }
+
+    st = it->status();
+
+    if (!st.ok())
+    {
+        std::cerr << "consus-partition-skew: " << st.ToString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (all)
+    {
+        for (unsigned i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+        {
+            std::cout << i << " " << counts[0][i] << "\n";
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    std::cout << keys << " live keys in " << dir << "\n";
+
+    for (size_t i = 0; i < ps.size(); ++i)
+    {
+        report(ps[i], counts[i], keys, top);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2017, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <string>
+#include <vector>
+
+// e
+#include <e/guard.h>
+#include <e/popt.h>
+
+// consus
+#include <consus-admin.h>
+#include "tools/common.h"
+
+int
+main(int argc, const char* argv[])
+{
+    long replication = 0;
+    const char* data_centers = NULL;
+    consus::connect_opts conn;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS] <table>");
+    ap.arg().name('r', "replication")
+            .description("keep N replicas of each key within a data center (default: cluster default)")
+            .metavar("N").as_long(&replication);
+    ap.arg().name('d', "data-centers")
+            .description("comma-separated list of the only data centers that store the table (default: all)")
+            .metavar("DC,DC").as_string(&data_centers);
+    ap.add("Connect to a cluster:", conn.parser());
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!conn.validate())
+    {
+        std::cerr << "consus-set-table-policy: invalid host:port specification\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 1)
+    {
+        std::cerr << "consus-set-table-policy takes one positional argument\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (replication < 0)
+    {
+        std::cerr << "consus-set-table-policy: replication must be positive\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> dcs;
+
+    if (data_centers)
+    {
+        std::string s(data_centers);
+        size_t start = 0;
+
+        while (start <= s.size())
+        {
+            size_t comma = s.find(',', start);
+            comma = comma == std::string::npos ? s.size() : comma;
+
+            if (comma > start)
+            {
+                dcs.push_back(s.substr(start, comma - start));
+            }
+
+            start = comma + 1;
+        }
+    }
+
+    std::vector<const char*> dc_ptrs;
+
+    for (size_t i = 0; i < dcs.size(); ++i)
+    {
+        dc_ptrs.push_back(dcs[i].c_str());
+    }
+
+    consus_client* cl = consus_create_conn_str(conn.conn_str());
+
+    if (!cl)
+    {
+        std::cerr << "consus-set-table-policy: memory allocation failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    e::guard g_cl = e::makeguard(consus_destroy, cl);
+    consus_returncode rc;
+
+    if (consus_admin_set_table_policy(cl, ap.args()[0], replication,
+                                      dc_ptrs.empty() ? NULL : &dc_ptrs[0], dc_ptrs.size(),
+                                      &rc) < 0)
+    {
+        std::cerr << "consus-set-table-policy: " << consus_error_message(cl) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -35,6 +35,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // POSIX
 #include <signal.h>
@@ -51,6 +52,7 @@
 #include <po6/errno.h>
 #include <po6/io/fd.h>
 #include <po6/path.h>
+#include <po6/time.h>
 
 // e
 #include <e/atomic.h>
@@ -108,6 +110,15 @@ handle_debug_mode(int /*signum*/)
     s_debug_mode = !s_debug_mode;
 }
 
+static void
+lower_checkpoint(int64_t lowest_log_entry, int64_t* checkpoint)
+{
+    if (lowest_log_entry >= 0 && lowest_log_entry < *checkpoint)
+    {
+        *checkpoint = lowest_log_entry;
+    }
+}
+
 struct daemon::coordinator_callback : public coordinator_link::callback
 {
     coordinator_callback(daemon* d);
@@ -235,9 +246,11 @@ daemon :: daemon()
     , m_writers(&m_gc)
     , m_lock_ops(&m_gc)
     , m_log()
+    , m_replay_recno(-1)
+    , m_replay_entry(NULL)
+    , m_replay_entry_sz(0)
     , m_durable_thread(po6::threads::make_obj_func(&daemon::durable, this))
-    , m_durable_mtx()
-    , m_durable_up_to(-1)
+    , m_durable_up_to(0)
     , m_durable_msgs()
     , m_durable_cbs()
     , m_pumping_thread(po6::threads::make_obj_func(&daemon::pump, this))
@@ -260,7 +273,8 @@ daemon :: run(bool background,
               bool set_coordinator,
               const char* coordinator,
               const char* data_center,
-              unsigned threads)
+              unsigned threads,
+              const durability_policy& durability)
 {
     if (!e::block_all_signals())
     {
@@ -284,7 +298,7 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
-    if (!m_log.open(data))
+    if (!m_log.open(data, durability))
     {
         LOG(ERROR) << "could not open log: " << po6::strerror(m_log.error());
         return EXIT_FAILURE;
@@ -342,6 +356,12 @@ daemon :: run(bool background,
     }
 
     m_busybee.reset(busybee_server::create(&m_busybee_controller, id, bind_to, &m_gc));
+    const uint64_t replay_start = po6::monotonic_time();
+    m_log.scan(&daemon::scan_log_entry, this);
+    const int64_t replayed = m_log.replay(&daemon::replay_log_entry, this);
+    const uint64_t replay_end = po6::monotonic_time();
+    LOG(INFO) << "replayed " << replayed << " log records in "
+              << double(replay_end - replay_start) / PO6_SECONDS << " seconds";
     m_durable_thread.start();
     m_pumping_thread.start();
 
@@ -561,6 +581,7 @@ daemon :: loop(size_t thread)
             case CLIENT_RESPONSE:
             case KVS_REP_RD:
             case KVS_REP_WR:
+            case KVS_REP_WR_MULTI:
             case KVS_RAW_RD:
             case KVS_RAW_RD_RESP:
             case KVS_RAW_WR:
@@ -569,6 +590,11 @@ daemon :: loop(size_t thread)
             case KVS_RAW_LK:
             case KVS_RAW_LK_RESP:
             case KVS_WOUND_XACT:
+            case KVS_RAW_WR_MULTI:
+            case KVS_RAW_WR_MULTI_RESP:
+            case KVS_LEASE_RD:
+            case KVS_LEASE_RD_RESP:
+            case KVS_BATCH:
             case KVS_MIGRATE_SYN:
             case KVS_MIGRATE_ACK:
             default:
@@ -807,6 +833,7 @@ daemon :: process_finished(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     {
         if (m_dispositions.put_ine(tg, outcome))
         {
+            log_outcome(tg, outcome);
             break;
         }
         else
@@ -1235,6 +1262,214 @@ daemon :: process_kvs_lock_op_resp(comm_id, std::auto_ptr<e::buffer>, e::unpacke
     }
 }
 
+void
+daemon :: scan_log_entry(void* p, const unsigned char* entry, size_t entry_sz)
+{
+    daemon* d = static_cast<daemon*>(p);
+    d->scan(entry, entry_sz);
+}
+
+void
+daemon :: scan(const unsigned char* entry, size_t entry_sz)
+{
+    // Restore the outcome of every group that finished before the restart,
+    // so that replay can pass over the rest of its records.
+    e::unpacker up = e::unpacker(e::slice(entry, entry_sz));
+    log_entry_t t = LOG_ENTRY_NOP;
+    transaction_group tg;
+    uint64_t outcome = 0;
+    up = up >> t;
+
+    if (up.error() || t != LOG_ENTRY_TX_OUTCOME)
+    {
+        return;
+    }
+
+    up = up >> tg >> outcome;
+
+    if (up.error())
+    {
+        return;
+    }
+
+    m_dispositions.put(tg, outcome);
+}
+
+void
+daemon :: replay_log_entry(void* p, int64_t recno, const unsigned char* entry, size_t entry_sz)
+{
+    daemon* d = static_cast<daemon*>(p);
+    d->m_replay_recno = recno;
+    d->m_replay_entry = entry;
+    d->m_replay_entry_sz = entry_sz;
+    d->replay(entry, entry_sz);
+    d->m_replay_recno = -1;
+    d->m_replay_entry = NULL;
+    d->m_replay_entry_sz = 0;
+}
+
+void
+daemon :: replay(const unsigned char* entry, size_t entry_sz)
+{
+    // Log entries carry the same payload as the message that produced them,
+    // so recovery feeds them through the same entry points as the network.
+    // When the state machine logs the entry again, append_log hands back the
+    // recovered recno instead of writing it a second time.  Re-sent messages
+    // are harmless; the recipients treat them as retransmissions.  The entry
+    // is copied because it points into a mapping that is released once
+    // replay completes.
+    std::auto_ptr<e::buffer> backing(e::buffer::create(reinterpret_cast<const char*>(entry), entry_sz));
+    e::unpacker up = backing->unpack_from(0);
+    log_entry_t t = LOG_ENTRY_NOP;
+    transaction_group tg;
+    up = up >> t >> tg;
+
+    if (up.error())
+    {
+        LOG(ERROR) << "dropping corrupt log entry during replay";
+        return;
+    }
+
+    // the group finished before the restart; rebuilding its state machines
+    // would only have them re-send messages for a decided outcome
+    if (m_dispositions.has(tg))
+    {
+        return;
+    }
+
+    switch (t)
+    {
+        case LOG_ENTRY_TX_BEGIN:
+        case LOG_ENTRY_TX_READ:
+        case LOG_ENTRY_TX_WRITE:
+        case LOG_ENTRY_TX_PREPARE:
+        case LOG_ENTRY_TX_ABORT:
+        {
+            uint64_t seqno = 0;
+            up = up >> seqno;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            transaction_map_t::state_reference tsr;
+            transaction* xact = m_transactions.get_or_create_state(tg, &tsr);
+            assert(xact);
+            xact->paxos_2a(seqno, t, up, backing, this);
+            return;
+        }
+        case LOG_ENTRY_LOCAL_VOTE_1A:
+        {
+            uint8_t idx;
+            paxos_synod::ballot b;
+            up = up >> idx >> b;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            local_voter_map_t::state_reference lvsr;
+            local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+            assert(lv);
+            lv->vote_1a(b.leader, idx, b, this);
+            return;
+        }
+        case LOG_ENTRY_LOCAL_VOTE_2A:
+        {
+            uint8_t idx;
+            paxos_synod::pvalue p;
+            up = up >> idx >> p;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            local_voter_map_t::state_reference lvsr;
+            local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+            assert(lv);
+            lv->vote_2a(p.b.leader, idx, p, this);
+            return;
+        }
+        case LOG_ENTRY_LOCAL_LEARN:
+        {
+            uint8_t idx;
+            uint64_t v;
+            up = up >> idx >> v;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            local_voter_map_t::state_reference lvsr;
+            local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+            assert(lv);
+            lv->vote_learn(idx, v, this);
+            return;
+        }
+        case LOG_ENTRY_GLOBAL_PROPOSE:
+        {
+            generalized_paxos::command c;
+            up = up >> c;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            global_voter_map_t::state_reference gvsr;
+            global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+            assert(gv);
+            gv->propose(c, this);
+            return;
+        }
+        case LOG_ENTRY_GLOBAL_VOTE_1A:
+        {
+            generalized_paxos::message_p1a m;
+            up = up >> m;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            global_voter_map_t::state_reference gvsr;
+            global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+            assert(gv);
+            gv->process_p1a(comm_id(m.b.leader.get()), m, this);
+            return;
+        }
+        case LOG_ENTRY_GLOBAL_VOTE_2A:
+        {
+            generalized_paxos::message_p2a m;
+            up = up >> m;
+
+            if (up.error())
+            {
+                break;
+            }
+
+            global_voter_map_t::state_reference gvsr;
+            global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+            assert(gv);
+            gv->process_p2a(comm_id(m.b.leader.get()), m, this);
+            return;
+        }
+        case LOG_ENTRY_TX_OUTCOME:
+        case LOG_ENTRY_GLOBAL_VOTE_2B:
+        case LOG_ENTRY_CONFIG:
+        case LOG_ENTRY_NOP:
+        default:
+            LOG(ERROR) << "dropping unexpected " << t << " log entry during replay";
+            return;
+    }
+
+    LOG(ERROR) << "dropping corrupt " << t << " log entry during replay";
+}
+
 consus::kvs_read*
 daemon :: create_read(read_map_t::state_reference* sr)
 {
@@ -1316,10 +1551,14 @@ daemon :: debug_dump()
     LOG(INFO) << "configuration version: " << get_config()->version().get();
     LOG(INFO) << "note that entries can appear multiple times in the following tables";
     LOG(INFO) << "this is a natural consequence of not holding global locks during the dump";
+    LOG(INFO) << m_durable_cbs.size() << " unanswered durable callbacks";
+    LOG(INFO) << m_durable_msgs.size() << " unanswered durable messages";
+    LOG(INFO) << "time to durable: " << m_log.time_to_durable();
+    LOG(INFO) << m_log.deduplicated() << " log appends deduplicated";
     {
-        po6::threads::mutex::hold hold(&m_durable_mtx);
-        LOG(INFO) << m_durable_cbs.size() << " unanswered durable callbacks";
-        LOG(INFO) << m_durable_msgs.size() << " unanswered durable messages";
+        durable_log_stats ls = m_log.stats();
+        LOG(INFO) << "log: " << ls.records << " records in " << ls.syncs << " syncs; "
+                  << ls.bytes_staged << " bytes staged, " << ls.bytes_written << " bytes written";
     }
     LOG(INFO) << "--------------------------------- Transactions ---------------------------------";
 
@@ -1566,24 +1805,26 @@ struct daemon::durable_msg
         msg = rhs.msg;
         return *this;
     }
-    bool operator < (const durable_msg& rhs) { return rhs.recno > recno; }
     int64_t recno;
     comm_id client;
     e::buffer* msg;
 };
 
-void
+int64_t
 daemon :: send_when_durable(const std::string& entry, comm_id id, std::auto_ptr<e::buffer> msg)
 {
     e::buffer* m = msg.release();
-    send_when_durable(entry, &id, &m, 1);
+    return send_when_durable(entry, &id, &m, 1);
 }
 
-void
+int64_t
 daemon :: send_when_durable(const std::string& entry, const comm_id* ids, e::buffer** msgs, size_t sz)
 {
-    int64_t x = m_log.append(entry.data(), entry.size());
+    // voters re-log the same vote on every retransmission of the message
+    // that prompted it; log it once and answer each copy once it's durable
+    int64_t x = append_log(entry, true);
     send_when_durable(x, ids, msgs, sz);
+    return x;
 }
 
 void
@@ -1627,30 +1868,22 @@ daemon :: send_when_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, s
         return;
     }
 
-    bool send_now = false;
-
+    if (uint64_t(idx) < e::atomic::load_64_acquire(&m_durable_up_to))
     {
-        po6::threads::mutex::hold hold(&m_durable_mtx);
-        send_now = idx <= m_durable_up_to;
-
-        if (!send_now)
+        for (size_t i = 0; i < sz; ++i)
         {
-            for (size_t i = 0; i < sz; ++i)
-            {
-                durable_msg d(idx, ids[i], msgs[i]);
-                m_durable_msgs.push_back(d);
-                std::push_heap(m_durable_msgs.begin(), m_durable_msgs.end());
-            }
+            send(ids[i], std::auto_ptr<e::buffer>(msgs[i]));
         }
+
+        return;
     }
 
-    if (send_now)
+    for (size_t i = 0; i < sz; ++i)
     {
-        for (size_t i = 0; i < sz; ++i)
-        {
-            send(ids[i], std::auto_ptr<e::buffer>(msgs[i]));
-        }
+        m_durable_msgs.enqueue(durable_msg(idx, ids[i], msgs[i]));
     }
+
+    wake_if_durable(idx);
 }
 
 void
@@ -1684,12 +1917,7 @@ daemon :: send_if_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg)
 void
 daemon :: send_if_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz)
 {
-    bool should_send = false;
-    m_durable_mtx.lock();
-    should_send = idx <= m_durable_up_to;
-    m_durable_mtx.unlock();
-
-    if (idx < 0 || !should_send)
+    if (idx < 0 || uint64_t(idx) >= e::atomic::load_64_acquire(&m_durable_up_to))
     {
         for (size_t i = 0; i < sz; ++i)
         {
@@ -1720,33 +1948,68 @@ struct daemon::durable_cb
         seqno = rhs.seqno;
         return *this;
     }
-    bool operator < (const durable_cb& rhs) { return rhs.recno > recno; }
     int64_t recno;
     transaction_group tg;
     uint64_t seqno;
 };
 
-void
+int64_t
 daemon :: callback_when_durable(const std::string& entry, const transaction_group& tg, uint64_t seqno)
 {
-    int64_t x = m_log.append(entry.data(), entry.size());
+    int64_t x = append_log(entry, false);
 
     if (x < 0)
     {
-        return;
+        return x;
+    }
+
+    m_durable_cbs.enqueue(durable_cb(x, tg, seqno));
+    wake_if_durable(x);
+    return x;
+}
+
+int64_t
+daemon :: append_log(const std::string& entry, bool unique)
+{
+    // Replay rebuilds state machines through the same paths that log; the
+    // record that prompted the call is already on disk under its own recno,
+    // and writing it again would copy the un-checkpointed log on each start.
+    if (m_replay_entry &&
+        m_replay_entry_sz == entry.size() &&
+        memcmp(m_replay_entry, entry.data(), entry.size()) == 0)
+    {
+        return m_replay_recno;
+    }
+
+    if (unique)
+    {
+        return m_log.append_unique(entry.data(), entry.size());
     }
 
-    bool wake = false;
+    return m_log.append(entry.data(), entry.size());
+}
+
+void
+daemon :: log_outcome(const transaction_group& tg, uint64_t outcome)
+{
+    // Nothing waits on this record.  If it is lost, replay rebuilds the
+    // group, which then re-learns its outcome from its peers.
+    std::string entry;
+    e::packer(&entry) << LOG_ENTRY_TX_OUTCOME << tg << outcome;
 
+    if (m_log.append(entry.data(), entry.size()) < 0)
     {
-        po6::threads::mutex::hold hold(&m_durable_mtx);
-        durable_cb d(x, tg, seqno);
-        m_durable_cbs.push_back(d);
-        std::push_heap(m_durable_cbs.begin(), m_durable_cbs.end());
-        wake = x <= m_durable_up_to;
+        LOG(ERROR) << "could not log outcome of " << tg;
     }
+}
 
-    if (wake)
+void
+daemon :: wake_if_durable(int64_t idx)
+{
+    // The durability thread publishes m_durable_up_to before it drains the
+    // queues.  If it did so after the enqueue that precedes this call, the
+    // drain may have missed the item, so prod the thread into another pass.
+    if (uint64_t(idx) < e::atomic::load_64_acquire(&m_durable_up_to))
     {
         m_log.wake();
     }
@@ -1766,6 +2029,8 @@ daemon :: durable()
 
     LOG(INFO) << "durability monitor started";
     int64_t x = -1;
+    std::vector<durable_msg> msgs;
+    std::vector<durable_cb> cbs;
     e::garbage_collector::thread_state ts;
     m_gc.register_thread(&ts);
 
@@ -1787,29 +2052,12 @@ daemon :: durable()
             break;
         }
 
-        std::vector<durable_msg> msgs;
-        std::vector<durable_cb> cbs;
-
-        {
-            po6::threads::mutex::hold hold(&m_durable_mtx);
-            m_durable_up_to = x;
-
-            while (!m_durable_msgs.empty() &&
-                   m_durable_msgs[0].recno < x)
-            {
-                msgs.push_back(m_durable_msgs[0]);
-                std::pop_heap(m_durable_msgs.begin(), m_durable_msgs.end());
-                m_durable_msgs.pop_back();
-            }
-
-            while (!m_durable_cbs.empty() &&
-                   m_durable_cbs[0].recno < x)
-            {
-                cbs.push_back(m_durable_cbs[0]);
-                std::pop_heap(m_durable_cbs.begin(), m_durable_cbs.end());
-                m_durable_cbs.pop_back();
-            }
-        }
+        msgs.clear();
+        cbs.clear();
+        e::atomic::store_64_release(&m_durable_up_to, std::max(x, int64_t(0)));
+        e::atomic::memory_barrier();
+        m_durable_msgs.drain(x, &msgs);
+        m_durable_cbs.drain(x, &cbs);
 
         for (size_t i = 0; i < msgs.size(); ++i)
         {
@@ -1862,24 +2110,32 @@ daemon :: pump()
             break;
         }
 
+        // Any state machine that logs after this point logs at or above
+        // checkpoint, so only those visited below can hold it down.
+        int64_t checkpoint = m_log.next_entry();
+
         for (transaction_map_t::iterator it(&m_transactions); it.valid(); ++it)
         {
             transaction* xact = *it;
             xact->externally_work_state_machine(this);
+            lower_checkpoint(xact->lowest_log_entry(), &checkpoint);
         }
 
         for (local_voter_map_t::iterator it(&m_local_voters); it.valid(); ++it)
         {
             local_voter* lv = *it;
             lv->externally_work_state_machine(this);
+            lower_checkpoint(lv->lowest_log_entry(), &checkpoint);
         }
 
         for (global_voter_map_t::iterator it(&m_global_voters); it.valid(); ++it)
         {
             global_voter* gv = *it;
             gv->externally_work_state_machine(this);
+            lower_checkpoint(gv->lowest_log_entry(), &checkpoint);
         }
 
+        m_log.checkpoint(checkpoint);
         m_gc.quiescent_state(&ts);
     }
 
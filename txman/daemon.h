@@ -59,6 +59,7 @@
 #include "txman/configuration.h"
 #include "txman/controller.h"
 #include "txman/durable_log.h"
+#include "txman/durable_queue.h"
 #include "txman/global_voter.h"
 #include "txman/kvs_lock_op.h"
 #include "txman/kvs_read.h"
@@ -85,7 +86,8 @@ class daemon
                 bool set_coordinator,
                 const char* coordinator,
                 const char* data_center,
-                unsigned threads);
+                unsigned threads,
+                const durability_policy& durability);
 
     private:
         struct coordinator_callback;
@@ -98,8 +100,8 @@ class daemon
         typedef e::state_hash_table<transaction_group, local_voter> local_voter_map_t;
         typedef e::state_hash_table<transaction_group, global_voter> global_voter_map_t;
         typedef e::nwf_hash_map<transaction_group, uint64_t, transaction_group::hash> disposition_map_t;
-        typedef std::vector<durable_msg> durable_msg_heap_t;
-        typedef std::vector<durable_cb> durable_cb_heap_t;
+        typedef durable_queue<durable_msg> durable_msg_queue_t;
+        typedef durable_queue<durable_cb> durable_cb_queue_t;
         friend class controller;
         friend class transaction;
         friend class local_voter;
@@ -135,6 +137,10 @@ class daemon
         void process_kvs_rep_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_kvs_rep_wr_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_kvs_lock_op_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        static void scan_log_entry(void* p, const unsigned char* entry, size_t entry_sz);
+        void scan(const unsigned char* entry, size_t entry_sz);
+        static void replay_log_entry(void* p, int64_t recno, const unsigned char* entry, size_t entry_sz);
+        void replay(const unsigned char* entry, size_t entry_sz);
         kvs_read* create_read(read_map_t::state_reference* sr);
         kvs_write* create_write(write_map_t::state_reference* sr);
         kvs_lock_op* create_lock_op(lock_op_map_t::state_reference* sr);
@@ -151,15 +157,19 @@ class daemon
         unsigned send(paxos_group_id g, std::auto_ptr<e::buffer> msg);
         unsigned send(const paxos_group& g, std::auto_ptr<e::buffer> msg);
         // XXX next two might cause excessive logging; investigate
-        void send_when_durable(const std::string& entry, comm_id id, std::auto_ptr<e::buffer> msg);
-        void send_when_durable(const std::string& entry, const comm_id* ids, e::buffer** msgs, size_t sz);
+        int64_t send_when_durable(const std::string& entry, comm_id id, std::auto_ptr<e::buffer> msg);
+        int64_t send_when_durable(const std::string& entry, const comm_id* ids, e::buffer** msgs, size_t sz);
         void send_when_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg);
         void send_when_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg);
         void send_when_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz);
         void send_if_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg);
         void send_if_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg);
         void send_if_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz);
-        void callback_when_durable(const std::string& entry, const transaction_group& tg, uint64_t seqno);
+        int64_t callback_when_durable(const std::string& entry, const transaction_group& tg, uint64_t seqno);
+        // append entry to the log, unless it is the record being replayed
+        int64_t append_log(const std::string& entry, bool unique);
+        void log_outcome(const transaction_group& tg, uint64_t outcome);
+        void wake_if_durable(int64_t idx);
         void durable();
         void pump();
 
@@ -180,13 +190,17 @@ class daemon
         write_map_t m_writers;
         lock_op_map_t m_lock_ops;
         durable_log m_log;
+        // the record being replayed, if any; it is already durable
+        int64_t m_replay_recno;
+        const unsigned char* m_replay_entry;
+        size_t m_replay_entry_sz;
 
         // awaiting durability
         po6::threads::thread m_durable_thread;
-        po6::threads::mutex m_durable_mtx;
-        int64_t m_durable_up_to;
-        durable_msg_heap_t m_durable_msgs;
-        durable_cb_heap_t m_durable_cbs;
+        // every recno below this is durable; written only by m_durable_thread
+        uint64_t m_durable_up_to;
+        durable_msg_queue_t m_durable_msgs;
+        durable_cb_queue_t m_durable_cbs;
 
         // state machine pumping
         po6::threads::thread m_pumping_thread;
@@ -25,21 +25,46 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 // C
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // POSIX
 #include <dirent.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 // STL
 #include <algorithm>
+#include <deque>
+#include <map>
 #include <vector>
 
+#ifdef CONSUS_LOG_COMPRESSION
+// LZ4
+#include <lz4.h>
+#endif
+
+// po6
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
 // e
+#include <e/atomic.h>
+#include <e/compat.h>
 #include <e/endian.h>
 #include <e/guard.h>
 #include <e/serialization.h>
@@ -49,9 +74,33 @@
 #include "common/crc32c.h"
 #include "txman/durable_log.h"
 
+using consus::durability_policy;
 using consus::durable_log;
+using consus::durable_log_stats;
+using consus::latency_histogram;
 
 #define RECORD_HEADER_SIZE (2 * sizeof(uint64_t))
+#define RECORD_FOOTER_SIZE (sizeof(uint32_t))
+// A size with this bit set introduces a compressed batch instead of a record.
+// Its entry is the batch's uncompressed size followed by an LZ4 block that
+// inflates to ordinary records; the header's recno is the batch's first.
+#define RECORD_BATCH_FLAG (1ULL << 63)
+// batches smaller than this are not worth compressing
+#define BATCH_COMPRESS_MIN 1024
+// refuse to inflate anything claiming to be larger than this
+#define BATCH_INFLATE_MAX (1ULL << 30)
+#define SEGMENT_PREFIX "log-"
+#define SEGMENT_NAME_SIZE 32
+// once a segment passes this size it is sealed and a fresh one takes its place
+#define SEGMENT_SIZE (64ULL * 1024ULL * 1024ULL)
+// records per unit of work when verifying checksums during recovery
+#define RECOVERY_CHUNK 4096
+// append_unique partitions the entries it remembers by checksum
+#define DEDUP_STRIPES 64
+
+// Each record is laid out as [recno|size|entry|crc].  The CRC covers the entry
+// and then the header, so that the expensive part can be computed before the
+// record number is assigned and outside of the log's mutex.
 
 static void
 encode_header(uint64_t recno, uint64_t size, unsigned char* header)
@@ -60,59 +109,765 @@ encode_header(uint64_t recno, uint64_t size, unsigned char* header)
     e::pack64be(size, header + sizeof(uint64_t));
 }
 
+static void
+segment_name(uint64_t id, char* name)
+{
+    snprintf(name, SEGMENT_NAME_SIZE, SEGMENT_PREFIX "%016llx", (unsigned long long)id);
+}
+
+static bool
+parse_segment_name(const char* name, uint64_t* id)
+{
+    const size_t prefix_sz = strlen(SEGMENT_PREFIX);
+
+    if (strncmp(name, SEGMENT_PREFIX, prefix_sz) != 0 ||
+        strlen(name) != prefix_sz + 16)
+    {
+        return false;
+    }
+
+    char* end = NULL;
+    *id = strtoull(name + prefix_sz, &end, 16);
+    return *end == '\0';
+}
+
+// Segments are preallocated, so appends do not change the file size and
+// fdatasync is enough; O_DSYNC segments are synced by the write itself.
+static bool
+sync_segment(int fd, durability_policy::sync_t sync)
+{
+    switch (sync)
+    {
+        case durability_policy::SYNC_FSYNC:
+            return fsync(fd) >= 0;
+        case durability_policy::SYNC_FDATASYNC:
+            return fdatasync(fd) >= 0;
+        case durability_policy::SYNC_DSYNC:
+            return true;
+        default:
+            abort();
+    }
+}
+
+static bool
+write_fully(int fd, const char* buf, size_t buf_sz, uint64_t offset)
+{
+    while (buf_sz > 0)
+    {
+        ssize_t ret = pwrite(fd, buf, buf_sz, offset);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret < 0)
+        {
+            return false;
+        }
+        else if (ret == 0)
+        {
+            // callers report errno, so a write that made no progress must
+            // not leave it unset
+            errno = EIO;
+            return false;
+        }
+
+        buf += ret;
+        buf_sz -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+#ifdef CONSUS_LOG_COMPRESSION
+// Encode the records in raw as one compressed batch.  Returns false, leaving
+// raw to be written as is, when that would not save space.
+static bool
+compress_batch(const std::string& raw, std::string* batch)
+{
+    if (raw.size() < BATCH_COMPRESS_MIN || raw.size() > BATCH_INFLATE_MAX)
+    {
+        return false;
+    }
+
+    const int bound = LZ4_compressBound(raw.size());
+    batch->resize(RECORD_HEADER_SIZE + sizeof(uint64_t) + bound + RECORD_FOOTER_SIZE);
+    unsigned char* header = reinterpret_cast<unsigned char*>(&(*batch)[0]);
+    unsigned char* entry = header + RECORD_HEADER_SIZE;
+    const int compressed = LZ4_compress_default(raw.data(),
+                                                reinterpret_cast<char*>(entry) + sizeof(uint64_t),
+                                                raw.size(), bound);
+
+    if (compressed <= 0)
+    {
+        return false;
+    }
+
+    const uint64_t entry_sz = sizeof(uint64_t) + compressed;
+
+    if (RECORD_HEADER_SIZE + entry_sz + RECORD_FOOTER_SIZE >= raw.size())
+    {
+        return false;
+    }
+
+    uint64_t recno;
+    e::unpack64be(reinterpret_cast<const unsigned char*>(raw.data()), &recno);
+    e::pack64be(raw.size(), entry);
+    encode_header(recno, RECORD_BATCH_FLAG | entry_sz, header);
+    uint32_t crc = consus::crc32c(0, entry, entry_sz);
+    crc = consus::crc32c(crc, header, RECORD_HEADER_SIZE);
+    e::pack32be(crc, entry + entry_sz);
+    batch->resize(RECORD_HEADER_SIZE + entry_sz + RECORD_FOOTER_SIZE);
+    return true;
+}
+#endif // CONSUS_LOG_COMPRESSION
+
 struct durable_log :: segment
 {
-    segment(po6::threads::mutex* mtx, int x)
-        : fd(x)
+    segment(uint64_t i, int x)
+        : id(i)
+        , fd(x)
+        , staged()
+        , writing()
+        , staged_times()
+        , writing_times()
         , offset_next_write(0)
         , offset_last_fsync(0)
+        , offset_disk(0)
+        , recno_first(0)
+        , recno_unsynced(0)
         , recno_last_write(0)
         , recno_last_fsync(0)
-        , ongoing_writes(0)
-        , done_writing(mtx)
         , syncing(false)
     {
     }
+    void stage(uint64_t recno, const unsigned char* entry, size_t entry_sz,
+               uint32_t crc, uint64_t now);
+    uint64_t id;
     po6::io::fd fd;
+    // records appended since the last write, encoded in on-disk form; the
+    // flush thread swaps this with "writing" and issues one write per batch
+    std::string staged;
+    std::string writing;
+    // when each staged/writing record was appended, for time-to-durable
+    std::vector<uint64_t> staged_times;
+    std::vector<uint64_t> writing_times;
     uint64_t offset_next_write;
     uint64_t offset_last_fsync;
+    // where the next batch lands in the file; owned by the flush thread, and
+    // behind the offsets above once batches are compressed
+    uint64_t offset_disk;
+    uint64_t recno_first;
+    // the lowest record not yet synced, when offset_next_write > offset_last_fsync
+    uint64_t recno_unsynced;
     uint64_t recno_last_write;
     uint64_t recno_last_fsync;
-    int32_t ongoing_writes;
-    po6::threads::cond done_writing;
     bool syncing;
 };
 
+void
+durable_log :: segment :: stage(uint64_t recno, const unsigned char* entry, size_t entry_sz,
+                                uint32_t crc, uint64_t now)
+{
+    unsigned char header[RECORD_HEADER_SIZE];
+    encode_header(recno, entry_sz, header);
+    crc = crc32c(crc, header, RECORD_HEADER_SIZE);
+    unsigned char footer[RECORD_FOOTER_SIZE];
+    e::pack32be(crc, footer);
+    staged.append(reinterpret_cast<const char*>(header), RECORD_HEADER_SIZE);
+    staged.append(reinterpret_cast<const char*>(entry), entry_sz);
+    staged.append(reinterpret_cast<const char*>(footer), RECORD_FOOTER_SIZE);
+    staged_times.push_back(now);
+    recno_unsynced = offset_next_write == offset_last_fsync ? recno : recno_unsynced;
+    offset_next_write += RECORD_HEADER_SIZE + entry_sz + RECORD_FOOTER_SIZE;
+    recno_first = recno_first == 0 ? recno : recno_first;
+    recno_last_write = recno;
+}
+
+// A shard is an independent pair of segments with its own mutex and flush
+// thread.  Record numbers come from one counter shared by every shard and are
+// assigned under the shard's mutex, so records within a shard are in order.
+class durable_log :: shard
+{
+    public:
+        shard(durable_log* log, segment* a, segment* b);
+        ~shard() throw ();
+
+    public:
+        int64_t append(const unsigned char* entry, size_t entry_sz,
+                       uint32_t crc, uint64_t now);
+        // the lowest record in this shard that is not yet durable
+        uint64_t unsynced();
+        void fail(int err);
+        void flush();
+
+    private:
+        segment* select_segment_write();
+        segment* select_segment_fsync();
+
+    public:
+        durable_log* const log;
+        po6::threads::mutex mtx;
+        po6::threads::cond staged;
+        po6::threads::thread flusher;
+        int error;
+        bool flush_waiting;
+        bool flush_batching;
+        // bytes staged in either segment, and when the oldest of them was
+        // appended; appends alternate between segments, so neither one alone
+        // says how large or how old the pending batch is
+        uint64_t staged_bytes;
+        uint64_t oldest_staged;
+        segment* segment_a;
+        segment* segment_b;
+        // the flush thread's scratch space for compressed batches
+        std::string compressed;
+
+    private:
+        shard(const shard&);
+        shard& operator = (const shard&);
+};
+
+durable_log :: shard :: shard(durable_log* l, segment* a, segment* b)
+    : log(l)
+    , mtx()
+    , staged(&mtx)
+    , flusher(po6::threads::make_obj_func(&shard::flush, this))
+    , error(0)
+    , flush_waiting(false)
+    , flush_batching(false)
+    , staged_bytes(0)
+    , oldest_staged(0)
+    , segment_a(a)
+    , segment_b(b)
+    , compressed()
+{
+}
+
+durable_log :: shard :: ~shard() throw ()
+{
+    delete segment_a;
+    delete segment_b;
+}
+
+int64_t
+durable_log :: shard :: append(const unsigned char* entry, size_t entry_sz,
+                               uint32_t crc, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&mtx);
+
+    if (error)
+    {
+        errno = error;
+        return -1;
+    }
+
+    const uint64_t recno = e::atomic::increment_64_fullbarrier(&log->m_next_entry, 1) - 1;
+    segment* seg = select_segment_write();
+    assert(seg);
+    assert(!seg->syncing);
+    seg->stage(recno, entry, entry_sz, crc, now);
+    staged_bytes += RECORD_HEADER_SIZE + entry_sz + RECORD_FOOTER_SIZE;
+    oldest_staged = oldest_staged == 0 ? now : oldest_staged;
+
+    if (flush_waiting ||
+        (flush_batching && log->m_policy.max_batch_bytes > 0 &&
+         staged_bytes >= log->m_policy.max_batch_bytes))
+    {
+        staged.signal();
+    }
+
+    return recno;
+}
+
+uint64_t
+durable_log :: shard :: unsynced()
+{
+    po6::threads::mutex::hold hold(&mtx);
+    const segment* a = segment_a;
+    const segment* b = segment_b;
+    uint64_t x = UINT64_MAX;
+
+    if (a->offset_next_write > a->offset_last_fsync)
+    {
+        x = std::min(x, a->recno_unsynced);
+    }
+
+    if (b->offset_next_write > b->offset_last_fsync)
+    {
+        x = std::min(x, b->recno_unsynced);
+    }
+
+    return x;
+}
+
+void
+durable_log :: shard :: fail(int err)
+{
+    po6::threads::mutex::hold hold(&mtx);
+
+    if (error == 0)
+    {
+        error = err;
+    }
+
+    staged.broadcast();
+}
+
+// Entries remembered by append_unique.  Both are guarded by mtx, which is held
+// across the append itself so that two concurrent appends of the same entry
+// write it once.  Because of that, recnos enter "order" in increasing order
+// and checkpoint can retire them from the front.
+struct durable_log :: dedup_stripe
+{
+    typedef std::multimap<uint32_t, std::pair<int64_t, std::string> > entry_map_t;
+    dedup_stripe() : mtx(), entries(), order() {}
+    po6::threads::mutex mtx;
+    entry_map_t entries;
+    std::deque<std::pair<int64_t, entry_map_t::iterator> > order;
+
+    private:
+        dedup_stripe(const dedup_stripe&);
+        dedup_stripe& operator = (const dedup_stripe&);
+};
+
+struct durable_log :: recovered_segment
+{
+    struct record
+    {
+        record() : recno(), header(), entry_sz() {}
+        record(uint64_t r, const unsigned char* h, uint64_t s) : recno(r), header(h), entry_sz(s) {}
+        uint64_t recno;
+        // points into the mapped segment, or into an inflated batch
+        const unsigned char* header;
+        uint64_t entry_sz;
+    };
+
+    recovered_segment(uint64_t i)
+        : id(i), base(NULL), size(0), records(), first_invalid(0)
+        , inflated(), unsupported(false) {}
+    ~recovered_segment() throw ()
+    {
+        if (base)
+        {
+            munmap(base, size);
+        }
+
+        for (size_t i = 0; i < inflated.size(); ++i)
+        {
+            delete inflated[i];
+        }
+    }
+    const unsigned char* data() const { return static_cast<const unsigned char*>(base); }
+    void index();
+    bool inflate(const unsigned char* header, uint64_t entry_sz);
+    bool verify(size_t idx);
+
+    uint64_t id;
+    void* base;
+    size_t size;
+    std::vector<record> records;
+    // records at and beyond this index are torn or corrupt
+    size_t first_invalid;
+    std::vector<std::string*> inflated;
+    // the segment holds compressed batches and this build cannot read them
+    bool unsupported;
+
+    private:
+        recovered_segment(const recovered_segment&);
+        recovered_segment& operator = (const recovered_segment&);
+};
+
+// Walk the headers of a mapped segment, stopping at zeroed (preallocated)
+// space or at a size that runs past the end of the file.  Checksums are
+// verified separately so that the work can be spread across cores.
+void
+durable_log :: recovered_segment :: index()
+{
+    const unsigned char* d = data();
+    uint64_t offset = 0;
+
+    while (offset + RECORD_HEADER_SIZE + RECORD_FOOTER_SIZE <= size)
+    {
+        uint64_t recno;
+        uint64_t entry_sz;
+        e::unpack64be(d + offset, &recno);
+        e::unpack64be(d + offset + sizeof(uint64_t), &entry_sz);
+
+        const bool batch = (entry_sz & RECORD_BATCH_FLAG) != 0;
+        entry_sz &= ~RECORD_BATCH_FLAG;
+
+        if (recno == 0 ||
+            entry_sz > size - offset - RECORD_HEADER_SIZE - RECORD_FOOTER_SIZE)
+        {
+            break;
+        }
+
+        if (!batch)
+        {
+            records.push_back(record(recno, d + offset, entry_sz));
+        }
+        else if (!inflate(d + offset, entry_sz))
+        {
+            break;
+        }
+
+        offset += RECORD_HEADER_SIZE + entry_sz + RECORD_FOOTER_SIZE;
+    }
+
+    first_invalid = records.size();
+}
+
+// A compressed batch is checked as a whole before it is inflated; the records
+// inside it are then verified like any other.  Anything short of a complete,
+// well-formed batch is treated as the torn end of the segment.
+bool
+durable_log :: recovered_segment :: inflate(const unsigned char* header, uint64_t entry_sz)
+{
+#ifdef CONSUS_LOG_COMPRESSION
+    const unsigned char* entry = header + RECORD_HEADER_SIZE;
+    uint32_t crc = crc32c(0, entry, entry_sz);
+    crc = crc32c(crc, header, RECORD_HEADER_SIZE);
+    uint32_t expected;
+    e::unpack32be(entry + entry_sz, &expected);
+    uint64_t raw_sz;
+
+    if (crc != expected || entry_sz < sizeof(uint64_t))
+    {
+        return false;
+    }
+
+    e::unpack64be(entry, &raw_sz);
+
+    if (raw_sz > BATCH_INFLATE_MAX)
+    {
+        return false;
+    }
+
+    std::auto_ptr<std::string> raw(new std::string(raw_sz, '\0'));
+    const int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(entry) + sizeof(uint64_t),
+                                        &(*raw)[0], entry_sz - sizeof(uint64_t), raw_sz);
+
+    if (ret < 0 || uint64_t(ret) != raw_sz)
+    {
+        return false;
+    }
+
+    const unsigned char* d = reinterpret_cast<const unsigned char*>(raw->data());
+    const size_t records_sz = records.size();
+    uint64_t offset = 0;
+
+    while (offset < raw_sz)
+    {
+        uint64_t recno;
+        uint64_t sz;
+
+        if (raw_sz - offset < RECORD_HEADER_SIZE + RECORD_FOOTER_SIZE)
+        {
+            records.resize(records_sz);
+            return false;
+        }
+
+        e::unpack64be(d + offset, &recno);
+        e::unpack64be(d + offset + sizeof(uint64_t), &sz);
+
+        if (recno == 0 ||
+            sz > raw_sz - offset - RECORD_HEADER_SIZE - RECORD_FOOTER_SIZE)
+        {
+            records.resize(records_sz);
+            return false;
+        }
+
+        records.push_back(record(recno, d + offset, sz));
+        offset += RECORD_HEADER_SIZE + sz + RECORD_FOOTER_SIZE;
+    }
+
+    inflated.push_back(raw.release());
+    return true;
+#else
+    (void) header;
+    (void) entry_sz;
+    unsupported = true;
+    return false;
+#endif
+}
+
+bool
+durable_log :: recovered_segment :: verify(size_t idx)
+{
+    const record& r(records[idx]);
+    const unsigned char* header = r.header;
+    const unsigned char* entry = header + RECORD_HEADER_SIZE;
+    uint32_t crc = crc32c(0, entry, r.entry_sz);
+    crc = crc32c(crc, header, RECORD_HEADER_SIZE);
+    uint32_t expected;
+    e::unpack32be(entry + r.entry_sz, &expected);
+    return crc == expected;
+}
+
+class durable_log :: recovery
+{
+    public:
+        recovery(const std::vector<recovered_segment*>& segments);
+        ~recovery() throw ();
+
+    public:
+        void run();
+
+    private:
+        struct chunk
+        {
+            chunk() : segment(), start(), limit() {}
+            chunk(size_t s, size_t st, size_t l) : segment(s), start(st), limit(l) {}
+            size_t segment;
+            size_t start;
+            size_t limit;
+        };
+        void spawn(void (recovery::*f)(), size_t work);
+        bool next(size_t* idx, size_t limit);
+        void index();
+        void verify();
+
+    private:
+        const std::vector<recovered_segment*>& m_segments;
+        std::vector<chunk> m_chunks;
+        po6::threads::mutex m_mtx;
+        size_t m_next;
+
+    private:
+        recovery(const recovery&);
+        recovery& operator = (const recovery&);
+};
+
+durable_log :: recovery :: recovery(const std::vector<recovered_segment*>& segments)
+    : m_segments(segments)
+    , m_chunks()
+    , m_mtx()
+    , m_next(0)
+{
+}
+
+durable_log :: recovery :: ~recovery() throw ()
+{
+}
+
+void
+durable_log :: recovery :: run()
+{
+    spawn(&recovery::index, m_segments.size());
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
+    {
+        const size_t records = m_segments[i]->records.size();
+
+        for (size_t start = 0; start < records; start += RECOVERY_CHUNK)
+        {
+            m_chunks.push_back(chunk(i, start, std::min(start + RECOVERY_CHUNK, records)));
+        }
+    }
+
+    spawn(&recovery::verify, m_chunks.size());
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
+    {
+        m_segments[i]->records.resize(m_segments[i]->first_invalid);
+    }
+}
+
+void
+durable_log :: recovery :: spawn(void (recovery::*f)(), size_t work)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t threads = std::min(work, size_t(cores > 0 ? cores : 1));
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+    m_next = 0;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        using namespace po6::threads;
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(f, this)));
+        ts.push_back(t);
+        t->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+}
+
+bool
+durable_log :: recovery :: next(size_t* idx, size_t limit)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_next >= limit)
+    {
+        return false;
+    }
+
+    *idx = m_next;
+    ++m_next;
+    return true;
+}
+
+void
+durable_log :: recovery :: index()
+{
+    size_t idx;
+
+    while (next(&idx, m_segments.size()))
+    {
+        m_segments[idx]->index();
+    }
+}
+
+void
+durable_log :: recovery :: verify()
+{
+    size_t idx;
+
+    while (next(&idx, m_chunks.size()))
+    {
+        const chunk& c(m_chunks[idx]);
+        recovered_segment* seg = m_segments[c.segment];
+
+        for (size_t i = c.start; i < c.limit; ++i)
+        {
+            if (!seg->verify(i))
+            {
+                po6::threads::mutex::hold hold(&m_mtx);
+                seg->first_invalid = std::min(seg->first_invalid, i);
+                break;
+            }
+        }
+    }
+}
+
+namespace
+{
+struct replay_entry
+{
+    replay_entry() : recno(), entry(), entry_sz() {}
+    replay_entry(uint64_t r, const unsigned char* en, size_t s) : recno(r), entry(en), entry_sz(s) {}
+    bool operator < (const replay_entry& rhs) const { return recno < rhs.recno; }
+    uint64_t recno;
+    const unsigned char* entry;
+    size_t entry_sz;
+};
+} // namespace
+
+durability_policy :: durability_policy()
+    : max_delay(0)
+    , max_batch_bytes(0)
+    , sync(SYNC_FSYNC)
+    , shards(1)
+    , compress(false)
+{
+}
+
+durable_log_stats :: durable_log_stats()
+    : records(0)
+    , syncs(0)
+    , bytes_staged(0)
+    , bytes_written(0)
+    , compress_time(0)
+{
+}
+
+void
+durable_log_stats :: add(const durable_log_stats& other)
+{
+    records += other.records;
+    syncs += other.syncs;
+    bytes_staged += other.bytes_staged;
+    bytes_written += other.bytes_written;
+    compress_time += other.compress_time;
+}
+
+bool
+consus :: parse_durability_sync(const char* name, durability_policy::sync_t* sync)
+{
+    if (strcmp(name, "fsync") == 0)
+    {
+        *sync = durability_policy::SYNC_FSYNC;
+    }
+    else if (strcmp(name, "fdatasync") == 0)
+    {
+        *sync = durability_policy::SYNC_FDATASYNC;
+    }
+    else if (strcmp(name, "dsync") == 0)
+    {
+        *sync = durability_policy::SYNC_DSYNC;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
 durable_log :: durable_log()
-    : m_path()
+    : m_policy()
+    , m_path()
     , m_dir()
     , m_lockfile()
     , m_mtx()
     , m_cond(&m_mtx)
-    , m_flush(po6::threads::make_obj_func(&durable_log::flush, this))
     , m_error(0)
     , m_wakeup(false)
     , m_next_entry(1)
-    , m_segment_a(NULL)
-    , m_segment_b(NULL)
+    , m_next_segment(1)
+    , m_next_shard(0)
+    , m_shards()
+    , m_dedup(new dedup_stripe[DEDUP_STRIPES])
+    , m_deduplicated(0)
+    , m_sealed()
+    , m_recovered()
+    , m_time_to_durable()
+    , m_stats()
 {
-    m_flush.start();
 }
 
 durable_log :: ~durable_log() throw ()
 {
     close();
-    m_flush.join();
 
-    delete m_segment_a;
-    delete m_segment_b;
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        m_shards[i]->flusher.join();
+        delete m_shards[i];
+    }
+
+    for (size_t i = 0; i < m_recovered.size(); ++i)
+    {
+        delete m_recovered[i];
+    }
+
+    delete[] m_dedup;
+}
+
+bool
+durable_log :: open(const std::string& dir)
+{
+    return open(dir, durability_policy());
 }
 
 bool
-durable_log :: open(const std::string& dir)
+durable_log :: open(const std::string& dir, const durability_policy& policy)
 {
     po6::threads::mutex::hold hold(&m_mtx);
+    m_policy = policy;
     m_path = dir;
+#ifndef CONSUS_LOG_COMPRESSION
+    if (m_policy.compress)
+    {
+        m_error = errno = ENOTSUP;
+        return false;
+    }
+#endif
     struct stat st;
     int ret = stat(m_path.c_str(), &st);
 
@@ -154,19 +909,123 @@ durable_log :: open(const std::string& dir)
         return false;
     }
 
-    // XXX do rotation on these and don't overwrite the old
-    int file_a = openat(m_dir.get(), "file_a", O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
-    int file_b = openat(m_dir.get(), "file_b", O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    // earlier versions wrote to these two files and truncated them on every
+    // start, so nothing in them was ever recovered
+    unlinkat(m_dir.get(), "file_a", 0);
+    unlinkat(m_dir.get(), "file_b", 0);
+    std::vector<uint64_t> ids;
 
-    if (file_a < 0 || file_b < 0)
+    if (!list_segments(&ids))
     {
-        ::close(file_a);
-        ::close(file_b);
+        m_error = errno;
         return false;
     }
 
-    m_segment_a = new segment(&m_mtx, file_a);
-    m_segment_b = new segment(&m_mtx, file_b);
+    std::sort(ids.begin(), ids.end());
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        char name[SEGMENT_NAME_SIZE];
+        segment_name(ids[i], name);
+        po6::io::fd sfd(openat(m_dir.get(), name, O_RDONLY));
+        struct stat sst;
+        m_next_segment = std::max(m_next_segment, ids[i] + 1);
+
+        if (sfd.get() < 0 || fstat(sfd.get(), &sst) < 0)
+        {
+            m_error = errno;
+            return false;
+        }
+
+        if (sst.st_size == 0)
+        {
+            unlinkat(m_dir.get(), name, 0);
+            continue;
+        }
+
+        std::auto_ptr<recovered_segment> rs(new recovered_segment(ids[i]));
+        rs->size = sst.st_size;
+        rs->base = mmap(NULL, rs->size, PROT_READ, MAP_SHARED, sfd.get(), 0);
+
+        if (rs->base == MAP_FAILED)
+        {
+            rs->base = NULL;
+            m_error = errno;
+            return false;
+        }
+
+        madvise(rs->base, rs->size, MADV_WILLNEED);
+        m_recovered.push_back(rs.release());
+    }
+
+    recovery r(m_recovered);
+    r.run();
+
+    for (size_t i = 0; i < m_recovered.size(); ++i)
+    {
+        if (m_recovered[i]->unsupported)
+        {
+            m_error = errno = ENOTSUP;
+            return false;
+        }
+    }
+
+    size_t idx = 0;
+
+    while (idx < m_recovered.size())
+    {
+        recovered_segment* rs = m_recovered[idx];
+
+        if (rs->records.empty())
+        {
+            char name[SEGMENT_NAME_SIZE];
+            segment_name(rs->id, name);
+            unlinkat(m_dir.get(), name, 0);
+            delete rs;
+            m_recovered.erase(m_recovered.begin() + idx);
+            continue;
+        }
+
+        uint64_t recno_lb = rs->records[0].recno;
+        uint64_t recno_ub = rs->records[0].recno;
+
+        for (size_t i = 0; i < rs->records.size(); ++i)
+        {
+            recno_lb = std::min(recno_lb, rs->records[i].recno);
+            recno_ub = std::max(recno_ub, rs->records[i].recno);
+        }
+
+        m_sealed.push_back(sealed_segment(rs->id, recno_lb, recno_ub));
+        m_next_entry = std::max(m_next_entry, recno_ub + 1);
+        ++idx;
+    }
+
+    const unsigned shards = std::max(m_policy.shards, 1U);
+
+    for (unsigned i = 0; i < shards; ++i)
+    {
+        std::auto_ptr<segment> seg_a(create_segment(m_next_segment));
+        ++m_next_segment;
+        std::auto_ptr<segment> seg_b(create_segment(m_next_segment));
+        ++m_next_segment;
+
+        if (!seg_a.get() || !seg_b.get())
+        {
+            m_error = errno;
+            return false;
+        }
+
+        std::auto_ptr<shard> sh(new shard(this, seg_a.get(), seg_b.get()));
+        seg_a.release();
+        seg_b.release();
+        m_shards.push_back(sh.release());
+    }
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        m_shards[i]->flusher.start();
+    }
+
     return true;
 }
 
@@ -176,6 +1035,11 @@ durable_log :: close()
     po6::threads::mutex::hold hold(&m_mtx);
     m_error = -1;
     m_cond.broadcast();
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        m_shards[i]->fail(-1);
+    }
 }
 
 int64_t
@@ -187,65 +1051,195 @@ durable_log :: append(const char* entry, size_t entry_sz)
 int64_t
 durable_log :: append(const unsigned char* entry, size_t entry_sz)
 {
-    unsigned char header[RECORD_HEADER_SIZE];
-    segment* seg;
-    uint64_t offset;
-    uint64_t recno;
+    return append(entry, entry_sz, crc32c(0, entry, entry_sz));
+}
+
+int64_t
+durable_log :: append_unique(const char* entry, size_t entry_sz)
+{
+    return append_unique(reinterpret_cast<const unsigned char*>(entry), entry_sz);
+}
+
+int64_t
+durable_log :: append_unique(const unsigned char* entry, size_t entry_sz)
+{
+    const uint32_t crc = crc32c(0, entry, entry_sz);
+    dedup_stripe* ds = &m_dedup[crc % DEDUP_STRIPES];
+    po6::threads::mutex::hold hold(&ds->mtx);
+    typedef dedup_stripe::entry_map_t::iterator iterator;
+    std::pair<iterator, iterator> range = ds->entries.equal_range(crc);
 
+    for (iterator it = range.first; it != range.second; ++it)
     {
-        po6::threads::mutex::hold hold(&m_mtx);
+        const std::string& seen(it->second.second);
 
-        if (m_error)
+        if (seen.size() == entry_sz &&
+            memcmp(seen.data(), entry, entry_sz) == 0)
         {
-            errno = m_error;
-            return -1;
+            e::atomic::increment_64_nobarrier(&m_deduplicated, 1);
+            return it->second.first;
         }
+    }
+
+    const int64_t recno = append(entry, entry_sz, crc);
 
-        recno = m_next_entry;
-        ++m_next_entry;
-        seg = select_segment_write();
-        assert(seg);
-        assert(!seg->syncing);
-        offset = seg->offset_next_write;
-        seg->offset_next_write += RECORD_HEADER_SIZE + entry_sz + sizeof(uint32_t);
-        seg->recno_last_write = recno;
-        ++seg->ongoing_writes;
+    if (recno > 0)
+    {
+        std::string bytes(reinterpret_cast<const char*>(entry), entry_sz);
+        iterator it = ds->entries.insert(std::make_pair(crc, std::make_pair(recno, bytes)));
+        ds->order.push_back(std::make_pair(recno, it));
     }
 
-    encode_header(recno, entry_sz, header);
-    uint32_t crc = 0;
-    crc = crc32c(crc, header, RECORD_HEADER_SIZE);
-    crc = crc32c(crc, entry, entry_sz);
-    unsigned char crcbuf[sizeof(uint32_t)];
-    e::pack32be(crc, crcbuf);
+    return recno;
+}
+
+int64_t
+durable_log :: append(const unsigned char* entry, size_t entry_sz, uint32_t crc)
+{
+    const uint64_t now = po6::monotonic_time();
 
-    if (pwrite(seg->fd.get(), header, RECORD_HEADER_SIZE, offset) < 0 ||
-        pwrite(seg->fd.get(), entry, entry_sz, offset + RECORD_HEADER_SIZE) < 0 ||
-        pwrite(seg->fd.get(), crcbuf, sizeof(uint32_t), offset + RECORD_HEADER_SIZE + entry_sz) < 0)
+    if (m_shards.empty())
     {
-        int e = errno;
-        po6::threads::mutex::hold hold(&m_mtx);
-        m_error = e;
+        errno = EBADF;
         return -1;
     }
 
+    // spread appenders round-robin; shards never share a mutex
+    const uint64_t idx = e::atomic::increment_64_nobarrier(&m_next_shard, 1);
+    return m_shards[idx % m_shards.size()]->append(entry, entry_sz, crc, now);
+}
+
+void
+durable_log :: scan(void (*f)(void*, const unsigned char*, size_t), void* p)
+{
     po6::threads::mutex::hold hold(&m_mtx);
-    --seg->ongoing_writes;
 
-    if (seg->ongoing_writes == 0)
+    for (size_t i = 0; i < m_recovered.size(); ++i)
     {
-        seg->done_writing.broadcast();
-        m_cond.broadcast();
+        const recovered_segment* rs = m_recovered[i];
+
+        for (size_t j = 0; j < rs->records.size(); ++j)
+        {
+            const recovered_segment::record& r(rs->records[j]);
+            f(p, r.header + RECORD_HEADER_SIZE, r.entry_sz);
+        }
     }
+}
 
-    return recno;
+int64_t
+durable_log :: replay(void (*f)(void*, int64_t, const unsigned char*, size_t), void* p)
+{
+    std::vector<recovered_segment*> recovered;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        recovered.swap(m_recovered);
+    }
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < recovered.size(); ++i)
+    {
+        total += recovered[i]->records.size();
+    }
+
+    std::vector<replay_entry> entries;
+    entries.reserve(total);
+
+    for (size_t i = 0; i < recovered.size(); ++i)
+    {
+        const recovered_segment* rs = recovered[i];
+
+        for (size_t j = 0; j < rs->records.size(); ++j)
+        {
+            const recovered_segment::record& r(rs->records[j]);
+            const unsigned char* entry = r.header + RECORD_HEADER_SIZE;
+            entries.push_back(replay_entry(r.recno, entry, r.entry_sz));
+        }
+    }
+
+    // each segment is already in order; this merges the interleaved segments
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        f(p, entries[i].recno, entries[i].entry, entries[i].entry_sz);
+    }
+
+    for (size_t i = 0; i < recovered.size(); ++i)
+    {
+        delete recovered[i];
+    }
+
+    return entries.size();
+}
+
+int64_t
+durable_log :: next_entry()
+{
+    return e::atomic::load_64_acquire(&m_next_entry);
+}
+
+void
+durable_log :: checkpoint(int64_t recno)
+{
+    std::vector<uint64_t> retired;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        size_t i = 0;
+
+        while (i < m_sealed.size())
+        {
+            if (recno > 0 && m_sealed[i].recno_ub < uint64_t(recno))
+            {
+                retired.push_back(m_sealed[i].id);
+                m_sealed[i] = m_sealed.back();
+                m_sealed.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        char name[SEGMENT_NAME_SIZE];
+        segment_name(retired[i], name);
+        unlinkat(m_dir.get(), name, 0);
+    }
+
+    // entries below the checkpoint belong to finished state machines, and the
+    // segments holding them may now be gone
+    for (size_t i = 0; i < DEDUP_STRIPES; ++i)
+    {
+        dedup_stripe* ds = &m_dedup[i];
+        po6::threads::mutex::hold hold(&ds->mtx);
+
+        while (!ds->order.empty() && ds->order.front().first < recno)
+        {
+            ds->entries.erase(ds->order.front().second);
+            ds->order.pop_front();
+        }
+    }
 }
 
 int64_t
 durable_log :: durable()
 {
-    po6::threads::mutex::hold hold(&m_mtx);
-    return durable_lock_held_elsewhere();
+    // Every record below x had its number assigned, and so was staged, before
+    // the shards are inspected; the lowest unsynced record of any shard is
+    // therefore a bound on what is durable across all of them.
+    uint64_t x = e::atomic::load_64_acquire(&m_next_entry);
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        x = std::min(x, m_shards[i]->unsynced());
+    }
+
+    return x;
 }
 
 int64_t
@@ -255,7 +1249,7 @@ durable_log :: wait(int64_t prev_ub)
 
     while (true)
     {
-        int64_t x = durable_lock_held_elsewhere();
+        int64_t x = durable();
 
         if (m_error == 0 && x <= prev_ub && !m_wakeup)
         {
@@ -284,8 +1278,28 @@ durable_log :: error()
     return m_error;
 }
 
+latency_histogram
+durable_log :: time_to_durable()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_time_to_durable;
+}
+
+durable_log_stats
+durable_log :: stats()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_stats;
+}
+
+uint64_t
+durable_log :: deduplicated()
+{
+    return e::atomic::load_64_nobarrier(&m_deduplicated);
+}
+
 void
-durable_log :: flush()
+durable_log :: shard :: flush()
 {
     sigset_t ss;
 
@@ -293,8 +1307,8 @@ durable_log :: flush()
         pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
     {
         int err = errno;
-        po6::threads::mutex::hold hold(&m_mtx);
-        m_error = err;
+        fail(err);
+        log->synced(err, latency_histogram(), durable_log_stats(), NULL);
         return;
     }
 
@@ -305,52 +1319,224 @@ durable_log :: flush()
         segment* seg;
 
         {
-            po6::threads::mutex::hold hold(&m_mtx);
+            po6::threads::mutex::hold hold(&mtx);
 
-            while (m_error == 0 &&
+            while (error == 0 &&
                    !(seg = select_segment_fsync()))
             {
-                m_cond.wait();
+                flush_waiting = true;
+                staged.wait();
+                flush_waiting = false;
+            }
+
+            // hold the batch open until it is old enough or big enough;
+            // appends keep going to this segment in the meantime
+            while (error == 0 && log->m_policy.max_delay > 0)
+            {
+                const uint64_t now = po6::monotonic_time();
+                const uint64_t deadline = oldest_staged + log->m_policy.max_delay;
+
+                if (now >= deadline ||
+                    (log->m_policy.max_batch_bytes > 0 &&
+                     staged_bytes >= log->m_policy.max_batch_bytes))
+                {
+                    break;
+                }
+
+                flush_batching = true;
+                staged.wait_for(deadline - now);
+                flush_batching = false;
             }
 
-            if (m_error != 0)
+            if (error != 0)
             {
                 break;
             }
 
+            // take everything staged so far as one batch; appenders move to
+            // the other segment while this one is written and synced
             seg->syncing = true;
+            assert(seg->writing.empty());
+            seg->staged.swap(seg->writing);
+            assert(seg->writing_times.empty());
+            seg->staged_times.swap(seg->writing_times);
+            const segment* other = seg == segment_a ? segment_b : segment_a;
+            assert(staged_bytes >= seg->writing.size());
+            staged_bytes -= seg->writing.size();
+            oldest_staged = other->staged_times.empty() ? 0 : other->staged_times.front();
+            offset_saved = seg->offset_next_write;
+            recno_saved = seg->recno_last_write;
+            assert(seg->offset_last_fsync + seg->writing.size() == offset_saved);
+        }
+
+        durable_log_stats stats;
+        stats.records = seg->writing_times.size();
+        stats.syncs = 1;
+        stats.bytes_staged = seg->writing.size();
+        const char* buf = seg->writing.data();
+        size_t buf_sz = seg->writing.size();
+
+#ifdef CONSUS_LOG_COMPRESSION
+        if (log->m_policy.compress)
+        {
+            const uint64_t start = po6::monotonic_time();
 
-            while (seg->ongoing_writes > 0)
+            if (compress_batch(seg->writing, &compressed))
             {
-                seg->done_writing.wait();
+                buf = compressed.data();
+                buf_sz = compressed.size();
             }
 
-            offset_saved = seg->offset_next_write;
-            recno_saved = seg->recno_last_write;
+            stats.compress_time = po6::monotonic_time() - start;
+        }
+#endif
+
+        stats.bytes_written = buf_sz;
+        const uint64_t offset = seg->offset_disk;
+        const bool seal = offset + buf_sz >= SEGMENT_SIZE;
+        int err = 0;
+        std::auto_ptr<segment> next;
+
+        if (!write_fully(seg->fd.get(), buf, buf_sz, offset) ||
+            !sync_segment(seg->fd.get(), log->m_policy.sync))
+        {
+            err = errno;
+        }
+        else if (seal)
+        {
+            const uint64_t next_id = e::atomic::increment_64_nobarrier(&log->m_next_segment, 1) - 1;
+            next.reset(log->create_segment(next_id));
+
+            if (!next.get())
+            {
+                err = errno;
+            }
+        }
+
+        const uint64_t now = po6::monotonic_time();
+        latency_histogram ttd;
+
+        for (size_t i = 0; err == 0 && i < seg->writing_times.size(); ++i)
+        {
+            ttd.add(now - seg->writing_times[i]);
         }
 
-        if (fsync(seg->fd.get()) < 0)
+        if (err == 0)
+        {
+            seg->offset_disk += buf_sz;
+        }
+        else
         {
-            int e = errno;
-            po6::threads::mutex::hold hold(&m_mtx);
-            m_error = e;
+            stats = durable_log_stats();
         }
 
+        // clear() retains capacity, so steady state appends do not allocate
+        seg->writing.clear();
+        seg->writing_times.clear();
+
+        std::auto_ptr<segment> retired;
+
         {
-            po6::threads::mutex::hold hold(&m_mtx);
+            po6::threads::mutex::hold hold(&mtx);
             seg->syncing = false;
-            seg->offset_last_fsync = offset_saved;
-            seg->recno_last_fsync = recno_saved;
-            m_cond.broadcast();
+
+            if (err != 0)
+            {
+                error = err;
+            }
+            else
+            {
+                seg->offset_last_fsync = offset_saved;
+                seg->recno_last_fsync = recno_saved;
+            }
+
+            if (next.get())
+            {
+                // no appends go to a segment while it syncs, so everything in
+                // seg is now on disk and it can be sealed
+                assert(seg->staged.empty());
+                segment** slot = seg == segment_a ? &segment_a : &segment_b;
+                *slot = next.release();
+                retired.reset(seg);
+            }
+        }
+
+        if (retired.get() && retired->recno_first > 0)
+        {
+            const sealed_segment ss(retired->id, retired->recno_first, retired->recno_last_fsync);
+            log->synced(err, ttd, stats, &ss);
+        }
+        else
+        {
+            log->synced(err, ttd, stats, NULL);
+        }
+    }
+}
+
+bool
+durable_log :: list_segments(std::vector<uint64_t>* ids)
+{
+    DIR* dir = opendir(m_path.c_str());
+
+    if (!dir)
+    {
+        return false;
+    }
+
+    e::guard g = e::makeguard(closedir, dir);
+    g.use_variable();
+    struct dirent* ent = NULL;
+    errno = 0;
+
+    while ((ent = readdir(dir)))
+    {
+        uint64_t id;
+
+        if (parse_segment_name(ent->d_name, &id))
+        {
+            ids->push_back(id);
         }
     }
+
+    return errno == 0;
+}
+
+durable_log::segment*
+durable_log :: create_segment(uint64_t id)
+{
+    char name[SEGMENT_NAME_SIZE];
+    segment_name(id, name);
+    const int flags = m_policy.sync == durability_policy::SYNC_DSYNC ? O_DSYNC : 0;
+    int fd = openat(m_dir.get(), name, O_RDWR|O_CREAT|O_EXCL|flags, S_IRUSR|S_IWUSR);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    std::auto_ptr<segment> seg(new segment(id, fd));
+
+    // Preallocate so that appends within the segment do not change the file
+    // size; not every filesystem supports this, and it is only an optimization
+    if (fallocate(fd, 0, 0, SEGMENT_SIZE) < 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        return NULL;
+    }
+
+    if (fsync(m_dir.get()) < 0)
+    {
+        return NULL;
+    }
+
+    return seg.release();
 }
 
 durable_log::segment*
-durable_log :: select_segment_write()
+durable_log :: shard :: select_segment_write()
 {
-    segment* a = m_segment_a;
-    segment* b = m_segment_b;
+    segment* a = segment_a;
+    segment* b = segment_b;
     assert(a->offset_next_write >= a->offset_last_fsync);
     assert(b->offset_next_write >= b->offset_last_fsync);
     const uint64_t a_unflushed = a->offset_next_write - a->offset_last_fsync;
@@ -379,16 +1565,10 @@ durable_log :: select_segment_write()
 }
 
 durable_log::segment*
-durable_log :: select_segment_fsync()
+durable_log :: shard :: select_segment_fsync()
 {
-    segment* a = m_segment_a;
-    segment* b = m_segment_b;
-
-    if (!a || !b)
-    {
-        return NULL;
-    }
-
+    segment* a = segment_a;
+    segment* b = segment_b;
     assert(!a->syncing);
     assert(!b->syncing);
     assert(a->offset_next_write >= a->offset_last_fsync);
@@ -418,23 +1598,30 @@ durable_log :: select_segment_fsync()
     }
 }
 
-int64_t
-durable_log :: durable_lock_held_elsewhere()
+void
+durable_log :: synced(int err, const latency_histogram& ttd,
+                      const durable_log_stats& stats, const sealed_segment* sealed)
 {
-    segment* a = m_segment_a;
-    segment* b = m_segment_b;
-    assert(a->offset_next_write >= a->offset_last_fsync);
-    assert(b->offset_next_write >= b->offset_last_fsync);
+    po6::threads::mutex::hold hold(&m_mtx);
 
-    if (a->recno_last_fsync > b->recno_last_fsync)
+    if (err != 0 && m_error == 0)
     {
-        std::swap(a, b);
+        // one shard failing fails the log as a whole
+        m_error = err;
+
+        for (size_t i = 0; i < m_shards.size(); ++i)
+        {
+            m_shards[i]->fail(err);
+        }
     }
 
-    if (a->offset_next_write - a->offset_last_fsync > 0)
+    m_time_to_durable.merge(ttd);
+    m_stats.add(stats);
+
+    if (sealed)
     {
-        return a->recno_last_fsync + 1;
+        m_sealed.push_back(*sealed);
     }
 
-    return b->recno_last_fsync + 1;
+    m_cond.broadcast();
 }
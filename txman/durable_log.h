@@ -40,16 +40,61 @@
 #include <po6/io/fd.h>
 #include <po6/threads/mutex.h>
 #include <po6/threads/cond.h>
-#include <po6/threads/thread.h>
 
 // e
 #include <e/lockfile.h>
 
 // consus
 #include "namespace.h"
+#include "common/latency_histogram.h"
 
 BEGIN_CONSUS_NAMESPACE
 
+// How the log trades commit latency for fewer, larger syncs.  The defaults
+// sync whatever is staged as soon as the previous sync finishes.
+class durability_policy
+{
+    public:
+        enum sync_t { SYNC_FSYNC, SYNC_FDATASYNC, SYNC_DSYNC };
+
+    public:
+        durability_policy();
+
+    public:
+        // hold a batch open this long (nanoseconds) after its first record
+        uint64_t max_delay;
+        // ... unless this many bytes are staged first (0 for no limit)
+        uint64_t max_batch_bytes;
+        sync_t sync;
+        // independent segment pairs, each with its own flush thread
+        unsigned shards;
+        // compress each batch with LZ4 before writing it; requires building
+        // with --enable-log-compression
+        bool compress;
+};
+
+// Cumulative counters for benchmarks and the debug dump
+class durable_log_stats
+{
+    public:
+        durable_log_stats();
+
+    public:
+        void add(const durable_log_stats& other);
+
+    public:
+        uint64_t records;
+        uint64_t syncs;
+        // bytes of encoded records, and bytes that reached the disk for them
+        uint64_t bytes_staged;
+        uint64_t bytes_written;
+        // nanoseconds spent compressing batches
+        uint64_t compress_time;
+};
+
+bool
+parse_durability_sync(const char* name, durability_policy::sync_t* sync);
+
 class durable_log
 {
     public:
@@ -58,34 +103,77 @@ class durable_log
 
     public:
         bool open(const std::string& dir);
+        bool open(const std::string& dir, const durability_policy& policy);
         void close();
         int64_t append(const char* entry, size_t entry_sz);
         int64_t append(const unsigned char* entry, size_t entry_sz);
-        int64_t replay(void (*f)(void*, const unsigned char*, size_t), void* p);
+        // append entry unless a byte-identical entry was appended since the
+        // last checkpoint that covers it; either way return its recno
+        int64_t append_unique(const char* entry, size_t entry_sz);
+        int64_t append_unique(const unsigned char* entry, size_t entry_sz);
+        // hand every record recovered by open to f, in no particular order;
+        // call any number of times, but only before replay
+        void scan(void (*f)(void*, const unsigned char*, size_t), void* p);
+        // hand every record recovered by open to f in record order, along
+        // with its recno; call at most once, after open and before relying
+        // on durable state
+        int64_t replay(void (*f)(void*, int64_t, const unsigned char*, size_t), void* p);
+        int64_t next_entry();
+        // every record below recno is no longer needed for recovery; sealed
+        // segments that hold only such records are removed
+        void checkpoint(int64_t recno);
         int64_t durable();
         int64_t wait(int64_t prev_ub);
         void wake();
         int error();
+        // time from append to durable for every record synced so far
+        latency_histogram time_to_durable();
+        durable_log_stats stats();
+        // appends answered by append_unique without writing
+        uint64_t deduplicated();
 
     private:
         class segment;
-        void flush();
-        segment* select_segment_write();
-        segment* select_segment_fsync();
-        int64_t durable_lock_held_elsewhere();
+        class shard;
+        struct dedup_stripe;
+        struct recovered_segment;
+        class recovery;
+        struct sealed_segment
+        {
+            sealed_segment() : id(), recno_lb(), recno_ub() {}
+            sealed_segment(uint64_t i, uint64_t lb, uint64_t ub)
+                : id(i), recno_lb(lb), recno_ub(ub) {}
+            uint64_t id;
+            uint64_t recno_lb;
+            uint64_t recno_ub;
+        };
+        int64_t append(const unsigned char* entry, size_t entry_sz, uint32_t crc);
+        bool list_segments(std::vector<uint64_t>* ids);
+        segment* create_segment(uint64_t id);
+        void synced(int err, const latency_histogram& ttd,
+                    const durable_log_stats& stats, const sealed_segment* sealed);
 
     private:
+        durability_policy m_policy;
         std::string m_path;
         po6::io::fd m_dir;
         e::lockfile m_lockfile;
         po6::threads::mutex m_mtx;
         po6::threads::cond m_cond;
-        po6::threads::thread m_flush;
         int m_error;
         bool m_wakeup;
+        // shared by all shards, and only ever atomically incremented once
+        // open returns
         uint64_t m_next_entry;
-        segment* m_segment_a;
-        segment* m_segment_b;
+        uint64_t m_next_segment;
+        uint64_t m_next_shard;
+        std::vector<shard*> m_shards;
+        dedup_stripe* m_dedup;
+        uint64_t m_deduplicated;
+        std::vector<sealed_segment> m_sealed;
+        std::vector<recovered_segment*> m_recovered;
+        latency_histogram m_time_to_durable;
+        durable_log_stats m_stats;
 
     private:
         durable_log(const durable_log&);
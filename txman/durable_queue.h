@@ -0,0 +1,340 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_durable_queue_h_
+#define consus_txman_durable_queue_h_
+
+// Messages and callbacks that wait for the durable log are produced by every
+// thread in the daemon, and consumed by the single durability thread.
+//
+// Producers push onto one of several lock-free stacks chosen by record
+// number, so an enqueue contends only with others on the same stripe.  The
+// consumer takes each stack whole, merges what it took into a private run
+// ordered by record number, and releases the prefix of the run that is now
+// durable in one pass.
+// Because record numbers are handed out in increasing order, the merge is
+// almost always a plain append.
+//
+// Released nodes go back to a small pool per stripe instead of to the heap;
+// the pool is taken under a mutex, because a lock-free pop would be open to
+// ABA once nodes are reused.
+//
+// T must have an int64_t member "recno" and be assignable.
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "namespace.h"
+
+#define DURABLE_QUEUE_STRIPES 16
+#define DURABLE_QUEUE_POOLED 1024
+
+BEGIN_CONSUS_NAMESPACE
+
+template <typename T>
+class durable_queue
+{
+    public:
+        durable_queue();
+        ~durable_queue() throw ();
+
+    public:
+        // safe to call from any thread
+        void enqueue(const T& t);
+        uint64_t size() { return e::atomic::load_64_nobarrier(&m_size); }
+        // only ever called from one thread; moves every item with a recno
+        // below up_to into out
+        void drain(int64_t up_to, std::vector<T>* out);
+
+    private:
+        struct node
+        {
+            node(const T& t) : item(t), next(NULL) {}
+            T item;
+            node* next;
+        };
+        struct stripe
+        {
+            stripe() : head(NULL) {}
+            node* head;
+            char padding[64 - sizeof(node*)];
+        };
+        struct pool
+        {
+            pool() : mtx(), head(NULL), size(0) {}
+            po6::threads::mutex mtx;
+            node* head;
+            size_t size;
+        };
+        static bool compare(const node* lhs, const node* rhs)
+        { return lhs->item.recno < rhs->item.recno; }
+        node* allocate(const T& t);
+        void release(node** nodes, size_t nodes_sz);
+
+    private:
+        stripe m_stripes[DURABLE_QUEUE_STRIPES];
+        pool m_pools[DURABLE_QUEUE_STRIPES];
+        uint64_t m_size;
+        // owned by the consumer; m_run[m_run_start:] is sorted by recno
+        std::vector<node*> m_run;
+        size_t m_run_start;
+        std::vector<node*> m_taken;
+
+    private:
+        durable_queue(const durable_queue&);
+        durable_queue& operator = (const durable_queue&);
+};
+
+template <typename T>
+durable_queue<T> :: durable_queue()
+    : m_stripes()
+    , m_size(0)
+    , m_run()
+    , m_run_start(0)
+    , m_taken()
+{
+}
+
+template <typename T>
+durable_queue<T> :: ~durable_queue() throw ()
+{
+    for (size_t i = 0; i < DURABLE_QUEUE_STRIPES; ++i)
+    {
+        node* n = m_stripes[i].head;
+
+        while (n)
+        {
+            node* tmp = n->next;
+            delete n;
+            n = tmp;
+        }
+    }
+
+    for (size_t i = m_run_start; i < m_run.size(); ++i)
+    {
+        delete m_run[i];
+    }
+
+    for (size_t i = 0; i < DURABLE_QUEUE_STRIPES; ++i)
+    {
+        node* n = m_pools[i].head;
+
+        while (n)
+        {
+            node* tmp = n->next;
+            delete n;
+            n = tmp;
+        }
+    }
+}
+
+template <typename T>
+void
+durable_queue<T> :: enqueue(const T& t)
+{
+    node* n = allocate(t);
+    node** head = &m_stripes[uint64_t(t.recno) % DURABLE_QUEUE_STRIPES].head;
+    node* old = e::atomic::load_ptr_acquire(head);
+
+    while (true)
+    {
+        n->next = old;
+        node* witness = e::atomic::compare_and_swap_ptr_fullbarrier(head, old, n);
+
+        if (witness == old)
+        {
+            break;
+        }
+
+        old = witness;
+    }
+
+    e::atomic::increment_64_nobarrier(&m_size, 1);
+}
+
+template <typename T>
+void
+durable_queue<T> :: drain(int64_t up_to, std::vector<T>* out)
+{
+    m_taken.clear();
+
+    for (size_t i = 0; i < DURABLE_QUEUE_STRIPES; ++i)
+    {
+        node** head = &m_stripes[i].head;
+        node* n = e::atomic::load_ptr_acquire(head);
+
+        while (n)
+        {
+            node* witness = e::atomic::compare_and_swap_ptr_fullbarrier(head, n, static_cast<node*>(NULL));
+
+            if (witness == n)
+            {
+                break;
+            }
+
+            n = witness;
+        }
+
+        while (n)
+        {
+            m_taken.push_back(n);
+            n = n->next;
+        }
+    }
+
+    if (!m_taken.empty())
+    {
+        std::sort(m_taken.begin(), m_taken.end(), compare);
+        const size_t mid = m_run.size();
+        m_run.insert(m_run.end(), m_taken.begin(), m_taken.end());
+
+        if (mid > m_run_start && compare(m_run[mid], m_run[mid - 1]))
+        {
+            std::inplace_merge(m_run.begin() + m_run_start,
+                               m_run.begin() + mid,
+                               m_run.end(), compare);
+        }
+    }
+
+    const size_t start = m_run_start;
+
+    // one pass over the ready prefix; nothing after it can be ready
+    while (m_run_start < m_run.size() &&
+           m_run[m_run_start]->item.recno < up_to)
+    {
+        out->push_back(m_run[m_run_start]->item);
+        ++m_run_start;
+    }
+
+    const uint64_t released = m_run_start - start;
+    e::atomic::increment_64_nobarrier(&m_size, -released);
+
+    if (released > 0)
+    {
+        release(&m_run[start], released);
+    }
+
+    if (m_run_start == m_run.size())
+    {
+        m_run.clear();
+        m_run_start = 0;
+    }
+    else if (m_run_start > m_run.size() / 2)
+    {
+        m_run.erase(m_run.begin(), m_run.begin() + m_run_start);
+        m_run_start = 0;
+    }
+}
+
+template <typename T>
+typename durable_queue<T>::node*
+durable_queue<T> :: allocate(const T& t)
+{
+    pool* p = &m_pools[uint64_t(t.recno) % DURABLE_QUEUE_STRIPES];
+    node* n = NULL;
+
+    {
+        po6::threads::mutex::hold hold(&p->mtx);
+        n = p->head;
+
+        if (n)
+        {
+            p->head = n->next;
+            --p->size;
+        }
+    }
+
+    if (!n)
+    {
+        return new node(t);
+    }
+
+    n->item = t;
+    n->next = NULL;
+    return n;
+}
+
+template <typename T>
+void
+durable_queue<T> :: release(node** nodes, size_t nodes_sz)
+{
+    // bucket by stripe first so that each pool's mutex is taken once
+    node* heads[DURABLE_QUEUE_STRIPES];
+    std::fill(heads, heads + DURABLE_QUEUE_STRIPES, static_cast<node*>(NULL));
+
+    for (size_t i = 0; i < nodes_sz; ++i)
+    {
+        const size_t idx = uint64_t(nodes[i]->item.recno) % DURABLE_QUEUE_STRIPES;
+        nodes[i]->next = heads[idx];
+        heads[idx] = nodes[i];
+    }
+
+    for (size_t i = 0; i < DURABLE_QUEUE_STRIPES; ++i)
+    {
+        node* n = heads[i];
+
+        if (!n)
+        {
+            continue;
+        }
+
+        pool* p = &m_pools[i];
+
+        {
+            po6::threads::mutex::hold hold(&p->mtx);
+
+            while (n && p->size < DURABLE_QUEUE_POOLED)
+            {
+                node* tmp = n->next;
+                n->next = p->head;
+                p->head = n;
+                ++p->size;
+                n = tmp;
+            }
+        }
+
+        // the pool is full; a burst beyond it goes back to the heap
+        while (n)
+        {
+            node* tmp = n->next;
+            delete n;
+            n = tmp;
+        }
+    }
+}
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_durable_queue_h_
@@ -147,6 +147,7 @@ global_voter :: global_voter(const transaction_group& tg)
     , m_outcome_in_dispositions(false)
     , m_data_center_cmp(new data_center_comparator(m_global_cmp.get()))
     , m_data_center_gp()
+    , m_lowest_log_entry(-1)
     , m_highest_log_entry(0)
     , m_dc_prev_learned()
     , m_xmit_vote()
@@ -189,6 +190,19 @@ global_voter :: finished()
     return (!m_data_center_init && !m_global_init) || m_outcome_in_dispositions;
 }
 
+int64_t
+global_voter :: lowest_log_entry()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if ((!m_data_center_init && !m_global_init) || m_outcome_in_dispositions)
+    {
+        return -1;
+    }
+
+    return m_lowest_log_entry;
+}
+
 bool
 global_voter :: initialized()
 {
@@ -352,8 +366,22 @@ global_voter :: propose(const generalized_paxos::command& c, daemon* d)
         std::string entry;
         e::packer(&entry)
             << LOG_ENTRY_GLOBAL_PROPOSE << m_tg << c;
-        int64_t id = d->m_log.append(entry.data(), entry.size());
-        m_highest_log_entry = std::max(m_highest_log_entry, id);
+        int64_t id = d->append_log(entry, true);
+
+        if (id < 0)
+        {
+            LOG(ERROR) << logid() << "could not log proposed transition " << pretty_print_outer(c);
+        }
+        else
+        {
+            m_highest_log_entry = std::max(m_highest_log_entry, id);
+
+            if (m_lowest_log_entry < 0)
+            {
+                m_lowest_log_entry = id;
+            }
+        }
+
         work_state_machine(d);
     }
 
@@ -388,8 +416,21 @@ global_voter :: process_p1a(comm_id id, const generalized_paxos::message_p1a& m,
         std::string entry;
         e::packer(&entry)
             << LOG_ENTRY_GLOBAL_VOTE_1A << m_tg << m;
-        int64_t x = d->m_log.append(entry.data(), entry.size());
+        int64_t x = d->append_log(entry, true);
+
+        if (x < 0)
+        {
+            // a 1b sent now would promise a ballot we never recorded
+            LOG(ERROR) << logid() << "could not log 1a message; not following " << ph(m.b);
+            return m_has_outcome;
+        }
+
         m_highest_log_entry = std::max(m_highest_log_entry, x);
+
+        if (m_lowest_log_entry < 0)
+        {
+            m_lowest_log_entry = x;
+        }
         LOG_IF(INFO, s_debug_mode) << logid() << "following " << ph(m.b);
     }
 
@@ -457,9 +498,25 @@ global_voter :: process_p2a(comm_id id, const generalized_paxos::message_p2a& m,
         std::string entry;
         e::packer(&entry)
             << LOG_ENTRY_GLOBAL_VOTE_2A << m_tg << m;
-        int64_t x = d->m_log.append(entry.data(), entry.size());
-        m_highest_log_entry = std::max(m_highest_log_entry, x);
-        LOG_IF(INFO, s_debug_mode)
+        int64_t x = d->append_log(entry, true);
+
+        if (x < 0)
+        {
+            // a 2b sent now would vouch for a value we never recorded
+            LOG(ERROR) << logid() << "could not log 2a message for " << ph(m.b);
+            send = false;
+        }
+        else
+        {
+            m_highest_log_entry = std::max(m_highest_log_entry, x);
+
+            if (m_lowest_log_entry < 0)
+            {
+                m_lowest_log_entry = x;
+            }
+        }
+
+        LOG_IF(INFO, s_debug_mode && send)
             << logid() << ph(m.b)
             << " suggests state machine input "
             << pretty_print_outer(m.v);
@@ -62,6 +62,7 @@ class global_voter
     public:
         const transaction_group& state_key() const;
         bool finished();
+        int64_t lowest_log_entry();
 
     public:
         bool initialized();
@@ -112,6 +113,7 @@ class global_voter
         // data center paxos
         const std::auto_ptr<data_center_comparator> m_data_center_cmp;
         generalized_paxos m_data_center_gp;
+        int64_t m_lowest_log_entry;
         int64_t m_highest_log_entry;
         generalized_paxos::cstruct m_dc_prev_learned;
         // data center paxos: rate limiting
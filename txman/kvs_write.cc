@@ -47,7 +47,7 @@ kvs_write :: kvs_write(const uint64_t& sk)
     , m_client()
     , m_client_nonce()
     , m_tx_group()
-    , m_tx_seqno()
+    , m_tx_seqnos()
     , m_tx_func()
 {
 }
@@ -95,11 +95,52 @@ kvs_write :: write(unsigned flags,
     m_init = true;
 }
 
+void
+kvs_write :: write(const std::vector<unsigned>& flags,
+                   const std::vector<e::slice>& tables,
+                   const std::vector<e::slice>& keys,
+                   uint64_t timestamp,
+                   const std::vector<e::slice>& values,
+                   daemon* d)
+{
+    assert(flags.size() == tables.size());
+    assert(flags.size() == keys.size());
+    assert(flags.size() == values.size());
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(KVS_REP_WR_MULTI)
+              + sizeof(uint64_t)
+              + sizeof(uint64_t);
+
+    for (size_t i = 0; i < flags.size(); ++i)
+    {
+        sz += sizeof(uint8_t)
+            + pack_size(tables[i])
+            + pack_size(keys[i])
+            + sizeof(uint64_t)
+            + pack_size(values[i]);
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE);
+    pa = pa << KVS_REP_WR_MULTI << m_state_key << uint64_t(flags.size());
+
+    for (size_t i = 0; i < flags.size(); ++i)
+    {
+        pa = pa << uint8_t(flags[i]) << tables[i] << keys[i] << timestamp << values[i];
+    }
+
+    configuration* c = d->get_config();
+    comm_id kvs = c->choose_kvs(d->m_us.dc);
+    d->send(kvs, msg);
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_init = true;
+}
+
 void
 kvs_write :: response(consus_returncode rc, daemon* d)
 {
     transaction_group tx_group;
-    uint64_t tx_seqno;
+    std::vector<uint64_t> tx_seqnos;
     void (transaction::*tx_func)(consus_returncode, uint64_t, daemon*);
 
     {
@@ -119,7 +160,7 @@ kvs_write :: response(consus_returncode rc, daemon* d)
         }
 
         tx_group = m_tx_group;
-        tx_seqno = m_tx_seqno;
+        tx_seqnos = m_tx_seqnos;
         tx_func = m_tx_func;
     }
 
@@ -128,9 +169,9 @@ kvs_write :: response(consus_returncode rc, daemon* d)
         daemon::transaction_map_t::state_reference tsr;
         transaction* xact = d->m_transactions.get_state(tx_group, &tsr);
 
-        if (xact)
+        for (size_t i = 0; xact && i < tx_seqnos.size(); ++i)
         {
-            (*xact.*tx_func)(rc, tx_seqno, d);
+            (*xact.*tx_func)(rc, tx_seqnos[i], d);
         }
     }
 }
@@ -149,6 +190,17 @@ kvs_write :: callback_transaction(const transaction_group& tg, uint64_t seqno,
 {
     po6::threads::mutex::hold hold(&m_mtx);
     m_tx_group = tg;
-    m_tx_seqno = seqno;
+    m_tx_seqnos = std::vector<uint64_t>(1, seqno);
+    m_tx_func = func;
+}
+
+void
+kvs_write :: callback_transaction(const transaction_group& tg,
+                                  const std::vector<uint64_t>& seqnos,
+                                  void (transaction::*func)(consus_returncode, uint64_t, daemon*))
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_tx_group = tg;
+    m_tx_seqnos = seqnos;
     m_tx_func = func;
 }
@@ -30,6 +30,7 @@
 
 // STL
 #include <memory>
+#include <vector>
 
 // po6
 #include <po6/threads/mutex.h>
@@ -63,10 +64,22 @@ class kvs_write
                    uint64_t timestamp,
                    const e::slice& value,
                    daemon* d);
+        // send all the writes in one request that every replica applies
+        // atomically; the vectors are parallel
+        void write(const std::vector<unsigned>& flags,
+                   const std::vector<e::slice>& tables,
+                   const std::vector<e::slice>& keys,
+                   uint64_t timestamp,
+                   const std::vector<e::slice>& values,
+                   daemon* d);
         void response(consus_returncode rc, daemon* d);
         void callback_client(comm_id client, uint64_t nonce);
         void callback_transaction(const transaction_group& tg, uint64_t seqno,
                                   void (transaction::*func)(consus_returncode, uint64_t, daemon*));
+        // invoke func once for each of seqnos
+        void callback_transaction(const transaction_group& tg,
+                                  const std::vector<uint64_t>& seqnos,
+                                  void (transaction::*func)(consus_returncode, uint64_t, daemon*));
 
     private:
         const uint64_t m_state_key;
@@ -78,7 +91,7 @@ class kvs_write
         uint64_t m_client_nonce;
         // transaction callback
         transaction_group m_tx_group;
-        uint64_t m_tx_seqno;
+        std::vector<uint64_t> m_tx_seqnos;
         void (transaction::*m_tx_func)(consus_returncode, uint64_t, daemon*);
 
     private:
@@ -84,6 +84,7 @@ local_voter :: local_voter(const transaction_group& tg)
     , m_outcome(0)
     , m_outcome_in_dispositions(false)
     , m_wounded(false)
+    , m_lowest_log_entry(-1)
 {
     po6::threads::mutex::hold hold(&m_mtx);
 }
@@ -105,6 +106,19 @@ local_voter :: finished()
     return !m_initialized || m_outcome_in_dispositions;
 }
 
+int64_t
+local_voter :: lowest_log_entry()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_initialized || m_outcome_in_dispositions)
+    {
+        return -1;
+    }
+
+    return m_lowest_log_entry;
+}
+
 void
 local_voter :: set_preferred_vote(uint64_t v, daemon* d)
 {
@@ -163,7 +177,16 @@ local_voter :: vote_1a(comm_id id, unsigned idx, const paxos_synod::ballot& b, d
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
         << LV_VOTE_1B << m_tg << uint8_t(idx) << a << p;
-    d->send_when_durable(entry, b.leader, msg);
+    int64_t x = d->send_when_durable(entry, b.leader, msg);
+
+    if (x < 0)
+    {
+        LOG(ERROR) << logid() << " instance[" << idx << "] could not log phase 1 vote; not responding to " << b;
+    }
+    else if (m_lowest_log_entry < 0)
+    {
+        m_lowest_log_entry = x;
+    }
 
     if (s_debug_mode)
     {
@@ -257,7 +280,16 @@ local_voter :: vote_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, d
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
         msg->pack_at(BUSYBEE_HEADER_SIZE)
             << LV_VOTE_2B << m_tg << uint8_t(idx) << p;
-        d->send_when_durable(entry, p.b.leader, msg);
+        int64_t x = d->send_when_durable(entry, p.b.leader, msg);
+
+        if (x < 0)
+        {
+            LOG(ERROR) << logid() << " instance[" << idx << "] could not log phase 2 vote; not responding to " << p.b;
+        }
+        else if (m_lowest_log_entry < 0)
+        {
+            m_lowest_log_entry = x;
+        }
     }
     else
     {
@@ -319,8 +351,17 @@ local_voter :: vote_learn(unsigned idx, uint64_t v, daemon* d)
         std::string entry;
         e::packer(&entry)
             << LOG_ENTRY_LOCAL_LEARN << m_tg << uint8_t(idx) << v;
-        d->m_log.append(entry.data(), entry.size());
+        int64_t x = d->append_log(entry, true);
         log = true;
+
+        if (x < 0)
+        {
+            LOG(ERROR) << logid() << " instance[" << idx << "] could not log learned value " << value_to_string(v);
+        }
+        else if (m_lowest_log_entry < 0)
+        {
+            m_lowest_log_entry = x;
+        }
     }
 
     m_votes[idx].force_learn(v);
@@ -48,6 +48,7 @@ class local_voter
     public:
         const transaction_group& state_key() const;
         bool finished();
+        int64_t lowest_log_entry();
 
     public:
         void set_preferred_vote(uint64_t v, daemon* d);
@@ -87,6 +88,7 @@ class local_voter
         uint64_t m_outcome;
         bool m_outcome_in_dispositions;
         bool m_wounded;
+        int64_t m_lowest_log_entry;
 
     private:
         local_voter(const local_voter&);
@@ -45,6 +45,7 @@ consus :: is_paxos_2a_log_entry(log_entry_t t)
         case LOG_ENTRY_LOCAL_VOTE_1A:
         case LOG_ENTRY_LOCAL_VOTE_2A:
         case LOG_ENTRY_LOCAL_LEARN:
+        case LOG_ENTRY_TX_OUTCOME:
         case LOG_ENTRY_GLOBAL_PROPOSE:
         case LOG_ENTRY_GLOBAL_VOTE_1A:
         case LOG_ENTRY_GLOBAL_VOTE_2A:
@@ -70,6 +71,7 @@ consus :: operator << (std::ostream& lhs, const log_entry_t& rhs)
         STRINGIFY(LOG_ENTRY_LOCAL_VOTE_1A);
         STRINGIFY(LOG_ENTRY_LOCAL_VOTE_2A);
         STRINGIFY(LOG_ENTRY_LOCAL_LEARN);
+        STRINGIFY(LOG_ENTRY_TX_OUTCOME);
         STRINGIFY(LOG_ENTRY_GLOBAL_PROPOSE);
         STRINGIFY(LOG_ENTRY_GLOBAL_VOTE_1A);
         STRINGIFY(LOG_ENTRY_GLOBAL_VOTE_2A);
@@ -51,6 +51,7 @@ enum log_entry_t
     LOG_ENTRY_LOCAL_VOTE_1A = 7944,
     LOG_ENTRY_LOCAL_VOTE_2A = 7946,
     LOG_ENTRY_LOCAL_LEARN   = 7947,
+    LOG_ENTRY_TX_OUTCOME    = 7948,
     LOG_ENTRY_GLOBAL_PROPOSE = 8000,
     LOG_ENTRY_GLOBAL_VOTE_1A = 8001,
     LOG_ENTRY_GLOBAL_VOTE_2A = 8002,
@@ -37,6 +37,7 @@
 // po6
 #include <po6/net/hostname.h>
 #include <po6/net/location.h>
+#include <po6/time.h>
 
 // e
 #include <e/popt.h>
@@ -68,6 +69,11 @@ main(int argc, const char* argv[])
     const char* pidfile = "";
     bool has_pidfile = false;
     long threads = 0;
+    long durability_delay = 0;
+    long durability_batch = 0;
+    const char* durability_sync = "fsync";
+    long log_shards = 1;
+    bool log_compress = false;
     bool log_immediate = false;
     sigset_t ss;
 
@@ -108,6 +114,21 @@ main(int argc, const char* argv[])
     ap.arg().name('t', "threads")
             .description("the number of threads which will handle network traffic")
             .metavar("N").as_long(&threads);
+    ap.arg().long_name("durability-delay")
+            .description("hold log writes up to this many microseconds to batch syncs (default: 0)")
+            .metavar("us").as_long(&durability_delay);
+    ap.arg().long_name("durability-batch")
+            .description("sync a held batch once it reaches this many bytes (default: no limit)")
+            .metavar("bytes").as_long(&durability_batch);
+    ap.arg().long_name("durability-sync")
+            .description("make the log durable with fsync, fdatasync, or dsync (default: fsync)")
+            .metavar("method").as_string(&durability_sync);
+    ap.arg().long_name("log-shards")
+            .description("split the durable log into N independently synced shards, each with two preallocated segments (default: 1)")
+            .metavar("N").as_long(&log_shards);
+    ap.arg().long_name("log-compress")
+            .description("compress each batch written to the durable log")
+            .set_true(&log_compress);
     ap.arg().long_name("log-immediate")
             .description("immediately flush all log output")
             .set_true(&log_immediate).hidden();
@@ -180,6 +201,23 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    consus::durability_policy durability;
+
+    if (durability_delay < 0 || durability_batch < 0)
+    {
+        std::cerr << "durability-delay and durability-batch must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!consus::parse_durability_sync(durability_sync, &durability.sync))
+    {
+        std::cerr << "durability-sync must be one of fsync, fdatasync, or dsync" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    durability.max_delay = durability_delay * PO6_MICROS;
+    durability.max_batch_bytes = durability_batch;
+
     google::InitGoogleLogging(argv[0]);
     google::InstallFailureSignalHandler();
 
@@ -204,6 +242,19 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (log_shards <= 0)
+    {
+        log_shards = 1;
+    }
+    else if (log_shards > 512)
+    {
+        std::cerr << "refusing to create more than 512 log shards" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    durability.shards = log_shards;
+    durability.compress = log_compress;
+
     try
     {
         consus::daemon d;
@@ -213,7 +264,7 @@ main(int argc, const char* argv[])
                      std::string(pidfile), has_pidfile,
                      listen, bind_to,
                      conn.isset(), conn.conn_str(),
-                     data_center, threads);
+                     data_center, threads, durability);
     }
     catch (std::exception& e)
     {
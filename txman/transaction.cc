@@ -251,6 +251,7 @@ transaction :: transaction(const transaction_group& tg)
     , m_prefer_to_commit(true)
     , m_ops()
     , m_deferred_2b()
+    , m_lowest_log_entry(-1)
 {
     po6::threads::mutex::hold hold(&m_mtx);
 
@@ -277,6 +278,19 @@ transaction :: finished()
     return m_state == INITIALIZED || m_state == GARBAGE_COLLECT;
 }
 
+int64_t
+transaction :: lowest_log_entry()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_state == INITIALIZED || m_state == GARBAGE_COLLECT)
+    {
+        return -1;
+    }
+
+    return m_lowest_log_entry;
+}
+
 void
 transaction :: begin(comm_id id, uint64_t nonce, uint64_t timestamp,
                      const paxos_group& group,
@@ -1207,8 +1221,21 @@ transaction :: work_state_machine_executing(daemon* d)
             if (!m_ops[i].log_write_issued)
             {
                 std::string le = generate_log_entry(i);
-                d->callback_when_durable(le, m_tg, i);
+                int64_t x = d->callback_when_durable(le, m_tg, i);
+
+                if (x < 0)
+                {
+                    // leave log_write_issued unset so the next pass retries
+                    LOG(ERROR) << logid() << " could not log operation " << i;
+                    continue;
+                }
+
                 m_ops[i].log_write_issued = true;
+
+                if (m_lowest_log_entry < 0)
+                {
+                    m_lowest_log_entry = x;
+                }
             }
 
             continue;
@@ -1471,6 +1498,7 @@ transaction :: work_state_machine_committed(daemon* d)
 {
     size_t non_nop = 0;
     size_t done = 0;
+    std::vector<uint64_t> writes;
     m_decision = COMMITTED;
 
     for (size_t i = 0; i < m_ops.size(); ++i)
@@ -1484,7 +1512,7 @@ transaction :: work_state_machine_committed(daemon* d)
 
         if (m_ops[i].require_write && !m_ops[i].write_done)
         {
-            start_write(i, d);
+            writes.push_back(i);
             continue;
         }
 
@@ -1502,6 +1530,8 @@ transaction :: work_state_machine_committed(daemon* d)
         ++done;
     }
 
+    start_writes(writes, d);
+
     if (done == non_nop)
     {
         send_tx_commit(d);
@@ -1681,6 +1711,57 @@ transaction :: start_write(uint64_t seqno, daemon* d)
     }
 }
 
+// Issue every write not yet in flight as one request so that each KVS applies
+// its share of the transaction with a single batch.
+void
+transaction :: start_writes(const std::vector<uint64_t>& seqnos, daemon* d)
+{
+    std::vector<uint64_t> unsent;
+
+    for (size_t i = 0; i < seqnos.size(); ++i)
+    {
+        assert(seqnos[i] < m_ops.size());
+
+        if (m_ops[seqnos[i]].write_nonce == 0)
+        {
+            unsent.push_back(seqnos[i]);
+        }
+    }
+
+    if (unsent.size() <= 1)
+    {
+        for (size_t i = 0; i < unsent.size(); ++i)
+        {
+            start_write(unsent[i], d);
+        }
+
+        return;
+    }
+
+    std::vector<unsigned> flags(unsent.size(), 0/*XXX*/);
+    std::vector<e::slice> tables;
+    std::vector<e::slice> keys;
+    std::vector<e::slice> values;
+
+    for (size_t i = 0; i < unsent.size(); ++i)
+    {
+        const operation& op(m_ops[unsent[i]]);
+        tables.push_back(op.table);
+        keys.push_back(op.key);
+        values.push_back(op.value);
+    }
+
+    daemon::write_map_t::state_reference sr;
+    kvs_write* kv = d->create_write(&sr);
+    kv->callback_transaction(m_tg, unsent, &transaction::callback_write);
+    kv->write(flags, tables, keys, m_timestamp, values, d);
+
+    for (size_t i = 0; i < unsent.size(); ++i)
+    {
+        m_ops[unsent[i]].write_nonce = kv->state_key();
+    }
+}
+
 void
 transaction :: start_verify_read(uint64_t seqno, daemon* d)
 {
@@ -1759,12 +1840,14 @@ void
 transaction :: record_disposition_commit(daemon* d)
 {
     d->m_dispositions.put(m_tg, CONSUS_VOTE_COMMIT);
+    d->log_outcome(m_tg, CONSUS_VOTE_COMMIT);
 }
 
 void
 transaction :: record_disposition_abort(daemon* d)
 {
     d->m_dispositions.put(m_tg, CONSUS_VOTE_ABORT);
+    d->log_outcome(m_tg, CONSUS_VOTE_ABORT);
 }
 
 void
@@ -63,6 +63,7 @@ class transaction
     public:
         const transaction_group& state_key() const;
         bool finished();
+        int64_t lowest_log_entry();
 
     // commands coming from the client
     public:
@@ -172,6 +173,7 @@ class transaction
         void release_lock(uint64_t seqno, daemon* d);
         void start_read(uint64_t seqno, daemon* d);
         void start_write(uint64_t seqno, daemon* d);
+        void start_writes(const std::vector<uint64_t>& seqnos, daemon* d);
         void start_verify_read(uint64_t seqno, daemon* d);
         void start_verify_write(uint64_t seqno, daemon* d);
 
@@ -212,6 +214,7 @@ class transaction
         bool m_prefer_to_commit;
         std::vector<operation> m_ops;
         std::vector<std::pair<comm_id, uint64_t> > m_deferred_2b;
+        int64_t m_lowest_log_entry;
 
     private:
         transaction(const transaction&);